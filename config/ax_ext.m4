@@ -117,16 +117,20 @@ AC_DEFUN([AX_EXT],
       AC_CACHE_CHECK([whether sse4.2 is enabled and supported], [ax_cv_have_sse42_ext],
       [
         ax_cv_have_sse42_ext=no
-        if test "$((0x$ecx>>20&0x01))" = 1; then
-          ax_cv_have_sse42_ext=yes
+        if test "$ax_cv_want_sse41_ext" = yes; then
+          if test "$((0x$ecx>>20&0x01))" = 1; then
+            ax_cv_have_sse42_ext=yes
+          fi
         fi
       ])
 
       AC_CACHE_CHECK([whether avx is enabled and supported], [ax_cv_have_avx_ext],
       [
         ax_cv_have_avx_ext=no
-        if test "$((0x$ecx>>28&0x01))" = 1; then
-          ax_cv_have_avx_ext=yes
+        if test "$ax_cv_want_sse41_ext" = yes; then
+          if test "$((0x$ecx>>28&0x01))" = 1; then
+            ax_cv_have_avx_ext=yes
+          fi
         fi
       ])
 
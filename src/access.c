@@ -28,6 +28,9 @@ static char rcsid[] = "$Id: access.c 99737 2013-06-27 19:33:03Z twu $";
 #ifdef PAGESIZE_VIA_SYSCTL
 #include <sys/sysctl.h>
 #endif
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 
 #include "assert.h"
 #include "mem.h"
@@ -49,6 +52,31 @@ static char rcsid[] = "$Id: access.c 99737 2013-06-27 19:33:03Z twu $";
 #endif
 
 
+#define HUGEPAGESIZE (2*1024*1024)
+#define MIN_RANGE_LENGTH (16*1024*1024) /* Smallest part of a file given to its own thread */
+
+static int access_nthreads = 1;
+
+void
+Access_setup (int nthreads) {
+  if (nthreads < 1) {
+    access_nthreads = 1;
+  } else {
+    access_nthreads = nthreads;
+  }
+  return;
+}
+
+double
+Access_gbps (size_t len, double seconds) {
+  if (seconds <= 0.0) {
+    return 0.0;
+  } else {
+    return (double) len/seconds/1.0e9;
+  }
+}
+
+
 bool
 Access_file_exists_p (char *filename) {
 #ifdef HAVE_STRUCT_STAT64
@@ -156,6 +184,29 @@ Access_file_equal (char *file1, char *file2) {
 }
 
 
+char *
+Access_filename_substitute (char *filename, char *oldsuffix, char *newsuffix) {
+  char *newfile, *p, *q = NULL;
+  int rootlength;
+
+  for (p = filename; *p != '\0'; p++) {
+    if (!strncmp(p,oldsuffix,strlen(oldsuffix))) {
+      q = p;
+    }
+  }
+  if (q == NULL) {
+    return (char *) NULL;
+  } else {
+    rootlength = q - filename;
+    newfile = (char *) CALLOC(strlen(filename)-strlen(oldsuffix)+strlen(newsuffix)+1,sizeof(char));
+    strncpy(newfile,filename,rootlength);
+    strcpy(&(newfile[rootlength]),newsuffix);
+    strcpy(&(newfile[rootlength+strlen(newsuffix)]),&(q[strlen(oldsuffix)]));
+    return newfile;
+  }
+}
+
+
 int
 Access_fileio (char *filename) {
   int fd;
@@ -179,6 +230,122 @@ Access_fileio_rw (char *filename) {
 }
 
 
+/* Reading and preloading split a file into page-aligned ranges, each
+   handled by its own thread */
+typedef struct Range_T *Range_T;
+struct Range_T {
+  int fd;
+  char *start;
+  off_t offset;
+  size_t length;
+  size_t pagesize;
+  int npages;
+  bool okayp;
+};
+
+static int
+ranges_setup (struct Range_T *ranges, int maxranges, int fd, void *memory, size_t len, size_t pagesize) {
+  int nranges, k;
+  size_t rangelength, offset;
+
+  if ((nranges = (len + MIN_RANGE_LENGTH - 1)/MIN_RANGE_LENGTH) > maxranges) {
+    nranges = maxranges;
+  } else if (nranges < 1) {
+    nranges = 1;
+  }
+  rangelength = (len + nranges - 1)/nranges;
+  rangelength = (rangelength + pagesize - 1)/pagesize*pagesize;
+
+  for (k = 0, offset = 0; k < nranges && offset < len; k++, offset += rangelength) {
+    ranges[k].fd = fd;
+    ranges[k].start = &(((char *) memory)[offset]);
+    ranges[k].offset = (off_t) offset;
+    ranges[k].length = (offset + rangelength > len) ? len - offset : rangelength;
+    ranges[k].pagesize = pagesize;
+    ranges[k].npages = 0;
+    ranges[k].okayp = false;
+  }
+  return k;
+}
+
+static void
+ranges_run (struct Range_T *ranges, int nranges, void *(*fcn)(void *)) {
+  int k;
+#ifdef HAVE_PTHREAD
+  pthread_t *thread_ids;
+
+  if (nranges > 1) {
+    thread_ids = (pthread_t *) CALLOC(nranges,sizeof(pthread_t));
+    for (k = 0; k < nranges; k++) {
+      if (pthread_create(&(thread_ids[k]),NULL,fcn,(void *) &(ranges[k])) != 0) {
+	/* Do this range in the current thread */
+	thread_ids[k] = pthread_self();
+	(*fcn)((void *) &(ranges[k]));
+      }
+    }
+    for (k = 0; k < nranges; k++) {
+      if (!pthread_equal(thread_ids[k],pthread_self())) {
+	pthread_join(thread_ids[k],NULL);
+      }
+    }
+    FREE(thread_ids);
+    return;
+  }
+#endif
+
+  for (k = 0; k < nranges; k++) {
+    (*fcn)((void *) &(ranges[k]));
+  }
+  return;
+}
+
+
+/* Asks for transparent huge pages on the 2 MB-aligned interior of a
+   region, to cut TLB misses on random lookups */
+static void
+advise_hugepages (void *memory, size_t len) {
+#if defined(HAVE_MADVISE) && defined(MADV_HUGEPAGE)
+  size_t start, end;
+
+  start = ((size_t) memory + HUGEPAGESIZE - 1) & ~((size_t) HUGEPAGESIZE - 1);
+  end = ((size_t) memory + len) & ~((size_t) HUGEPAGESIZE - 1);
+  if (end > start) {
+    madvise((void *) start,end - start,MADV_HUGEPAGE);
+  }
+#endif
+  return;
+}
+
+
+#if defined(HAVE_PREAD) && !defined(WORDS_BIGENDIAN)
+static void *
+read_range (void *data) {
+  Range_T range = (Range_T) data;
+  char *p = range->start;
+  off_t offset = range->offset;
+  size_t nleft = range->length;
+  ssize_t nread;
+
+  while (nleft > 0) {
+    if ((nread = pread(range->fd,p,nleft,offset)) < 0) {
+      if (errno != EINTR) {
+	return (void *) NULL;
+      }
+    } else if (nread == 0) {
+      return (void *) NULL;
+    } else {
+      p += nread;
+      offset += nread;
+      nleft -= nread;
+    }
+  }
+
+  range->okayp = true;
+  return (void *) NULL;
+}
+#endif
+
+
 #ifndef WORDS_BIGENDIAN
 /* Needed as a test on Macintosh machines */
 static UINT4
@@ -222,8 +389,39 @@ Access_allocated (size_t *len, double *seconds, char *filename, size_t eltsize)
   void *p;
   int i;
 
+#if defined(HAVE_PREAD) && !defined(WORDS_BIGENDIAN)
+  struct Range_T *ranges;
+  int fd, nranges, k;
+#endif
+
   *len = (size_t) Access_filesize(filename);
 
+#if defined(HAVE_PREAD) && !defined(WORDS_BIGENDIAN)
+  if (eltsize == 4 || eltsize == 8) {
+    /* Read ranges in parallel, directly into memory that can be backed by huge pages */
+    fd = Access_fileio(filename);
+    Stopwatch_start(stopwatch = Stopwatch_new());
+    memory = (void *) MALLOC(*len);
+    advise_hugepages(memory,*len);
+
+    ranges = (struct Range_T *) CALLOC(access_nthreads,sizeof(struct Range_T));
+    nranges = ranges_setup(ranges,access_nthreads,fd,memory,*len,/*pagesize*/HUGEPAGESIZE);
+    ranges_run(ranges,nranges,read_range);
+    for (k = 0; k < nranges; k++) {
+      if (ranges[k].okayp == false) {
+	fprintf(stderr,"Error: could not read file %s.  Error %d: %s\n",filename,errno,strerror(errno));
+	exit(9);
+      }
+    }
+    FREE(ranges);
+    close(fd);
+
+    *seconds = Stopwatch_stop(stopwatch);
+    Stopwatch_free(&stopwatch);
+    return memory;
+  }
+#endif
+
   if ((fp = FOPEN_READ_BINARY(filename)) == NULL) {
     fprintf(stderr,"Error: can't open file %s with fopen\n",filename);
     exit(9);
@@ -231,6 +429,7 @@ Access_allocated (size_t *len, double *seconds, char *filename, size_t eltsize)
 
   Stopwatch_start(stopwatch = Stopwatch_new());
   memory = (void *) MALLOC(*len);
+  advise_hugepages(memory,*len);
   if (eltsize == 4) {
     FREAD_UINTS(memory,(*len)/eltsize,fp);
   } else if (eltsize == 8) {
@@ -575,6 +774,32 @@ Access_mmap_offset_rw (int *remainder, int fd, off_t offset, size_t length, size
 
 #ifdef HAVE_MMAP
 
+/* Faults in the pages of a range, a whole range at a time if the
+   kernel supports MADV_POPULATE_READ */
+static void *
+preload_range (void *data) {
+  Range_T range = (Range_T) data;
+  volatile char *p, *end;
+  char sum = 0;
+
+#if defined(HAVE_MADVISE) && defined(MADV_POPULATE_READ)
+  if (madvise((void *) range->start,range->length,MADV_POPULATE_READ) == 0) {
+    range->npages = (range->length + range->pagesize - 1)/range->pagesize;
+    range->okayp = true;
+    return (void *) NULL;
+  }
+#endif
+
+  end = (volatile char *) &(range->start[range->length]);
+  for (p = (volatile char *) range->start; p < end; p += range->pagesize) {
+    sum += *p;
+    range->npages += 1;
+  }
+
+  range->okayp = true;
+  return (void *) NULL;
+}
+
 #ifdef HAVE_CADDR_T
 caddr_t
 #else
@@ -587,9 +812,9 @@ Access_mmap_and_preload (int *fd, size_t *len, int *npages, double *seconds, cha
 #else
   void *memory;
 #endif
-  int pagesize, indicesperpage;
-  size_t totalindices, i;	/* Needs to handle uncompressed genomes > 2 gigabytes */
-  int nzero = 0, npos = 0;
+  size_t pagesize;
+  struct Range_T *ranges;
+  int nranges, k;
   Stopwatch_T stopwatch;
 
 
@@ -612,10 +837,8 @@ Access_mmap_and_preload (int *fd, size_t *len, int *npages, double *seconds, cha
 
   } else {
 
-    pagesize = get_pagesize();
+    pagesize = (size_t) get_pagesize();
 
-    indicesperpage = pagesize/eltsize;
-    
     Stopwatch_start(stopwatch = Stopwatch_new());
 
     memory = mmap(NULL,length,PROT_READ,0
@@ -637,25 +860,23 @@ Access_mmap_and_preload (int *fd, size_t *len, int *npages, double *seconds, cha
       Stopwatch_stop(stopwatch);
       Stopwatch_free(&stopwatch);
     } else {
-      /* Touch all pages */
+      /* Touch all pages, in parallel ranges */
       debug(printf("Got mmap of %lu bytes at %p to %p\n",length,memory,memory+length-1));
+      advise_hugepages((void *) memory,*len);
 #ifdef HAVE_MADVISE
 #ifdef HAVE_MADVISE_MADV_WILLNEED
       madvise(memory,*len,MADV_WILLNEED);
 #endif
 #endif
-      totalindices = (*len)/eltsize;
-      for (i = 0; i < totalindices; i += indicesperpage) {
-	if (((char *) memory)[i] == 0) {
-	  nzero++;
-	} else {
-	  npos++;
-	}
-	if (i % 10000 == 0) {
-	  fprintf(stderr,".");
-	}
+      ranges = (struct Range_T *) CALLOC(access_nthreads,sizeof(struct Range_T));
+      nranges = ranges_setup(ranges,access_nthreads,*fd,(void *) memory,*len,pagesize);
+      ranges_run(ranges,nranges,preload_range);
+      *npages = 0;
+      for (k = 0; k < nranges; k++) {
+	*npages += ranges[k].npages;
       }
-      *npages = nzero + npos;
+      FREE(ranges);
+
       *seconds = Stopwatch_stop(stopwatch);
       Stopwatch_free(&stopwatch);
     }
@@ -666,3 +887,225 @@ Access_mmap_and_preload (int *fd, size_t *len, int *npages, double *seconds, cha
 #endif
 
 
+
+
+#ifdef HAVE_SHM_OPEN
+
+/* Shared memory segments.  Each segment holds the contents of one
+   index or genome file (or the expanded offsets) in host byte order,
+   as for ALLOCATED, so that concurrent processes on one host can
+   attach a single resident copy.  A segment is created without any
+   permissions and made readable only after it has been filled, so a
+   process never attaches a partially written copy. */
+
+#define SHM_PREFIX "/gmap-"
+#define SHM_MAXBASENAME 200
+
+/* The name combines the file basename with a hash of its full path,
+   size, and modification time, so a rebuilt index does not attach a
+   stale segment */
+char *
+Access_shm_name (char *filename, char *suffix) {
+  char *shmname, *resolved, *path, *basename, *p, stamp[64];
+  struct stat sb;
+  unsigned long long hash = 14695981039346656037ULL; /* FNV-1a */
+  size_t baselength;
+
+  if ((resolved = realpath(filename,NULL)) != NULL) {
+    path = resolved;
+  } else {
+    path = filename;
+  }
+  for (p = path; *p != '\0'; p++) {
+    hash = (hash ^ (unsigned char) *p) * 1099511628211ULL;
+  }
+  if (stat(filename,&sb) == 0) {
+    sprintf(stamp,"%llu:%llu",(unsigned long long) sb.st_size,(unsigned long long) sb.st_mtime);
+    for (p = stamp; *p != '\0'; p++) {
+      hash = (hash ^ (unsigned char) *p) * 1099511628211ULL;
+    }
+  }
+
+  if ((basename = strrchr(path,'/')) == NULL) {
+    basename = path;
+  } else {
+    basename++;
+  }
+  if ((baselength = strlen(basename)) > SHM_MAXBASENAME) {
+    baselength = SHM_MAXBASENAME;
+  }
+
+  shmname = (char *) CALLOC(strlen(SHM_PREFIX)+baselength+1+(suffix == NULL ? 0 : strlen(suffix))+1+16+1,
+			    sizeof(char));
+  strcpy(shmname,SHM_PREFIX);
+  strncat(shmname,basename,baselength);
+  if (suffix != NULL) {
+    strcat(shmname,".");
+    strcat(shmname,suffix);
+  }
+  sprintf(&(shmname[strlen(shmname)]),".%016llx",hash);
+
+  if (resolved != NULL) {
+    free(resolved);		/* Allocated by realpath */
+  }
+  return shmname;
+}
+
+
+/* Returns NULL if the segment does not exist or is still being filled */
+void *
+Access_shm_attach (int *fd, size_t *len, char *shmname) {
+  void *memory;
+  struct stat sb;
+
+  if ((*fd = shm_open(shmname,O_RDONLY,0)) < 0) {
+    return (void *) NULL;
+  } else if (fstat(*fd,&sb) < 0 || (sb.st_mode & S_IRUSR) == 0 || sb.st_size == 0) {
+    close(*fd);
+    return (void *) NULL;
+  }
+
+  *len = (size_t) sb.st_size;
+  if ((memory = mmap(NULL,*len,PROT_READ,MAP_SHARED,*fd,0)) == MAP_FAILED) {
+    fprintf(stderr,"Got mmap failure on shared memory segment %s of %lu bytes.  Error %d: %s\n",
+	    shmname,(unsigned long) *len,errno,strerror(errno));
+    close(*fd);
+    return (void *) NULL;
+  }
+
+  return memory;
+}
+
+
+static void *
+shm_create (int *fd, char *shmname, size_t len) {
+  void *memory;
+
+  if ((*fd = shm_open(shmname,O_RDWR | O_CREAT | O_EXCL,0)) < 0) {
+    /* Exists already, possibly being filled by another process */
+    return (void *) NULL;
+  } else if (ftruncate(*fd,(off_t) len) < 0 ||
+	     (memory = mmap(NULL,len,PROT_READ | PROT_WRITE,MAP_SHARED,*fd,0)) == MAP_FAILED) {
+    fprintf(stderr,"Unable to create shared memory segment %s of %lu bytes.  Error %d: %s\n",
+	    shmname,(unsigned long) len,errno,strerror(errno));
+    shm_unlink(shmname);
+    close(*fd);
+    return (void *) NULL;
+  } else {
+    return memory;
+  }
+}
+
+static void *
+shm_publish (int fd, char *shmname, void *memory, size_t len) {
+  munmap(memory,len);
+  if (fchmod(fd,S_IRUSR | S_IRGRP | S_IROTH) < 0 ||
+      (memory = mmap(NULL,len,PROT_READ,MAP_SHARED,fd,0)) == MAP_FAILED) {
+    fprintf(stderr,"Unable to publish shared memory segment %s.  Error %d: %s\n",
+	    shmname,errno,strerror(errno));
+    shm_unlink(shmname);
+    close(fd);
+    return (void *) NULL;
+  } else {
+    return memory;
+  }
+}
+
+
+/* Attaches the segment named shmname, or else copies data into a new
+   one.  Returns NULL if neither is possible, in which case the caller
+   keeps its private copy. */
+void *
+Access_shm_store (int *fd, size_t *len, double *seconds, char *shmname, void *data, size_t datalen) {
+  void *memory;
+  Stopwatch_T stopwatch;
+
+  Stopwatch_start(stopwatch = Stopwatch_new());
+  if ((memory = Access_shm_attach(&(*fd),&(*len),shmname)) == NULL && datalen > 0) {
+    if ((memory = shm_create(&(*fd),shmname,datalen)) != NULL) {
+      memcpy(memory,data,datalen);
+      memory = shm_publish(*fd,shmname,memory,datalen);
+      *len = datalen;
+    }
+  }
+  *seconds = Stopwatch_stop(stopwatch);
+  Stopwatch_free(&stopwatch);
+
+  return memory;
+}
+
+
+/* Attaches the segment for filename, or else creates it by reading
+   the file.  Returns NULL if neither is possible. */
+void *
+Access_shm_load (int *fd, size_t *len, double *seconds, char *filename, size_t eltsize) {
+  void *memory;
+  char *shmname;
+  FILE *fp;
+  size_t filelen, nread;
+  Stopwatch_T stopwatch;
+
+  Stopwatch_start(stopwatch = Stopwatch_new());
+  shmname = Access_shm_name(filename,/*suffix*/NULL);
+
+  if ((memory = Access_shm_attach(&(*fd),&(*len),shmname)) == NULL &&
+      (filelen = (size_t) Access_filesize(filename)) > 0) {
+    if ((fp = FOPEN_READ_BINARY(filename)) == NULL) {
+      fprintf(stderr,"Error: can't open file %s with fopen\n",filename);
+      exit(9);
+    }
+    if ((memory = shm_create(&(*fd),shmname,filelen)) != NULL) {
+      if (eltsize == 4) {
+	nread = FREAD_UINTS(memory,filelen/eltsize,fp);
+      } else if (eltsize == 8) {
+	nread = FREAD_UINT8S(memory,filelen/eltsize,fp);
+      } else {
+	nread = fread(memory,eltsize,filelen/eltsize,fp);
+      }
+
+      if (nread != filelen/eltsize) {
+	fprintf(stderr,"Error reading %s into shared memory\n",filename);
+	munmap(memory,filelen);
+	shm_unlink(shmname);
+	close(*fd);
+	memory = (void *) NULL;
+      } else {
+	memory = shm_publish(*fd,shmname,memory,filelen);
+	*len = filelen;
+      }
+    }
+    fclose(fp);
+  }
+
+  FREE(shmname);
+  *seconds = Stopwatch_stop(stopwatch);
+  Stopwatch_free(&stopwatch);
+
+  return memory;
+}
+
+
+void
+Access_shm_detach (void *memory, size_t len, int fd) {
+  munmap(memory,len);
+  close(fd);
+  return;
+}
+
+
+/* Unlinks the segment for filename (and suffix), if there is one.
+   Processes that have it attached keep their mappings until they
+   exit. */
+void
+Access_shm_remove (char *filename, char *suffix) {
+  char *shmname;
+
+  shmname = Access_shm_name(filename,suffix);
+  if (shm_unlink(shmname) == 0) {
+    fprintf(stderr,"Removed shared memory segment %s\n",shmname);
+  }
+  FREE(shmname);
+  return;
+}
+
+#endif
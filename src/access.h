@@ -15,11 +15,18 @@
 
 #include "bool.h"
 
-/* ALLOCATED implies bigendian conversion already done */
-typedef enum {USE_ALLOCATE, USE_MMAP_ONLY, USE_MMAP_PRELOAD, USE_FILEIO} Access_mode_T;
-typedef enum {ALLOCATED, MMAPPED, FILEIO} Access_T;
+/* ALLOCATED and SHARED imply bigendian conversion already done */
+/* USE_SHARED_REMOVE unlinks the shared memory segment for a file, without reading the file */
+typedef enum {USE_ALLOCATE, USE_MMAP_ONLY, USE_MMAP_PRELOAD, USE_FILEIO, USE_SHARED, USE_SHARED_REMOVE} Access_mode_T;
+typedef enum {ALLOCATED, MMAPPED, FILEIO, SHARED} Access_T;
 #define MAX32BIT 4294967295U	/* 2^32 - 1 */
 
+extern void
+Access_setup (int nthreads);
+
+extern double
+Access_gbps (size_t len, double seconds);
+
 extern bool
 Access_file_exists_p (char *filename);
 
@@ -32,6 +39,11 @@ Access_file_copy (char *dest_file, char *source_file);
 extern bool
 Access_file_equal (char *file1, char *file2);
 
+/* Returns a copy of filename with the last occurrence of oldsuffix
+   replaced by newsuffix, or NULL if oldsuffix does not occur */
+extern char *
+Access_filename_substitute (char *filename, char *oldsuffix, char *newsuffix);
+
 extern int
 Access_fileio (char *filename);
 
@@ -77,4 +89,24 @@ extern void *
 Access_mmap_and_preload (int *fd, size_t *len, int *npages, double *seconds,
 			 char *filename, size_t eltsize);
 
+#ifdef HAVE_SHM_OPEN
+extern char *
+Access_shm_name (char *filename, char *suffix);
+
+extern void *
+Access_shm_attach (int *fd, size_t *len, char *shmname);
+
+extern void *
+Access_shm_store (int *fd, size_t *len, double *seconds, char *shmname, void *data, size_t datalen);
+
+extern void *
+Access_shm_load (int *fd, size_t *len, double *seconds, char *filename, size_t eltsize);
+
+extern void
+Access_shm_detach (void *memory, size_t len, int fd);
+
+extern void
+Access_shm_remove (char *filename, char *suffix);
+#endif
+
 #endif
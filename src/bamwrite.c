@@ -0,0 +1,625 @@
+static char rcsid[] = "$Id: bamwrite.c $";
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "bamwrite.h"
+#include <stdlib.h>
+#include <string.h>
+
+#include "mem.h"
+#include "bgzf.h"
+
+
+#ifdef DEBUG
+#define debug(x) x
+#else
+#define debug(x)
+#endif
+
+
+#if defined(HAVE_ZLIB) && defined(HAVE_OPEN_MEMSTREAM)
+
+#define NFIELDS 11		/* Mandatory SAM fields */
+#define MAXREADNAME 254		/* l_read_name is a uint8, including the null */
+
+
+#define T Bamwrite_T
+struct T {
+  FILE *fp;
+  Bgzf_T bgzf;
+  Univ_IIT_T chromosome_iit;
+
+  FILE *textfp;			/* Memory stream for the print routines */
+  char *text;
+  size_t textlength;
+
+  char *header;			/* Header lines seen before the first alignment */
+  int headerlength;
+  int headeralloc;
+  bool header_written_p;
+
+  unsigned char *record;
+  int recordlength;
+  int recordalloc;
+
+  char *lastchr;		/* Cache for chromosome lookups */
+  int lastchralloc;
+  int lastrefid;
+};
+
+
+T
+Bamwrite_new (FILE *fp, Univ_IIT_T chromosome_iit) {
+  T new = (T) MALLOC(sizeof(*new));
+
+  new->fp = fp;
+  new->bgzf = Bgzf_new(fp);
+  new->chromosome_iit = chromosome_iit;
+
+  new->text = NULL;
+  new->textlength = 0;
+  if ((new->textfp = open_memstream(&new->text,&new->textlength)) == NULL) {
+    fprintf(stderr,"Unable to open memory stream for BAM output\n");
+    exit(9);
+  }
+
+  new->headeralloc = 1024;
+  new->header = (char *) MALLOC(new->headeralloc*sizeof(char));
+  new->headerlength = 0;
+  new->header_written_p = false;
+
+  new->recordalloc = 1024;
+  new->record = (unsigned char *) MALLOC(new->recordalloc*sizeof(unsigned char));
+  new->recordlength = 0;
+
+  new->lastchralloc = 64;
+  new->lastchr = (char *) MALLOC(new->lastchralloc*sizeof(char));
+  new->lastchr[0] = '\0';
+  new->lastrefid = -1;
+
+  return new;
+}
+
+
+FILE *
+Bamwrite_textfp (T this) {
+  return this->textfp;
+}
+
+
+/************************************************************************
+ *   Record buffer
+ ************************************************************************/
+
+static unsigned char *
+record_extend (T this, int length) {
+  unsigned char *p;
+
+  if (this->recordlength + length > this->recordalloc) {
+    while (this->recordlength + length > this->recordalloc) {
+      this->recordalloc *= 2;
+    }
+    p = (unsigned char *) MALLOC(this->recordalloc*sizeof(unsigned char));
+    memcpy(p,this->record,this->recordlength);
+    FREE(this->record);
+    this->record = p;
+  }
+
+  p = &(this->record[this->recordlength]);
+  this->recordlength += length;
+  return p;
+}
+
+static void
+put_uint8 (unsigned char *p, unsigned int x) {
+  p[0] = x & 0xff;
+  return;
+}
+
+static void
+put_uint16 (unsigned char *p, unsigned int x) {
+  p[0] = x & 0xff;
+  p[1] = (x >> 8) & 0xff;
+  return;
+}
+
+static void
+put_uint32 (unsigned char *p, unsigned int x) {
+  p[0] = x & 0xff;
+  p[1] = (x >> 8) & 0xff;
+  p[2] = (x >> 16) & 0xff;
+  p[3] = (x >> 24) & 0xff;
+  return;
+}
+
+static void
+put_float (unsigned char *p, float x) {
+  unsigned int bits;
+
+  memcpy(&bits,&x,sizeof(float));
+  put_uint32(p,bits);
+  return;
+}
+
+
+/************************************************************************
+ *   Header
+ ************************************************************************/
+
+static void
+header_append (T this, char *line, int linelength) {
+  char *p;
+
+  if (this->headerlength + linelength + 1 > this->headeralloc) {
+    while (this->headerlength + linelength + 1 > this->headeralloc) {
+      this->headeralloc *= 2;
+    }
+    p = (char *) MALLOC(this->headeralloc*sizeof(char));
+    memcpy(p,this->header,this->headerlength);
+    FREE(this->header);
+    this->header = p;
+  }
+
+  memcpy(&(this->header[this->headerlength]),line,linelength);
+  this->header[this->headerlength + linelength] = '\n';
+  this->headerlength += linelength + 1;
+  return;
+}
+
+/* Magic, header text, and the reference list, which must follow the
+   order of Univ_IIT_dump_sam */
+static void
+write_header (T this) {
+  unsigned char buffer[4];
+  int nrefs, index, namelength;
+  char *label;
+  bool allocp;
+
+  Bgzf_write(this->bgzf,"BAM\1",4);
+  put_uint32(buffer,this->headerlength);
+  Bgzf_write(this->bgzf,buffer,4);
+  Bgzf_write(this->bgzf,this->header,this->headerlength);
+
+  if (this->chromosome_iit == NULL) {
+    nrefs = 0;
+  } else {
+    nrefs = Univ_IIT_total_nintervals(this->chromosome_iit);
+  }
+  put_uint32(buffer,nrefs);
+  Bgzf_write(this->bgzf,buffer,4);
+
+  for (index = 1; index <= nrefs; index++) {
+    label = Univ_IIT_label(this->chromosome_iit,index,&allocp);
+    namelength = strlen(label) + 1;
+    put_uint32(buffer,namelength);
+    Bgzf_write(this->bgzf,buffer,4);
+    Bgzf_write(this->bgzf,label,namelength);
+    put_uint32(buffer,(unsigned int) Univ_IIT_interval_length(this->chromosome_iit,index));
+    Bgzf_write(this->bgzf,buffer,4);
+    if (allocp == true) {
+      FREE(label);
+    }
+  }
+
+  this->header_written_p = true;
+  return;
+}
+
+
+/************************************************************************
+ *   Alignment records
+ ************************************************************************/
+
+static int
+lookup_refid (T this, char *chr) {
+  int length;
+
+  if (chr[0] == '*' && chr[1] == '\0') {
+    return -1;
+  } else if (!strcmp(chr,this->lastchr)) {
+    return this->lastrefid;
+  } else {
+    if ((length = strlen(chr) + 1) > this->lastchralloc) {
+      FREE(this->lastchr);
+      this->lastchralloc = length;
+      this->lastchr = (char *) MALLOC(this->lastchralloc*sizeof(char));
+    }
+    strcpy(this->lastchr,chr);
+
+    if (this->chromosome_iit == NULL ||
+	(this->lastrefid = Univ_IIT_find_one(this->chromosome_iit,chr)) < 0) {
+      fprintf(stderr,"BAM output: chromosome %s is not in the genome\n",chr);
+      exit(9);
+    } else {
+      this->lastrefid -= 1;	/* Convert to 0-based */
+    }
+    return this->lastrefid;
+  }
+}
+
+/* Computes bin given a 0-based, half-open interval, as in the SAM
+   specification */
+static int
+reg2bin (int beg, int end) {
+  --end;
+  if (beg >> 14 == end >> 14) return ((1 << 15) - 1)/7 + (beg >> 14);
+  if (beg >> 17 == end >> 17) return ((1 << 12) - 1)/7 + (beg >> 17);
+  if (beg >> 20 == end >> 20) return ((1 << 9) - 1)/7 + (beg >> 20);
+  if (beg >> 23 == end >> 23) return ((1 << 6) - 1)/7 + (beg >> 23);
+  if (beg >> 26 == end >> 26) return ((1 << 3) - 1)/7 + (beg >> 26);
+  return 0;
+}
+
+static int
+cigar_opcode (char c) {
+  switch (c) {
+  case 'M': return 0;
+  case 'I': return 1;
+  case 'D': return 2;
+  case 'N': return 3;
+  case 'S': return 4;
+  case 'H': return 5;
+  case 'P': return 6;
+  case '=': return 7;
+  case 'X': return 8;
+  default: return -1;
+  }
+}
+
+/* 4-bit codes for =ACMGRSVTWYHKDBN, in either case, and 15 (N) for
+   anything else */
+static const unsigned char seq_code[256] = {
+  15,15,15,15,15,15,15,15,15,15,15,15,15,15,15,15,
+  15,15,15,15,15,15,15,15,15,15,15,15,15,15,15,15,
+  15,15,15,15,15,15,15,15,15,15,15,15,15,15,15,15,
+  15,15,15,15,15,15,15,15,15,15,15,15,15, 0,15,15,
+  15, 1,14, 2,13,15,15, 4,11,15,15,12,15, 3,15,15,
+  15,15, 5, 6, 8,15, 7, 9,15,10,15,15,15,15,15,15,
+  15, 1,14, 2,13,15,15, 4,11,15,15,12,15, 3,15,15,
+  15,15, 5, 6, 8,15, 7, 9,15,10,15,15,15,15,15,15,
+  15,15,15,15,15,15,15,15,15,15,15,15,15,15,15,15,
+  15,15,15,15,15,15,15,15,15,15,15,15,15,15,15,15,
+  15,15,15,15,15,15,15,15,15,15,15,15,15,15,15,15,
+  15,15,15,15,15,15,15,15,15,15,15,15,15,15,15,15,
+  15,15,15,15,15,15,15,15,15,15,15,15,15,15,15,15,
+  15,15,15,15,15,15,15,15,15,15,15,15,15,15,15,15,
+  15,15,15,15,15,15,15,15,15,15,15,15,15,15,15,15,
+  15,15,15,15,15,15,15,15,15,15,15,15,15,15,15,15
+};
+
+
+static void
+malformed (char *line) {
+  fprintf(stderr,"BAM output: cannot convert line %s\n",line);
+  exit(9);
+}
+
+
+/* Appends packed CIGAR operations, and returns their number.  Also
+   computes the number of reference positions covered. */
+static int
+encode_cigar (int *reflength, T this, char *cigar) {
+  int ncigar = 0, opcode;
+  unsigned int length;
+  char *p = cigar;
+
+  *reflength = 0;
+  if (cigar[0] == '*' && cigar[1] == '\0') {
+    return 0;
+  }
+
+  while (*p != '\0') {
+    length = (unsigned int) strtoul(p,&p,10);
+    if ((opcode = cigar_opcode(*p)) < 0) {
+      malformed(cigar);
+    }
+    put_uint32(record_extend(this,4),length << 4 | opcode);
+    if (opcode == 0 || opcode == 2 || opcode == 3 || opcode == 7 || opcode == 8) {
+      *reflength += length;
+    }
+    ncigar++;
+    p++;
+  }
+
+  return ncigar;
+}
+
+static void
+encode_int_tag (T this, long int value) {
+  unsigned char *p;
+
+  if (value < 0) {
+    if (value >= -128) {
+      p = record_extend(this,2);
+      p[0] = 'c';
+      put_uint8(&(p[1]),(unsigned int) value);
+    } else if (value >= -32768) {
+      p = record_extend(this,3);
+      p[0] = 's';
+      put_uint16(&(p[1]),(unsigned int) value);
+    } else {
+      p = record_extend(this,5);
+      p[0] = 'i';
+      put_uint32(&(p[1]),(unsigned int) value);
+    }
+  } else {
+    if (value <= 255) {
+      p = record_extend(this,2);
+      p[0] = 'C';
+      put_uint8(&(p[1]),(unsigned int) value);
+    } else if (value <= 65535) {
+      p = record_extend(this,3);
+      p[0] = 'S';
+      put_uint16(&(p[1]),(unsigned int) value);
+    } else {
+      p = record_extend(this,5);
+      p[0] = 'I';
+      put_uint32(&(p[1]),(unsigned int) value);
+    }
+  }
+  return;
+}
+
+static void
+encode_array_tag (T this, char *values) {
+  unsigned char *p;
+  char subtype = values[0], *q;
+  int nvalues = 0, size, countpos;
+
+  switch (subtype) {
+  case 'c': case 'C': size = 1; break;
+  case 's': case 'S': size = 2; break;
+  case 'i': case 'I': case 'f': size = 4; break;
+  default: malformed(values); return;
+  }
+
+  p = record_extend(this,6);
+  p[0] = 'B';
+  p[1] = subtype;
+  countpos = this->recordlength - 4;
+
+  q = &(values[1]);
+  while (*q == ',') {
+    q++;
+    p = record_extend(this,size);
+    if (subtype == 'f') {
+      put_float(p,(float) strtod(q,&q));
+    } else if (size == 1) {
+      put_uint8(p,(unsigned int) strtol(q,&q,10));
+    } else if (size == 2) {
+      put_uint16(p,(unsigned int) strtol(q,&q,10));
+    } else {
+      put_uint32(p,(unsigned int) strtoll(q,&q,10));
+    }
+    nvalues++;
+  }
+
+  put_uint32(&(this->record[countpos]),nvalues);
+  return;
+}
+
+/* Tags have the form XX:T:value */
+static void
+encode_tag (T this, char *tag) {
+  unsigned char *p;
+  int length;
+
+  if (strlen(tag) < 5 || tag[2] != ':' || tag[4] != ':') {
+    malformed(tag);
+  }
+
+  p = record_extend(this,2);
+  p[0] = tag[0];
+  p[1] = tag[1];
+
+  switch (tag[3]) {
+  case 'A':
+    p = record_extend(this,2);
+    p[0] = 'A';
+    p[1] = tag[5];
+    break;
+  case 'i':
+    encode_int_tag(this,strtol(&(tag[5]),NULL,10));
+    break;
+  case 'f':
+    p = record_extend(this,5);
+    p[0] = 'f';
+    put_float(&(p[1]),(float) strtod(&(tag[5]),NULL));
+    break;
+  case 'Z': case 'H':
+    length = strlen(&(tag[5])) + 1;
+    p = record_extend(this,1 + length);
+    p[0] = tag[3];
+    memcpy(&(p[1]),&(tag[5]),length);
+    break;
+  case 'B':
+    encode_array_tag(this,&(tag[5]));
+    break;
+  default:
+    malformed(tag);
+  }
+
+  return;
+}
+
+
+/* line is modified in place */
+static void
+write_record (T this, char *line) {
+  char *fields[NFIELDS], *tags, *p;
+  int fieldlengths[NFIELDS];
+  int nfields, refid, pos, reflength, readnamelength, ncigar, seqlength, i;
+  unsigned int flag, mapq;
+  unsigned char *fixed, *q;
+
+  /* strchr scans faster than a loop over characters */
+  p = line;
+  tags = NULL;
+  for (nfields = 0; nfields < NFIELDS; nfields++) {
+    fields[nfields] = p;
+    if ((p = strchr(p,'\t')) != NULL) {
+      fieldlengths[nfields] = p - fields[nfields];
+      *p++ = '\0';
+    } else if (nfields < NFIELDS - 1) {
+      malformed(line);
+    } else {
+      fieldlengths[nfields] = strlen(fields[nfields]);
+    }
+  }
+  if (p != NULL && *p != '\0') {
+    tags = p;
+  }
+
+  this->recordlength = 0;
+  record_extend(this,36);	/* block_size and the fixed fields, filled in below */
+
+  refid = lookup_refid(this,fields[2]);
+  pos = atoi(fields[3]) - 1;
+  flag = (unsigned int) strtoul(fields[1],NULL,10);
+  mapq = (unsigned int) strtoul(fields[4],NULL,10);
+
+  if ((readnamelength = fieldlengths[0]) > MAXREADNAME) {
+    fprintf(stderr,"BAM output: read name %s is longer than %d characters\n",fields[0],MAXREADNAME);
+    exit(9);
+  }
+  q = record_extend(this,readnamelength + 1);
+  memcpy(q,fields[0],readnamelength);
+  q[readnamelength] = '\0';
+
+  ncigar = encode_cigar(&reflength,this,fields[5]);
+
+  if (fields[9][0] == '*' && fields[9][1] == '\0') {
+    seqlength = 0;
+  } else {
+    seqlength = fieldlengths[9];
+    q = record_extend(this,(seqlength + 1)/2);
+    for (i = 0; i + 1 < seqlength; i += 2) {
+      q[i/2] = seq_code[(unsigned char) fields[9][i]] << 4 | seq_code[(unsigned char) fields[9][i+1]];
+    }
+    if (i < seqlength) {
+      q[i/2] = seq_code[(unsigned char) fields[9][i]] << 4;
+    }
+
+    q = record_extend(this,seqlength);
+    if (fields[10][0] == '*' && fields[10][1] == '\0') {
+      memset(q,0xff,seqlength);
+    } else if (fieldlengths[10] != seqlength) {
+      malformed(line);
+    } else {
+      for (i = 0; i < seqlength; i++) {
+	q[i] = fields[10][i] - 33;
+      }
+    }
+  }
+
+  while (tags != NULL) {
+    if ((p = strchr(tags,'\t')) != NULL) {
+      *p++ = '\0';
+    }
+    encode_tag(this,tags);
+    tags = p;
+  }
+
+  fixed = this->record;
+
+  put_uint32(&(fixed[0]),this->recordlength - 4);
+  put_uint32(&(fixed[4]),refid);
+  put_uint32(&(fixed[8]),pos);
+  put_uint8(&(fixed[12]),readnamelength + 1);
+  put_uint8(&(fixed[13]),mapq);
+  put_uint16(&(fixed[14]),reg2bin(pos,(reflength > 0) ? pos + reflength : pos + 1));
+  put_uint16(&(fixed[16]),ncigar);
+  put_uint16(&(fixed[18]),flag);
+  put_uint32(&(fixed[20]),seqlength);
+  if (fields[6][0] == '=' && fields[6][1] == '\0') {
+    put_uint32(&(fixed[24]),refid);
+  } else {
+    put_uint32(&(fixed[24]),lookup_refid(this,fields[6]));
+  }
+  put_uint32(&(fixed[28]),atoi(fields[7]) - 1);
+  put_uint32(&(fixed[32]),atoi(fields[8]));
+
+  Bgzf_flush_try(this->bgzf,this->recordlength);
+  Bgzf_write(this->bgzf,this->record,this->recordlength);
+
+  return;
+}
+
+
+/* Converts complete SAM lines.  text is modified in place. */
+void
+Bamwrite_sam_text (T this, char *text, size_t textlength) {
+  char *line, *end, *p;
+
+  line = text;
+  end = &(text[textlength]);
+  while (line < end) {
+    if ((p = memchr(line,'\n',end - line)) == NULL) {
+      p = end;
+    }
+    *p = '\0';
+
+    if (p == line) {
+      /* Skip empty line */
+    } else if (line[0] == '@') {
+      if (this->header_written_p == false) {
+	header_append(this,line,p - line);
+      }
+    } else {
+      if (this->header_written_p == false) {
+	write_header(this);
+      }
+      write_record(this,line);
+    }
+
+    line = p + 1;
+  }
+
+  return;
+}
+
+
+/* Converts whatever the print routines have written to textfp, and
+   rewinds it.  The stream stays open, so callers can keep using it.
+   After the rewind, the size reported by the next fflush is the
+   number of bytes written since. */
+void
+Bamwrite_flush (T this) {
+  fflush(this->textfp);
+  if (this->textlength > 0) {
+    Bamwrite_sam_text(this,this->text,this->textlength);
+    fseek(this->textfp,0,SEEK_SET);
+  }
+  return;
+}
+
+
+/* Also closes the file, unless it is stdout */
+void
+Bamwrite_close (T *old) {
+  if (*old) {
+    Bamwrite_flush(*old);
+    if ((*old)->header_written_p == false) {
+      write_header(*old);
+    }
+    Bgzf_close(&(*old)->bgzf);
+
+    fclose((*old)->textfp);
+    free((*old)->text);
+    if ((*old)->fp == stdout) {
+      fflush(stdout);
+    } else {
+      fclose((*old)->fp);
+    }
+
+    FREE((*old)->lastchr);
+    FREE((*old)->record);
+    FREE((*old)->header);
+    FREE(*old);
+  }
+  return;
+}
+
+#endif /* HAVE_ZLIB && HAVE_OPEN_MEMSTREAM */
+
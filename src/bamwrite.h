@@ -0,0 +1,30 @@
+/* $Id: bamwrite.h $ */
+#ifndef BAMWRITE_INCLUDED
+#define BAMWRITE_INCLUDED
+
+#include <stdio.h>
+#include "bool.h"
+#include "iit-read-univ.h"
+
+/* Converts SAM text, as printed by samprint.c and samheader.c, into
+   BAM records written through a BGZF writer.  Header lines are
+   collected until the first alignment, and then written in binary
+   form, with references taken from the chromosome IIT. */
+
+#define T Bamwrite_T
+typedef struct T *T;
+
+extern T
+Bamwrite_new (FILE *fp, Univ_IIT_T chromosome_iit);
+extern void
+Bamwrite_close (T *old);
+extern FILE *
+Bamwrite_textfp (T this);
+extern void
+Bamwrite_flush (T this);
+extern void
+Bamwrite_sam_text (T this, char *text, size_t textlength);
+
+#undef T
+#endif
+
@@ -0,0 +1,409 @@
+static char rcsid[] = "$Id: bgzf.c $";
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "bgzf.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_PTHREAD
+#ifdef HAVE_SYS_TYPES_H
+#include <sys/types.h>		/* Needed to define pthread_t on Solaris */
+#endif
+#include <pthread.h>
+#endif
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "assert.h"
+#include "mem.h"
+
+
+#ifdef DEBUG
+#define debug(x) x
+#else
+#define debug(x)
+#endif
+
+
+#ifdef HAVE_ZLIB
+
+#define BGZF_MAXBLOCK 65536
+#define BGZF_HEADERLENGTH 18
+#define BGZF_FOOTERLENGTH 8
+
+/* Lets each writer run this far ahead of its oldest unwritten block */
+#define MAXINFLIGHT_PER_COMPRESSOR 4
+
+static unsigned char bgzf_header[BGZF_HEADERLENGTH] =
+  {0x1f, 0x8b, 0x08, 0x04, 0, 0, 0, 0, 0, 0xff, 0x06, 0, 'B', 'C', 0x02, 0, 0, 0};
+
+/* Empty block that marks the end of a BAM file */
+static unsigned char bgzf_eof[28] =
+  {0x1f, 0x8b, 0x08, 0x04, 0, 0, 0, 0, 0, 0xff, 0x06, 0, 'B', 'C', 0x02, 0, 0x1b, 0,
+   0x03, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+
+
+typedef struct Job_T *Job_T;
+struct Job_T {
+  unsigned char *data;
+  int datalength;
+  unsigned char *block;
+  int blocklength;
+  bool donep;
+
+  Job_T next_pending;		/* Queue for the compression threads */
+  Job_T next;			/* Blocks of one writer, in file order */
+};
+
+
+#define T Bgzf_T
+struct T {
+  FILE *fp;
+  unsigned char *data;		/* Block being filled */
+  int datalength;
+
+  Job_T head;			/* Blocks handed to the compression threads */
+  Job_T tail;
+  int ninflight;
+
+  bool inlinep;			/* No compression threads, so compress here */
+  z_stream strm;
+};
+
+
+static int ncompressors = 0;
+
+#ifdef HAVE_PTHREAD
+static pthread_t *compressor_ids = NULL;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t job_avail_p = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t job_done_p = PTHREAD_COND_INITIALIZER;
+static Job_T pending_head = NULL;
+static Job_T pending_tail = NULL;
+static bool shutdownp = false;
+#endif
+
+
+static void
+put_uint16 (unsigned char *p, unsigned int x) {
+  p[0] = x & 0xff;
+  p[1] = (x >> 8) & 0xff;
+  return;
+}
+
+static void
+put_uint32 (unsigned char *p, unsigned int x) {
+  p[0] = x & 0xff;
+  p[1] = (x >> 8) & 0xff;
+  p[2] = (x >> 16) & 0xff;
+  p[3] = (x >> 24) & 0xff;
+  return;
+}
+
+
+/* Deflates data into block, which holds BGZF_MAXBLOCK bytes, and
+   returns the length of the block.  strm is set up for raw deflate. */
+static int
+compress_block (unsigned char *block, z_stream *strm, unsigned char *data, int datalength) {
+  int blocklength;
+  z_stream stored;
+
+  deflateReset(strm);
+  strm->next_in = data;
+  strm->avail_in = datalength;
+  strm->next_out = &(block[BGZF_HEADERLENGTH]);
+  strm->avail_out = BGZF_MAXBLOCK - BGZF_HEADERLENGTH - BGZF_FOOTERLENGTH;
+
+  if (deflate(strm,Z_FINISH) == Z_STREAM_END) {
+    blocklength = BGZF_HEADERLENGTH + strm->total_out + BGZF_FOOTERLENGTH;
+
+  } else {
+    /* Incompressible data.  Stored blocks always fit, since
+       BGZF_BLOCKSIZE leaves room for their overhead. */
+    memset(&stored,0,sizeof(z_stream));
+    deflateInit2(&stored,Z_NO_COMPRESSION,Z_DEFLATED,/*raw*/-15,8,Z_DEFAULT_STRATEGY);
+    stored.next_in = data;
+    stored.avail_in = datalength;
+    stored.next_out = &(block[BGZF_HEADERLENGTH]);
+    stored.avail_out = BGZF_MAXBLOCK - BGZF_HEADERLENGTH - BGZF_FOOTERLENGTH;
+    if (deflate(&stored,Z_FINISH) != Z_STREAM_END) {
+      fprintf(stderr,"Unable to deflate BGZF block of %d bytes\n",datalength);
+      exit(9);
+    }
+    blocklength = BGZF_HEADERLENGTH + stored.total_out + BGZF_FOOTERLENGTH;
+    deflateEnd(&stored);
+  }
+
+  memcpy(block,bgzf_header,BGZF_HEADERLENGTH);
+  put_uint16(&(block[16]),blocklength - 1);
+  put_uint32(&(block[blocklength - 8]),crc32(crc32(0L,NULL,0),data,datalength));
+  put_uint32(&(block[blocklength - 4]),datalength);
+
+  return blocklength;
+}
+
+
+#ifdef HAVE_PTHREAD
+static void *
+compressor_thread (void *data) {
+  Job_T job;
+  z_stream strm;
+
+  memset(&strm,0,sizeof(z_stream));
+  deflateInit2(&strm,Z_DEFAULT_COMPRESSION,Z_DEFLATED,/*raw*/-15,8,Z_DEFAULT_STRATEGY);
+
+  while (1) {
+    pthread_mutex_lock(&pool_lock);
+    while (pending_head == NULL && shutdownp == false) {
+      pthread_cond_wait(&job_avail_p,&pool_lock);
+    }
+    if ((job = pending_head) == NULL) {
+      /* Shutting down */
+      pthread_mutex_unlock(&pool_lock);
+      deflateEnd(&strm);
+      return (void *) NULL;
+    }
+    if ((pending_head = job->next_pending) == NULL) {
+      pending_tail = (Job_T) NULL;
+    }
+    pthread_mutex_unlock(&pool_lock);
+
+    job->blocklength = compress_block(job->block,&strm,job->data,job->datalength);
+    debug(fprintf(stderr,"Compressed %d bytes to %d\n",job->datalength,job->blocklength));
+
+    pthread_mutex_lock(&pool_lock);
+    job->donep = true;
+    pthread_cond_broadcast(&job_done_p);
+    pthread_mutex_unlock(&pool_lock);
+  }
+}
+#endif
+
+
+void
+Bgzf_setup (int ncompressors_in) {
+#ifdef HAVE_PTHREAD
+  int i;
+
+  ncompressors = ncompressors_in;
+  shutdownp = false;
+  if (ncompressors > 0) {
+    compressor_ids = (pthread_t *) CALLOC(ncompressors,sizeof(pthread_t));
+    for (i = 0; i < ncompressors; i++) {
+      pthread_create(&(compressor_ids[i]),NULL,compressor_thread,(void *) NULL);
+    }
+  }
+#else
+  ncompressors = 0;
+#endif
+
+  return;
+}
+
+void
+Bgzf_cleanup () {
+#ifdef HAVE_PTHREAD
+  int i;
+
+  if (ncompressors > 0) {
+    pthread_mutex_lock(&pool_lock);
+    shutdownp = true;
+    pthread_cond_broadcast(&job_avail_p);
+    pthread_mutex_unlock(&pool_lock);
+
+    for (i = 0; i < ncompressors; i++) {
+      pthread_join(compressor_ids[i],NULL);
+    }
+    FREE(compressor_ids);
+    ncompressors = 0;
+  }
+#endif
+
+  return;
+}
+
+
+T
+Bgzf_new (FILE *fp) {
+  T new = (T) MALLOC(sizeof(*new));
+
+  new->fp = fp;
+  new->data = (unsigned char *) MALLOC(BGZF_BLOCKSIZE*sizeof(unsigned char));
+  new->datalength = 0;
+
+  new->head = new->tail = (Job_T) NULL;
+  new->ninflight = 0;
+
+  memset(&new->strm,0,sizeof(z_stream));
+  if ((new->inlinep = (ncompressors == 0)) == true) {
+    deflateInit2(&new->strm,Z_DEFAULT_COMPRESSION,Z_DEFLATED,/*raw*/-15,8,Z_DEFAULT_STRATEGY);
+  }
+
+  return new;
+}
+
+
+static void
+write_block (T this, unsigned char *block, int blocklength) {
+  if (fwrite(block,sizeof(unsigned char),blocklength,this->fp) != (size_t) blocklength) {
+    fprintf(stderr,"Error writing BGZF block\n");
+    exit(9);
+  }
+  return;
+}
+
+
+#ifdef HAVE_PTHREAD
+/* Writes finished blocks at the head of this writer's list, waiting
+   for unfinished ones while more than nkeep blocks are in flight */
+static void
+write_finished (T this, int nkeep) {
+  Job_T job;
+
+  while (this->head != NULL) {
+    pthread_mutex_lock(&pool_lock);
+    if (this->head->donep == false && this->ninflight <= nkeep) {
+      pthread_mutex_unlock(&pool_lock);
+      return;
+    }
+    while (this->head->donep == false) {
+      pthread_cond_wait(&job_done_p,&pool_lock);
+    }
+    job = this->head;
+    if ((this->head = job->next) == NULL) {
+      this->tail = (Job_T) NULL;
+    }
+    this->ninflight -= 1;
+    pthread_mutex_unlock(&pool_lock);
+
+    write_block(this,job->block,job->blocklength);
+    FREE(job->block);
+    FREE(job->data);
+    FREE(job);
+  }
+
+  return;
+}
+#endif
+
+
+/* Compresses the block being filled, and starts a new one */
+static void
+dispatch_block (T this) {
+  unsigned char *block;
+  int blocklength;
+#ifdef HAVE_PTHREAD
+  Job_T job;
+#endif
+
+  if (this->datalength == 0) {
+    return;
+  }
+
+#ifdef HAVE_PTHREAD
+  if (this->inlinep == false) {
+    job = (Job_T) MALLOC(sizeof(*job));
+    job->data = this->data;
+    job->datalength = this->datalength;
+    job->block = (unsigned char *) MALLOC(BGZF_MAXBLOCK*sizeof(unsigned char));
+    job->blocklength = 0;
+    job->donep = false;
+    job->next_pending = job->next = (Job_T) NULL;
+
+    pthread_mutex_lock(&pool_lock);
+    if (pending_tail == NULL) {
+      pending_head = job;
+    } else {
+      pending_tail->next_pending = job;
+    }
+    pending_tail = job;
+    pthread_cond_signal(&job_avail_p);
+
+    if (this->tail == NULL) {
+      this->head = job;
+    } else {
+      this->tail->next = job;
+    }
+    this->tail = job;
+    this->ninflight += 1;
+    pthread_mutex_unlock(&pool_lock);
+
+    this->data = (unsigned char *) MALLOC(BGZF_BLOCKSIZE*sizeof(unsigned char));
+    this->datalength = 0;
+
+    write_finished(this,/*nkeep*/MAXINFLIGHT_PER_COMPRESSOR*ncompressors);
+    return;
+  }
+#endif
+
+  block = (unsigned char *) MALLOC(BGZF_MAXBLOCK*sizeof(unsigned char));
+  blocklength = compress_block(block,&this->strm,this->data,this->datalength);
+  write_block(this,block,blocklength);
+  FREE(block);
+  this->datalength = 0;
+
+  return;
+}
+
+
+void
+Bgzf_write (T this, void *data, int length) {
+  unsigned char *p = (unsigned char *) data;
+  int n;
+
+  while (length > 0) {
+    if ((n = BGZF_BLOCKSIZE - this->datalength) > length) {
+      n = length;
+    }
+    memcpy(&(this->data[this->datalength]),p,n);
+    this->datalength += n;
+    p += n;
+    length -= n;
+
+    if (this->datalength == BGZF_BLOCKSIZE) {
+      dispatch_block(this);
+    }
+  }
+
+  return;
+}
+
+
+/* Starts a new block if length more bytes would not fit in this one,
+   so that short records do not span blocks */
+void
+Bgzf_flush_try (T this, int length) {
+  if (this->datalength + length > BGZF_BLOCKSIZE) {
+    dispatch_block(this);
+  }
+  return;
+}
+
+
+/* Writes remaining blocks and the end-of-file marker.  Does not close
+   the file. */
+void
+Bgzf_close (T *old) {
+  if (*old) {
+    dispatch_block(*old);
+#ifdef HAVE_PTHREAD
+    write_finished(*old,/*nkeep*/0);
+#endif
+    write_block(*old,bgzf_eof,sizeof(bgzf_eof));
+    fflush((*old)->fp);
+
+    if ((*old)->inlinep == true) {
+      deflateEnd(&(*old)->strm);
+    }
+    FREE((*old)->data);
+    FREE(*old);
+  }
+  return;
+}
+
+#endif /* HAVE_ZLIB */
+
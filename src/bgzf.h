@@ -0,0 +1,33 @@
+/* $Id: bgzf.h $ */
+#ifndef BGZF_INCLUDED
+#define BGZF_INCLUDED
+
+#include <stdio.h>
+#include "bool.h"
+
+/* Writes the blocked gzip format used by BAM files.  Full blocks are
+   deflated by a pool of compression threads, started by Bgzf_setup,
+   and written to the file in order by the thread calling Bgzf_write. */
+
+#define BGZF_BLOCKSIZE 0xff00	/* Uncompressed bytes per block, as in samtools */
+
+#define T Bgzf_T
+typedef struct T *T;
+
+extern void
+Bgzf_setup (int ncompressors);
+extern void
+Bgzf_cleanup ();
+
+extern T
+Bgzf_new (FILE *fp);
+extern void
+Bgzf_close (T *old);
+extern void
+Bgzf_write (T this, void *data, int length);
+extern void
+Bgzf_flush_try (T this, int length);
+
+#undef T
+#endif
+
@@ -0,0 +1,361 @@
+static char rcsid[] = "$Id: blockdiff.c $";
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "blockdiff.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef WORDS_BIGENDIAN
+#include "bigendian.h"
+#elif defined(HAVE_SSE2)
+#define USE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+
+#ifdef DEBUG
+#define debug(x) x
+#else
+#define debug(x)
+#endif
+
+
+#ifdef HAVE_BUILTIN_POPCOUNT
+#define count_bits(x) __builtin_popcount(x)
+#else
+static inline int
+count_bits (Genomecomp_T x) {
+  x = x - ((x >> 1) & 0x55555555);
+  x = (x & 0x33333333) + ((x >> 2) & 0x33333333);
+  x = (x + (x >> 4)) & 0x0F0F0F0F;
+  return (int) ((x * 0x01010101) >> 24);
+}
+#endif
+
+
+/* Gathers the even bits of x into the low 16 bits */
+static inline Genomecomp_T
+compress_even_bits (Genomecomp_T x) {
+  x &= 0x55555555;
+  x = (x | (x >> 1)) & 0x33333333;
+  x = (x | (x >> 2)) & 0x0F0F0F0F;
+  x = (x | (x >> 4)) & 0x00FF00FF;
+  x = (x | (x >> 8)) & 0x0000FFFF;
+  return x;
+}
+
+/* One bit for each of the 16 bases in x and y, set where they differ */
+static inline Genomecomp_T
+word_diff (Genomecomp_T x, Genomecomp_T y) {
+  x ^= y;
+  return compress_even_bits(x | (x >> 1));
+}
+
+
+Genomecomp_T
+Blockdiff_word (Genomecomp_T *query_block, Genomecomp_T *ref_block, Genomecomp_T *alt_block,
+		bool query_unk_mismatch_p, bool genome_unk_mismatch_p) {
+  Genomecomp_T high, low, flags, diff;
+
+#ifdef WORDS_BIGENDIAN
+  high = Bigendian_convert_uint(ref_block[0]);
+  low = Bigendian_convert_uint(ref_block[1]);
+  flags = Bigendian_convert_uint(ref_block[2]);
+#else
+  high = ref_block[0]; low = ref_block[1]; flags = ref_block[2];
+#endif
+  diff = word_diff(query_block[1],low) | (word_diff(query_block[0],high) << 16);
+
+  if (alt_block != NULL) {
+#ifdef WORDS_BIGENDIAN
+    high = Bigendian_convert_uint(alt_block[0]);
+    low = Bigendian_convert_uint(alt_block[1]);
+#else
+    high = alt_block[0]; low = alt_block[1];
+#endif
+    diff &= word_diff(query_block[1],low) | (word_diff(query_block[0],high) << 16);
+  }
+
+  if (query_unk_mismatch_p == true) {
+    diff |= query_block[2];
+  } else {
+    diff &= ~query_block[2];
+  }
+
+  if (genome_unk_mismatch_p == true) {
+    diff |= flags;
+  } else {
+    diff &= ~flags;
+  }
+
+  return diff;
+}
+
+
+#ifdef USE_SSE2
+/* Transposes 4 consecutive blocks into vectors of their high, low,
+   and flags words */
+static inline void
+load_blocks_4 (__m128i *high, __m128i *low, __m128i *flags, Genomecomp_T *blocks) {
+  __m128 v0, v1, v2, a, b;
+
+  v0 = _mm_castsi128_ps(_mm_loadu_si128((__m128i *) &(blocks[0]))); /* h0 l0 f0 h1 */
+  v1 = _mm_castsi128_ps(_mm_loadu_si128((__m128i *) &(blocks[4]))); /* l1 f1 h2 l2 */
+  v2 = _mm_castsi128_ps(_mm_loadu_si128((__m128i *) &(blocks[8]))); /* f2 h3 l3 f3 */
+
+  a = _mm_shuffle_ps(v0,v0,_MM_SHUFFLE(3,0,3,0));
+  b = _mm_shuffle_ps(v1,v2,_MM_SHUFFLE(1,1,2,2));
+  *high = _mm_castps_si128(_mm_shuffle_ps(a,b,_MM_SHUFFLE(2,0,1,0)));
+
+  a = _mm_shuffle_ps(v0,v1,_MM_SHUFFLE(0,0,1,1));
+  b = _mm_shuffle_ps(v1,v2,_MM_SHUFFLE(2,2,3,3));
+  *low = _mm_castps_si128(_mm_shuffle_ps(a,b,_MM_SHUFFLE(2,0,2,0)));
+
+  if (flags != NULL) {
+    a = _mm_shuffle_ps(v0,v1,_MM_SHUFFLE(1,1,2,2));
+    b = _mm_shuffle_ps(v2,v2,_MM_SHUFFLE(3,3,0,0));
+    *flags = _mm_castps_si128(_mm_shuffle_ps(a,b,_MM_SHUFFLE(2,0,2,0)));
+  }
+
+  return;
+}
+
+static inline __m128i
+word_diff_4 (__m128i x, __m128i y) {
+  x = _mm_xor_si128(x,y);
+  x = _mm_and_si128(_mm_or_si128(x,_mm_srli_epi32(x,1)),_mm_set1_epi32(0x55555555));
+  x = _mm_and_si128(_mm_or_si128(x,_mm_srli_epi32(x,1)),_mm_set1_epi32(0x33333333));
+  x = _mm_and_si128(_mm_or_si128(x,_mm_srli_epi32(x,2)),_mm_set1_epi32(0x0F0F0F0F));
+  x = _mm_and_si128(_mm_or_si128(x,_mm_srli_epi32(x,4)),_mm_set1_epi32(0x00FF00FF));
+  x = _mm_and_si128(_mm_or_si128(x,_mm_srli_epi32(x,8)),_mm_set1_epi32(0x0000FFFF));
+  return x;
+}
+
+/* Diff words from the vectors of query, ref, and alt words.
+   high_alt and low_alt are NULL if there is no alt. */
+static inline __m128i
+diff_4 (__m128i qhigh, __m128i qlow, __m128i qflags, __m128i high, __m128i low, __m128i flags,
+	__m128i *high_alt, __m128i *low_alt, bool query_unk_mismatch_p, bool genome_unk_mismatch_p) {
+  __m128i diff;
+
+  diff = _mm_or_si128(word_diff_4(qlow,low),_mm_slli_epi32(word_diff_4(qhigh,high),16));
+  if (high_alt != NULL) {
+    diff = _mm_and_si128(diff,_mm_or_si128(word_diff_4(qlow,*low_alt),_mm_slli_epi32(word_diff_4(qhigh,*high_alt),16)));
+  }
+
+  if (query_unk_mismatch_p == true) {
+    diff = _mm_or_si128(diff,qflags);
+  } else {
+    diff = _mm_andnot_si128(qflags,diff);
+  }
+
+  if (genome_unk_mismatch_p == true) {
+    diff = _mm_or_si128(diff,flags);
+  } else {
+    diff = _mm_andnot_si128(flags,diff);
+  }
+
+  return diff;
+}
+
+/* Diff words for 4 consecutive blocks */
+static inline __m128i
+block_diff_4 (Genomecomp_T *query_blocks, Genomecomp_T *ref_blocks, Genomecomp_T *alt_blocks,
+	      bool query_unk_mismatch_p, bool genome_unk_mismatch_p) {
+  __m128i qhigh, qlow, qflags, high, low, flags, high_alt, low_alt;
+
+  load_blocks_4(&qhigh,&qlow,&qflags,query_blocks);
+  load_blocks_4(&high,&low,&flags,ref_blocks);
+  if (alt_blocks == NULL) {
+    return diff_4(qhigh,qlow,qflags,high,low,flags,/*high_alt*/NULL,/*low_alt*/NULL,
+		  query_unk_mismatch_p,genome_unk_mismatch_p);
+  } else {
+    load_blocks_4(&high_alt,&low_alt,/*flags*/NULL,alt_blocks);
+    return diff_4(qhigh,qlow,qflags,high,low,flags,&high_alt,&low_alt,
+		  query_unk_mismatch_p,genome_unk_mismatch_p);
+  }
+}
+
+/* Total of set bits in the 4 words */
+static inline int
+count_bits_4 (__m128i x) {
+  x = _mm_sub_epi32(x,_mm_and_si128(_mm_srli_epi32(x,1),_mm_set1_epi32(0x55555555)));
+  x = _mm_add_epi32(_mm_and_si128(x,_mm_set1_epi32(0x33333333)),
+		    _mm_and_si128(_mm_srli_epi32(x,2),_mm_set1_epi32(0x33333333)));
+  x = _mm_and_si128(_mm_add_epi32(x,_mm_srli_epi32(x,4)),_mm_set1_epi32(0x0F0F0F0F));
+  x = _mm_sad_epu8(x,_mm_setzero_si128());
+  return _mm_cvtsi128_si32(x) + _mm_cvtsi128_si32(_mm_srli_si128(x,8));
+}
+
+/* Set bits in each of the 4 words */
+static inline __m128i
+lane_bits_4 (__m128i x) {
+  x = _mm_sub_epi32(x,_mm_and_si128(_mm_srli_epi32(x,1),_mm_set1_epi32(0x55555555)));
+  x = _mm_add_epi32(_mm_and_si128(x,_mm_set1_epi32(0x33333333)),
+		    _mm_and_si128(_mm_srli_epi32(x,2),_mm_set1_epi32(0x33333333)));
+  x = _mm_and_si128(_mm_add_epi32(x,_mm_srli_epi32(x,4)),_mm_set1_epi32(0x0F0F0F0F));
+  x = _mm_add_epi32(x,_mm_srli_epi32(x,8));
+  x = _mm_add_epi32(x,_mm_srli_epi32(x,16));
+  return _mm_and_si128(x,_mm_set1_epi32(0x3F));
+}
+#endif
+
+
+int
+Blockdiff_count_limit (Genomecomp_T *query_blocks, Genomecomp_T *ref_blocks, Genomecomp_T *alt_blocks,
+		       int startpos, int endpos, int max_mismatches,
+		       bool query_unk_mismatch_p, bool genome_unk_mismatch_p) {
+  int nmismatches, startblock, endblock, i;
+  Genomecomp_T diff, startmask, endmask;
+
+  if (endpos <= startpos) {
+    return 0;
+  }
+
+  startblock = startpos/32;
+  endblock = (endpos - 1)/32;
+  startmask = ~0U << (startpos % 32);
+  endmask = (endpos % 32 == 0) ? ~0U : ~(~0U << (endpos % 32));
+  debug(printf("Blockdiff_count_limit from %d to %d, blocks %d..%d\n",startpos,endpos,startblock,endblock));
+
+  diff = Blockdiff_word(&(query_blocks[3*startblock]),&(ref_blocks[3*startblock]),
+			alt_blocks == NULL ? NULL : &(alt_blocks[3*startblock]),
+			query_unk_mismatch_p,genome_unk_mismatch_p);
+  if (endblock == startblock) {
+    return count_bits(diff & startmask & endmask);
+  } else if ((nmismatches = count_bits(diff & startmask)) > max_mismatches) {
+    return nmismatches;
+  }
+
+  i = startblock + 1;
+#ifdef USE_SSE2
+  for ( ; i + 4 <= endblock; i += 4) {
+    nmismatches += count_bits_4(block_diff_4(&(query_blocks[3*i]),&(ref_blocks[3*i]),
+					     alt_blocks == NULL ? NULL : &(alt_blocks[3*i]),
+					     query_unk_mismatch_p,genome_unk_mismatch_p));
+    if (nmismatches > max_mismatches) {
+      return nmismatches;
+    }
+  }
+#endif
+
+  for ( ; i < endblock; i++) {
+    diff = Blockdiff_word(&(query_blocks[3*i]),&(ref_blocks[3*i]),
+			  alt_blocks == NULL ? NULL : &(alt_blocks[3*i]),
+			  query_unk_mismatch_p,genome_unk_mismatch_p);
+    if ((nmismatches += count_bits(diff)) > max_mismatches) {
+      return nmismatches;
+    }
+  }
+
+  diff = Blockdiff_word(&(query_blocks[3*endblock]),&(ref_blocks[3*endblock]),
+			alt_blocks == NULL ? NULL : &(alt_blocks[3*endblock]),
+			query_unk_mismatch_p,genome_unk_mismatch_p);
+  return nmismatches + count_bits(diff & endmask);
+}
+
+
+#ifdef USE_SSE2
+/* Mask for the bases of block b that lie within startpos..endpos-1 */
+static inline Genomecomp_T
+block_mask (int b, int startpos, int endpos) {
+  Genomecomp_T mask = ~0U;
+
+  if (b < startpos/32 || b > (endpos - 1)/32) {
+    return 0U;
+  }
+  if (b == startpos/32) {
+    mask &= ~0U << (startpos % 32);
+  }
+  if (b == (endpos - 1)/32 && endpos % 32 != 0) {
+    mask &= ~(~0U << (endpos % 32));
+  }
+  return mask;
+}
+#endif
+
+
+void
+Blockdiff_count_limit_4 (int *nmismatches, Genomecomp_T **query_blocks, Genomecomp_T **ref_blocks,
+			 Genomecomp_T **alt_blocks, int *startpos, int *endpos, int max_mismatches,
+			 bool query_unk_mismatch_p, bool genome_unk_mismatch_p) {
+#ifdef USE_SSE2
+  __m128i qhigh, qlow, qflags, high, low, flags, high_alt, low_alt, diff, counts, maxv;
+  Genomecomp_T *q[4], *r[4], *a[4], masks[4];
+  int startblock[4], endblock[4], minblock, maxblock, b, k;
+
+  minblock = startblock[0] = startpos[0]/32;
+  maxblock = endblock[0] = (endpos[0] - 1)/32;
+  for (k = 1; k < 4; k++) {
+    if ((startblock[k] = startpos[k]/32) < minblock) {
+      minblock = startblock[k];
+    }
+    if ((endblock[k] = (endpos[k] - 1)/32) > maxblock) {
+      maxblock = endblock[k];
+    }
+  }
+  debug(printf("Blockdiff_count_limit_4 over blocks %d..%d\n",minblock,maxblock));
+
+  counts = _mm_setzero_si128();
+  maxv = _mm_set1_epi32(max_mismatches);
+  for (b = minblock; b <= maxblock; b++) {
+    /* Lanes outside their own range reread their nearest block, masked out */
+    for (k = 0; k < 4; k++) {
+      masks[k] = block_mask(b,startpos[k],endpos[k]);
+      if (b < startblock[k]) {
+	q[k] = &(query_blocks[k][3*startblock[k]]);
+	r[k] = &(ref_blocks[k][3*startblock[k]]);
+	a[k] = (alt_blocks == NULL) ? NULL : &(alt_blocks[k][3*startblock[k]]);
+      } else if (b > endblock[k]) {
+	q[k] = &(query_blocks[k][3*endblock[k]]);
+	r[k] = &(ref_blocks[k][3*endblock[k]]);
+	a[k] = (alt_blocks == NULL) ? NULL : &(alt_blocks[k][3*endblock[k]]);
+      } else {
+	q[k] = &(query_blocks[k][3*b]);
+	r[k] = &(ref_blocks[k][3*b]);
+	a[k] = (alt_blocks == NULL) ? NULL : &(alt_blocks[k][3*b]);
+      }
+    }
+
+    qhigh = _mm_set_epi32(q[3][0],q[2][0],q[1][0],q[0][0]);
+    qlow = _mm_set_epi32(q[3][1],q[2][1],q[1][1],q[0][1]);
+    qflags = _mm_set_epi32(q[3][2],q[2][2],q[1][2],q[0][2]);
+    high = _mm_set_epi32(r[3][0],r[2][0],r[1][0],r[0][0]);
+    low = _mm_set_epi32(r[3][1],r[2][1],r[1][1],r[0][1]);
+    flags = _mm_set_epi32(r[3][2],r[2][2],r[1][2],r[0][2]);
+    if (alt_blocks == NULL) {
+      diff = diff_4(qhigh,qlow,qflags,high,low,flags,/*high_alt*/NULL,/*low_alt*/NULL,
+		    query_unk_mismatch_p,genome_unk_mismatch_p);
+    } else {
+      high_alt = _mm_set_epi32(a[3][0],a[2][0],a[1][0],a[0][0]);
+      low_alt = _mm_set_epi32(a[3][1],a[2][1],a[1][1],a[0][1]);
+      diff = diff_4(qhigh,qlow,qflags,high,low,flags,&high_alt,&low_alt,
+		    query_unk_mismatch_p,genome_unk_mismatch_p);
+    }
+    diff = _mm_and_si128(diff,_mm_loadu_si128((__m128i *) masks));
+    counts = _mm_add_epi32(counts,lane_bits_4(diff));
+
+    if (_mm_movemask_epi8(_mm_cmpgt_epi32(counts,maxv)) == 0xFFFF) {
+      debug(printf("All lanes exceed %d mismatches at block %d\n",max_mismatches,b));
+      break;
+    }
+  }
+
+  _mm_storeu_si128((__m128i *) nmismatches,counts);
+
+#else
+  int k;
+
+  for (k = 0; k < 4; k++) {
+    nmismatches[k] = Blockdiff_count_limit(query_blocks[k],ref_blocks[k],
+					   alt_blocks == NULL ? NULL : alt_blocks[k],
+					   startpos[k],endpos[k],max_mismatches,
+					   query_unk_mismatch_p,genome_unk_mismatch_p);
+  }
+#endif
+
+  return;
+}
+
@@ -0,0 +1,37 @@
+/* $Id: blockdiff.h $ */
+#ifndef BLOCKDIFF_INCLUDED
+#define BLOCKDIFF_INCLUDED
+#include "bool.h"
+#include "types.h"
+
+/* Mismatch kernels over compressed blocks of 32 bases, each stored as
+   three words (high, low, flags), as in the genome and in the arrays
+   from Compress_shift.  query_blocks must already be shifted to line
+   up with ref_blocks.  If alt_blocks is non-NULL, a base mismatches
+   only if it differs from both ref and alt, as in SNP-tolerant
+   alignment.  Bit i of a diff word is set if base i of its block
+   mismatches. */
+
+extern Genomecomp_T
+Blockdiff_word (Genomecomp_T *query_block, Genomecomp_T *ref_block, Genomecomp_T *alt_block,
+		bool query_unk_mismatch_p, bool genome_unk_mismatch_p);
+
+/* Counts mismatches at bases startpos through endpos - 1, counted
+   from the start of the first block.  Stops early once the count
+   exceeds max_mismatches, and then returns a value above it. */
+extern int
+Blockdiff_count_limit (Genomecomp_T *query_blocks, Genomecomp_T *ref_blocks, Genomecomp_T *alt_blocks,
+		       int startpos, int endpos, int max_mismatches,
+		       bool query_unk_mismatch_p, bool genome_unk_mismatch_p);
+
+/* Runs Blockdiff_count_limit on 4 independent comparisons, one per
+   SIMD lane, storing the counts in nmismatches[0..3].  Each array
+   argument holds one entry per lane, and alt_blocks may be NULL.
+   Every lane must cover at least one base.  Stops once all lanes
+   exceed max_mismatches. */
+extern void
+Blockdiff_count_limit_4 (int *nmismatches, Genomecomp_T **query_blocks, Genomecomp_T **ref_blocks,
+			 Genomecomp_T **alt_blocks, int *startpos, int *endpos, int max_mismatches,
+			 bool query_unk_mismatch_p, bool genome_unk_mismatch_p);
+
+#endif
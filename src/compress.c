@@ -19,6 +19,14 @@ static char rcsid[] = "$Id: compress.c 99737 2013-06-27 19:33:03Z twu $";
 #include "complement.h"
 #include "mem.h"		/* For Compress_new */
 
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#ifdef HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
 
 /* Another MONITOR_INTERVAL is in indexdb.c */
 #define MONITOR_INTERVAL 10000000 /* 10 million nt */
@@ -318,6 +326,31 @@ genomecomp_read_current (Genomecomp_T *high, Genomecomp_T *low, Genomecomp_T *fl
 }
 
 
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t badchar_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/* Locks, because threads compressing different slices of the genome
+   share one count, so the messages are limited for the whole genome */
+static void
+count_badchar (int *nbadchars, char c, Univcoord_T position) {
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock(&badchar_lock);
+#endif
+  (*nbadchars) += 1;
+  if (*nbadchars < MAX_BADCHAR_MESSAGES) {
+    fprintf(stderr,"Don't recognize character %c at position %lu.  Using N instead\n",c,position);
+  } else if (*nbadchars == MAX_BADCHAR_MESSAGES) {
+    fprintf(stderr,"Too many non-recognizable characters.  Not reporting each individual occurrence anymore.\n");
+  } else if ((*nbadchars) % BADCHAR_INTERVAL == 0) {
+    fprintf(stderr,"A total of %d non-ACGTNX characters seen so far.\n",*nbadchars);
+  }
+#ifdef HAVE_PTHREAD
+  pthread_mutex_unlock(&badchar_lock);
+#endif
+  return;
+}
+
 static void
 write_compressed_one (FILE *fp, int *nbadchars, char Buffer[], Univcoord_T position) {
   Genomecomp_T high = 0U, low = 0U, flags = 0U, carry;
@@ -344,15 +377,7 @@ write_compressed_one (FILE *fp, int *nbadchars, char Buffer[], Univcoord_T posit
     case 'N': flags |= LEFT_BIT; break;
     case 'X': high |= LEFT_T; flags |= LEFT_BIT; break;
     default: 
-      (*nbadchars) += 1;
-      if (*nbadchars < MAX_BADCHAR_MESSAGES) {
-	fprintf(stderr,"Don't recognize character %c at position %lu.  Using N instead\n",
-		Buffer[i],position+i);
-      } else if (*nbadchars == MAX_BADCHAR_MESSAGES) {
-	fprintf(stderr,"Too many non-recognizable characters.  Not reporting each individual occurrence anymore.\n");
-      } else if ((*nbadchars) % BADCHAR_INTERVAL == 0) {
-	fprintf(stderr,"A total of %d non-ACGTNX characters seen so far.\n",*nbadchars);
-      }
+      count_badchar(nbadchars,Buffer[i],position+i);
       flags |= LEFT_BIT;
       break;
     }
@@ -365,11 +390,50 @@ write_compressed_one (FILE *fp, int *nbadchars, char Buffer[], Univcoord_T posit
   return;
 }
 
+#ifdef HAVE_SSE2
+/* Packs 16 characters into 2 bits each, in the order of
+   put_compressed_one.  Returns false unless all are A, C, G, or T, in
+   either case. */
+static inline bool
+compress_word (Genomecomp_T *word, char *chars) {
+  __m128i upper, acgt, codes;
+
+  upper = _mm_andnot_si128(_mm_set1_epi8(0x20),_mm_loadu_si128((__m128i *) chars));
+  acgt = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(upper,_mm_set1_epi8('A')),_mm_cmpeq_epi8(upper,_mm_set1_epi8('C'))),
+		      _mm_or_si128(_mm_cmpeq_epi8(upper,_mm_set1_epi8('G')),_mm_cmpeq_epi8(upper,_mm_set1_epi8('T'))));
+  if (_mm_movemask_epi8(acgt) != 0xFFFF) {
+    return false;
+  }
+
+  /* 'A', 'C', 'G', and 'T' are 0x41, 0x43, 0x47, and 0x54, so the low
+     two bits of (c >> 1) ^ (c >> 2) are 0, 1, 2, and 3 */
+  codes = _mm_and_si128(_mm_xor_si128(_mm_srli_epi16(upper,1),_mm_srli_epi16(upper,2)),_mm_set1_epi8(3));
+
+  /* Merge neighbors into 4, 8, and then 16 bits */
+  codes = _mm_and_si128(_mm_or_si128(codes,_mm_srli_epi16(codes,6)),_mm_set1_epi16(0x000F));
+  codes = _mm_and_si128(_mm_or_si128(codes,_mm_srli_epi32(codes,12)),_mm_set1_epi32(0x000000FF));
+  codes = _mm_or_si128(codes,_mm_srli_epi64(codes,24));
+
+  *word = ((Genomecomp_T) _mm_cvtsi128_si32(codes) & 0x0000FFFF) |
+    ((Genomecomp_T) _mm_cvtsi128_si32(_mm_srli_si128(codes,8)) << 16);
+  return true;
+}
+#endif
+
 static void
 put_compressed_one (Genomecomp_T *sectioncomp, int *nbadchars, char Buffer[], Univcoord_T position) {
   Genomecomp_T high = 0U, low = 0U, flags = 0U, carry;
   int i;
 
+#ifdef HAVE_SSE2
+  if (compress_word(&low,Buffer) == true && compress_word(&high,&(Buffer[16])) == true) {
+    sectioncomp[0] = high;
+    sectioncomp[1] = low;
+    sectioncomp[2] = 0U;
+    return;
+  }
+#endif
+
   for (i = 0; i < 32; i++) {
     carry = high & 3U;
     high >>= 2;
@@ -391,15 +455,7 @@ put_compressed_one (Genomecomp_T *sectioncomp, int *nbadchars, char Buffer[], Un
     case 'N': flags |= LEFT_BIT; break;
     case 'X': high |= LEFT_T; flags |= LEFT_BIT; break;
     default: 
-      (*nbadchars) += 1;
-      if (*nbadchars < MAX_BADCHAR_MESSAGES) {
-	fprintf(stderr,"Don't recognize character %c at position %lu.  Using N instead\n",
-		Buffer[i],position+i);
-      } else if (*nbadchars == MAX_BADCHAR_MESSAGES) {
-	fprintf(stderr,"Too many non-recognizable characters.  Not reporting each individual occurrence anymore.\n");
-      } else if ((*nbadchars) % BADCHAR_INTERVAL == 0) {
-	fprintf(stderr,"A total of %d non-ACGTNX characters seen so far.\n",*nbadchars);
-      }
+      count_badchar(nbadchars,Buffer[i],position+i);
       flags |= LEFT_BIT;
       break;
     }
@@ -509,8 +565,9 @@ Compress_update_file (int nbadchars, FILE *fp, char *gbuffer, Univcoord_T startp
 }
 
 
-int
-Compress_update_memory (int nbadchars, Genomecomp_T *genomecomp, char *gbuffer, Univcoord_T startpos,
+/* nbadchars may be shared by threads updating different blocks */
+void
+Compress_update_memory (int *nbadchars, Genomecomp_T *genomecomp, char *gbuffer, Univcoord_T startpos,
 			Univcoord_T endpos) {
   /* Chrpos_T length = endpos - startpos; */
   Univcoord_T startblock, endblock, ptr;
@@ -543,7 +600,7 @@ Compress_update_memory (int nbadchars, Genomecomp_T *genomecomp, char *gbuffer,
     for (i = startdiscard; i < enddiscard; i++) {
       Buffer[i] = gbuffer ? gbuffer[k++] : 'X';
     }
-    put_compressed_one(&(genomecomp[ptr]),&nbadchars,Buffer,startpos);
+    put_compressed_one(&(genomecomp[ptr]),nbadchars,Buffer,startpos);
 
   } else {
 
@@ -564,14 +621,14 @@ Compress_update_memory (int nbadchars, Genomecomp_T *genomecomp, char *gbuffer,
     for (i = startdiscard; i < 32; i++) {
       Buffer[i] = gbuffer ? gbuffer[k++] : 'X';
     }
-    put_compressed_one(&(genomecomp[ptr]),&nbadchars,Buffer,startpos);
+    put_compressed_one(&(genomecomp[ptr]),nbadchars,Buffer,startpos);
     ptr += 3;
       
     while (ptr < endblock) {
       for (i = 0; i < 32; i++) {
 	Buffer[i] = gbuffer ? gbuffer[k++] : 'X';
       }
-      put_compressed_one(&(genomecomp[ptr]),&nbadchars,Buffer,ptr/3*32U);
+      put_compressed_one(&(genomecomp[ptr]),nbadchars,Buffer,ptr/3*32U);
       ptr += 3;
     }
 
@@ -593,11 +650,11 @@ Compress_update_memory (int nbadchars, Genomecomp_T *genomecomp, char *gbuffer,
       for (i = 0; i < enddiscard; i++) {
 	Buffer[i] = gbuffer ? gbuffer[k++] : 'X';
       }
-      put_compressed_one(&(genomecomp[ptr]),&nbadchars,Buffer,ptr/3*32U);
+      put_compressed_one(&(genomecomp[ptr]),nbadchars,Buffer,ptr/3*32U);
     }
   }
 
-  return nbadchars;
+  return;
 }
 
 
@@ -19,8 +19,8 @@ Compress_uncompress (FILE *fp, int wraplength);
 extern int
 Compress_update_file (int nbadchars, FILE *fp, char *gbuffer, Univcoord_T startpos,
 		      Univcoord_T endpos, int index1part);
-extern int
-Compress_update_memory (int nbadchars, Genomecomp_T *genomecomp, char *gbuffer, Univcoord_T startpos,
+extern void
+Compress_update_memory (int *nbadchars, Genomecomp_T *genomecomp, char *gbuffer, Univcoord_T startpos,
 			Univcoord_T endpos);
 extern void
 Compress_free (T *old);
@@ -0,0 +1,138 @@
+static char rcsid[] = "$Id: cpuinfo.c $";
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "cpuinfo.h"
+#include <stdio.h>
+#include <stdlib.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <cpuid.h>
+#define USE_CPUID 1
+#endif
+
+
+#ifdef DEBUG
+#define debug(x) x
+#else
+#define debug(x)
+#endif
+
+
+static bool setup_p = false;
+static Simd_level_T simd_level = SIMD_NONE;
+static bool popcnt_p = false;
+
+
+#ifdef USE_CPUID
+/* Which register states the operating system saves on a context
+   switch.  Without this, AVX instructions fault even when cpuid
+   reports them. */
+static unsigned int
+xgetbv0 () {
+  unsigned int eax, edx;
+
+  __asm__ __volatile__ ("xgetbv" : "=a" (eax), "=d" (edx) : "c" (0));
+  return eax;
+}
+#endif
+
+
+static void
+cpuinfo_setup () {
+#ifdef USE_CPUID
+  unsigned int eax, ebx, ecx, edx, xcr0 = 0;
+
+  if (__get_cpuid(1,&eax,&ebx,&ecx,&edx) == 0) {
+    return;
+  }
+  debug(printf("cpuid 1: ecx %08X, edx %08X\n",ecx,edx));
+
+  if ((edx >> 26) & 1) {
+    simd_level = SIMD_SSE2;
+  }
+  if (simd_level == SIMD_SSE2 && ((ecx >> 19) & 1)) {
+    simd_level = SIMD_SSE4_1;
+  }
+  popcnt_p = ((ecx >> 23) & 1) ? true : false;
+
+  if ((ecx >> 27) & 1) {
+    /* OSXSAVE */
+    xcr0 = xgetbv0();
+  }
+
+  /* AVX, with XMM and YMM state saved by the operating system */
+  if (simd_level == SIMD_SSE4_1 && ((ecx >> 28) & 1) && (xcr0 & 0x06) == 0x06 &&
+      __get_cpuid_max(0,NULL) >= 7) {
+    __cpuid_count(7,0,eax,ebx,ecx,edx);
+    debug(printf("cpuid 7: ebx %08X\n",ebx));
+    if ((ebx >> 5) & 1) {
+      simd_level = SIMD_AVX2;
+      /* AVX512F and AVX512BW, with opmask and ZMM state saved */
+      if (((ebx >> 16) & 1) && ((ebx >> 30) & 1) && (xcr0 & 0xE6) == 0xE6) {
+	simd_level = SIMD_AVX512;
+      }
+    }
+  }
+#endif
+
+  return;
+}
+
+
+Simd_level_T
+Cpuinfo_simd_level () {
+  if (setup_p == false) {
+    cpuinfo_setup();
+    setup_p = true;
+  }
+  return simd_level;
+}
+
+bool
+Cpuinfo_popcnt_p () {
+  if (setup_p == false) {
+    cpuinfo_setup();
+    setup_p = true;
+  }
+  return popcnt_p;
+}
+
+char *
+Cpuinfo_simd_string (Simd_level_T level) {
+  switch (level) {
+  case SIMD_NONE: return "none";
+  case SIMD_SSE2: return "SSE2";
+  case SIMD_SSE4_1: return "SSE4.1";
+  case SIMD_AVX2: return "AVX2";
+  case SIMD_AVX512: return "AVX-512";
+  }
+  return "unknown";
+}
+
+
+/* Code compiled with configure-time flags like -msse4.1 or -mpopcnt
+   cannot run on an older processor.  Say so, instead of dying later
+   on an illegal instruction. */
+void
+Cpuinfo_check_build () {
+#ifdef USE_CPUID
+#if defined(__SSE4_1__)
+  if (Cpuinfo_simd_level() < SIMD_SSE4_1) {
+    fprintf(stderr,"This program was compiled for SSE4.1, which this processor does not support.\n");
+    fprintf(stderr,"Please re-run configure with --disable-sse4.1 and re-compile\n");
+    exit(9);
+  }
+#endif
+#if defined(__POPCNT__)
+  if (Cpuinfo_popcnt_p() == false) {
+    fprintf(stderr,"This program was compiled for popcnt, which this processor does not support.\n");
+    fprintf(stderr,"Please re-run configure with --disable-popcnt and re-compile\n");
+    exit(9);
+  }
+#endif
+#endif
+
+  return;
+}
+
@@ -0,0 +1,36 @@
+/* $Id: cpuinfo.h $ */
+#ifndef CPUINFO_INCLUDED
+#define CPUINFO_INCLUDED
+
+#include "bool.h"
+
+/* In increasing order, so levels can be compared */
+typedef enum {SIMD_NONE, SIMD_SSE2, SIMD_SSE4_1, SIMD_AVX2, SIMD_AVX512} Simd_level_T;
+
+/* gcc 4.9 and clang can compile single functions for instruction
+   sets beyond those given on the command line.  Kernels for newer
+   processors are then built into every binary and chosen at run time
+   by checking Cpuinfo_simd_level. */
+#if (defined(__x86_64__) || defined(__i386__)) && \
+  (defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define USE_TARGET_ATTRIBUTES 1
+#define TARGET_SSE4_1 __attribute__((target("sse4.1")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define TARGET_AVX512 __attribute__((target("avx512f,avx512bw")))
+#else
+#define TARGET_SSE4_1
+#define TARGET_AVX2
+#define TARGET_AVX512
+#endif
+
+extern Simd_level_T
+Cpuinfo_simd_level ();
+extern bool
+Cpuinfo_popcnt_p ();
+extern char *
+Cpuinfo_simd_string (Simd_level_T level);
+extern void
+Cpuinfo_check_build ();
+
+#endif
+
@@ -9,12 +9,29 @@ static char rcsid[] = "$Id: dynprog.c 104140 2013-08-08 03:14:00Z twu $";
 #include <string.h>
 #include <math.h>		/* For ceil, log, pow */
 #include <ctype.h>		/* For tolower */
+#include "cpuinfo.h"
+
+/* The 8-bit (SSE4.1) and wider kernels are compiled in whenever the
+   compiler allows, and chosen at run time in Dynprog_init */
+#if defined(HAVE_SSE4_1) || (defined(HAVE_SSE2) && defined(USE_TARGET_ATTRIBUTES))
+#define USE_SIMD_8 1
+#endif
+#if defined(HAVE_SSE2) && (defined(__AVX2__) || defined(USE_TARGET_ATTRIBUTES))
+#define USE_AVX2 1
+#endif
+#if defined(HAVE_SSE2) && (defined(__AVX512BW__) || defined(USE_TARGET_ATTRIBUTES))
+#define USE_AVX512 1
+#endif
+
 #ifdef HAVE_SSE2
 #include <emmintrin.h>
 #endif
-#ifdef HAVE_SSE4_1
+#ifdef USE_SIMD_8
 #include <smmintrin.h>
 #endif
+#if defined(USE_AVX2) || defined(USE_AVX512)
+#include <immintrin.h>
+#endif
 
 
 #include "bool.h"
@@ -166,7 +183,7 @@ static char rcsid[] = "$Id: dynprog.c 104140 2013-08-08 03:14:00Z twu $";
 
 /* We can allow -128 and -32768 for NEG_INFINITY in SIMD procedures,
    because we are using saturation */
-#ifdef HAVE_SSE4_1
+#ifdef USE_SIMD_8
 #define NEG_INFINITY_8 -128
 #define MAX_CHAR 127
 
@@ -411,6 +428,10 @@ static Triecontent_T *triecontents_max;
 
 static bool novelsplicingp;
 
+/* Chosen in Dynprog_init for this processor */
+static Simd_level_T simd_level = SIMD_NONE;
+static int maxlength_epi8 = -1;	/* -1 if 8-bit kernels cannot run */
+
 
 char *
 Dynprog_endalign_string (Endalign_T endalign) {
@@ -549,7 +570,6 @@ get_genomic_nt (char *g_alt, int genomicpos, Univcoord_T chroffset, Univcoord_T
  * Matrix
  ************************************************************************/
 
-#if !defined(HAVE_SSE2) || defined(DEBUG14)
 /* Makes a matrix of dimensions 0..glength x 0..rlength inclusive */
 static Score32_T **
 Matrix32_alloc (int rlength, int glength, Score32_T **ptrs, Score32_T *space) {
@@ -572,7 +592,6 @@ Matrix32_alloc (int rlength, int glength, Score32_T **ptrs, Score32_T *space) {
   return matrix;
 }
 
-#endif
 
 #if defined(DEBUG2) || defined(DEBUG14)
 static void
@@ -867,7 +886,6 @@ Matrix3_print (struct Int3_T **matrix, int rlength, int glength, char *rsequence
 /*  Directions  */
 /************************************************************************/
 
-#if !defined(HAVE_SSE2) || defined(DEBUG14)
 /* Makes a matrix of dimensions 0..glength x 0..rlength inclusive */
 static Direction32_T **
 Directions32_alloc (int rlength, int glength, Direction32_T **ptrs, Direction32_T *space) {
@@ -884,7 +902,6 @@ Directions32_alloc (int rlength, int glength, Direction32_T **ptrs, Direction32_
 
   return directions;
 }
-#endif
 
 #ifdef DEBUG2
 static void
@@ -1093,12 +1110,12 @@ struct T {
   struct Int3_T **matrix3_ptrs, *matrix3_space;
 #endif
 
-#if !defined(HAVE_SSE2) || defined(DEBUG14)
+  /* For compute_scores_standard.  Allocated with SSE2 only for
+     DEBUG14 or Dynprog_check_kernels. */
   Score32_T **matrix_ptrs, *matrix_space;
   Direction32_T **directions_ptrs_0, *directions_space_0;
   Direction32_T **directions_ptrs_1, *directions_space_1;
   Direction32_T **directions_ptrs_2, *directions_space_2;
-#endif
 #ifdef HAVE_SSE2
   void **aligned_matrix_ptrs, *aligned_matrix_space;
   void **aligned_directions_ptrs_0, *aligned_directions_space_0;
@@ -1131,6 +1148,35 @@ compute_maxlengths (int *max_rlength, int *max_glength,
 }
 
 
+static void
+standard_space_alloc (T this) {
+  int max_rlength = this->max_rlength, max_glength = this->max_glength;
+
+  this->matrix_ptrs = (Score32_T **) CALLOC(max_glength+1,sizeof(Score32_T *));
+  this->matrix_space = (Score32_T *) CALLOC((max_glength+1)*(max_glength+1),sizeof(Score32_T));
+  this->directions_ptrs_0 = (Direction32_T **) CALLOC(max_glength+1,sizeof(Direction32_T *));
+  this->directions_space_0 = (Direction32_T *) CALLOC((max_glength+1)*(max_rlength+1),sizeof(Direction32_T));
+  this->directions_ptrs_1 = (Direction32_T **) CALLOC(max_glength+1,sizeof(Direction32_T *));
+  this->directions_space_1 = (Direction32_T *) CALLOC((max_glength+1)*(max_rlength+1),sizeof(Direction32_T));
+  this->directions_ptrs_2 = (Direction32_T **) CALLOC(max_glength+1,sizeof(Direction32_T *));
+  this->directions_space_2 = (Direction32_T *) CALLOC((max_glength+1)*(max_rlength+1),sizeof(Direction32_T));
+  return;
+}
+
+static void
+standard_space_free (T this) {
+  FREE(this->matrix_ptrs);
+  FREE(this->matrix_space);
+  FREE(this->directions_ptrs_2);
+  FREE(this->directions_space_2);
+  FREE(this->directions_ptrs_1);
+  FREE(this->directions_space_1);
+  FREE(this->directions_ptrs_0);
+  FREE(this->directions_space_0);
+  return;
+}
+
+
 T
 Dynprog_new (int maxlookback, int extraquerygap, int maxpeelback,
 	     int extramaterial_end, int extramaterial_paired) {
@@ -1148,16 +1194,9 @@ Dynprog_new (int maxlookback, int extraquerygap, int maxpeelback,
   new->matrix3_space = (struct Int3_T *) CALLOC((max_glength+1)*(max_rlength+1),sizeof(struct Int3_T));
 #endif
 #if !defined(HAVE_SSE2) || defined(DEBUG14)
-  new->matrix_ptrs = (Score32_T **) CALLOC(max_glength+1,sizeof(Score32_T *));
-  new->matrix_space = (Score32_T *) CALLOC((max_glength+1)*(max_glength+1),sizeof(Score32_T));
-  new->directions_ptrs_0 = (Direction32_T **) CALLOC(max_glength+1,sizeof(Direction32_T *));
-  new->directions_space_0 = (Direction32_T *) CALLOC((max_glength+1)*(max_rlength+1),sizeof(Direction32_T));
-  new->directions_ptrs_1 = (Direction32_T **) CALLOC(max_glength+1,sizeof(Direction32_T *));
-  new->directions_space_1 = (Direction32_T *) CALLOC((max_glength+1)*(max_rlength+1),sizeof(Direction32_T));
-  new->directions_ptrs_2 = (Direction32_T **) CALLOC(max_glength+1,sizeof(Direction32_T *));
-  new->directions_space_2 = (Direction32_T *) CALLOC((max_glength+1)*(max_rlength+1),sizeof(Direction32_T));
-#endif
-#ifdef HAVE_SSE4_1
+  standard_space_alloc(new);
+#endif
+#ifdef USE_SIMD_8
   /* Use SIMD_NCHARS > SIMD_NSHORTS and sizeof(Score16_T) > sizeof(Score8_T) */
   new->aligned_matrix_ptrs = (void **) CALLOC(max_glength+1,sizeof(void *));
   new->aligned_matrix_space = (void *) _mm_malloc((max_glength+1)*(max_rlength+SIMD_NCHARS+SIMD_NCHARS)*sizeof(Score16_T),16);
@@ -1189,14 +1228,7 @@ Dynprog_free (T *old) {
     FREE((*old)->matrix3_space);
 #endif
 #if !defined(HAVE_SSE2) || defined(DEBUG14)
-    FREE((*old)->matrix_ptrs);
-    FREE((*old)->matrix_space);
-    FREE((*old)->directions_ptrs_2);
-    FREE((*old)->directions_space_2);
-    FREE((*old)->directions_ptrs_1);
-    FREE((*old)->directions_space_1);
-    FREE((*old)->directions_ptrs_0);
-    FREE((*old)->directions_space_0);
+    standard_space_free(*old);
 #endif
 #ifdef HAVE_SSE2
     FREE((*old)->aligned_matrix_ptrs);
@@ -1668,10 +1700,35 @@ jump_penalty_init (int maxlookback, int extraquerygap, int maxpeelback,
 
 /************************************************************************/
 
+/* Widest kernels that are compiled in and supported by this processor */
+Simd_level_T
+Dynprog_simd_level () {
+  Simd_level_T level = Cpuinfo_simd_level();
+
+#if defined(USE_AVX512)
+  return level;
+#elif defined(USE_AVX2)
+  return (level > SIMD_AVX2) ? SIMD_AVX2 : level;
+#elif defined(USE_SIMD_8)
+  return (level > SIMD_SSE4_1) ? SIMD_SSE4_1 : level;
+#elif defined(HAVE_SSE2)
+  return (level > SIMD_SSE2) ? SIMD_SSE2 : level;
+#else
+  return SIMD_NONE;
+#endif
+}
+
 void
 Dynprog_init (int maxlookback, int extraquerygap, int maxpeelback,
 	      int extramaterial_end, int extramaterial_paired, Mode_T mode) {
   pairdistance_init(mode);
+
+  simd_level = Dynprog_simd_level();
+#ifdef USE_SIMD_8
+  if (simd_level >= SIMD_SSE4_1) {
+    maxlength_epi8 = SIMD_MAXLENGTH_EPI8;
+  }
+#endif
 #if 0
   jump_penalty_init(maxlookback,extraquerygap,maxpeelback,
 		    extramaterial_end,extramaterial_paired);
@@ -2157,7 +2214,7 @@ banded_directions16_compare_Fgap (Direction16_T **directions1, Direction32_T **d
 #endif
 
 
-#ifdef HAVE_SSE4_1
+#ifdef USE_SIMD_8
 /* Makes a matrix of dimensions 0..rlength x 0..glength inclusive */
 static Score8_T **
 aligned_score8_alloc (int rlength, int glength, void **ptrs, void *space) {
@@ -2242,7 +2299,6 @@ aligned_directions16_alloc (int rlength, int glength, void **ptrs, void *space)
 #endif
 
 
-#if !defined(HAVE_SSE2) || defined(DEBUG14)
 static Score32_T **
 compute_scores_standard (Direction32_T ***directions_nogap, Direction32_T ***directions_Egap, Direction32_T ***directions_Fgap,
 			 T this, char *rsequence, char *gsequence, char *gsequence_alt, int goffset,
@@ -2700,11 +2756,170 @@ compute_scores_standard (Direction32_T ***directions_nogap, Direction32_T ***dir
 
   return matrix;
 }
+
+
+#if defined(USE_SIMD_8) && defined(USE_AVX2)
+/* Rows r..r+31 of a column, equivalent to two 128-bit blocks of
+   compute_scores_simd_8.  X_prev_nogap holds H[c-1][r-1] in its lowest
+   char, and the value for the next step is returned in the same form. */
+static inline TARGET_AVX2 __m128i
+step_simd_8_avx2 (Score8_T *score_column, Score8_T *prev_column,
+		  Direction8_T *directions_nogap, Direction8_T *directions_Egap, Score8_T *EE,
+		  Score8_T *pairscores_std_ptr, Score8_T *pairscores_alt_ptr, __m128i X_prev_nogap,
+		  __m256i v_open, __m256i v_extend, __m256i E_mask, bool jump_late_p) {
+  __m256i pairscores_std, pairscores_alt;
+  __m256i H_nogap_r, X_prev, E_r_gap, T1, dir_horiz;
+
+  E_r_gap = _mm256_loadu_si256((__m256i *) EE);
+  H_nogap_r = _mm256_loadu_si256((__m256i *) prev_column);
+
+  /* EGAP */
+  T1 = _mm256_adds_epi8(H_nogap_r, v_open);
+  if (jump_late_p) {
+    dir_horiz = _mm256_cmpgt_epi8(T1,E_r_gap); /* E < H */
+    dir_horiz = _mm256_andnot_si256(dir_horiz,_mm256_set1_epi8(-1)); /* E >= H, for jump late */
+  } else {
+    dir_horiz = _mm256_cmpgt_epi8(E_r_gap,T1); /* E > H, for jump early */
+  }
+  _mm256_storeu_si256((__m256i *) directions_Egap,dir_horiz);
+
+  E_r_gap = _mm256_max_epi8(E_r_gap, T1); /* Compare H + open with vert */
+  E_r_gap = _mm256_adds_epi8(E_r_gap, v_extend); /* Compute scores for Egap (vert + open) */
+  E_r_gap = _mm256_min_epi8(E_r_gap, E_mask); /* All MAX_CHAR unless last block */
+  _mm256_storeu_si256((__m256i *) EE, E_r_gap);
+
+  /* NOGAP.  Shift by one char across the two 128-bit lanes */
+  X_prev = _mm256_inserti128_si256(_mm256_setzero_si256(),X_prev_nogap,0);
+  X_prev_nogap = _mm_srli_si128(_mm256_extracti128_si256(H_nogap_r,1),LAST_CHAR);
+  T1 = _mm256_permute2x128_si256(H_nogap_r,H_nogap_r,0x08); /* (low lane of H) << 128 */
+  H_nogap_r = _mm256_alignr_epi8(H_nogap_r,T1,LAST_CHAR);
+  H_nogap_r = _mm256_or_si256(H_nogap_r, X_prev);
+
+  /* Add pairscores, allowing for alternate genomic nt */
+  pairscores_std = _mm256_loadu_si256((__m256i *) pairscores_std_ptr);
+  pairscores_alt = _mm256_loadu_si256((__m256i *) pairscores_alt_ptr);
+  H_nogap_r = _mm256_adds_epi8(H_nogap_r, _mm256_max_epi8(pairscores_std,pairscores_alt));
+
+  if (jump_late_p) {
+    dir_horiz = _mm256_cmpgt_epi8(H_nogap_r,E_r_gap); /* E < H */
+    dir_horiz = _mm256_andnot_si256(dir_horiz,_mm256_set1_epi8(-1)); /* E >= H, for jump late */
+  } else {
+    dir_horiz = _mm256_cmpgt_epi8(E_r_gap,H_nogap_r); /* E > H, for jump early */
+  }
+  _mm256_storeu_si256((__m256i *) directions_nogap,dir_horiz);
+
+  H_nogap_r = _mm256_max_epi8(H_nogap_r, E_r_gap); /* Compare H + pairscores with horiz + extend */
+  _mm256_storeu_si256((__m256i *) score_column, H_nogap_r);
+
+  return X_prev_nogap;
+}
+
+/* Covers as many rows from r to rhigh_ceil as fit in 32-row steps,
+   and returns the row where the 128-bit loop continues */
+static TARGET_AVX2 int
+column_simd_8_avx2 (__m128i *X_prev_nogap, int r, int rhigh, int rhigh_ceil,
+                    Score8_T *score_column, Score8_T *prev_column,
+                    Direction8_T *directions_nogap, Direction8_T *directions_Egap, Score8_T *EE,
+                    Score8_T *pairscores_std_ptr, Score8_T *pairscores_alt_ptr,
+                    Score8_T open, Score8_T extend, __m128i E_mask_bottom, bool jump_late_p) {
+  __m256i v_open, v_extend, E_mask_none, E_mask_last;
+
+  v_open = _mm256_set1_epi8(open);
+  v_extend = _mm256_set1_epi8(extend);
+  E_mask_none = _mm256_set1_epi8(MAX_CHAR);
+  E_mask_last = _mm256_inserti128_si256(E_mask_none,E_mask_bottom,1);
+
+  for ( ; r + 31 <= rhigh_ceil; r += 32) {
+    *X_prev_nogap = step_simd_8_avx2(&(score_column[r]),&(prev_column[r]),&(directions_nogap[r]),&(directions_Egap[r]),
+                                     &(EE[r-1]),&(pairscores_std_ptr[r-1]),&(pairscores_alt_ptr[r-1]),*X_prev_nogap,
+                                     v_open,v_extend,(r + 32 > rhigh) ? E_mask_last : E_mask_none,jump_late_p);
+  }
+
+  return r;
+}
 #endif
 
+#if defined(USE_SIMD_8) && defined(USE_AVX512)
+/* Rows r..r+63 of a column, equivalent to four 128-bit blocks of
+   compute_scores_simd_8 */
+static inline TARGET_AVX512 __m128i
+step_simd_8_avx512 (Score8_T *score_column, Score8_T *prev_column,
+		    Direction8_T *directions_nogap, Direction8_T *directions_Egap, Score8_T *EE,
+		    Score8_T *pairscores_std_ptr, Score8_T *pairscores_alt_ptr, __m128i X_prev_nogap,
+		    __m512i v_open, __m512i v_extend, __m512i E_mask, bool jump_late_p) {
+  __m512i pairscores_std, pairscores_alt;
+  __m512i H_nogap_r, X_prev, E_r_gap, T1;
+  __mmask64 dir_horiz;
 
-#ifdef HAVE_SSE4_1
-static Score8_T **
+  E_r_gap = _mm512_loadu_si512((__m512i *) EE);
+  H_nogap_r = _mm512_loadu_si512((__m512i *) prev_column);
+
+  /* EGAP */
+  T1 = _mm512_adds_epi8(H_nogap_r, v_open);
+  if (jump_late_p) {
+    dir_horiz = _mm512_cmpge_epi8_mask(E_r_gap,T1); /* E >= H, for jump late */
+  } else {
+    dir_horiz = _mm512_cmpgt_epi8_mask(E_r_gap,T1); /* E > H, for jump early */
+  }
+  _mm512_storeu_si512((__m512i *) directions_Egap,_mm512_movm_epi8(dir_horiz));
+
+  E_r_gap = _mm512_max_epi8(E_r_gap, T1); /* Compare H + open with vert */
+  E_r_gap = _mm512_adds_epi8(E_r_gap, v_extend); /* Compute scores for Egap (vert + open) */
+  E_r_gap = _mm512_min_epi8(E_r_gap, E_mask); /* All MAX_CHAR unless last block */
+  _mm512_storeu_si512((__m512i *) EE, E_r_gap);
+
+  /* NOGAP.  Shift by one char across the four 128-bit lanes */
+  X_prev = _mm512_inserti32x4(_mm512_setzero_si512(),X_prev_nogap,0);
+  X_prev_nogap = _mm_srli_si128(_mm512_extracti32x4_epi32(H_nogap_r,3),LAST_CHAR);
+  T1 = _mm512_alignr_epi64(H_nogap_r,_mm512_setzero_si512(),6); /* H << 128 */
+  H_nogap_r = _mm512_alignr_epi8(H_nogap_r,T1,LAST_CHAR);
+  H_nogap_r = _mm512_or_si512(H_nogap_r, X_prev);
+
+  /* Add pairscores, allowing for alternate genomic nt */
+  pairscores_std = _mm512_loadu_si512((__m512i *) pairscores_std_ptr);
+  pairscores_alt = _mm512_loadu_si512((__m512i *) pairscores_alt_ptr);
+  H_nogap_r = _mm512_adds_epi8(H_nogap_r, _mm512_max_epi8(pairscores_std,pairscores_alt));
+
+  if (jump_late_p) {
+    dir_horiz = _mm512_cmpge_epi8_mask(E_r_gap,H_nogap_r); /* E >= H, for jump late */
+  } else {
+    dir_horiz = _mm512_cmpgt_epi8_mask(E_r_gap,H_nogap_r); /* E > H, for jump early */
+  }
+  _mm512_storeu_si512((__m512i *) directions_nogap,_mm512_movm_epi8(dir_horiz));
+
+  H_nogap_r = _mm512_max_epi8(H_nogap_r, E_r_gap); /* Compare H + pairscores with horiz + extend */
+  _mm512_storeu_si512((__m512i *) score_column, H_nogap_r);
+
+  return X_prev_nogap;
+}
+
+/* Covers as many rows from r to rhigh_ceil as fit in 64-row steps,
+   and returns the row where the 128-bit loop continues */
+static TARGET_AVX512 int
+column_simd_8_avx512 (__m128i *X_prev_nogap, int r, int rhigh, int rhigh_ceil,
+                      Score8_T *score_column, Score8_T *prev_column,
+                      Direction8_T *directions_nogap, Direction8_T *directions_Egap, Score8_T *EE,
+                      Score8_T *pairscores_std_ptr, Score8_T *pairscores_alt_ptr,
+                      Score8_T open, Score8_T extend, __m128i E_mask_bottom, bool jump_late_p) {
+  __m512i v_open, v_extend, E_mask_none, E_mask_last;
+
+  v_open = _mm512_set1_epi8(open);
+  v_extend = _mm512_set1_epi8(extend);
+  E_mask_none = _mm512_set1_epi8(MAX_CHAR);
+  E_mask_last = _mm512_inserti32x4(E_mask_none,E_mask_bottom,3);
+
+  for ( ; r + 63 <= rhigh_ceil; r += 64) {
+    *X_prev_nogap = step_simd_8_avx512(&(score_column[r]),&(prev_column[r]),&(directions_nogap[r]),&(directions_Egap[r]),
+                                       &(EE[r-1]),&(pairscores_std_ptr[r-1]),&(pairscores_alt_ptr[r-1]),*X_prev_nogap,
+                                       v_open,v_extend,(r + 64 > rhigh) ? E_mask_last : E_mask_none,jump_late_p);
+  }
+
+  return r;
+}
+#endif
+
+#ifdef USE_SIMD_8
+static TARGET_SSE4_1 Score8_T **
 compute_scores_simd_8 (Direction8_T ***directions_nogap, Direction8_T ***directions_Egap, Direction8_T ***directions_Fgap,
 		       T this, char *rsequence, char *gsequence, char *gsequence_alt, int goffset,
 		       int rlength, int glength, Univcoord_T chroffset, Univcoord_T chrhigh, bool watsonp,
@@ -2939,7 +3154,24 @@ compute_scores_simd_8 (Direction8_T ***directions_nogap, Direction8_T ***directi
       }
 
 
-      for (r = rlo; r <= rhigh; r += SIMD_NCHARS) {
+      r = rlo;
+#ifdef USE_AVX512
+      if (simd_level >= SIMD_AVX512) {
+	r = column_simd_8_avx512(&X_prev_nogap,r,rhigh,rhigh_ceil,score_column,matrix[c-1],
+	                         (*directions_nogap)[c],(*directions_Egap)[c],(Score8_T *) EE,
+	                         pairscores_std_ptr,pairscores_alt_ptr,open,extend,E_mask_bottom,
+	                         /*jump_late_p*/true);
+      }
+#endif
+#ifdef USE_AVX2
+      if (simd_level >= SIMD_AVX2) {
+	r = column_simd_8_avx2(&X_prev_nogap,r,rhigh,rhigh_ceil,score_column,matrix[c-1],
+	                       (*directions_nogap)[c],(*directions_Egap)[c],(Score8_T *) EE,
+	                       pairscores_std_ptr,pairscores_alt_ptr,open,extend,E_mask_bottom,
+	                       /*jump_late_p*/true);
+      }
+#endif
+      for ( ; r <= rhigh; r += SIMD_NCHARS) {
 	/* Load previous E vector at this point in the query sequence */
 	/* H vector already loaded before loop or at bottom of loop */
 	E_r_gap = _mm_load_si128(&(EE[(r-1)/SIMD_NCHARS]));
@@ -3108,7 +3340,24 @@ compute_scores_simd_8 (Direction8_T ***directions_nogap, Direction8_T ***directi
       }
 
 
-      for (r = rlo; r <= rhigh; r += SIMD_NCHARS) {
+      r = rlo;
+#ifdef USE_AVX512
+      if (simd_level >= SIMD_AVX512) {
+	r = column_simd_8_avx512(&X_prev_nogap,r,rhigh,rhigh_ceil,score_column,matrix[c-1],
+	                         (*directions_nogap)[c],(*directions_Egap)[c],(Score8_T *) EE,
+	                         pairscores_std_ptr,pairscores_alt_ptr,open,extend,E_mask_bottom,
+	                         /*jump_late_p*/false);
+      }
+#endif
+#ifdef USE_AVX2
+      if (simd_level >= SIMD_AVX2) {
+	r = column_simd_8_avx2(&X_prev_nogap,r,rhigh,rhigh_ceil,score_column,matrix[c-1],
+	                       (*directions_nogap)[c],(*directions_Egap)[c],(Score8_T *) EE,
+	                       pairscores_std_ptr,pairscores_alt_ptr,open,extend,E_mask_bottom,
+	                       /*jump_late_p*/false);
+      }
+#endif
+      for ( ; r <= rhigh; r += SIMD_NCHARS) {
 	/* Load previous E vector at this point in the query sequence */
 	/* H vector already loaded before loop or at bottom of loop */
 	E_r_gap = _mm_load_si128(&(EE[(r-1)/SIMD_NCHARS]));
@@ -3229,6 +3478,166 @@ compute_scores_simd_8 (Direction8_T ***directions_nogap, Direction8_T ***directi
 #endif
 
 
+#ifdef USE_AVX2
+/* Rows r..r+15 of a column, equivalent to two 128-bit blocks of
+   compute_scores_simd_16.  X_prev_nogap holds H[c-1][r-1] in its lowest
+   char, and the value for the next step is returned in the same form. */
+static inline TARGET_AVX2 __m128i
+step_simd_16_avx2 (Score16_T *score_column, Score16_T *prev_column,
+		  Direction16_T *directions_nogap, Direction16_T *directions_Egap, Score16_T *EE,
+		  Score16_T *pairscores_std_ptr, Score16_T *pairscores_alt_ptr, __m128i X_prev_nogap,
+		  __m256i v_open, __m256i v_extend, __m256i E_mask, bool jump_late_p) {
+  __m256i pairscores_std, pairscores_alt;
+  __m256i H_nogap_r, X_prev, E_r_gap, T1, dir_horiz;
+
+  E_r_gap = _mm256_loadu_si256((__m256i *) EE);
+  H_nogap_r = _mm256_loadu_si256((__m256i *) prev_column);
+
+  /* EGAP */
+  T1 = _mm256_adds_epi16(H_nogap_r, v_open);
+  if (jump_late_p) {
+    dir_horiz = _mm256_cmpgt_epi16(T1,E_r_gap); /* E < H */
+    dir_horiz = _mm256_andnot_si256(dir_horiz,_mm256_set1_epi16(-1)); /* E >= H, for jump late */
+  } else {
+    dir_horiz = _mm256_cmpgt_epi16(E_r_gap,T1); /* E > H, for jump early */
+  }
+  _mm256_storeu_si256((__m256i *) directions_Egap,dir_horiz);
+
+  E_r_gap = _mm256_max_epi16(E_r_gap, T1); /* Compare H + open with vert */
+  E_r_gap = _mm256_adds_epi16(E_r_gap, v_extend); /* Compute scores for Egap (vert + open) */
+  E_r_gap = _mm256_min_epi16(E_r_gap, E_mask); /* All MAX_SHORT unless last block */
+  _mm256_storeu_si256((__m256i *) EE, E_r_gap);
+
+  /* NOGAP.  Shift by one short across the two 128-bit lanes */
+  X_prev = _mm256_inserti128_si256(_mm256_setzero_si256(),X_prev_nogap,0);
+  X_prev_nogap = _mm_srli_si128(_mm256_extracti128_si256(H_nogap_r,1),LAST_SHORT);
+  T1 = _mm256_permute2x128_si256(H_nogap_r,H_nogap_r,0x08); /* (low lane of H) << 128 */
+  H_nogap_r = _mm256_alignr_epi8(H_nogap_r,T1,LAST_SHORT);
+  H_nogap_r = _mm256_or_si256(H_nogap_r, X_prev);
+
+  /* Add pairscores, allowing for alternate genomic nt */
+  pairscores_std = _mm256_loadu_si256((__m256i *) pairscores_std_ptr);
+  pairscores_alt = _mm256_loadu_si256((__m256i *) pairscores_alt_ptr);
+  H_nogap_r = _mm256_adds_epi16(H_nogap_r, _mm256_max_epi16(pairscores_std,pairscores_alt));
+
+  if (jump_late_p) {
+    dir_horiz = _mm256_cmpgt_epi16(H_nogap_r,E_r_gap); /* E < H */
+    dir_horiz = _mm256_andnot_si256(dir_horiz,_mm256_set1_epi16(-1)); /* E >= H, for jump late */
+  } else {
+    dir_horiz = _mm256_cmpgt_epi16(E_r_gap,H_nogap_r); /* E > H, for jump early */
+  }
+  _mm256_storeu_si256((__m256i *) directions_nogap,dir_horiz);
+
+  H_nogap_r = _mm256_max_epi16(H_nogap_r, E_r_gap); /* Compare H + pairscores with horiz + extend */
+  _mm256_storeu_si256((__m256i *) score_column, H_nogap_r);
+
+  return X_prev_nogap;
+}
+
+/* Covers as many rows from r to rhigh_ceil as fit in 16-row steps,
+   and returns the row where the 128-bit loop continues */
+static TARGET_AVX2 int
+column_simd_16_avx2 (__m128i *X_prev_nogap, int r, int rhigh, int rhigh_ceil,
+                     Score16_T *score_column, Score16_T *prev_column,
+                     Direction16_T *directions_nogap, Direction16_T *directions_Egap, Score16_T *EE,
+                     Score16_T *pairscores_std_ptr, Score16_T *pairscores_alt_ptr,
+                     Score16_T open, Score16_T extend, __m128i E_mask_bottom, bool jump_late_p) {
+  __m256i v_open, v_extend, E_mask_none, E_mask_last;
+
+  v_open = _mm256_set1_epi16(open);
+  v_extend = _mm256_set1_epi16(extend);
+  E_mask_none = _mm256_set1_epi16(MAX_SHORT);
+  E_mask_last = _mm256_inserti128_si256(E_mask_none,E_mask_bottom,1);
+
+  for ( ; r + 15 <= rhigh_ceil; r += 16) {
+    *X_prev_nogap = step_simd_16_avx2(&(score_column[r]),&(prev_column[r]),&(directions_nogap[r]),&(directions_Egap[r]),
+                                      &(EE[r-1]),&(pairscores_std_ptr[r-1]),&(pairscores_alt_ptr[r-1]),*X_prev_nogap,
+                                      v_open,v_extend,(r + 16 > rhigh) ? E_mask_last : E_mask_none,jump_late_p);
+  }
+
+  return r;
+}
+#endif
+
+#ifdef USE_AVX512
+/* Rows r..r+31 of a column, equivalent to four 128-bit blocks of
+   compute_scores_simd_16 */
+static inline TARGET_AVX512 __m128i
+step_simd_16_avx512 (Score16_T *score_column, Score16_T *prev_column,
+		    Direction16_T *directions_nogap, Direction16_T *directions_Egap, Score16_T *EE,
+		    Score16_T *pairscores_std_ptr, Score16_T *pairscores_alt_ptr, __m128i X_prev_nogap,
+		    __m512i v_open, __m512i v_extend, __m512i E_mask, bool jump_late_p) {
+  __m512i pairscores_std, pairscores_alt;
+  __m512i H_nogap_r, X_prev, E_r_gap, T1;
+  __mmask32 dir_horiz;
+
+  E_r_gap = _mm512_loadu_si512((__m512i *) EE);
+  H_nogap_r = _mm512_loadu_si512((__m512i *) prev_column);
+
+  /* EGAP */
+  T1 = _mm512_adds_epi16(H_nogap_r, v_open);
+  if (jump_late_p) {
+    dir_horiz = _mm512_cmpge_epi16_mask(E_r_gap,T1); /* E >= H, for jump late */
+  } else {
+    dir_horiz = _mm512_cmpgt_epi16_mask(E_r_gap,T1); /* E > H, for jump early */
+  }
+  _mm512_storeu_si512((__m512i *) directions_Egap,_mm512_movm_epi16(dir_horiz));
+
+  E_r_gap = _mm512_max_epi16(E_r_gap, T1); /* Compare H + open with vert */
+  E_r_gap = _mm512_adds_epi16(E_r_gap, v_extend); /* Compute scores for Egap (vert + open) */
+  E_r_gap = _mm512_min_epi16(E_r_gap, E_mask); /* All MAX_SHORT unless last block */
+  _mm512_storeu_si512((__m512i *) EE, E_r_gap);
+
+  /* NOGAP.  Shift by one short across the four 128-bit lanes */
+  X_prev = _mm512_inserti32x4(_mm512_setzero_si512(),X_prev_nogap,0);
+  X_prev_nogap = _mm_srli_si128(_mm512_extracti32x4_epi32(H_nogap_r,3),LAST_SHORT);
+  T1 = _mm512_alignr_epi64(H_nogap_r,_mm512_setzero_si512(),6); /* H << 128 */
+  H_nogap_r = _mm512_alignr_epi8(H_nogap_r,T1,LAST_SHORT);
+  H_nogap_r = _mm512_or_si512(H_nogap_r, X_prev);
+
+  /* Add pairscores, allowing for alternate genomic nt */
+  pairscores_std = _mm512_loadu_si512((__m512i *) pairscores_std_ptr);
+  pairscores_alt = _mm512_loadu_si512((__m512i *) pairscores_alt_ptr);
+  H_nogap_r = _mm512_adds_epi16(H_nogap_r, _mm512_max_epi16(pairscores_std,pairscores_alt));
+
+  if (jump_late_p) {
+    dir_horiz = _mm512_cmpge_epi16_mask(E_r_gap,H_nogap_r); /* E >= H, for jump late */
+  } else {
+    dir_horiz = _mm512_cmpgt_epi16_mask(E_r_gap,H_nogap_r); /* E > H, for jump early */
+  }
+  _mm512_storeu_si512((__m512i *) directions_nogap,_mm512_movm_epi16(dir_horiz));
+
+  H_nogap_r = _mm512_max_epi16(H_nogap_r, E_r_gap); /* Compare H + pairscores with horiz + extend */
+  _mm512_storeu_si512((__m512i *) score_column, H_nogap_r);
+
+  return X_prev_nogap;
+}
+
+/* Covers as many rows from r to rhigh_ceil as fit in 32-row steps,
+   and returns the row where the 128-bit loop continues */
+static TARGET_AVX512 int
+column_simd_16_avx512 (__m128i *X_prev_nogap, int r, int rhigh, int rhigh_ceil,
+                       Score16_T *score_column, Score16_T *prev_column,
+                       Direction16_T *directions_nogap, Direction16_T *directions_Egap, Score16_T *EE,
+                       Score16_T *pairscores_std_ptr, Score16_T *pairscores_alt_ptr,
+                       Score16_T open, Score16_T extend, __m128i E_mask_bottom, bool jump_late_p) {
+  __m512i v_open, v_extend, E_mask_none, E_mask_last;
+
+  v_open = _mm512_set1_epi16(open);
+  v_extend = _mm512_set1_epi16(extend);
+  E_mask_none = _mm512_set1_epi16(MAX_SHORT);
+  E_mask_last = _mm512_inserti32x4(E_mask_none,E_mask_bottom,3);
+
+  for ( ; r + 31 <= rhigh_ceil; r += 32) {
+    *X_prev_nogap = step_simd_16_avx512(&(score_column[r]),&(prev_column[r]),&(directions_nogap[r]),&(directions_Egap[r]),
+                                        &(EE[r-1]),&(pairscores_std_ptr[r-1]),&(pairscores_alt_ptr[r-1]),*X_prev_nogap,
+                                        v_open,v_extend,(r + 32 > rhigh) ? E_mask_last : E_mask_none,jump_late_p);
+  }
+
+  return r;
+}
+#endif
+
 #ifdef HAVE_SSE2
 static Score16_T **
 compute_scores_simd_16 (Direction16_T ***directions_nogap, Direction16_T ***directions_Egap, Direction16_T ***directions_Fgap,
@@ -3457,7 +3866,24 @@ compute_scores_simd_16 (Direction16_T ***directions_nogap, Direction16_T ***dire
       }
 
 
-      for (r = rlo; r <= rhigh; r += SIMD_NSHORTS) {
+      r = rlo;
+#ifdef USE_AVX512
+      if (simd_level >= SIMD_AVX512) {
+	r = column_simd_16_avx512(&X_prev_nogap,r,rhigh,rhigh_ceil,score_column,matrix[c-1],
+	                          (*directions_nogap)[c],(*directions_Egap)[c],(Score16_T *) EE,
+	                          pairscores_std_ptr,pairscores_alt_ptr,open,extend,E_mask_bottom,
+	                          /*jump_late_p*/true);
+      }
+#endif
+#ifdef USE_AVX2
+      if (simd_level >= SIMD_AVX2) {
+	r = column_simd_16_avx2(&X_prev_nogap,r,rhigh,rhigh_ceil,score_column,matrix[c-1],
+	                        (*directions_nogap)[c],(*directions_Egap)[c],(Score16_T *) EE,
+	                        pairscores_std_ptr,pairscores_alt_ptr,open,extend,E_mask_bottom,
+	                        /*jump_late_p*/true);
+      }
+#endif
+      for ( ; r <= rhigh; r += SIMD_NSHORTS) {
 	/* Load previous E vector at this point in the query sequence */
 	/* H vector already loaded before loop or at bottom of loop */
 	E_r_gap = _mm_load_si128(&(EE[(r-1)/SIMD_NSHORTS]));
@@ -3635,7 +4061,24 @@ compute_scores_simd_16 (Direction16_T ***directions_nogap, Direction16_T ***dire
       }
 
 
-      for (r = rlo; r <= rhigh; r += SIMD_NSHORTS) {
+      r = rlo;
+#ifdef USE_AVX512
+      if (simd_level >= SIMD_AVX512) {
+	r = column_simd_16_avx512(&X_prev_nogap,r,rhigh,rhigh_ceil,score_column,matrix[c-1],
+	                          (*directions_nogap)[c],(*directions_Egap)[c],(Score16_T *) EE,
+	                          pairscores_std_ptr,pairscores_alt_ptr,open,extend,E_mask_bottom,
+	                          /*jump_late_p*/false);
+      }
+#endif
+#ifdef USE_AVX2
+      if (simd_level >= SIMD_AVX2) {
+	r = column_simd_16_avx2(&X_prev_nogap,r,rhigh,rhigh_ceil,score_column,matrix[c-1],
+	                        (*directions_nogap)[c],(*directions_Egap)[c],(Score16_T *) EE,
+	                        pairscores_std_ptr,pairscores_alt_ptr,open,extend,E_mask_bottom,
+	                        /*jump_late_p*/false);
+      }
+#endif
+      for ( ; r <= rhigh; r += SIMD_NSHORTS) {
 	/* Load previous E vector at this point in the query sequence */
 	/* H vector already loaded before loop or at bottom of loop */
 	E_r_gap = _mm_load_si128(&(EE[(r-1)/SIMD_NSHORTS]));
@@ -3764,6 +4207,346 @@ compute_scores_simd_16 (Direction16_T ***directions_nogap, Direction16_T ***dire
 #endif
 
 
+/************************************************************************
+ *   Checking the SIMD kernels against compute_scores_standard
+ ************************************************************************/
+
+#ifdef HAVE_SSE2
+#define CHECK_MAXLENGTH 300	/* Query length, at most max_rlength */
+#define CHECK_MAXEXTRA 40	/* Genomic insertions beyond the query length */
+
+#ifdef USE_SIMD_8
+/* Uses the rules of the DEBUG14 comparisons.  Scores near
+   NEG_INFINITY can saturate, and directions are compared only as DIAG
+   or not.  Egap is not checked at rhigh inside the query, and Fgap is
+   not checked at rlo below the first row. */
+static int
+check_matrix8 (Score8_T **matrix, Direction8_T **directions_nogap, Direction8_T **directions_Egap,
+	       Direction8_T **directions_Fgap, Score32_T **matrix_std, Direction32_T **directions_nogap_std,
+	       Direction32_T **directions_Egap_std, Direction32_T **directions_Fgap_std,
+	       int rlength, int glength, int lband, int uband) {
+  int nerrors = 0;
+  int r, c, rlo, rhigh;
+
+  for (c = 1; c <= glength; c++) {
+    if ((rlo = c - uband) < 1) {
+      rlo = 1;
+    }
+    if ((rhigh = c + lband) > rlength) {
+      rhigh = rlength;
+    }
+
+    for (r = rlo; r <= rhigh; r++) {
+      if (matrix[c][r] <= NEG_INFINITY_8 + 30 && matrix_std[c][r] <= NEG_INFINITY_8 + 30) {
+	/* Okay */
+      } else if (matrix[c][r] != matrix_std[c][r]) {
+	fprintf(stderr,"At %d,%d, score %d != standard %d\n",r,c,matrix[c][r],matrix_std[c][r]);
+	nerrors++;
+      }
+
+      if (matrix[c][r] < NEG_INFINITY_8 + 30) {
+	/* Don't check directions */
+      } else {
+	if ((directions_nogap[c][r] == DIAG) != (directions_nogap_std[c][r] == DIAG)) {
+	  fprintf(stderr,"At %d,%d, nogap dir %d != standard %d\n",r,c,directions_nogap[c][r],directions_nogap_std[c][r]);
+	  nerrors++;
+	}
+	if ((r < rhigh || c + lband > rlength) &&
+	    (directions_Egap[c][r] == DIAG) != (directions_Egap_std[c][r] == DIAG)) {
+	  fprintf(stderr,"At %d,%d, Egap dir %d != standard %d\n",r,c,directions_Egap[c][r],directions_Egap_std[c][r]);
+	  nerrors++;
+	}
+	if ((r > rlo || c - uband < 1) &&
+	    (directions_Fgap[c][r] == DIAG) != (directions_Fgap_std[c][r] == DIAG)) {
+	  fprintf(stderr,"At %d,%d, Fgap dir %d != standard %d\n",r,c,directions_Fgap[c][r],directions_Fgap_std[c][r]);
+	  nerrors++;
+	}
+      }
+    }
+  }
+
+  return nerrors;
+}
+#endif
+
+static int
+check_matrix16 (Score16_T **matrix, Direction16_T **directions_nogap, Direction16_T **directions_Egap,
+		Direction16_T **directions_Fgap, Score32_T **matrix_std, Direction32_T **directions_nogap_std,
+		Direction32_T **directions_Egap_std, Direction32_T **directions_Fgap_std,
+		int rlength, int glength, int lband, int uband) {
+  int nerrors = 0;
+  int r, c, rlo, rhigh;
+
+  for (c = 1; c <= glength; c++) {
+    if ((rlo = c - uband) < 1) {
+      rlo = 1;
+    }
+    if ((rhigh = c + lband) > rlength) {
+      rhigh = rlength;
+    }
+
+    for (r = rlo; r <= rhigh; r++) {
+      if (matrix[c][r] <= NEG_INFINITY_16 + 30 && matrix_std[c][r] <= NEG_INFINITY_16 + 30) {
+	/* Okay */
+      } else if (matrix[c][r] != matrix_std[c][r]) {
+	fprintf(stderr,"At %d,%d, score %d != standard %d\n",r,c,matrix[c][r],matrix_std[c][r]);
+	nerrors++;
+      }
+
+      if ((directions_nogap[c][r] == DIAG) != (directions_nogap_std[c][r] == DIAG)) {
+	fprintf(stderr,"At %d,%d, nogap dir %d != standard %d\n",r,c,directions_nogap[c][r],directions_nogap_std[c][r]);
+	nerrors++;
+      }
+      if ((r < rhigh || c + lband > rlength) &&
+	  (directions_Egap[c][r] == DIAG) != (directions_Egap_std[c][r] == DIAG)) {
+	fprintf(stderr,"At %d,%d, Egap dir %d != standard %d\n",r,c,directions_Egap[c][r],directions_Egap_std[c][r]);
+	nerrors++;
+      }
+      if ((r > rlo || c - uband < 1) &&
+	  (directions_Fgap[c][r] == DIAG) != (directions_Fgap_std[c][r] == DIAG)) {
+	fprintf(stderr,"At %d,%d, Fgap dir %d != standard %d\n",r,c,directions_Fgap[c][r],directions_Fgap_std[c][r]);
+	nerrors++;
+      }
+    }
+  }
+
+  return nerrors;
+}
+
+#ifdef USE_SIMD_8
+/* The 8-bit kernels saturate at NEG_INFINITY_8, and scores that
+   climb back from there no longer match.  A gap opened from a score
+   above the limit can still go below it. */
+static bool
+saturates_8_p (Score32_T **matrix_std, int rlength, int glength, int lband, int uband,
+	       Score32_T open, Score32_T extend) {
+  int r, c, rlo, rhigh;
+
+  for (c = 1; c <= glength; c++) {
+    if ((rlo = c - uband) < 1) {
+      rlo = 1;
+    }
+    if ((rhigh = c + lband) > rlength) {
+      rhigh = rlength;
+    }
+    for (r = rlo; r <= rhigh; r++) {
+      if (matrix_std[c][r] + open + extend < NEG_INFINITY_8) {
+	return true;
+      }
+    }
+  }
+
+  return false;
+}
+
+/* Saves the band of an 8-bit result in saved, or if comparep is true,
+   returns the number of cells that differ from the saved one */
+static int
+saved_matrix8 (Score8_T **saved, Score8_T **matrix, Direction8_T **directions_nogap,
+	       Direction8_T **directions_Egap, Direction8_T **directions_Fgap,
+	       int rlength, int glength, int lband, int uband, bool comparep) {
+  int nerrors = 0;
+  int r, c, rlo, rhigh, k;
+
+  for (c = 1; c <= glength; c++) {
+    if ((rlo = c - uband) < 1) {
+      rlo = 1;
+    }
+    if ((rhigh = c + lband) > rlength) {
+      rhigh = rlength;
+    }
+    for (r = rlo; r <= rhigh; r++) {
+      k = c*(rlength + 1) + r;
+      if (comparep == false) {
+	saved[0][k] = matrix[c][r];
+	saved[1][k] = directions_nogap[c][r];
+	saved[2][k] = directions_Egap[c][r];
+	saved[3][k] = directions_Fgap[c][r];
+      } else if (saved[0][k] != matrix[c][r] || saved[1][k] != directions_nogap[c][r] ||
+		 saved[2][k] != directions_Egap[c][r] || saved[3][k] != directions_Fgap[c][r]) {
+	fprintf(stderr,"At %d,%d, score %d and dirs %d %d %d != SSE4.1 %d and %d %d %d\n",
+		r,c,matrix[c][r],directions_nogap[c][r],directions_Egap[c][r],directions_Fgap[c][r],
+		saved[0][k],saved[1][k],saved[2][k],saved[3][k]);
+	nerrors++;
+      }
+    }
+  }
+
+  return nerrors;
+}
+#endif
+
+/* Makes a genomic segment from the query with substitutions and
+   indels, so that the alignment scores stay high */
+static int
+check_mutate (char *gsequence, char *rsequence, int rlength) {
+  int glength = 0, i = 0;
+
+  while (i < rlength && glength < CHECK_MAXLENGTH + CHECK_MAXEXTRA) {
+    switch (rand() % 20) {
+    case 0: gsequence[glength++] = "ACGT"[rand() % 4]; i++; break;
+    case 1: i++; break;
+    case 2: gsequence[glength++] = "ACGT"[rand() % 4]; break;
+    default: gsequence[glength++] = rsequence[i++];
+    }
+  }
+  if (glength == 0) {
+    gsequence[glength++] = "ACGT"[rand() % 4];
+  }
+  return glength;
+}
+#endif
+
+
+/* Aligns ntrials random query and genomic pairs with the banded
+   kernels at each SIMD level up to the one chosen by Dynprog_init,
+   and compares the scores, including the final score, and directions
+   with compute_scores_standard.  Prints each difference, and returns
+   their number. */
+int
+Dynprog_check_kernels (int ntrials) {
+  int nerrors = 0;
+#ifdef HAVE_SSE2
+  T this;
+  Simd_level_T chosen_level = simd_level;
+  char rbuffer[CHECK_MAXLENGTH], gbuffer[CHECK_MAXLENGTH + CHECK_MAXEXTRA];
+  char *rsequence, *gsequence;
+  int rlength, glength, lband, uband, extraband, trial, level, i, n;
+  int ntrials_8 = 0, ntrials_8_saturated = 0;
+  Mismatchtype_T mismatchtype;
+  Score32_T open, extend;
+  bool widebandp, jump_late_p, revp;
+  Score32_T **matrix_std;
+  Direction32_T **directions_nogap_std, **directions_Egap_std, **directions_Fgap_std;
+  Score16_T **matrix16;
+  Direction16_T **directions16_nogap, **directions16_Egap, **directions16_Fgap;
+#ifdef USE_SIMD_8
+  Score8_T **matrix8, *saved8[4];
+  Direction8_T **directions8_nogap, **directions8_Egap, **directions8_Fgap;
+  bool saturatedp;
+#endif
+
+  this = Dynprog_new(/*maxlookback*/CHECK_MAXLENGTH,/*extraquerygap*/CHECK_MAXEXTRA,/*maxpeelback*/0,
+		     /*extramaterial_end*/0,/*extramaterial_paired*/0);
+#ifndef DEBUG14
+  standard_space_alloc(this);
+#endif
+#ifdef USE_SIMD_8
+  for (i = 0; i < 4; i++) {
+    saved8[i] = (Score8_T *) MALLOC((CHECK_MAXLENGTH + CHECK_MAXEXTRA + 1)*(CHECK_MAXLENGTH + 1)*sizeof(Score8_T));
+  }
+#endif
+
+  srand(1);
+  for (trial = 0; trial < ntrials; trial++) {
+    /* Long queries for the 16-bit kernels, short ones for the 8-bit
+       kernels, and long queries against short genomic segments from
+       part of them, which use the 8-bit kernels for many rows */
+    if (trial % 3 == 0) {
+      rlength = 1 + rand() % CHECK_MAXLENGTH;
+    } else if (trial % 3 == 1) {
+      rlength = 1 + rand() % SIMD_MAXLENGTH_EPI8;
+    } else {
+      rlength = 1 + rand() % (CHECK_MAXLENGTH/2);
+    }
+    for (i = 0; i < rlength; i++) {
+      rbuffer[i] = "ACGT"[rand() % 4];
+    }
+    if (trial % 3 == 2) {
+      n = 1 + rand() % (SIMD_MAXLENGTH_EPI8 - 4);
+      i = (n < rlength) ? rand() % (rlength - n + 1) : 0;
+      glength = check_mutate(gbuffer,&(rbuffer[i]),(n < rlength) ? n : rlength);
+    } else {
+      glength = check_mutate(gbuffer,rbuffer,rlength);
+    }
+
+    mismatchtype = (Mismatchtype_T) (rand() % NMISMATCHTYPES);
+    open = (rand() % 2) ? SINGLE_OPEN_HIGHQ : PAIRED_OPEN_HIGHQ;
+    extend = (rand() % 2) ? SINGLE_EXTEND_HIGHQ : CDNA_EXTEND_HIGHQ;
+    extraband = rand() % 10;
+    widebandp = (rand() % 4) ? true : false;
+    jump_late_p = (rand() % 2) ? true : false;
+    if ((revp = (rand() % 2) ? true : false) == true) {
+      rsequence = &(rbuffer[rlength-1]);
+      gsequence = &(gbuffer[glength-1]);
+    } else {
+      rsequence = rbuffer;
+      gsequence = gbuffer;
+    }
+    compute_bands(&lband,&uband,rlength,glength,extraband,widebandp);
+
+    matrix_std = compute_scores_standard(&directions_nogap_std,&directions_Egap_std,&directions_Fgap_std,
+					 this,rsequence,gsequence,/*gsequence_alt*/gsequence,/*goffset*/0,
+					 rlength,glength,/*chroffset*/0,/*chrhigh*/0,/*watsonp*/true,mismatchtype,
+					 open,extend,lband,uband,jump_late_p,revp);
+#ifdef USE_SIMD_8
+    saturatedp = saturates_8_p(matrix_std,rlength,glength,lband,uband,open,extend);
+#endif
+
+    for (level = SIMD_SSE2; level <= (int) chosen_level; level++) {
+      simd_level = (Simd_level_T) level;
+
+      matrix16 = compute_scores_simd_16(&directions16_nogap,&directions16_Egap,&directions16_Fgap,
+					this,rsequence,gsequence,/*gsequence_alt*/gsequence,/*goffset*/0,
+					rlength,glength,/*chroffset*/0,/*chrhigh*/0,/*watsonp*/true,mismatchtype,
+					(Score16_T) open,(Score16_T) extend,lband,uband,jump_late_p,revp);
+      if ((n = check_matrix16(matrix16,directions16_nogap,directions16_Egap,directions16_Fgap,
+			      matrix_std,directions_nogap_std,directions_Egap_std,directions_Fgap_std,
+			      rlength,glength,lband,uband)) > 0) {
+	fprintf(stderr,"Trial %d: %d differences in 16-bit %s kernel (rlength %d, glength %d, lband %d, uband %d, revp %d)\n",
+		trial,n,Cpuinfo_simd_string(simd_level),rlength,glength,lband,uband,revp);
+	nerrors += n;
+      }
+
+#ifdef USE_SIMD_8
+      if (level >= SIMD_SSE4_1 && (rlength <= SIMD_MAXLENGTH_EPI8 || glength <= SIMD_MAXLENGTH_EPI8)) {
+	matrix8 = compute_scores_simd_8(&directions8_nogap,&directions8_Egap,&directions8_Fgap,
+				       this,rsequence,gsequence,/*gsequence_alt*/gsequence,/*goffset*/0,
+				       rlength,glength,/*chroffset*/0,/*chrhigh*/0,/*watsonp*/true,mismatchtype,
+				       (Score8_T) open,(Score8_T) extend,lband,uband,jump_late_p,revp);
+	if (saturatedp == false) {
+	  ntrials_8 += (level == SIMD_SSE4_1) ? 1 : 0;
+	  n = check_matrix8(matrix8,directions8_nogap,directions8_Egap,directions8_Fgap,
+			    matrix_std,directions_nogap_std,directions_Egap_std,directions_Fgap_std,
+			    rlength,glength,lband,uband);
+	} else if (level == SIMD_SSE4_1) {
+	  /* Saturated scores differ from the standard kernel, so the
+	     wider kernels are compared with the SSE4.1 kernel instead */
+	  ntrials_8_saturated++;
+	  n = saved_matrix8(saved8,matrix8,directions8_nogap,directions8_Egap,directions8_Fgap,
+			    rlength,glength,lband,uband,/*comparep*/false);
+	} else {
+	  n = saved_matrix8(saved8,matrix8,directions8_nogap,directions8_Egap,directions8_Fgap,
+			    rlength,glength,lband,uband,/*comparep*/true);
+	}
+	if (n > 0) {
+	  fprintf(stderr,"Trial %d: %d differences in 8-bit %s kernel (rlength %d, glength %d, lband %d, uband %d, revp %d)\n",
+		  trial,n,Cpuinfo_simd_string(simd_level),rlength,glength,lband,uband,revp);
+	  nerrors += n;
+	}
+      }
+#endif
+    }
+  }
+  simd_level = chosen_level;
+  fprintf(stderr,"Compared %d 16-bit and %d 8-bit alignments at each level up to %s with the standard kernel, and %d saturated 8-bit alignments with the SSE4.1 kernel: %d differences\n",
+	  ntrials,ntrials_8,Cpuinfo_simd_string(chosen_level),ntrials_8_saturated,nerrors);
+
+#ifdef USE_SIMD_8
+  for (i = 0; i < 4; i++) {
+    FREE(saved8[i]);
+  }
+#endif
+#ifndef DEBUG14
+  standard_space_free(this);
+#endif
+  Dynprog_free(&this);
+#endif
+
+  return nerrors;
+}
+
+
 #if 0
 static Score16_T **
 compute_scores (Direction16_T ***directions, Score_T ***jump, T this, 
@@ -3946,7 +4729,7 @@ compute_scores (Direction16_T ***directions, Score_T ***jump, T this,
 #endif
 
 
-#ifdef HAVE_SSE4_1
+#ifdef USE_SIMD_8
 static void
 find_best_endpoint_8 (int *finalscore, int *bestr, int *bestc, Score8_T **matrix, 
 		      int rlength, int glength, int extraband_end_or_paired,
@@ -4072,7 +4855,7 @@ find_best_endpoint (int *finalscore, int *bestr, int *bestc,
 }
 
 
-#ifdef HAVE_SSE4_1
+#ifdef USE_SIMD_8
 static void
 find_best_endpoint_to_queryend_indels_8 (int *finalscore, int *bestr, int *bestc, Score8_T **matrix, 
 					 int rlength, int glength, int extraband_end_or_paired,
@@ -4578,7 +5361,7 @@ traceback_prev (List_T pairs, int *nmatches, int *nmismatches, int *nopens, int
 #endif
 
 
-#ifdef HAVE_SSE4_1
+#ifdef USE_SIMD_8
 static List_T
 traceback_8 (List_T pairs, int *nmatches, int *nmismatches, int *nopens, int *nindels,
 	     Direction8_T **directions_nogap, Direction8_T **directions_Egap, Direction8_T **directions_Fgap,
@@ -4950,7 +5733,7 @@ traceback_nogaps (List_T pairs, int *nmatches, int *nmismatches,
 }
 
 
-#ifdef HAVE_SSE4_1
+#ifdef USE_SIMD_8
 static List_T
 traceback_local_8 (List_T pairs, int *nmatches, int *nmismatches, int *nopens, int *nindels,
 		   Direction8_T **directions_nogap, Direction8_T **directions_Egap, Direction8_T **directions_Fgap,
@@ -5314,7 +6097,7 @@ traceback_local_nogaps (List_T pairs, int *nmatches, int *nmismatches, int r, in
 #endif
 
 
-#ifdef HAVE_SSE4_1
+#ifdef USE_SIMD_8
 /* Columns are always genomic.  Rows are always query.  Bridging across common columns */
 static void
 bridge_cdna_gap_8 (int *finalscore, int *bestcL, int *bestcR, int *bestrL, int *bestrR,
@@ -5700,7 +6483,7 @@ get_splicesite_probs (double *left_prob, double *right_prob, int cL, int cR,
 }
 
 
-#ifdef HAVE_SSE4_1
+#ifdef USE_SIMD_8
 static bool
 bridge_intron_gap_8 (int *finalscore, int *bestrL, int *bestrR, int *bestcL, int *bestcR,
 		     int *best_introntype, double *left_prob, double *right_prob,
@@ -8242,7 +9025,7 @@ Dynprog_single_gap (int *dynprogindex, int *finalscore, int *nmatches, int *nmis
   Score16_T **matrix, open, extend;
   Direction16_T **directions_nogap, **directions_Egap, **directions_Fgap;
 #endif
-#ifdef HAVE_SSE4_1
+#ifdef USE_SIMD_8
   Score8_T **matrix8;
   Direction8_T **directions8_nogap, **directions8_Egap, **directions8_Fgap;
 #endif
@@ -8319,9 +9102,9 @@ Dynprog_single_gap (int *dynprogindex, int *finalscore, int *nmatches, int *nmis
 
 
   compute_bands(&lband,&uband,rlength,glength,extraband_single,widebandp);
-#ifdef HAVE_SSE4_1
+#ifdef USE_SIMD_8
   /* Use || because we want the minimum length (which determines the diagonal length) to achieve a score less than 128 */
-  if (rlength <= SIMD_MAXLENGTH_EPI8 || glength <= SIMD_MAXLENGTH_EPI8) {
+  if (rlength <= maxlength_epi8 || glength <= maxlength_epi8) {
     matrix8 = compute_scores_simd_8(&directions8_nogap,&directions8_Egap,&directions8_Fgap,dynprog,
 #ifdef PMAP
 				    inst_rsequence,
@@ -8471,7 +9254,7 @@ Dynprog_cdna_gap (int *dynprogindex, int *finalscore, bool *incompletep,
   Direction16_T **directionsL_nogap, **directionsL_Egap, **directionsL_Fgap,
     **directionsR_nogap, **directionsR_Egap, **directionsR_Fgap;
 #endif
-#ifdef HAVE_SSE4_1
+#ifdef USE_SIMD_8
   Score8_T **matrix8L, **matrix8R;
   Direction8_T **directions8L_nogap, **directions8L_Egap, **directions8L_Fgap,
     **directions8R_nogap, **directions8R_Egap, **directions8R_Fgap;
@@ -8564,9 +9347,9 @@ Dynprog_cdna_gap (int *dynprogindex, int *finalscore, bool *incompletep,
   inst_rev_rsequenceR = &(inst_rsequence[rev_roffsetR-roffsetL]);
 #endif
 
-#ifdef HAVE_SSE4_1
+#ifdef USE_SIMD_8
   /* Use || because we want the minimum length (which determines the diagonal length) to achieve a score less than 128 */
-  if (glength <= SIMD_MAXLENGTH_EPI8 || (rlengthL <= SIMD_MAXLENGTH_EPI8 && rlengthR <= SIMD_MAXLENGTH_EPI8)) {
+  if (glength <= maxlength_epi8 || (rlengthL <= maxlength_epi8 && rlengthR <= maxlength_epi8)) {
     use8p = true;
   } else {
     use8p = false;
@@ -8575,7 +9358,7 @@ Dynprog_cdna_gap (int *dynprogindex, int *finalscore, bool *incompletep,
 
 
   compute_bands(&lband,&uband,rlengthR,glength,extraband_paired,/*widebandp*/true);
-#ifdef HAVE_SSE4_1
+#ifdef USE_SIMD_8
   if (use8p == true) {
     matrix8R = compute_scores_simd_8(&directions8R_nogap,&directions8R_Egap,&directions8R_Fgap,dynprogR,
 #ifdef PMAP
@@ -8631,7 +9414,7 @@ Dynprog_cdna_gap (int *dynprogindex, int *finalscore, bool *incompletep,
 
 
   compute_bands(&lband,&uband,rlengthL,glength,extraband_paired,/*widebandp*/true);
-#ifdef HAVE_SSE4_1
+#ifdef USE_SIMD_8
   if (use8p == true) {
     matrix8L = compute_scores_simd_8(&directions8L_nogap,&directions8L_Egap,&directions8L_Fgap,dynprogL,
 #ifdef PMAP
@@ -8685,7 +9468,7 @@ Dynprog_cdna_gap (int *dynprogindex, int *finalscore, bool *incompletep,
 #endif
 
   nmatches = nmismatches = nopens = nindels = 0;
-#ifdef HAVE_SSE4_1
+#ifdef USE_SIMD_8
   if (use8p == true) {
     bridge_cdna_gap_8(&(*finalscore),&bestcL,&bestcR,&bestrL,&bestrR,matrix8L,matrix8R,
 		      glength,rlengthL,rlengthR,extraband_paired,
@@ -8717,7 +9500,7 @@ Dynprog_cdna_gap (int *dynprogindex, int *finalscore, bool *incompletep,
 		      rev_roffsetR,rev_goffset,pairpool,/*revp*/true,
 		      chroffset,chrhigh,cdna_direction,watsonp,*dynprogindex);
 
-#ifdef HAVE_SSE4_1
+#ifdef USE_SIMD_8
   }
 #endif
 
@@ -8768,7 +9551,7 @@ Dynprog_cdna_gap (int *dynprogindex, int *finalscore, bool *incompletep,
     *incompletep = true;
   }
 
-#ifdef HAVE_SSE4_1
+#ifdef USE_SIMD_8
   if (use8p == true) {
     pairs = traceback_8(pairs,&nmatches,&nmismatches,&nopens,&nindels,
 			directions8L_nogap,directions8L_Egap,directions8L_Fgap,bestrL,bestcL,
@@ -8791,7 +9574,7 @@ Dynprog_cdna_gap (int *dynprogindex, int *finalscore, bool *incompletep,
 #endif
 		      roffsetL,goffset,pairpool,/*revp*/false,
 		      chroffset,chrhigh,cdna_direction,watsonp,*dynprogindex);
-#ifdef HAVE_SSE4_1
+#ifdef USE_SIMD_8
   }
 #endif
 
@@ -8848,7 +9631,7 @@ Dynprog_genome_gap (int *dynprogindex, int *finalscore, int *new_leftgenomepos,
   Direction16_T **directionsL_nogap, **directionsL_Egap, **directionsL_Fgap,
     **directionsR_nogap, **directionsR_Egap, **directionsR_Fgap;
 #endif
-#ifdef HAVE_SSE4_1
+#ifdef USE_SIMD_8
   Score8_T **matrix8L, **matrix8R;
   Direction8_T **directions8L_nogap, **directions8L_Egap, **directions8L_Fgap,
     **directions8R_nogap, **directions8R_Egap, **directions8R_Fgap;
@@ -8992,9 +9775,9 @@ Dynprog_genome_gap (int *dynprogindex, int *finalscore, int *new_leftgenomepos,
 #endif
   rev_roffset = roffset+rlength-1;
 
-#ifdef HAVE_SSE4_1
+#ifdef USE_SIMD_8
   /* Use || because we want the minimum length (which determines the diagonal length) to achieve a score less than 128 */
-  if (rlength <= SIMD_MAXLENGTH_EPI8 || (glengthL <= SIMD_MAXLENGTH_EPI8 && glengthR <= SIMD_MAXLENGTH_EPI8)) {
+  if (rlength <= maxlength_epi8 || (glengthL <= maxlength_epi8 && glengthR <= maxlength_epi8)) {
     use8p = true;
   } else {
     use8p = false;
@@ -9002,7 +9785,7 @@ Dynprog_genome_gap (int *dynprogindex, int *finalscore, int *new_leftgenomepos,
 #endif
 
   compute_bands(&lband,&uband,rlength,glengthL,extraband_paired,/*widebandp*/true);
-#ifdef HAVE_SSE4_1
+#ifdef USE_SIMD_8
   if (use8p == true) {
     matrix8L = compute_scores_simd_8(&directions8L_nogap,&directions8L_Egap,&directions8L_Fgap,dynprogL,
 #ifdef PMAP
@@ -9056,7 +9839,7 @@ Dynprog_genome_gap (int *dynprogindex, int *finalscore, int *new_leftgenomepos,
 #endif
   
   compute_bands(&lband,&uband,rlength,glengthR,extraband_paired,/*widebandp*/true);
-#ifdef HAVE_SSE4_1
+#ifdef USE_SIMD_8
   if (use8p == true) {
     matrix8R = compute_scores_simd_8(&directions8R_nogap,&directions8R_Egap,&directions8R_Fgap,dynprogR,
 #ifdef PMAP
@@ -9109,7 +9892,7 @@ Dynprog_genome_gap (int *dynprogindex, int *finalscore, int *new_leftgenomepos,
 				    lband,uband,/*for revp true*/!jump_late_p,/*revp*/true);
 #endif
 
-#ifdef HAVE_SSE4_1
+#ifdef USE_SIMD_8
   if (use8p == true) {
     if (bridge_intron_gap_8(&(*finalscore),&bestrL,&bestrR,&bestcL,&bestcR,
 			    &(*introntype),&(*left_prob),&(*right_prob),
@@ -9175,7 +9958,7 @@ Dynprog_genome_gap (int *dynprogindex, int *finalscore, int *new_leftgenomepos,
     }
 
   } else {
-#endif  /* HAVE_SSE4_1 */
+#endif  /* USE_SIMD_8 */
 
     if (bridge_intron_gap(&(*finalscore),&bestrL,&bestrR,&bestcL,&bestcR,
 			  &(*introntype),&(*left_prob),&(*right_prob),
@@ -9239,7 +10022,7 @@ Dynprog_genome_gap (int *dynprogindex, int *finalscore, int *new_leftgenomepos,
       return List_reverse(pairs);
     }
 
-#ifdef HAVE_SSE4_1
+#ifdef USE_SIMD_8
   }
 #endif
 
@@ -9301,7 +10084,7 @@ Dynprog_end5_gap (int *dynprogindex, int *finalscore, int *nmatches, int *nmisma
   Score16_T **matrix, open, extend;
   Direction16_T **directions_nogap, **directions_Egap, **directions_Fgap;
 #endif
-#ifdef HAVE_SSE4_1
+#ifdef USE_SIMD_8
   Direction8_T **directions8_nogap, **directions8_Egap, **directions8_Fgap;
   Score8_T **matrix8;
   bool use8p = false;
@@ -9369,9 +10152,9 @@ Dynprog_end5_gap (int *dynprogindex, int *finalscore, int *nmatches, int *nmisma
 
   if (endalign == QUERYEND_GAP || endalign == BEST_LOCAL) {
     compute_bands(&lband,&uband,rlength,glength,extraband_end,/*widebandp*/true);
-#ifdef HAVE_SSE4_1
+#ifdef USE_SIMD_8
     /* Use || because we want the minimum length (which determines the diagonal length) to achieve a score less than 128 */
-    if (rlength <= SIMD_MAXLENGTH_EPI8 || glength <= SIMD_MAXLENGTH_EPI8) {
+    if (rlength <= maxlength_epi8 || glength <= maxlength_epi8) {
       use8p = true;
       matrix8 = compute_scores_simd_8(&directions8_nogap,&directions8_Egap,&directions8_Fgap,dynprog,
 #ifdef PMAP
@@ -9437,9 +10220,9 @@ Dynprog_end5_gap (int *dynprogindex, int *finalscore, int *nmatches, int *nmisma
 
   } else if (endalign == QUERYEND_INDELS) {
     compute_bands(&lband,&uband,rlength,glength,extraband_end,/*widebandp*/true);
-#ifdef HAVE_SSE4_1
+#ifdef USE_SIMD_8
     /* Use || because we want the minimum length (which determines the diagonal length) to achive a score less than 128 */
-    if (rlength <= SIMD_MAXLENGTH_EPI8 || glength <= SIMD_MAXLENGTH_EPI8) {
+    if (rlength <= maxlength_epi8 || glength <= maxlength_epi8) {
       use8p = true;
       matrix8 = compute_scores_simd_8(&directions8_nogap,&directions8_Egap,&directions8_Fgap,dynprog,
 #ifdef PMAP
@@ -9542,7 +10325,7 @@ Dynprog_end5_gap (int *dynprogindex, int *finalscore, int *nmatches, int *nmisma
 			     /*revp*/true,watsonp,*dynprogindex);
     *finalscore = (*nmatches)*FULLMATCH + (*nmismatches)*MISMATCH_ENDQ;
 
-#ifdef HAVE_SSE4_1
+#ifdef USE_SIMD_8
   } else if (use8p == true) {
     pairs = traceback_8(NULL,&(*nmatches),&(*nmismatches),&(*nopens),&(*nindels),
 			directions8_nogap,directions8_Egap,directions8_Fgap,bestr,bestc,
@@ -9624,7 +10407,7 @@ Dynprog_end5_splicejunction (int *dynprogindex, int *finalscore, int *missscore,
   Score16_T **matrix, open, extend;
   Direction16_T **directions_nogap, **directions_Egap, **directions_Fgap;
 #endif
-#ifdef HAVE_SSE4_1
+#ifdef USE_SIMD_8
   Score8_T **matrix8;
   Direction8_T **directions8_nogap, **directions8_Egap, **directions8_Fgap;
   bool use8p = false;
@@ -9692,9 +10475,9 @@ Dynprog_end5_splicejunction (int *dynprogindex, int *finalscore, int *missscore,
 #endif
 
   compute_bands(&lband,&uband,rlength,glength,extraband_end,/*widebandp*/true);
-#ifdef HAVE_SSE4_1
+#ifdef USE_SIMD_8
   /* Use || because we want the minimum length (which determines the diagonal length) to achieve a score less than 128 */
-  if (rlength <= SIMD_MAXLENGTH_EPI8 || glength <= SIMD_MAXLENGTH_EPI8) {
+  if (rlength <= maxlength_epi8 || glength <= maxlength_epi8) {
     use8p = true;
     matrix8 = compute_scores_simd_8(&directions8_nogap,&directions8_Egap,&directions8_Fgap,dynprog,
 #ifdef PMAP
@@ -9753,7 +10536,7 @@ Dynprog_end5_splicejunction (int *dynprogindex, int *finalscore, int *missscore,
 #endif
 
   *nmatches = *nmismatches = *nopens = *nindels = 0;
-#ifdef HAVE_SSE4_1
+#ifdef USE_SIMD_8
   if (use8p == true) {
     pairs = traceback_local_8(NULL,&(*nmatches),&(*nmismatches),&(*nopens),&(*nindels),
 			      directions8_nogap,directions8_Egap,directions8_Fgap,&bestr,&bestc,/*endc*/contlength,
@@ -9807,7 +10590,7 @@ Dynprog_end5_splicejunction (int *dynprogindex, int *finalscore, int *missscore,
 			    rev_gsequence,rev_gsequence_uc,rev_gsequence_alt,
 			    rev_roffset,rev_goffset_anchor,pairpool,/*revp*/true,
 			    chroffset,chrhigh,cdna_direction,watsonp,*dynprogindex);
-#ifdef HAVE_SSE4_1
+#ifdef USE_SIMD_8
   }
 #endif
 
@@ -9862,7 +10645,7 @@ Dynprog_end3_gap (int *dynprogindex, int *finalscore, int *nmatches, int *nmisma
   Score16_T **matrix, open, extend;
   Direction16_T **directions_nogap, **directions_Egap, **directions_Fgap;
 #endif
-#ifdef HAVE_SSE4_1
+#ifdef USE_SIMD_8
   Score8_T **matrix8;
   Direction8_T **directions8_nogap, **directions8_Egap, **directions8_Fgap;
   bool use8p = false;
@@ -9926,9 +10709,9 @@ Dynprog_end3_gap (int *dynprogindex, int *finalscore, int *nmatches, int *nmisma
 
   if (endalign == QUERYEND_GAP || endalign == BEST_LOCAL) {
     compute_bands(&lband,&uband,rlength,glength,extraband_end,/*widebandp*/true);
-#ifdef HAVE_SSE4_1
+#ifdef USE_SIMD_8
     /* Use || because we want the minimum length (which determines the diagonal length) to achieve a score less than 128 */
-    if (rlength <= SIMD_MAXLENGTH_EPI8 || glength <= SIMD_MAXLENGTH_EPI8) {
+    if (rlength <= maxlength_epi8 || glength <= maxlength_epi8) {
       use8p = true;
       matrix8 = compute_scores_simd_8(&directions8_nogap,&directions8_Egap,&directions8_Fgap,dynprog,
 #ifdef PMAP
@@ -9993,9 +10776,9 @@ Dynprog_end3_gap (int *dynprogindex, int *finalscore, int *nmatches, int *nmisma
 
   } else if (endalign == QUERYEND_INDELS) {
     compute_bands(&lband,&uband,rlength,glength,extraband_end,/*widebandp*/true);
-#ifdef HAVE_SSE4_1
+#ifdef USE_SIMD_8
     /* Use || because we want the minimum length (which determines the diagonal length) to achieve a score less than 128 */
-    if (rlength <= SIMD_MAXLENGTH_EPI8 || glength <= SIMD_MAXLENGTH_EPI8) {
+    if (rlength <= maxlength_epi8 || glength <= maxlength_epi8) {
       use8p = true;
       matrix8 = compute_scores_simd_8(&directions8_nogap,&directions8_Egap,&directions8_Fgap,dynprog,
 #ifdef PMAP
@@ -10096,7 +10879,7 @@ Dynprog_end3_gap (int *dynprogindex, int *finalscore, int *nmatches, int *nmisma
 			     /*revp*/false,watsonp,*dynprogindex);
     *finalscore = (*nmatches)*FULLMATCH + (*nmismatches)*MISMATCH_ENDQ;
 
-#ifdef HAVE_SSE4_1
+#ifdef USE_SIMD_8
   } else if (use8p == true) {
     pairs = traceback_8(NULL,&(*nmatches),&(*nmismatches),&(*nopens),&(*nindels),
 			directions8_nogap,directions8_Egap,directions8_Fgap,bestr,bestc,
@@ -10177,7 +10960,7 @@ Dynprog_end3_splicejunction (int *dynprogindex, int *finalscore, int *missscore,
   Score16_T **matrix, open, extend;
   Direction16_T **directions_nogap, **directions_Egap, **directions_Fgap;
 #endif
-#ifdef HAVE_SSE4_1
+#ifdef USE_SIMD_8
   Score8_T **matrix8;
   Direction8_T **directions8_nogap, **directions8_Egap, **directions8_Fgap;
   bool use8p = false;
@@ -10248,9 +11031,9 @@ Dynprog_end3_splicejunction (int *dynprogindex, int *finalscore, int *missscore,
 #endif
 
   compute_bands(&lband,&uband,rlength,glength,extraband_end,/*widebandp*/true);
-#ifdef HAVE_SSE4_1
+#ifdef USE_SIMD_8
   /* Use || because we want the minimum length (which determines the diagonal length) to achieve a score less than 128 */
-  if (rlength <= SIMD_MAXLENGTH_EPI8 || glength <= SIMD_MAXLENGTH_EPI8) {
+  if (rlength <= maxlength_epi8 || glength <= maxlength_epi8) {
     use8p = true;
     matrix8 = compute_scores_simd_8(&directions8_nogap,&directions8_Egap,&directions8_Fgap,dynprog,
 #ifdef PMAP
@@ -10311,7 +11094,7 @@ Dynprog_end3_splicejunction (int *dynprogindex, int *finalscore, int *missscore,
 #endif
 
   *nmatches = *nmismatches = *nopens = *nindels = 0;
-#ifdef HAVE_SSE4_1
+#ifdef USE_SIMD_8
   if (use8p == true) {
     pairs = traceback_local_8(NULL,&(*nmatches),&(*nmismatches),&(*nopens),&(*nindels),
 			      directions8_nogap,directions8_Egap,directions8_Fgap,&bestr,&bestc,/*endc*/contlength,
@@ -10365,7 +11148,7 @@ Dynprog_end3_splicejunction (int *dynprogindex, int *finalscore, int *missscore,
 			    gsequence,gsequence_uc,gsequence_alt,
 			    roffset,goffset_anchor,pairpool,/*revp*/false,
 			    chroffset,chrhigh,cdna_direction,watsonp,*dynprogindex);
-#ifdef HAVE_SSE4_1
+#ifdef USE_SIMD_8
   }
 #endif
 
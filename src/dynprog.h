@@ -16,6 +16,7 @@ typedef struct Dynprog_T *Dynprog_T;
 #include "splicetrie_build.h"	/* For splicetype */
 #include "genome.h"
 #include "mode.h"
+#include "cpuinfo.h"
 
 #ifdef GSNAP
 #include "compress.h"
@@ -63,9 +64,13 @@ Dynprog_pairdistance (int c1, int c2);
 
 extern void
 Dynprog_term (void);
+extern Simd_level_T
+Dynprog_simd_level ();
 extern void
 Dynprog_init (int maxlookback, int extraquerygap, int maxpeelback,
 	      int extramaterial_end, int extramaterial_paired, Mode_T mode);
+extern int
+Dynprog_check_kernels (int ntrials);
 
 extern List_T
 Dynprog_single_gap (int *dynprogindex, int *finalscore,
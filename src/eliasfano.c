@@ -0,0 +1,252 @@
+static char rcsid[] = "$Id: eliasfano.c $";
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "eliasfano.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>		/* For memset */
+
+
+#ifdef DEBUG
+#define debug(x) x
+#else
+#define debug(x)
+#endif
+
+
+/* Bits are numbered from the low end of each word, starting after the
+   first word of the block, which holds the first offset.  The block
+   then starts with a 5-bit field: either lowbits, the number of low
+   bits of each Elias-Fano value, or GAMMA_BLOCK.  Elias-Fano blocks
+   have the low bits of all values, followed by the high parts in
+   unary.  Gamma blocks have the gamma code of each difference plus
+   one. */
+#define HEADER_BITS 5
+#define GAMMA_BLOCK 31
+
+
+#ifdef HAVE_BUILTIN_POPCOUNT
+#define count_bits(x) __builtin_popcount(x)
+#else
+static inline int
+count_bits (UINT4 x) {
+  x = x - ((x >> 1) & 0x55555555);
+  x = (x & 0x33333333) + ((x >> 2) & 0x33333333);
+  x = (x + (x >> 4)) & 0x0F0F0F0F;
+  return (int) ((x * 0x01010101) >> 24);
+}
+#endif
+
+#ifdef HAVE_BUILTIN_CTZ
+#define count_trailing_zeroes(x) __builtin_ctz(x)
+#else
+static inline int
+count_trailing_zeroes (UINT4 x) {
+  int n = 0;
+
+  while ((x & 1U) == 0U) {
+    x >>= 1;
+    n++;
+  }
+  return n;
+}
+#endif
+
+
+/* Reads nbits (at most 32) starting at bitpos.  May read one word past
+   the block, so the writer pads the end of the file. */
+static inline UINT4
+get_bits (Offsetscomp_T *words, UINT4 bitpos, int nbits) {
+  UINT8 window;
+
+  if (nbits == 0) {
+    return 0U;
+  } else {
+    window = ((UINT8) words[bitpos >> 5] | ((UINT8) words[(bitpos >> 5) + 1] << 32)) >> (bitpos & 31);
+    return (UINT4) (window & (~0ULL >> (64 - nbits)));
+  }
+}
+
+static inline void
+put_bits (Offsetscomp_T *words, UINT4 bitpos, UINT8 value, int nbits) {
+  while (nbits > 0) {
+    words[bitpos >> 5] |= (UINT4) (value << (bitpos & 31));
+    value >>= (32 - (bitpos & 31));
+    nbits -= (32 - (bitpos & 31));
+    bitpos += (32 - (bitpos & 31));
+  }
+  return;
+}
+
+
+/* Number of bits after the leading one of x */
+static inline int
+gamma_length (UINT8 x) {
+  int nb = 0;
+
+  while ((x >> nb) > 1) {
+    nb++;
+  }
+  return nb;
+}
+
+
+int
+Eliasfano_encode_block (Offsetscomp_T *words, Positionsptr_T *offsets, int blocksize) {
+  UINT4 universe, value, bitpos, highpos;
+  UINT8 ef_nbits, gamma_nbits, gamma;
+  int lowbits, nb, k;
+
+  memset(words,0,ELIASFANO_MAX_BLOCK_WORDS(blocksize)*sizeof(Offsetscomp_T));
+  words[0] = offsets[0];
+  universe = offsets[blocksize] - offsets[0];
+
+  for (lowbits = 0; ((UINT8) blocksize << (lowbits + 1)) <= (UINT8) universe; lowbits++) ;
+  ef_nbits = (UINT8) blocksize*(lowbits + 1) + (universe >> lowbits);
+
+  gamma_nbits = 0;
+  for (k = 0; k < blocksize; k++) {
+    gamma_nbits += 2*gamma_length((UINT8) (offsets[k+1] - offsets[k]) + 1) + 1;
+  }
+  debug(printf("Block with universe %u: lowbits %d, %llu bits Elias-Fano, %llu bits gamma\n",
+	       universe,lowbits,ef_nbits,gamma_nbits));
+
+  if (ef_nbits <= gamma_nbits) {
+    put_bits(&(words[1]),0,lowbits,HEADER_BITS);
+    highpos = HEADER_BITS + blocksize*lowbits;
+    for (k = 0; k < blocksize; k++) {
+      value = offsets[k+1] - offsets[0];
+      put_bits(&(words[1]),HEADER_BITS + k*lowbits,value & ~(~0ULL << lowbits),lowbits);
+      bitpos = highpos + (value >> lowbits) + k;
+      words[1 + (bitpos >> 5)] |= (1U << (bitpos & 31));
+    }
+    return 1 + (int) ((HEADER_BITS + ef_nbits + 31)/32);
+
+  } else {
+    put_bits(&(words[1]),0,GAMMA_BLOCK,HEADER_BITS);
+    bitpos = HEADER_BITS;
+    for (k = 0; k < blocksize; k++) {
+      gamma = (UINT8) (offsets[k+1] - offsets[k]) + 1;
+      nb = gamma_length(gamma);
+      bitpos += nb;		/* Zeroes, then the leading one, then the rest */
+      put_bits(&(words[1]),bitpos,1 | ((gamma & ~(~0ULL << nb)) << 1),nb + 1);
+      bitpos += nb + 1;
+    }
+    return 1 + (int) ((HEADER_BITS + gamma_nbits + 31)/32);
+  }
+}
+
+
+/* Position of the first one at or after bitpos */
+static inline UINT4
+next_one (Offsetscomp_T *words, UINT4 bitpos) {
+  UINT4 window;
+
+  while ((window = get_bits(words,bitpos,32)) == 0U) {
+    bitpos += 32;
+  }
+  return bitpos + count_trailing_zeroes(window);
+}
+
+/* Position of the one with rank k (from 0) at or after bitpos */
+static inline UINT4
+select_one (Offsetscomp_T *words, UINT4 bitpos, int k) {
+  UINT4 window;
+  int n;
+
+  while ((n = count_bits(window = get_bits(words,bitpos,32))) <= k) {
+    k -= n;
+    bitpos += 32;
+  }
+  while (k-- > 0) {
+    window &= window - 1;	/* Clear lowest one */
+  }
+  return bitpos + count_trailing_zeroes(window);
+}
+
+/* Decodes gamma-coded differences, returning the offset of entry j
+   relative to the start of the block, and the next one in *end0 */
+static Positionsptr_T
+gamma_offsets (Positionsptr_T *end0, Offsetscomp_T *words, int j) {
+  Positionsptr_T cum = 0U;
+  UINT4 bitpos = HEADER_BITS;
+  int nb, k;
+
+  for (k = 0; k <= j; k++) {
+    /* The zeroes can fill a 32-bit window, which __builtin_ctz does not handle */
+    nb = (int) (next_one(words,bitpos) - bitpos);
+    bitpos += nb + 1;
+    if (k == j) {
+      *end0 = cum + (Positionsptr_T) (((1ULL << nb) | get_bits(words,bitpos,nb)) - 1);
+    } else {
+      cum += (Positionsptr_T) (((1ULL << nb) | get_bits(words,bitpos,nb)) - 1);
+    }
+    bitpos += nb;
+  }
+
+  return cum;
+}
+
+
+Positionsptr_T
+Eliasfano_offsetptr (Positionsptr_T *end0, Gammaptr_T *efptrs, Offsetscomp_T *offsetsef,
+		     Blocksize_T blocksize, Storedoligomer_T oligo) {
+  Offsetscomp_T *block, *words;
+  Positionsptr_T base, ptr0;
+  UINT4 highpos, pos;
+  int lowbits, j;
+
+  block = &(offsetsef[efptrs[oligo/blocksize]]);
+  j = oligo % blocksize;
+  base = block[0];
+  words = &(block[1]);
+
+  if ((lowbits = get_bits(words,0,HEADER_BITS)) == GAMMA_BLOCK) {
+    ptr0 = gamma_offsets(&(*end0),words,j);
+    *end0 += base;
+    return base + ptr0;
+  }
+
+  highpos = HEADER_BITS + blocksize*lowbits;
+  if (j == 0) {
+    ptr0 = base;
+    pos = next_one(words,highpos);
+  } else {
+    pos = select_one(words,highpos,j - 1);
+    ptr0 = base + (((pos - highpos - (j - 1)) << lowbits) | get_bits(words,HEADER_BITS + (j - 1)*lowbits,lowbits));
+    pos = next_one(words,pos + 1);
+  }
+  *end0 = base + (((pos - highpos - j) << lowbits) | get_bits(words,HEADER_BITS + j*lowbits,lowbits));
+
+  debug(printf("Eliasfano_offsetptr for oligo %u: block %u, entry %d, lowbits %d => %u..%u\n",
+	       oligo,oligo/blocksize,j,lowbits,ptr0,*end0));
+  return ptr0;
+}
+
+
+/* Does not need the next offset, so oligo may be the oligospace */
+Positionsptr_T
+Eliasfano_offsetptr_only (Gammaptr_T *efptrs, Offsetscomp_T *offsetsef,
+			  Blocksize_T blocksize, Storedoligomer_T oligo) {
+  Offsetscomp_T *block, *words;
+  UINT4 highpos, pos;
+  int lowbits, j;
+  Positionsptr_T end0;
+
+  block = &(offsetsef[efptrs[oligo/blocksize]]);
+  if ((j = oligo % blocksize) == 0) {
+    return block[0];
+  }
+  words = &(block[1]);
+
+  if ((lowbits = get_bits(words,0,HEADER_BITS)) == GAMMA_BLOCK) {
+    return block[0] + gamma_offsets(&end0,words,j);
+  } else {
+    highpos = HEADER_BITS + blocksize*lowbits;
+    pos = select_one(words,highpos,j - 1);
+    return block[0] + (((pos - highpos - (j - 1)) << lowbits) | get_bits(words,HEADER_BITS + (j - 1)*lowbits,lowbits));
+  }
+}
+
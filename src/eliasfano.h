@@ -0,0 +1,35 @@
+/* $Id: eliasfano.h $ */
+#ifndef ELIASFANO_INCLUDED
+#define ELIASFANO_INCLUDED
+#include "types.h"
+
+/* Alternative to the gamma-coded offsetscomp format.  Each block of
+   blocksize offsets starts at a word given by efptrs, with the first
+   offset of the block followed by the offsets of the block and the
+   first offset of the next block, relative to the first.  These are
+   Elias-Fano coded, so any one can be decoded from the block without
+   decoding the others.  Blocks that would be larger than their gamma
+   coding, because of a few very frequent oligomers, are gamma coded
+   instead. */
+
+#define EFPTRS_FILESUFFIX "efptrs"
+#define OFFSETSEF_FILESUFFIX "offsetsef"
+
+/* Enough words for any block */
+#define ELIASFANO_MAX_BLOCK_WORDS(blocksize) (2 + (blocksize)*66/32 + 1)
+
+/* Encodes offsets[0..blocksize] into words, and returns the number of
+   words used */
+extern int
+Eliasfano_encode_block (Offsetscomp_T *words, Positionsptr_T *offsets, int blocksize);
+
+extern Positionsptr_T
+Eliasfano_offsetptr (Positionsptr_T *end0, Gammaptr_T *efptrs, Offsetscomp_T *offsetsef,
+		     Blocksize_T blocksize, Storedoligomer_T oligo);
+
+extern Positionsptr_T
+Eliasfano_offsetptr_only (Gammaptr_T *efptrs, Offsetscomp_T *offsetsef,
+			  Blocksize_T blocksize, Storedoligomer_T oligo);
+
+#endif
+
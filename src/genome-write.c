@@ -20,6 +20,9 @@ static char rcsid[] = "$Id: genome-write.c 99737 2013-06-27 19:33:03Z twu $";
 #ifdef HAVE_SYS_TYPES_H
 #include <sys/types.h>		/* For off_t */
 #endif
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 
 #include "mem.h"
 #include "types.h"
@@ -165,13 +168,6 @@ fill_x (FILE *fp, Univcoord_T startpos, Univcoord_T endpos, bool uncompressedp,
   return;
 }
 
-static void
-fill_x_memory (Genomecomp_T *genomecomp, Univcoord_T startpos, Univcoord_T endpos) {
-
-  Compress_update_memory(/*nbadchars*/0,genomecomp,NULL,startpos,endpos);
-  return;
-}
-
 
 #define BUFFERSIZE 8192
 
@@ -573,7 +569,7 @@ genome_writeraw_file (FILE *refgenome_fp, FILE *input,
 
 static void
 fill_circular_chromosomes (UINT4 *genomecomp, Univ_IIT_T chromosome_iit, int circular_typeint) {
-  int indx;
+  int indx, nbadchars = 0;
   Univinterval_T interval;
   char *segment, *chr;
   Univcoord_T alias_startpos, alias_endpos, orig_startpos, orig_endpos;
@@ -600,7 +596,7 @@ fill_circular_chromosomes (UINT4 *genomecomp, Univ_IIT_T chromosome_iit, int cir
       segment = (char *) CALLOC(seglength+1U,sizeof(char));
       /* Add 1U because procedures below are expecting exclusive coordinates */
       Genome_uncompress_mmap(segment,genomecomp,orig_startpos,orig_endpos+1U);
-      Compress_update_memory(/*nbadchars*/0,genomecomp,segment,alias_startpos,alias_endpos+1U);
+      Compress_update_memory(&nbadchars,genomecomp,segment,alias_startpos,alias_endpos+1U);
       FREE(segment);
     }
   }
@@ -610,13 +606,346 @@ fill_circular_chromosomes (UINT4 *genomecomp, Univ_IIT_T chromosome_iit, int cir
 
 
 
+/************************************************************************
+ *   Compressing the genome in memory.  The reading thread collects
+ *   sequence into slices of consecutive positions, and worker threads
+ *   compress them.  A slice updates the blocks that it covers
+ *   completely without locking, and the partial blocks at its ends
+ *   under a lock, since neighboring slices share them.  A slice that
+ *   overlaps a pending one waits for it, so that later contigs
+ *   overwrite earlier ones, as when compressing serially.
+ ************************************************************************/
+
+#define SLICE_LENGTH 1048576	/* nt */
+
+typedef struct Slice_T *Slice_T;
+struct Slice_T {
+  char *buffer;			/* NULL for a slice of X's */
+  char *sequence;
+  Univcoord_T startpos;
+  Univcoord_T endpos;		/* Exclusive */
+  Slice_T next;
+};
+
+typedef struct Compressor_T *Compressor_T;
+struct Compressor_T {
+  Genomecomp_T *genomecomp;
+  int nbadchars;
+  int nworkers;			/* If 0, slices are compressed by the reading thread */
+
+  /* Slice being collected by the reading thread */
+  char *buffer;
+  Chrpos_T length;
+  bool revcompp;
+  Univcoord_T anchor;		/* Start of forward sequence, or end of reverse sequence */
+
+#ifdef HAVE_PTHREAD
+  pthread_t *workers;
+  pthread_mutex_t lock;
+  pthread_mutex_t boundary_lock;
+  pthread_cond_t slice_avail_p;
+  pthread_cond_t slice_done_p;
+  Slice_T head;			/* Queued slices */
+  Slice_T tail;
+  int nqueued;
+  Slice_T active;		/* Slices being compressed */
+  bool donep;
+#endif
+};
+
+
+/* Bad characters are counted in this->nbadchars, shared by all
+   workers, so the messages about them are limited for the whole
+   genome */
+static void
+compress_slice (Compressor_T this, Slice_T slice) {
+  Univcoord_T startpos = slice->startpos, endpos = slice->endpos, fullstart, fullend;
+  char *sequence = slice->sequence;
+
+  fullstart = (startpos + 31U)/32U*32U;
+  fullend = endpos/32U*32U;
+
+  if (fullstart >= fullend) {
+#ifdef HAVE_PTHREAD
+    pthread_mutex_lock(&this->boundary_lock);
+#endif
+    Compress_update_memory(&this->nbadchars,this->genomecomp,sequence,startpos,endpos);
+#ifdef HAVE_PTHREAD
+    pthread_mutex_unlock(&this->boundary_lock);
+#endif
+
+  } else {
+    if (startpos < fullstart) {
+#ifdef HAVE_PTHREAD
+      pthread_mutex_lock(&this->boundary_lock);
+#endif
+      Compress_update_memory(&this->nbadchars,this->genomecomp,sequence,startpos,fullstart);
+#ifdef HAVE_PTHREAD
+      pthread_mutex_unlock(&this->boundary_lock);
+#endif
+    }
+
+    Compress_update_memory(&this->nbadchars,this->genomecomp,
+			   sequence == NULL ? NULL : &(sequence[fullstart - startpos]),
+			   fullstart,fullend);
+
+    if (fullend < endpos) {
+#ifdef HAVE_PTHREAD
+      pthread_mutex_lock(&this->boundary_lock);
+#endif
+      Compress_update_memory(&this->nbadchars,this->genomecomp,
+			     sequence == NULL ? NULL : &(sequence[fullend - startpos]),
+			     fullend,endpos);
+#ifdef HAVE_PTHREAD
+      pthread_mutex_unlock(&this->boundary_lock);
+#endif
+    }
+  }
+
+  return;
+}
+
+
+#ifdef HAVE_PTHREAD
+static bool
+overlaps_pending_p (Compressor_T this, Univcoord_T startpos, Univcoord_T endpos) {
+  Slice_T slice;
+
+  for (slice = this->head; slice != NULL; slice = slice->next) {
+    if (slice->startpos < endpos && startpos < slice->endpos) {
+      return true;
+    }
+  }
+  for (slice = this->active; slice != NULL; slice = slice->next) {
+    if (slice->startpos < endpos && startpos < slice->endpos) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void *
+compressor_worker (void *data) {
+  Compressor_T this = (Compressor_T) data;
+  Slice_T slice, *p;
+
+  pthread_mutex_lock(&this->lock);
+  while (1) {
+    while (this->head == NULL && this->donep == false) {
+      pthread_cond_wait(&this->slice_avail_p,&this->lock);
+    }
+    if ((slice = this->head) == NULL) {
+      pthread_mutex_unlock(&this->lock);
+      return (void *) NULL;
+    }
+    if ((this->head = slice->next) == NULL) {
+      this->tail = NULL;
+    }
+    this->nqueued -= 1;
+    slice->next = this->active;
+    this->active = slice;
+    pthread_mutex_unlock(&this->lock);
+
+    compress_slice(this,slice);
+
+    pthread_mutex_lock(&this->lock);
+    for (p = &this->active; *p != slice; p = &((*p)->next)) ;
+    *p = slice->next;
+    pthread_cond_broadcast(&this->slice_done_p);
+
+    if (slice->buffer != NULL) {
+      FREE(slice->buffer);
+    }
+    FREE(slice);
+  }
+}
+#endif
+
+
+static Compressor_T
+Compressor_new (Genomecomp_T *genomecomp, int nworkers) {
+  Compressor_T new = (Compressor_T) MALLOC(sizeof(*new));
+#ifdef HAVE_PTHREAD
+  int i;
+#endif
+
+  new->genomecomp = genomecomp;
+  new->nbadchars = 0;
+  new->buffer = (char *) NULL;
+  new->length = 0;
+  new->revcompp = false;
+  new->anchor = 0;
+
+#ifdef HAVE_PTHREAD
+  new->nworkers = nworkers;
+  pthread_mutex_init(&new->lock,NULL);
+  pthread_mutex_init(&new->boundary_lock,NULL);
+  pthread_cond_init(&new->slice_avail_p,NULL);
+  pthread_cond_init(&new->slice_done_p,NULL);
+  new->head = new->tail = new->active = (Slice_T) NULL;
+  new->nqueued = 0;
+  new->donep = false;
+
+  if (nworkers > 0) {
+    new->workers = (pthread_t *) CALLOC(nworkers,sizeof(pthread_t));
+    for (i = 0; i < nworkers; i++) {
+      pthread_create(&(new->workers[i]),NULL,compressor_worker,(void *) new);
+    }
+  }
+#else
+  new->nworkers = 0;
+#endif
+
+  return new;
+}
+
+/* Takes ownership of buffer */
+static void
+compressor_put (Compressor_T this, char *buffer, char *sequence, Univcoord_T startpos, Univcoord_T endpos) {
+  Slice_T slice;
+
+  if (startpos >= endpos) {
+    if (buffer != NULL) {
+      FREE(buffer);
+    }
+    return;
+  }
+
+  slice = (Slice_T) MALLOC(sizeof(*slice));
+  slice->buffer = buffer;
+  slice->sequence = sequence;
+  slice->startpos = startpos;
+  slice->endpos = endpos;
+  slice->next = (Slice_T) NULL;
+
+  if (this->nworkers == 0) {
+    compress_slice(this,slice);
+    if (buffer != NULL) {
+      FREE(buffer);
+    }
+    FREE(slice);
+
+#ifdef HAVE_PTHREAD
+  } else {
+    pthread_mutex_lock(&this->lock);
+    while (this->nqueued >= 2*this->nworkers || overlaps_pending_p(this,startpos,endpos) == true) {
+      pthread_cond_wait(&this->slice_done_p,&this->lock);
+    }
+    if (this->tail == NULL) {
+      this->head = slice;
+    } else {
+      this->tail->next = slice;
+    }
+    this->tail = slice;
+    this->nqueued += 1;
+    pthread_cond_signal(&this->slice_avail_p);
+    pthread_mutex_unlock(&this->lock);
+#endif
+  }
+
+  return;
+}
+
+static void
+compressor_flush (Compressor_T this) {
+  if (this->length == 0) {
+    /* Nothing collected */
+  } else if (this->revcompp == true) {
+    compressor_put(this,this->buffer,&(this->buffer[SLICE_LENGTH - this->length]),
+		   this->anchor - this->length,this->anchor);
+    this->buffer = (char *) NULL;
+  } else {
+    compressor_put(this,this->buffer,this->buffer,this->anchor,this->anchor + this->length);
+    this->buffer = (char *) NULL;
+  }
+  this->length = 0;
+  return;
+}
+
+static void
+compressor_fill_x (Compressor_T this, Univcoord_T startpos, Univcoord_T endpos) {
+  compressor_flush(this);
+  compressor_put(this,/*buffer*/NULL,/*sequence*/NULL,startpos,endpos);
+  return;
+}
+
+/* Adds segment at startpos.  Reverse sequence arrives from the end of
+   the contig backwards, so it is collected from the end of the buffer. */
+static void
+compressor_add (Compressor_T this, char *segment, Chrpos_T length, Univcoord_T startpos, bool revcompp) {
+
+  if (this->length > 0) {
+    if (revcompp != this->revcompp || this->length + length > SLICE_LENGTH) {
+      compressor_flush(this);
+    } else if (revcompp == true && this->anchor - this->length != startpos + length) {
+      compressor_flush(this);
+    } else if (revcompp == false && this->anchor + this->length != startpos) {
+      compressor_flush(this);
+    }
+  }
+
+  if (this->length == 0) {
+    if (this->buffer == NULL) {
+      this->buffer = (char *) MALLOC(SLICE_LENGTH*sizeof(char));
+    }
+    this->revcompp = revcompp;
+    this->anchor = (revcompp == true) ? startpos + length : startpos;
+  }
+
+  if (revcompp == true) {
+    memcpy(&(this->buffer[SLICE_LENGTH - this->length - length]),segment,length*sizeof(char));
+  } else {
+    memcpy(&(this->buffer[this->length]),segment,length*sizeof(char));
+  }
+  this->length += length;
+
+  return;
+}
+
+/* Returns the number of non-ACGTNX characters */
+static int
+Compressor_finish (Compressor_T *old) {
+  int nbadchars;
+#ifdef HAVE_PTHREAD
+  int i;
+#endif
+
+  compressor_flush(*old);
+
+#ifdef HAVE_PTHREAD
+  if ((*old)->nworkers > 0) {
+    pthread_mutex_lock(&(*old)->lock);
+    (*old)->donep = true;
+    pthread_cond_broadcast(&(*old)->slice_avail_p);
+    pthread_mutex_unlock(&(*old)->lock);
+    for (i = 0; i < (*old)->nworkers; i++) {
+      pthread_join((*old)->workers[i],NULL);
+    }
+    FREE((*old)->workers);
+  }
+  pthread_cond_destroy(&(*old)->slice_done_p);
+  pthread_cond_destroy(&(*old)->slice_avail_p);
+  pthread_mutex_destroy(&(*old)->boundary_lock);
+  pthread_mutex_destroy(&(*old)->lock);
+#endif
+
+  if ((*old)->buffer != NULL) {
+    FREE((*old)->buffer);
+  }
+  nbadchars = (*old)->nbadchars;
+  FREE(*old);
+
+  return nbadchars;
+}
+
+
 /* Puts reference genome into refgenome_fp (assume compressed),
    and puts alternate strain sequences into altstrain_iit. */
 static void
 genome_write_memory (FILE *refgenome_fp, FILE *input, 
 		     Univ_IIT_T contig_iit, IIT_T altstrain_iit, 
 		     Univ_IIT_T chromosome_iit, int circular_typeint, Genomecomp_T *genomecomp,
-		     size_t nuint4, char *fileroot, int nmessages) {
+		     size_t nuint4, char *fileroot, int nmessages, int nthreads) {
   char Buffer[BUFFERSIZE], Complement[BUFFERSIZE], *segment;
   char *accession, *p;
   Univcoord_T leftposition, rightposition, startposition, endposition,
@@ -627,10 +956,11 @@ genome_write_memory (FILE *refgenome_fp, FILE *input,
 #ifdef ALTSTRAIN
   int altstrain_index, altstrain_offset;
 #endif
-  int nbadchars = 0;
+  int nbadchars;
   int ncontigs = 0;
-  size_t i;
-  
+  Compressor_T compressor;
+
+  compressor = Compressor_new(genomecomp,/*nworkers*/nthreads);
   while (fgets(Buffer,BUFFERSIZE,input) != NULL) {
     if (Buffer[0] == '>') {
       /* HEADER */
@@ -688,11 +1018,11 @@ genome_write_memory (FILE *refgenome_fp, FILE *input,
       if (startposition > maxposition) {
 	/* Start beyond end of file */
 	debug(printf("Filling with X's from %lu to %lu-1\n",maxposition,startposition));
-	fill_x_memory(genomecomp,maxposition,startposition);
+	compressor_fill_x(compressor,maxposition,startposition);
 	  
 	if (contigtype > 0) {
 #ifdef ALTSTRAIN
-	  fill_x_memory(genomecomp,leftposition,rightposition + 1);
+	  compressor_fill_x(compressor,leftposition,rightposition + 1);
 	  maxposition = currposition = rightposition + 1;
 #endif
 	} else {
@@ -706,7 +1036,7 @@ genome_write_memory (FILE *refgenome_fp, FILE *input,
 #ifdef ALTSTRAIN
 	  if (rightposition + 1 > maxposition) {
 	    debug(printf("Filling with X's from %u to %u-1\n",maxposition,rightposition+1));
-	    fill_x_memory(genomecomp,maxposition,rightposition + 1);
+	    compressor_fill_x(compressor,maxposition,rightposition + 1);
 	    maxposition = currposition = rightposition + 1;
 	  }
 #endif
@@ -749,10 +1079,10 @@ genome_write_memory (FILE *refgenome_fp, FILE *input,
 	if (revcompp == true) {
 	  debug(printf("Filling with sequence from %lu-1 to %lu\n",currposition,currposition-strlen(segment)));
 	  currposition -= strlen(segment);
-	  nbadchars = Compress_update_memory(nbadchars,genomecomp,segment,currposition,currposition+strlen(segment));
+	  compressor_add(compressor,segment,strlen(segment),currposition,/*revcompp*/true);
 	} else {
 	  debug(printf("Filling with sequence from %lu to %lu-1\n",currposition,currposition+strlen(segment)));
-	  nbadchars = Compress_update_memory(nbadchars,genomecomp,segment,currposition,currposition+strlen(segment));
+	  compressor_add(compressor,segment,strlen(segment),currposition,/*revcompp*/false);
 	  currposition += strlen(segment);
 	  if (currposition > maxposition) {
 	    maxposition = currposition;
@@ -762,6 +1092,8 @@ genome_write_memory (FILE *refgenome_fp, FILE *input,
     }
   }
 
+  nbadchars = Compressor_finish(&compressor);
+
   fill_circular_chromosomes(genomecomp,chromosome_iit,circular_typeint);
 
   move_absolute(refgenome_fp,0U);
@@ -776,7 +1108,7 @@ void
 Genome_write (char *genomesubdir, char *fileroot, FILE *input, 
 	      Univ_IIT_T contig_iit, IIT_T altstrain_iit, Univ_IIT_T chromosome_iit,
 	      bool uncompressedp, bool rawp, bool writefilep,
-	      Univcoord_T genomelength, int index1part, int nmessages) {
+	      Univcoord_T genomelength, int index1part, int nmessages, int nthreads) {
   size_t nuint4;
   FILE *refgenome_fp;
   char *filename;
@@ -847,7 +1179,7 @@ Genome_write (char *genomesubdir, char *fileroot, FILE *input,
       }
       circular_typeint = Univ_IIT_typeint(chromosome_iit,"circular");
       genome_write_memory(refgenome_fp,input,contig_iit,altstrain_iit,chromosome_iit,circular_typeint,
-			  genomecomp,nuint4,fileroot,nmessages);
+			  genomecomp,nuint4,fileroot,nmessages,nthreads);
       fclose(refgenome_fp);
       FREE(genomecomp);
     }
@@ -863,6 +1195,7 @@ Genomecomp_T *
 Genome_create_blocks (char *genomicseg, Univcoord_T genomelength) {
   Genomecomp_T *genomecomp;
   size_t nuint4;
+  int nbadchars = 0;
 
   nuint4 = ((genomelength + 31)/32U)*3;
   genomecomp = (Genomecomp_T *) CALLOC(nuint4+4,sizeof(Genomecomp_T));
@@ -879,7 +1212,7 @@ Genome_create_blocks (char *genomicseg, Univcoord_T genomelength) {
   genomecomp[nuint4+2] = 0xFFFFFFFF;
   genomecomp[nuint4+3] = 0xFFFFFFFF;
 
-  Compress_update_memory(/*nbadchars*/0,genomecomp,genomicseg,/*currposition*/0,genomelength);
+  Compress_update_memory(&nbadchars,genomecomp,genomicseg,/*currposition*/0,genomelength);
 
   return genomecomp;
 }
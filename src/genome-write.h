@@ -7,11 +7,14 @@
 #include "iit-read.h"
 #include "types.h"
 
+/* When the compressed genome is built in memory, nthreads threads
+   compress the sequence while it is read, or the reading thread
+   does if nthreads is 0 */
 extern void
 Genome_write (char *genomesubdir, char *fileroot, FILE *input, 
 	      Univ_IIT_T contig_iit, IIT_T altstrain_iit, Univ_IIT_T chromosome_iit,
 	      bool uncompressedp, bool rawp, bool writefilep,
-	      Univcoord_T genomelength, int index1part, int nmessages);
+	      Univcoord_T genomelength, int index1part, int nmessages, int nthreads);
 
 extern Genomecomp_T *
 Genome_create_blocks (char *genomicseg, Univcoord_T genomelength);
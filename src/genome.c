@@ -35,6 +35,10 @@ static char rcsid[] = "$Id: genome.c 99737 2013-06-27 19:33:03Z twu $";
 #include "genomicpos.h"		/* For Genomicpos_commafmt */
 #include "types.h"
 
+#ifdef HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
 
 #ifdef WORDS_BIGENDIAN
 #include "bigendian.h"
@@ -121,6 +125,14 @@ Genome_free (T *old) {
 	munmap((void *) (*old)->chars,(*old)->len);
       }
       close((*old)->fd);
+#endif
+#ifdef HAVE_SHM_OPEN
+    } else if ((*old)->access == SHARED) {
+      if ((*old)->compressedp == true) {
+	Access_shm_detach((void *) (*old)->blocks,(*old)->len,(*old)->fd);
+      } else {
+	Access_shm_detach((void *) (*old)->chars,(*old)->len,(*old)->fd);
+      }
 #endif
     } else if ((*old)->access == FILEIO) {
 #ifdef HAVE_PTHREAD
@@ -173,7 +185,7 @@ Genome_new (char *genomesubdir, char *fileroot, char *snps_root, bool genome_lc_
 	exit(9);
       } else {
 	comma = Genomicpos_commafmt(new->len);
-	fprintf(stderr,"done (%s bytes, %.2f sec)\n",comma,seconds);
+	fprintf(stderr,"done (%s bytes, %.2f sec, %.2f GB/s)\n",comma,seconds,Access_gbps(new->len,seconds));
 	FREE(comma);
 	new->access = ALLOCATED;
       }
@@ -188,7 +200,7 @@ Genome_new (char *genomesubdir, char *fileroot, char *snps_root, bool genome_lc_
 	new->access = FILEIO;
       } else {
 	comma = Genomicpos_commafmt(new->len);
-	fprintf(stderr,"done (%s bytes, %d pages, %.2f sec)\n",comma,npages,seconds);
+	fprintf(stderr,"done (%s bytes, %d pages, %.2f sec, %.2f GB/s)\n",comma,npages,seconds,Access_gbps(new->len,seconds));
 	FREE(comma);
 	new->access = MMAPPED;
       }
@@ -202,6 +214,29 @@ Genome_new (char *genomesubdir, char *fileroot, char *snps_root, bool genome_lc_
       }
 #endif
 
+#ifdef HAVE_SHM_OPEN
+    } else if (access == USE_SHARED) {
+      fprintf(stderr,"Attaching compressed genome in shared memory...");
+      if ((new->blocks = (Genomecomp_T *) Access_shm_load(&new->fd,&new->len,&seconds,filename,sizeof(Genomecomp_T))) != NULL) {
+	new->access = SHARED;
+      } else {
+	fprintf(stderr,"not available (will allocate private copy instead)...");
+	if ((new->blocks = (Genomecomp_T *) Access_allocated(&new->len,&seconds,filename,sizeof(Genomecomp_T))) == NULL) {
+	  fprintf(stderr,"insufficient memory (need to use a lower batch mode (-B))\n");
+	  exit(9);
+	}
+	new->access = ALLOCATED;
+      }
+      comma = Genomicpos_commafmt(new->len);
+      fprintf(stderr,"done (%s bytes, %.2f sec, %.2f GB/s)\n",comma,seconds,Access_gbps(new->len,seconds));
+      FREE(comma);
+
+    } else if (access == USE_SHARED_REMOVE) {
+      Access_shm_remove(filename,/*suffix*/NULL);
+      new->blocks = (Genomecomp_T *) NULL;
+      new->access = ALLOCATED;
+#endif
+
     } else if (access == USE_FILEIO) {
       new->blocks = (Genomecomp_T *) NULL;
       new->fd = Access_fileio(filename);
@@ -219,7 +254,7 @@ Genome_new (char *genomesubdir, char *fileroot, char *snps_root, bool genome_lc_
 	exit(9);
       } else {
 	comma = Genomicpos_commafmt(new->len);
-	fprintf(stderr,"done (%s bytes, %.2f sec)\n",comma,seconds);
+	fprintf(stderr,"done (%s bytes, %.2f sec, %.2f GB/s)\n",comma,seconds,Access_gbps(new->len,seconds));
 	FREE(comma);
 	new->access = ALLOCATED;
       }
@@ -234,7 +269,7 @@ Genome_new (char *genomesubdir, char *fileroot, char *snps_root, bool genome_lc_
 	new->access = FILEIO;
       } else {
 	comma = Genomicpos_commafmt(new->len);
-	fprintf(stderr,"done (%s bytes, %d pages, %.2f sec)\n",comma,npages,seconds);
+	fprintf(stderr,"done (%s bytes, %d pages, %.2f sec, %.2f GB/s)\n",comma,npages,seconds,Access_gbps(new->len,seconds));
 	FREE(comma);
 	new->access = MMAPPED;
       }
@@ -249,6 +284,29 @@ Genome_new (char *genomesubdir, char *fileroot, char *snps_root, bool genome_lc_
       }
 #endif
 
+#ifdef HAVE_SHM_OPEN
+    } else if (access == USE_SHARED) {
+      fprintf(stderr,"Attaching uncompressed genome in shared memory...");
+      if ((new->chars = (char *) Access_shm_load(&new->fd,&new->len,&seconds,filename,sizeof(char))) != NULL) {
+	new->access = SHARED;
+      } else {
+	fprintf(stderr,"not available (will allocate private copy instead)...");
+	if ((new->chars = (char *) Access_allocated(&new->len,&seconds,filename,sizeof(char))) == NULL) {
+	  fprintf(stderr,"insufficient memory (need to use a lower batch mode (-B))\n");
+	  exit(9);
+	}
+	new->access = ALLOCATED;
+      }
+      comma = Genomicpos_commafmt(new->len);
+      fprintf(stderr,"done (%s bytes, %.2f sec, %.2f GB/s)\n",comma,seconds,Access_gbps(new->len,seconds));
+      FREE(comma);
+
+    } else if (access == USE_SHARED_REMOVE) {
+      Access_shm_remove(filename,/*suffix*/NULL);
+      new->chars = (char *) NULL;
+      new->access = ALLOCATED;
+#endif
+
     } else if (access == USE_FILEIO) {
       new->chars = (char *) NULL;
       new->fd = Access_fileio(filename);
@@ -372,6 +430,7 @@ Genome_replace_x (void) {
 #endif
 
 
+#ifndef HAVE_SSE2
 static const char *nucleotides[65536] =
 {"AAAAAAAA","CAAAAAAA","GAAAAAAA","TAAAAAAA","ACAAAAAA","CCAAAAAA","GCAAAAAA","TCAAAAAA",
  "AGAAAAAA","CGAAAAAA","GGAAAAAA","TGAAAAAA","ATAAAAAA","CTAAAAAA","GTAAAAAA","TTAAAAAA",
@@ -8565,6 +8624,102 @@ static const char *nucleotides[65536] =
  "AGGTTTTT","CGGTTTTT","GGGTTTTT","TGGTTTTT","ATGTTTTT","CTGTTTTT","GTGTTTTT","TTGTTTTT",
  "AATTTTTT","CATTTTTT","GATTTTTT","TATTTTTT","ACTTTTTT","CCTTTTTT","GCTTTTTT","TCTTTTTT",
  "AGTTTTTT","CGTTTTTT","GGTTTTTT","TGTTTTTT","ATTTTTTT","CTTTTTTT","GTTTTTTT","TTTTTTTT"};
+#endif
+
+
+#ifdef HAVE_SSE2
+/* Returns bytes that are 0xFF where bit 2i (bit0) or bit 2i+1 (bit1)
+   of word is set, for the 16 bases in word */
+static inline void
+spread_base_bits (__m128i *bit0, __m128i *bit1, Genomecomp_T word) {
+  __m128i v, mask0, mask1;
+
+  mask0 = _mm_set_epi8(0x40,0x10,0x04,0x01, 0x40,0x10,0x04,0x01, 0x40,0x10,0x04,0x01, 0x40,0x10,0x04,0x01);
+  mask1 = _mm_slli_epi16(mask0,1);
+
+  v = _mm_cvtsi32_si128((int) word);
+  v = _mm_unpacklo_epi8(v,v);
+  v = _mm_unpacklo_epi16(v,v);	/* Byte i holds byte i/4 of word */
+
+  *bit0 = _mm_cmpeq_epi8(_mm_and_si128(v,mask0),mask0);
+  *bit1 = _mm_cmpeq_epi8(_mm_and_si128(v,mask1),mask1);
+  return;
+}
+
+/* Expands 16 bases to A, C, G, T, or N where flags (low 16 bits) are set */
+static inline __m128i
+uncompress_word (Genomecomp_T word, Genomecomp_T flags) {
+  __m128i bit0, bit1, chars, nmask, mask;
+
+  spread_base_bits(&bit0,&bit1,word);
+  /* 'A' = 65, 'C' = 'A' + 2, 'G' = 'A' + 6, and 'T' = 'A' + 2 + 6 + 11 */
+  chars = _mm_add_epi8(_mm_set1_epi8('A'),_mm_and_si128(bit0,_mm_set1_epi8(2)));
+  chars = _mm_add_epi8(chars,_mm_and_si128(bit1,_mm_set1_epi8(6)));
+  chars = _mm_add_epi8(chars,_mm_and_si128(_mm_and_si128(bit0,bit1),_mm_set1_epi8(11)));
+
+  mask = _mm_set_epi8(-128,0x40,0x20,0x10,0x08,0x04,0x02,0x01, -128,0x40,0x20,0x10,0x08,0x04,0x02,0x01);
+  nmask = _mm_cvtsi32_si128((int) flags);
+  nmask = _mm_unpacklo_epi8(nmask,nmask);
+  nmask = _mm_unpacklo_epi16(nmask,nmask);
+  nmask = _mm_unpacklo_epi32(nmask,nmask);	/* Byte i holds byte i/8 of flags */
+  nmask = _mm_cmpeq_epi8(_mm_and_si128(nmask,mask),mask);
+
+  return _mm_or_si128(_mm_and_si128(nmask,_mm_set1_epi8('N')),_mm_andnot_si128(nmask,chars));
+}
+#endif
+
+
+/* Writes the 32 characters of a block, with N where flags are set */
+static inline void
+uncompress_block (char *Buffer, Genomecomp_T high, Genomecomp_T low, Genomecomp_T flags) {
+#ifdef HAVE_SSE2
+  _mm_storeu_si128((__m128i *) Buffer,uncompress_word(low,flags & 0x0000FFFF));
+  _mm_storeu_si128((__m128i *) &(Buffer[16]),uncompress_word(high,flags >> 16));
+#else
+  int i;
+
+  memcpy(Buffer,nucleotides[low & 0x0000FFFF],8);
+  memcpy(&(Buffer[8]),nucleotides[low >> 16],8);
+  memcpy(&(Buffer[16]),nucleotides[high & 0x0000FFFF],8);
+  memcpy(&(Buffer[24]),nucleotides[high >> 16],8);
+  if (flags) {
+    for (i = 0; i < 32; i++) {
+      if (flags & 1U) {
+	Buffer[i] = 'N';
+      }
+      flags >>= 1;
+    }
+  }
+#endif
+  return;
+}
+
+/* Writes the 32 nucleotides of a block as values 0..3 */
+static inline void
+uncompress_block_nucleotides (unsigned char *gbuffer, Genomecomp_T high, Genomecomp_T low) {
+#ifdef HAVE_SSE2
+  __m128i bit0, bit1, one, two;
+
+  one = _mm_set1_epi8(1);
+  two = _mm_set1_epi8(2);
+  spread_base_bits(&bit0,&bit1,low);
+  _mm_storeu_si128((__m128i *) gbuffer,_mm_or_si128(_mm_and_si128(bit0,one),_mm_and_si128(bit1,two)));
+  spread_base_bits(&bit0,&bit1,high);
+  _mm_storeu_si128((__m128i *) &(gbuffer[16]),_mm_or_si128(_mm_and_si128(bit0,one),_mm_and_si128(bit1,two)));
+#else
+  int i;
+
+  for (i = 0; i < 16; i++) {
+    gbuffer[i] = (unsigned char) (low & 0x03);
+    low >>= 2;
+  }
+  for ( ; i < 32; i++) {
+    gbuffer[i] = (unsigned char) (high & 0x03);
+    high >>= 2;
+  }
+#endif
+  return;
+}
  
 
 
@@ -8918,7 +9073,7 @@ Genome_uncompress_mmap (char *gbuffer1, Genomecomp_T *blocks, Univcoord_T startp
   Univcoord_T startblock, endblock, ptr;
   Genomecomp_T high, low, flags;
   char Buffer[32];
-  int startdiscard, enddiscard, i, k;
+  int startdiscard, enddiscard, k;
 
   /* sequence = (char *) CALLOC(length+1,sizeof(char)); */
 
@@ -8937,18 +9092,7 @@ Genome_uncompress_mmap (char *gbuffer1, Genomecomp_T *blocks, Univcoord_T startp
     high = blocks[ptr]; low = blocks[ptr+1]; flags = blocks[ptr+2];
 #endif
 
-    memcpy(Buffer,nucleotides[low & 0x0000FFFF],8);
-    memcpy(&(Buffer[8]),nucleotides[low >> 16],8);
-    memcpy(&(Buffer[16]),nucleotides[high & 0x0000FFFF],8);
-    memcpy(&(Buffer[24]),nucleotides[high >> 16],8);
-    if (flags) {
-      for (i = 0; i < 32; i++) {
-	if (flags & 1U) {
-	  Buffer[i] = 'N';
-	}
-	flags >>= 1;
-      }
-    }
+    uncompress_block(Buffer,high,low,flags);
     memcpy(gbuffer1,&(Buffer[startdiscard]),(enddiscard - startdiscard));
 
   } else {
@@ -8960,18 +9104,7 @@ Genome_uncompress_mmap (char *gbuffer1, Genomecomp_T *blocks, Univcoord_T startp
     high = blocks[ptr]; low = blocks[ptr+1]; flags = blocks[ptr+2];
 #endif
 
-    memcpy(Buffer,nucleotides[low & 0x0000FFFF],8);
-    memcpy(&(Buffer[8]),nucleotides[low >> 16],8);
-    memcpy(&(Buffer[16]),nucleotides[high & 0x0000FFFF],8);
-    memcpy(&(Buffer[24]),nucleotides[high >> 16],8);
-    if (flags) {
-      for (i = 0; i < 32; i++) {
-	if (flags & 1U) {
-	  Buffer[i] = 'N';
-	}
-	flags >>= 1;
-      }
-    }
+    uncompress_block(Buffer,high,low,flags);
     memcpy(gbuffer1,&(Buffer[startdiscard]),k = 32 - startdiscard);
     ptr += 3;
       
@@ -8984,18 +9117,7 @@ Genome_uncompress_mmap (char *gbuffer1, Genomecomp_T *blocks, Univcoord_T startp
       high = blocks[ptr]; low = blocks[ptr+1]; flags = blocks[ptr+2];
 #endif
 
-      memcpy(&(gbuffer1[k]),nucleotides[low & 0x0000FFFF],8); k += 8;
-      memcpy(&(gbuffer1[k]),nucleotides[low >> 16],8); k += 8;
-      memcpy(&(gbuffer1[k]),nucleotides[high & 0x0000FFFF],8); k += 8;
-      memcpy(&(gbuffer1[k]),nucleotides[high >> 16],8); k += 8;
-      if (flags) {
-	for (i = k - 32; i < k; i++) {
-	  if (flags & 1U) {
-	    gbuffer1[i] = 'N';
-	  }
-	  flags >>= 1;
-	}
-      }
+      uncompress_block(&(gbuffer1[k]),high,low,flags); k += 32;
       ptr += 3;
     }
 
@@ -9008,18 +9130,7 @@ Genome_uncompress_mmap (char *gbuffer1, Genomecomp_T *blocks, Univcoord_T startp
       high = blocks[ptr]; low = blocks[ptr+1]; flags = blocks[ptr+2];
 #endif
 
-      memcpy(Buffer,nucleotides[low & 0x0000FFFF],8);
-      memcpy(&(Buffer[8]),nucleotides[low >> 16],8);
-      memcpy(&(Buffer[16]),nucleotides[high & 0x0000FFFF],8);
-      memcpy(&(Buffer[24]),nucleotides[high >> 16],8);
-      if (flags) {
-	for (i = 0; i < 32; i++) {
-	  if (flags & 1U) {
-	    Buffer[i] = 'N';
-	  }
-	  flags >>= 1;
-	}
-      }
+      uncompress_block(Buffer,high,low,flags);
       memcpy(&(gbuffer1[k]),Buffer,enddiscard);
     }
   }
@@ -9036,7 +9147,7 @@ uncompress_mmap_snps_subst (char *gbuffer1, Genomecomp_T *refblocks, Genomecomp_
   Univcoord_T startblock, endblock, ptr;
   Genomecomp_T althigh, altlow, refflags;
   char Buffer[32];
-  int startdiscard, enddiscard, i, k, k1;
+  int startdiscard, enddiscard, k;
 
   /* sequence = (char *) CALLOC(length+1,sizeof(char)); */
 
@@ -9055,27 +9166,7 @@ uncompress_mmap_snps_subst (char *gbuffer1, Genomecomp_T *refblocks, Genomecomp_
     althigh = altblocks[ptr]; altlow = altblocks[ptr+1]; refflags = refblocks[ptr+2];
 #endif
 
-    memcpy(Buffer,nucleotides[altlow & 0x0000FFFF],8);
-    memcpy(&(Buffer[8]),nucleotides[altlow >> 16],8);
-    memcpy(&(Buffer[16]),nucleotides[althigh & 0x0000FFFF],8);
-    memcpy(&(Buffer[24]),nucleotides[althigh >> 16],8);
-
-    if (refflags) {
-      for (i = 0; i < 16; i++) {
-	if (refflags & 1U) {
-	  Buffer[i] = 'N';
-	}
-	altlow >>= 2;
-	refflags >>= 1;
-      }
-      for ( ; i < 32; i++) {
-	if (refflags & 1U) {
-	  Buffer[i] = 'N';
-	}
-	althigh >>= 2;
-	refflags >>= 1;
-      }
-    }
+    uncompress_block(Buffer,althigh,altlow,refflags);
     memcpy(gbuffer1,&(Buffer[startdiscard]),(enddiscard - startdiscard));
 
   } else {
@@ -9087,27 +9178,7 @@ uncompress_mmap_snps_subst (char *gbuffer1, Genomecomp_T *refblocks, Genomecomp_
     althigh = altblocks[ptr]; altlow = altblocks[ptr+1]; refflags = refblocks[ptr+2];
 #endif
 
-    memcpy(Buffer,nucleotides[altlow & 0x0000FFFF],8);
-    memcpy(&(Buffer[8]),nucleotides[altlow >> 16],8);
-    memcpy(&(Buffer[16]),nucleotides[althigh & 0x0000FFFF],8);
-    memcpy(&(Buffer[24]),nucleotides[althigh >> 16],8);
-
-    if (refflags) {
-      for (i = 0; i < 16; i++) {
-	if (refflags & 1U) {
-	  Buffer[i] = 'N';
-	}
-	altlow >>= 2;
-	refflags >>= 1;
-      }
-      for ( ; i < 32; i++) {
-	if (refflags & 1U) {
-	  Buffer[i] = 'N';
-	}
-	althigh >>= 2;
-	refflags >>= 1;
-      }
-    }
+    uncompress_block(Buffer,althigh,altlow,refflags);
     memcpy(gbuffer1,&(Buffer[startdiscard]),k = 32 - startdiscard);
     ptr += 3;
       
@@ -9120,28 +9191,7 @@ uncompress_mmap_snps_subst (char *gbuffer1, Genomecomp_T *refblocks, Genomecomp_
       althigh = altblocks[ptr]; altlow = altblocks[ptr+1]; refflags = refblocks[ptr+2];
 #endif
 
-      memcpy(&(gbuffer1[k]),nucleotides[altlow & 0x0000FFFF],8); k += 8;
-      memcpy(&(gbuffer1[k]),nucleotides[altlow >> 16],8); k += 8;
-      memcpy(&(gbuffer1[k]),nucleotides[althigh & 0x0000FFFF],8); k += 8;
-      memcpy(&(gbuffer1[k]),nucleotides[althigh >> 16],8); k += 8;
-
-      if (refflags) {
-	k1 = k - 32;
-	for (i = 0; i < 16; i++, k1++) {
-	  if (refflags & 1U) {
-	    gbuffer1[k1] = 'N';
-	  }
-	  altlow >>= 2;
-	  refflags >>= 1;
-	}
-	for ( ; i < 32; i++, k1++) {
-	  if (refflags & 1U) {
-	    gbuffer1[k1] = 'N';
-	  }
-	  althigh >>= 2;
-	  refflags >>= 1;
-	}
-      }
+      uncompress_block(&(gbuffer1[k]),althigh,altlow,refflags); k += 32;
       ptr += 3;
     }
 
@@ -9154,27 +9204,7 @@ uncompress_mmap_snps_subst (char *gbuffer1, Genomecomp_T *refblocks, Genomecomp_
       althigh = altblocks[ptr]; altlow = altblocks[ptr+1]; refflags = refblocks[ptr+2];
 #endif
 
-      memcpy(Buffer,nucleotides[altlow & 0x0000FFFF],8);
-      memcpy(&(Buffer[8]),nucleotides[altlow >> 16],8);
-      memcpy(&(Buffer[16]),nucleotides[althigh & 0x0000FFFF],8);
-      memcpy(&(Buffer[24]),nucleotides[althigh >> 16],8);
-
-      if (refflags) {
-	for (i = 0; i < 16; i++) {
-	  if (refflags & 1U) {
-	    Buffer[i] = 'N';
-	  }
-	  altlow >>= 2;
-	  refflags >>= 1;
-	}
-	for ( ; i < 32; i++) {
-	  if (refflags & 1U) {
-	    Buffer[i] = 'N';
-	  }
-	  althigh >>= 2;
-	  refflags >>= 1;
-	}
-      }
+      uncompress_block(Buffer,althigh,altlow,refflags);
       memcpy(&(gbuffer1[k]),Buffer,enddiscard);
     }
   }
@@ -9838,14 +9868,8 @@ uncompress_mmap_nucleotides (unsigned char *gbuffer, Genomecomp_T *blocks, Univc
 #else
       high = blocks[ptr]; low = blocks[ptr+1];
 #endif
-      for (i = 0; i < 16; i++) {
-	gbuffer[k++] = (unsigned char) (low & 0x03);
-	low >>= 2;
-      }
-      for ( ; i < 32; i++) {
-	gbuffer[k++] = (unsigned char) (high & 0x03);
-	high >>= 2;
-      }
+      uncompress_block_nucleotides(&(gbuffer[k]),high,low);
+      k += 32;
 
       /* printf("Block %d assigned up to %d\n",ptr,k); */
       ptr += 3;
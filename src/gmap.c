@@ -44,6 +44,7 @@ static char rcsid[] = "$Id: gmap.c 104798 2013-08-14 00:53:57Z twu $";
 #include "stage1.h"
 #include "gregion.h"
 #include "oligoindex_hr.h"	/* For Oligoindex_hr_setup */
+#include "cpuinfo.h"
 #include "stage2.h"
 #include "splicetrie.h"
 #include "dynprog.h"
@@ -243,6 +244,9 @@ static int part_interval = 1;
 static int min_matches;
 static Access_mode_T offsetscomp_access = USE_ALLOCATE;
 static bool expand_offsets_p = false;
+static bool shared_memory_p = false;
+static bool shared_memory_loader_p = false;
+static bool shared_memory_remove_p = false;
 
 #ifdef HAVE_MMAP
 static Access_mode_T positions_access = USE_MMAP_PRELOAD;
@@ -275,7 +279,7 @@ static bool literalrefp = false;
 
 static bool altstrainp = false;
 #ifdef HAVE_PTHREAD
-static pthread_t output_thread_id, *worker_thread_ids;
+static pthread_t output_thread_id, input_thread_id, *worker_thread_ids;
 static int nworkers = 1;	/* (int) sysconf(_SC_NPROCESSORS_ONLN) */
 #endif
 #ifndef PMAP
@@ -430,6 +434,7 @@ static struct option long_options[] = {
   {"batch", required_argument, 0, 'B'}, /* offsetscomp_access, positions_access, genome_access */
 #endif
   {"expand-offsets", required_argument, 0, 0}, /* expand_offsets_p */
+  {"shared-memory", required_argument, 0, 0}, /* shared_memory_p, shared_memory_loader_p, shared_memory_remove_p */
   {"min-intronlength", required_argument, 0, 0}, /* min_intronlength */
   {"intronlength", required_argument, 0, 'K'}, /* maxintronlen_bound */
   {"totallength", required_argument, 0, 'L'}, /* maxtotallen_bound */
@@ -539,6 +544,7 @@ static struct option long_options[] = {
   /* Help options */
   {"version", no_argument, 0, 0}, /* print_program_version */
   {"help", no_argument, 0, 0}, /* print_program_usage */
+  {"check-dynprog", required_argument, 0, 0}, /* Dynprog_check_kernels, hidden, for make check */
   {0, 0, 0, 0}
 };
 
@@ -631,6 +637,10 @@ print_program_version () {
   fprintf(stdout," AVX");
 #endif
   fprintf(stdout,"\n");
+  fprintf(stdout,"SIMD functions on this processor: %s%s\n",
+	  Cpuinfo_simd_string(Cpuinfo_simd_level()),Cpuinfo_popcnt_p() == true ? " popcount" : "");
+  fprintf(stdout,"SIMD kernels chosen at run time: dynprog %s, oligoindex %s\n",
+	  Cpuinfo_simd_string(Dynprog_simd_level()),Cpuinfo_simd_string(Oligoindex_hr_simd_level()));
 
 
 #ifdef PMAP
@@ -664,6 +674,8 @@ check_compiler_assumptions () {
   __m128i a;
 #endif
 
+  Cpuinfo_check_build();
+
   fprintf(stderr,"Checking compiler assumptions for popcnt: ");
   fprintf(stderr,"%08X ",x);
 #ifdef HAVE_BUILTIN_CLZ
@@ -4066,6 +4078,13 @@ main (int argc, char *argv[]) {
       } else if (!strcmp(long_name,"help")) {
 	print_program_usage();
 	exit(0);
+      } else if (!strcmp(long_name,"check-dynprog")) {
+	Dynprog_init(nullgap,EXTRAQUERYGAP,maxpeelback,extramaterial_end,extramaterial_paired,mode);
+	if (Dynprog_check_kernels(atoi(check_valid_int(optarg))) > 0) {
+	  exit(9);
+	} else {
+	  exit(0);
+	}
 
       } else if (!strcmp(long_name,"expand-offsets")) {
 	if (!strcmp(optarg,"1")) {
@@ -4077,6 +4096,25 @@ main (int argc, char *argv[]) {
 	  exit(9);
 	}
 
+      } else if (!strcmp(long_name,"shared-memory")) {
+#ifdef HAVE_SHM_OPEN
+	if (!strcmp(optarg,"use")) {
+	  shared_memory_loader_p = false;
+	} else if (!strcmp(optarg,"load")) {
+	  shared_memory_loader_p = true;
+	} else if (!strcmp(optarg,"remove")) {
+	  shared_memory_loader_p = true;
+	  shared_memory_remove_p = true;
+	} else {
+	  fprintf(stderr,"--shared-memory must be use, load, or remove\n");
+	  exit(9);
+	}
+	shared_memory_p = true;
+#else
+	fprintf(stderr,"--shared-memory is not available, since this program was built without shm_open\n");
+	exit(9);
+#endif
+
       } else if (!strcmp(long_name,"basesize")) {
 	required_basesize = atoi(check_valid_int(optarg));
 
@@ -4745,7 +4783,12 @@ main (int argc, char *argv[]) {
 
   } else {
     /* Open input stream and peek at first char */
-    if (user_pairalign_p == true) {
+    if (shared_memory_loader_p == true) {
+      /* Loading or removing shared memory segments reads no input */
+      input = NULL;
+      files = (char **) NULL;
+      nfiles = 0;
+    } else if (user_pairalign_p == true) {
       input = stdin;
       files = (char **) NULL;
       nfiles = 0;
@@ -4767,10 +4810,24 @@ main (int argc, char *argv[]) {
     nread = Inbuffer_fill_init(inbuffer);
   }
 
+  /* Index files are read and preloaded by as many threads as workers */
+  Access_setup(nworkers);
+
+  if (shared_memory_remove_p == true) {
+    /* Unlink the segments by name, without reading any files */
+    offsetscomp_access = USE_SHARED_REMOVE;
+    positions_access = USE_SHARED_REMOVE;
+    genome_access = USE_SHARED_REMOVE;
+  } else if (shared_memory_p == true) {
+    offsetscomp_access = USE_SHARED;
+    positions_access = USE_SHARED;
+    genome_access = USE_SHARED;
+  }
+
   if (nread > 1) {
     multiple_sequences_p = true;
 #ifdef HAVE_MMAP
-    if (offsetscomp_access != USE_ALLOCATE || genome_access != USE_ALLOCATE) {
+    if (shared_memory_p == false && (offsetscomp_access != USE_ALLOCATE || genome_access != USE_ALLOCATE)) {
       fprintf(stderr,"Note: >1 sequence detected, so index files are being memory mapped.\n");
       fprintf(stderr,"  GMAP can run slowly at first while the computer starts to accumulate\n");
       fprintf(stderr,"  pages from the hard disk into its cache.  To copy index files into RAM\n");
@@ -4781,7 +4838,7 @@ main (int argc, char *argv[]) {
       fprintf(stderr,"\n");
     }
 #endif
-  } else {
+  } else if (shared_memory_p == false) {
     /* multiple_sequences_p = false; */
     /* fprintf(stderr,"Note: only 1 sequence detected.  Ignoring batch (-B) command\n"); */
     expand_offsets_p = false;
@@ -5064,6 +5121,12 @@ main (int argc, char *argv[]) {
 #endif
   }
 
+  if (shared_memory_loader_p == true) {
+    /* Segments persist after this process exits, until removed */
+    fprintf(stderr,"Finished with shared memory segments\n");
+    exit(0);
+  }
+
   if (splicing_file != NULL && genome != NULL) {
     if (Genome_blocks(genome) == NULL) {
       fprintf(stderr,"known splicing can be used only with compressed genome\n");
@@ -5206,11 +5269,11 @@ main (int argc, char *argv[]) {
 			    user_genomicseg,usersegment,dbversion,genome,chromosome_iit,
 			    chrsubset,contig_iit,altstrain_iit,map_iit,
 			    map_divint_crosstable,printtype,checksump,chimera_margin,
+			    nworkers,orderedp,
 #ifndef PMAP
 			    sam_headers_p,quality_shift,sam_paired_p,
 			    sam_read_group_id,sam_read_group_name,
 			    sam_read_group_library,sam_read_group_platform,
-			    nworkers,orderedp,
 #endif
 			    nofailsp,failsonlyp,fails_as_input_p,maxpaths,quiet_if_excessive_p,
 			    map_exons_p,map_bothstrands_p,print_comment_p,nflanking,
@@ -5259,6 +5322,14 @@ main (int argc, char *argv[]) {
 
       Except_init_pthread();
 
+      if (user_pairalign_p == false) {
+	/* Parse input ahead of the workers on its own thread.  Not
+	   possible with -2, which interleaves reads of the user segment. */
+	Inbuffer_set_reader(inbuffer);
+	pthread_create(&input_thread_id,&thread_attr_join,Inbuffer_thread_reader,
+		       (void *) inbuffer);
+      }
+
       if (orderedp == true) {
 	pthread_create(&output_thread_id,&thread_attr_join,Outbuffer_thread_ordered,
 		       (void *) outbuffer);
@@ -5279,6 +5350,9 @@ main (int argc, char *argv[]) {
       for (i = 0; i < nworkers; i++) {
 	pthread_join(worker_thread_ids[i],NULL);
       }
+      if (user_pairalign_p == false) {
+	pthread_join(input_thread_id,NULL);
+      }
 
       /* Do not delete global_except_key, because worker threads might still need it */
       /* Except_term_pthread(); */
@@ -5476,6 +5550,16 @@ Input options (must include -d or -g)\n\
                                    Values: 0 (no, default), or 1 (yes).\n\
                                    Expansion gives faster alignment, but requires more memory\n\
 ");
+#ifdef HAVE_SHM_OPEN
+  fprintf(stdout,"\
+  --shared-memory=STRING         Keep genome, offsets, and positions in POSIX shared memory segments\n\
+                                   that other gmap processes on this host can attach, overriding --batch.\n\
+                                   Values: use (attach segments, creating any that are missing),\n\
+                                   load (create segments and exit without reading input),\n\
+                                   or remove (remove segments and exit).  Segments persist until removed;\n\
+                                   give load and remove the same index options as the jobs that use them.\n\
+");
+#endif
 
     fprintf(stdout,"\
   --nosplicing                   Turns off splicing (useful for aligning genomic sequences\n\
@@ -5636,7 +5720,9 @@ Output options\n\
                                    existing files.  Otherwise, the default is to create new files.\n\
   --output-buffer-size=INT       Buffer size, in queries, for output thread (default 1000).  When the number\n\
                                    of results to be printed exceeds this size, the worker threads are halted\n\
-                                   until the backlog is cleared\n\
+                                   until the backlog is cleared.  With --ordered, this is the size of the\n\
+                                   reordering window, and a worker waits while its query is this many\n\
+                                   queries ahead of the last one printed\n\
 ");
 
 
@@ -59,6 +59,10 @@ static int index1interval = 3;	/* Interval for storing 12-mers */
 static bool genome_lc_p = false;
 static bool rawp = false;
 static bool writefilep = false;
+static bool positions_delta_p = false;
+static int nthreads = 0;	/* If > 0, -G compresses with this many threads, and -O and -P read
+				   <sourcedir>/<dbname>.genomecomp with this many threads */
+static size_t build_memory = 0;	/* If > 0, memory limit for -P, which then also reads the .genomecomp file */
 /* static bool sortchrp = true;	? Sorting now based on order in .coords file */
 static int wraplength = 0;
 static bool mask_lowercase_p = false;
@@ -887,16 +891,16 @@ main (int argc, char *argv[]) {
   Univ_IIT_T chromosome_iit, contig_iit;
   char *typestring;
   Univcoord_T genomelength, totalnts;
-  char *chromosomefile, *iitfile, *positionsfile, *gammaptrsfile, *offsetsfile, interval_char;
+  char *chromosomefile, *iitfile, *positionsfile, *gammaptrsfile, *offsetsfile, *genomecompfile, interval_char;
   Chrpos_T seglength;
-  FILE *fp;
+  FILE *fp, *sequence_fp;
   bool coord_values_8p;
 
   int c;
   extern int optind;
   extern char *optarg;
 
-  while ((c = getopt(argc,argv,"F:D:d:b:k:q:ArlGCUOPWw:e:Ss:m")) != -1) {
+  while ((c = getopt(argc,argv,"F:D:d:b:k:q:ArlGCUOPWzw:e:Ss:mt:M:")) != -1) {
     switch (c) {
     case 'F': sourcedir = optarg; break;
     case 'D': destdir = optarg; break;
@@ -920,6 +924,7 @@ main (int argc, char *argv[]) {
     case 'O': action = OFFSETS; break;
     case 'P': action = POSITIONS; break;
     case 'W': writefilep = true; break;
+    case 'z': positions_delta_p = true; break;
     case 'w': wraplength = atoi(optarg); break;
     case 'e': nmessages = atoi(optarg); break;
 
@@ -945,6 +950,8 @@ main (int argc, char *argv[]) {
       break;
 
     case 'm': mask_lowercase_p = true; break;
+    case 't': nthreads = atoi(optarg); break;
+    case 'M': build_memory = (size_t) strtoul(optarg,NULL,10) * 1024 * 1024; break;
     }
   }
   argc -= (optind - 1);
@@ -1050,7 +1057,7 @@ main (int argc, char *argv[]) {
     accsegmentpos_table_gc(&accsegmentpos_table);
 
   } else if (action == GENOME) {
-    /* Usage: cat <fastafile> | gmapindex [-F <sourcedir>] [-D <destdir>] -d <dbname> -G
+    /* Usage: cat <fastafile> | gmapindex [-F <sourcedir>] [-D <destdir>] -d <dbname> [-t <nthreads>] -G
        Requires <fastafile> in appropriate format and <sourcedir>/<dbname>.chromosome.iit 
        and <sourcedir>/<dbname>.contig.iit files.
        Creates <destdir>/<dbname>.genome */
@@ -1078,7 +1085,7 @@ main (int argc, char *argv[]) {
       /* index1part needed only if writing an uncompressed genome using a file */
       Genome_write(destdir,fileroot,stdin,contig_iit,/*altstrain_iit*/NULL,
 		   chromosome_iit,genome_lc_p,rawp,writefilep,genomelength,
-		   index1part,nmessages);
+		   index1part,nmessages,nthreads);
     } else if (Univ_IIT_ntypes(contig_iit) > 1) {
       fprintf(stderr,"GMAPINDEX no longer supports alternate strains\n");
       abort();
@@ -1112,8 +1119,22 @@ main (int argc, char *argv[]) {
     }
 
   } else if (action == OFFSETS) {
-    /* Usage: cat <genomefile> | gmapindex [-F <sourcedir>] [-D <destdir>] -d <dbname> -O
-       Creates <destdir>/<dbname>.idxoffsets */
+    /* Usage: cat <genomefile> | gmapindex [-F <sourcedir>] [-D <destdir>] -d <dbname> -O, or
+              gmapindex [-F <sourcedir>] [-D <destdir>] -d <dbname> -t <nthreads> -O
+       Creates <destdir>/<dbname>.idxoffsets.  With -t, reads <sourcedir>/<dbname>.genomecomp */
+
+    if (nthreads > 0 && genome_lc_p == false) {
+      genomecompfile = (char *) CALLOC(strlen(sourcedir)+strlen("/")+
+				       strlen(fileroot)+strlen(".genomecomp")+1,sizeof(char));
+      sprintf(genomecompfile,"%s/%s.genomecomp",sourcedir,fileroot);
+      if ((sequence_fp = FOPEN_READ_BINARY(genomecompfile)) == NULL) {
+	fprintf(stderr,"Can't open file %s\n",genomecompfile);
+	exit(9);
+      }
+    } else {
+      genomecompfile = (char *) NULL;
+      sequence_fp = stdin;
+    }
 
     chromosomefile = (char *) CALLOC(strlen(sourcedir)+strlen("/")+
 				     strlen(fileroot)+strlen(".chromosome.iit")+1,sizeof(char));
@@ -1157,18 +1178,42 @@ main (int argc, char *argv[]) {
 	      destdir,fileroot,IDX_FILESUFFIX,offsetscomp_basesize,index1part,interval_char,"offsetscomp");
     }
 
-    Indexdb_write_offsets(gammaptrsfile,offsetsfile,stdin,chromosome_iit,
+    Indexdb_write_offsets(gammaptrsfile,offsetsfile,sequence_fp,chromosome_iit,
 			  offsetscomp_basesize,index1part,index1interval,
-			  genome_lc_p,fileroot,mask_lowercase_p);
+			  genome_lc_p,fileroot,mask_lowercase_p,genomecompfile,nthreads);
 
+    if (genomecompfile != NULL) {
+      fclose(sequence_fp);
+      FREE(genomecompfile);
+    }
     FREE(offsetsfile);
     FREE(gammaptrsfile);
     Univ_IIT_free(&chromosome_iit);
 
   } else if (action == POSITIONS) {
-    /* Usage: cat <genomefile> | gmapindex [-F <sourcedir>] [-D <destdir>] -d <dbname> -P
+    /* Usage: cat <genomefile> | gmapindex [-F <sourcedir>] [-D <destdir>] -d <dbname> [-z] -P, or
+              gmapindex [-F <sourcedir>] [-D <destdir>] -d <dbname> [-z] [-t <nthreads>] [-M <megabytes>] -P
        Requires <sourcedir>/<dbname>.idxoffsets.
-       Creates <destdir>/<dbname>.idxpositions */
+       Creates <destdir>/<dbname>.idxpositions, and with -z, also
+       <destdir>/<dbname>.idxpositionsdelta and .idxpositionsblocks.
+       With -t or -M, reads <sourcedir>/<dbname>.genomecomp.  With -M,
+       builds positions in ranges that fit in the given memory. */
+
+    if (build_memory > 0 && nthreads == 0) {
+      nthreads = 1;
+    }
+    if (nthreads > 0 && genome_lc_p == false) {
+      genomecompfile = (char *) CALLOC(strlen(sourcedir)+strlen("/")+
+				       strlen(fileroot)+strlen(".genomecomp")+1,sizeof(char));
+      sprintf(genomecompfile,"%s/%s.genomecomp",sourcedir,fileroot);
+      if ((sequence_fp = FOPEN_READ_BINARY(genomecompfile)) == NULL) {
+	fprintf(stderr,"Can't open file %s\n",genomecompfile);
+	exit(9);
+      }
+    } else {
+      genomecompfile = (char *) NULL;
+      sequence_fp = stdin;
+    }
 
     chromosomefile = (char *) CALLOC(strlen(sourcedir)+strlen("/")+
 				     strlen(fileroot)+strlen(".chromosome.iit")+1,sizeof(char));
@@ -1233,10 +1278,15 @@ main (int argc, char *argv[]) {
       coord_values_8p = false;
     }
 
-    Indexdb_write_positions(positionsfile,gammaptrsfile,offsetsfile,stdin,chromosome_iit,
+    Indexdb_write_positions(positionsfile,gammaptrsfile,offsetsfile,sequence_fp,chromosome_iit,
 			    offsetscomp_basesize,index1part,index1interval,
-			    genome_lc_p,writefilep,fileroot,mask_lowercase_p,coord_values_8p);
+			    genome_lc_p,writefilep,fileroot,mask_lowercase_p,coord_values_8p,
+			    positions_delta_p,genomecompfile,nthreads,build_memory);
 
+    if (genomecompfile != NULL) {
+      fclose(sequence_fp);
+      FREE(genomecompfile);
+    }
     FREE(positionsfile);
     FREE(offsetsfile);
     FREE(gammaptrsfile);
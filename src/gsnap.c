@@ -25,8 +25,7 @@ static char rcsid[] = "$Id: gsnap.c 103703 2013-08-02 23:08:31Z twu $";
 #endif
 
 #ifdef HAVE_ZLIB
-#include <zlib.h>
-#define GZBUFFER_SIZE 131072
+#include "gunzip.h"
 #endif
 
 #ifdef HAVE_BZLIB
@@ -54,10 +53,13 @@ static char rcsid[] = "$Id: gsnap.c 103703 2013-08-02 23:08:31Z twu $";
 #include "substring.h"
 #include "stage3hr.h"
 #include "goby.h"
+#include "bgzf.h"		/* For Bgzf_setup */
 #include "spanningelt.h"
 #include "splicetrie_build.h"
+#include "splicetrie_cache.h"
 #include "oligo.h"		/* For Oligo_setup */
 #include "oligoindex_hr.h"	/* For Oligoindex_hr_setup */
+#include "cpuinfo.h"
 #include "stage2.h"		/* For Stage2_setup */
 #include "stage1hr.h"
 #include "indexdb.h"
@@ -150,6 +152,7 @@ static bool filter_chastity_p = false;
 static bool allow_paired_end_mismatch_p = false;
 static bool filter_if_both_p = false;
 static bool gunzip_p = false;
+static int gunzip_nthreads = 2;
 static bool bunzip2_p = false;
 
 /* Compute options */
@@ -164,6 +167,10 @@ static int trim_indel_score = -4;
 
 static Access_mode_T offsetscomp_access = USE_ALLOCATE;
 static bool expand_offsets_p = false;
+static bool shared_memory_p = false;
+static bool shared_memory_loader_p = false;
+static bool shared_memory_remove_p = false;
+static int prefetch_batch = 1;
 
 #ifdef HAVE_MMAP
 static Access_mode_T positions_access = USE_MMAP_PRELOAD;
@@ -180,7 +187,7 @@ static int expected_pairlength = 200;
 static int pairlength_deviation = 100;
 
 #ifdef HAVE_PTHREAD
-static pthread_t output_thread_id, *worker_thread_ids;
+static pthread_t output_thread_id, input_thread_id, *worker_thread_ids;
 static pthread_key_t global_request_key;
 static int nworkers = 1;	/* (int) sysconf(_SC_NPROCESSORS_ONLN) */
 #endif
@@ -240,6 +247,9 @@ static bool distances_observed_p = false;
 static char *user_splicingdir = (char *) NULL;
 static char *splicing_file = (char *) NULL;
 static IIT_T splicing_iit = NULL;
+static char *user_splicetrie_cachefile = (char *) NULL;
+static bool build_splicetrie_cache_p = false;
+static Splicetrie_cache_T splicetrie_cache = NULL;
 static bool amb_closest_p = false;
 static bool amb_clip_p = true;
 
@@ -298,6 +308,8 @@ static int *runlength_divint_crosstable = NULL;
 static unsigned int output_buffer_size = 1000;
 static bool output_sam_p = false;
 static bool output_goby_p = false;
+static bool output_bam_p = false;
+static int bam_nthreads = 2;
 
 /* For Illumina, subtract 64.  For Sanger, subtract 33.  For Goby, subtract 0. */
 /* static int quality_score_adj = 64;  -- Stored in mapq.c */
@@ -311,6 +323,7 @@ static bool quiet_if_excessive_p = false;
 static int maxpaths_search = 1000;
 static int maxpaths_report = 100;
 static bool orderedp = false;
+static bool print_in_workers_p = false;
 static bool failsonlyp = false;
 static bool nofailsp = false;
 static bool fails_as_input_p = false;
@@ -380,6 +393,7 @@ static struct option long_options[] = {
 
 #ifdef HAVE_ZLIB
   {"gunzip", no_argument, 0, 0}, /* gunzip_p */
+  {"gunzip-threads", required_argument, 0, 0}, /* gunzip_nthreads */
 #endif
 
 #ifdef HAVE_BZLIB
@@ -391,6 +405,8 @@ static struct option long_options[] = {
   {"batch", required_argument, 0, 'B'}, /* offsetscomp_access, positions_access, genome_access */
 #endif
   {"expand-offsets", required_argument, 0, 0}, /* expand_offsets_p */
+  {"shared-memory", required_argument, 0, 0}, /* shared_memory_p, shared_memory_loader_p, shared_memory_remove_p */
+  {"prefetch-batch", required_argument, 0, 0}, /* prefetch_batch */
   {"pairmax-dna", required_argument, 0, 0}, /* pairmax_dna */
   {"pairmax-rna", required_argument, 0, 0}, /* pairmax_rna */
   {"pairexpect", required_argument, 0, 0},  /* expected_pairlength */
@@ -431,6 +447,8 @@ static struct option long_options[] = {
   {"splicingdir", required_argument, 0, 0},	  /* user_splicingdir */
   {"use-splicing", required_argument, 0, 's'}, /* splicing_iit, knownsplicingp */
   {"ambig-splice-noclip", no_argument, 0, 0},  /* amb_clip_p */
+  {"splicetrie-cache", required_argument, 0, 0}, /* user_splicetrie_cachefile */
+  {"build-splicetrie-cache", no_argument, 0, 0}, /* build_splicetrie_cache_p */
   {"genes", required_argument, 0, 'g'}, /* genes_iit */
   {"favor-multiexon", no_argument, 0, 0}, /* favor_multiexon_p */
 
@@ -467,7 +485,9 @@ static struct option long_options[] = {
 
   /* Output options */
   {"output-buffer-size", required_argument, 0, 0}, /* output_buffer_size */
-  {"format", required_argument, 0, 'A'}, /* output_sam_p, output_goby_p */
+  {"print-in-workers", no_argument, 0, 0}, /* print_in_workers_p */
+  {"format", required_argument, 0, 'A'}, /* output_sam_p, output_goby_p, output_bam_p */
+  {"bam-threads", required_argument, 0, 0}, /* bam_nthreads */
 
   {"quality-protocol", required_argument, 0, 0}, /* quality_score_adj, quality_shift */
   {"quality-zero-score", required_argument, 0, 'J'}, /* quality_score_adj */
@@ -600,6 +620,10 @@ print_program_version () {
   fprintf(stdout," AVX");
 #endif
   fprintf(stdout,"\n");
+  fprintf(stdout,"SIMD functions on this processor: %s%s\n",
+	  Cpuinfo_simd_string(Cpuinfo_simd_level()),Cpuinfo_popcnt_p() == true ? " popcount" : "");
+  fprintf(stdout,"SIMD kernels chosen at run time: dynprog %s, oligoindex %s\n",
+	  Cpuinfo_simd_string(Dynprog_simd_level()),Cpuinfo_simd_string(Oligoindex_hr_simd_level()));
 
 
   fprintf(stdout,"Sizes: off_t (%lu), size_t (%lu), unsigned int (%lu), long int (%lu)\n",
@@ -632,6 +656,8 @@ check_compiler_assumptions () {
   __m128i a;
 #endif
 
+  Cpuinfo_check_build();
+
   fprintf(stderr,"Checking compiler assumptions for popcnt: ");
   fprintf(stderr,"%08X ",x);
 #ifdef HAVE_BUILTIN_CLZ
@@ -853,10 +879,57 @@ signal_handler (int sig) {
 
 #define POOL_FREE_INTERVAL 200
 
+/* Takes requests from the inbuffer prefetch_batch at a time.  Each
+   level of index prefetching is issued on a read one call before the
+   next level, so the loads for a read are complete by the time it is
+   handed out. */
+static void
+prefetch_request (Request_T request, int level) {
+  Shortread_T queryseq2;
+
+  Stage1_prefetch_read(Request_queryseq1(request),indexdb,indexdb2,level);
+  if ((queryseq2 = Request_queryseq2(request)) != NULL) {
+    Stage1_prefetch_read(queryseq2,indexdb,indexdb2,level);
+  }
+  return;
+}
+
+static Request_T
+get_request (Request_T *batch, int *nbatch, int *batchi) {
+  int level, j;
+
+  if (prefetch_batch == 1) {
+    return Inbuffer_get_request(inbuffer);
+
+  } else if (*batchi >= *nbatch) {
+    if ((*nbatch = Inbuffer_get_requests(batch,inbuffer,prefetch_batch)) == 0) {
+      return (Request_T) NULL;
+    }
+    *batchi = 0;
+
+    /* Start the pipeline for the first reads of the batch */
+    for (level = 0; level < STAGE1_PREFETCH_NLEVELS; level++) {
+      for (j = 0; j < STAGE1_PREFETCH_NLEVELS - level && j < *nbatch; j++) {
+	prefetch_request(batch[j],level);
+      }
+    }
+  }
+
+  for (level = 0; level < STAGE1_PREFETCH_NLEVELS; level++) {
+    if ((j = *batchi + STAGE1_PREFETCH_NLEVELS - level) < *nbatch) {
+      prefetch_request(batch[j],level);
+    }
+  }
+
+  return batch[(*batchi)++];
+}
+
+
 static void
 single_thread () {
   Floors_T *floors_array;
-  Request_T request;
+  Request_T request, *batch;
+  int nbatch = 0, batchi = 0;
   Result_T result;
   Shortread_T queryseq1;
   int i;
@@ -885,6 +958,7 @@ single_thread () {
   worker_stopwatch = (timingp == true) ? Stopwatch_new() : (Stopwatch_T) NULL;
 
   floors_array = (Floors_T *) CALLOC(MAX_READLENGTH+1,sizeof(Floors_T));
+  batch = (Request_T *) MALLOC(prefetch_batch*sizeof(Request_T));
   /* Except_stack_create(); -- requires pthreads */
 
 #ifdef MEMUSAGE
@@ -892,7 +966,7 @@ single_thread () {
   Mem_usage_reset(0);
 #endif
 
-  while ((request = Inbuffer_get_request(inbuffer)) != NULL) {
+  while ((request = get_request(batch,&nbatch,&batchi)) != NULL) {
     debug(printf("single_thread got request %d\n",Request_id(request)));
 
     TRY
@@ -963,6 +1037,7 @@ single_thread () {
     }
   }
   FREE(floors_array);
+  FREE(batch);
 
   if (worker_stopwatch != NULL) {
     Stopwatch_free(&worker_stopwatch);
@@ -984,7 +1059,8 @@ static void *
 worker_thread (void *data) {
   long int worker_id = (long int) data;
   Floors_T *floors_array;
-  Request_T request;
+  Request_T request, *batch;
+  int nbatch = 0, batchi = 0;
   Result_T result;
   Shortread_T queryseq1;
   int i;
@@ -1016,6 +1092,7 @@ worker_thread (void *data) {
   worker_stopwatch = (timingp == true) ? Stopwatch_new() : (Stopwatch_T) NULL;
 
   floors_array = (Floors_T *) CALLOC(MAX_READLENGTH+1,sizeof(Floors_T));
+  batch = (Request_T *) MALLOC(prefetch_batch*sizeof(Request_T));
   Except_stack_create();
 
 #ifdef MEMUSAGE
@@ -1023,7 +1100,7 @@ worker_thread (void *data) {
   Mem_usage_reset(0);
 #endif
 
-  while ((request = Inbuffer_get_request(inbuffer)) != NULL) {
+  while ((request = get_request(batch,&nbatch,&batchi)) != NULL) {
     debug(printf("worker_thread %ld got request %d\n",worker_id,Request_id(request)));
     pthread_setspecific(global_request_key,(void *) request);
     if (worker_jobid % POOL_FREE_INTERVAL == 0) {
@@ -1089,6 +1166,7 @@ worker_thread (void *data) {
     }
   }
   FREE(floors_array);
+  FREE(batch);
 
   if (worker_stopwatch != NULL) {
     Stopwatch_free(&worker_stopwatch);
@@ -1262,9 +1340,11 @@ check_valid_float (char *string) {
 int
 main (int argc, char *argv[]) {
   char *genomesubdir = NULL, *snpsdir = NULL, *modedir = NULL, *mapdir = NULL, *iitfile = NULL, *fileroot = NULL;
+  char *splicing_iitfile = NULL, *chromosome_iitfile, *splicetrie_cachefile;
+  int ntriecontents_obs = 0, ntriecontents_max = 0;
   FILE *input = NULL, *input2 = NULL;
 #ifdef HAVE_ZLIB
-  gzFile gzipped = NULL, gzipped2 = NULL;
+  Gunzip_T gzipped = NULL, gzipped2 = NULL;
 #endif
 
 #ifdef HAVE_BZLIB
@@ -1336,6 +1416,31 @@ main (int argc, char *argv[]) {
 	  exit(9);
 	}
 
+      } else if (!strcmp(long_name,"prefetch-batch")) {
+	if ((prefetch_batch = atoi(check_valid_int(optarg))) < 1) {
+	  fprintf(stderr,"--prefetch-batch must be at least 1\n");
+	  exit(9);
+	}
+
+      } else if (!strcmp(long_name,"shared-memory")) {
+#ifdef HAVE_SHM_OPEN
+	if (!strcmp(optarg,"use")) {
+	  shared_memory_loader_p = false;
+	} else if (!strcmp(optarg,"load")) {
+	  shared_memory_loader_p = true;
+	} else if (!strcmp(optarg,"remove")) {
+	  shared_memory_loader_p = true;
+	  shared_memory_remove_p = true;
+	} else {
+	  fprintf(stderr,"--shared-memory must be use, load, or remove\n");
+	  exit(9);
+	}
+	shared_memory_p = true;
+#else
+	fprintf(stderr,"--shared-memory is not available, since this program was built without shm_open\n");
+	exit(9);
+#endif
+
       } else if (!strcmp(long_name,"basesize")) {
 	required_basesize = atoi(check_valid_int(optarg));
 
@@ -1379,6 +1484,10 @@ main (int argc, char *argv[]) {
 	user_splicingdir = optarg;
       } else if (!strcmp(long_name,"ambig-splice-noclip")) {
 	amb_clip_p = false;
+      } else if (!strcmp(long_name,"splicetrie-cache")) {
+	user_splicetrie_cachefile = optarg;
+      } else if (!strcmp(long_name,"build-splicetrie-cache")) {
+	build_splicetrie_cache_p = true;
 
       } else if (!strcmp(long_name,"tallydir")) {
 	user_tallydir = optarg;
@@ -1421,6 +1530,10 @@ main (int argc, char *argv[]) {
 	inbuffer_nspaces = atoi(check_valid_int(optarg));
       } else if (!strcmp(long_name,"output-buffer-size")) {
 	output_buffer_size = atoi(check_valid_int(optarg));
+      } else if (!strcmp(long_name,"print-in-workers")) {
+	print_in_workers_p = true;
+      } else if (!strcmp(long_name,"bam-threads")) {
+	bam_nthreads = atoi(check_valid_int(optarg));
       } else if (!strcmp(long_name,"barcode-length")) {
 	barcode_length = atoi(check_valid_int(optarg));
       } else if (!strcmp(long_name,"fastq-id-start")) {
@@ -1457,6 +1570,8 @@ main (int argc, char *argv[]) {
 #ifdef HAVE_ZLIB
       } else if (!strcmp(long_name,"gunzip")) {
 	gunzip_p = true;
+      } else if (!strcmp(long_name,"gunzip-threads")) {
+	gunzip_nthreads = atoi(check_valid_int(optarg));
 #endif
 #ifdef HAVE_BZLIB
       } else if (!strcmp(long_name,"bunzip2")) {
@@ -1760,6 +1875,15 @@ main (int argc, char *argv[]) {
 	output_sam_p = true;
       } else if (!strcmp(optarg,"goby")) {
 	output_goby_p = true;
+      } else if (!strcmp(optarg,"bam")) {
+#if defined(HAVE_ZLIB) && defined(HAVE_OPEN_MEMSTREAM)
+	/* SAM records, converted to binary as they are written */
+	output_sam_p = true;
+	output_bam_p = true;
+#else
+	fprintf(stderr,"BAM output requires zlib and open_memstream, which were not found at compile time\n");
+	exit(9);
+#endif
       } else {
 	fprintf(stderr,"Output format %s not recognized\n",optarg);
 	exit(9);
@@ -1920,8 +2044,29 @@ main (int argc, char *argv[]) {
   }
 
 
+  /* Index files are read and preloaded by as many threads as workers */
+  Access_setup(nworkers);
+
+  if (shared_memory_remove_p == true) {
+    /* Unlink the segments by name, without reading any files */
+    offsetscomp_access = USE_SHARED_REMOVE;
+    positions_access = USE_SHARED_REMOVE;
+    genome_access = USE_SHARED_REMOVE;
+  } else if (shared_memory_p == true) {
+    offsetscomp_access = USE_SHARED;
+    positions_access = USE_SHARED;
+    genome_access = USE_SHARED;
+  }
+
+
   /* Open input stream and peek at first char */
-  if (argc == 0) {
+  if (shared_memory_loader_p == true) {
+    /* Loading or removing shared memory segments reads no input */
+    files = (char **) NULL;
+    nfiles = 0;
+    nextchar = EOF;
+
+  } else if (argc == 0) {
     input = stdin;
     files = (char **) NULL;
     nfiles = 0;
@@ -1936,13 +2081,11 @@ main (int argc, char *argv[]) {
 
     if (gunzip_p == true) {
 #ifdef HAVE_ZLIB
-      if ((gzipped = gzopen(files[0],"rb")) == NULL) {
+      Gunzip_setup(gunzip_nthreads);
+      if ((gzipped = Gunzip_new(files[0])) == NULL) {
 	fprintf(stderr,"Cannot open gzipped file %s\n",files[0]);
 	exit(9);
       } else {
-#ifdef HAVE_ZLIB_GZBUFFER
-	gzbuffer(gzipped,GZBUFFER_SIZE);
-#endif
 	nextchar = Shortread_input_init_gzip(gzipped);
       }
 #endif
@@ -1978,8 +2121,10 @@ main (int argc, char *argv[]) {
 
   /* Interpret first char to determine input type */
   if (nextchar == EOF) {
-    fprintf(stderr,"Input is empty\n");
-    exit(9);
+    if (shared_memory_loader_p == false) {
+      fprintf(stderr,"Input is empty\n");
+      exit(9);
+    }
 
 #ifdef HAVE_GOBY
   } else if (creads_format_p == true) {
@@ -2004,7 +2149,7 @@ main (int argc, char *argv[]) {
     /* Looks like a FASTQ file */
     if (nfiles == 0 || force_single_end_p == true) {
 #ifdef HAVE_ZLIB
-      gzipped2 = (gzFile) NULL;
+      gzipped2 = (Gunzip_T) NULL;
 #endif
 #ifdef HAVE_BZLIB
       bzipped2 = (Bzip2_T) NULL;
@@ -2013,13 +2158,10 @@ main (int argc, char *argv[]) {
     } else {
       if (gunzip_p == true) {
 #ifdef HAVE_ZLIB
-	if ((gzipped2 = gzopen(files[0],"rb")) == NULL) {
+	if ((gzipped2 = Gunzip_new(files[0])) == NULL) {
 	  fprintf(stderr,"Cannot open gzipped file %s\n",files[0]);
 	  exit(9);
 	} else {
-#ifdef HAVE_ZLIB_GZBUFFER
-	  gzbuffer(gzipped2,GZBUFFER_SIZE);
-#endif
 	  /* nextchar2 = */ Shortread_input_init_gzip(gzipped2);
 	}
 #endif
@@ -2076,7 +2218,7 @@ main (int argc, char *argv[]) {
 
   if (nread > 1) {
     multiple_sequences_p = true;
-    if (offsetscomp_access != USE_ALLOCATE || genome_access != USE_ALLOCATE) {
+    if (shared_memory_p == false && (offsetscomp_access != USE_ALLOCATE || genome_access != USE_ALLOCATE)) {
       fprintf(stderr,"Note: >1 sequence detected, so index files are being memory mapped.\n");
       fprintf(stderr,"  GSNAP can run slowly at first while the computer starts to accumulate\n");
       fprintf(stderr,"  pages from the hard disk into its cache.  To copy index files into RAM\n");
@@ -2086,7 +2228,7 @@ main (int argc, char *argv[]) {
 #endif
       fprintf(stderr,"\n");
     }
-  } else {
+  } else if (shared_memory_p == false) {
     /* multiple_sequences_p = false; */
     /* fprintf(stderr,"Note: only 1 sequence detected.  Ignoring batch (-B) command\n"); */
     expand_offsets_p = false;
@@ -2301,6 +2443,12 @@ main (int argc, char *argv[]) {
   }
   genome_blocks = Genome_blocks(genome);
 
+  if (shared_memory_loader_p == true) {
+    /* Segments persist after this process exits, until removed */
+    fprintf(stderr,"Finished with shared memory segments\n");
+    exit(0);
+  }
+
   if (min_distantsplicing_end_matches < index1part) {
     fprintf(stderr,"Minimum value for distant-splice-endlength is the value for -k (kmer size) %d\n",index1part);
     exit(9);
@@ -2347,6 +2495,7 @@ main (int argc, char *argv[]) {
       if ((splicing_iit = IIT_read(splicing_file,/*name*/NULL,/*readonlyp*/true,/*divread*/READ_ALL,
 				   /*divstring*/NULL,/*add_iit_p*/true,/*labels_read_p*/true)) != NULL) {
 	fprintf(stderr,"Reading splicing file %s locally...",splicing_file);
+	splicing_iitfile = Splicetrie_cache_iitfile(splicing_file);
       }
     } else {
       iitfile = (char *) CALLOC(strlen(user_splicingdir)+strlen("/")+strlen(splicing_file)+1,sizeof(char));
@@ -2354,6 +2503,7 @@ main (int argc, char *argv[]) {
       if ((splicing_iit = IIT_read(iitfile,/*name*/NULL,/*readonlyp*/true,/*divread*/READ_ALL,
 				   /*divstring*/NULL,/*add_iit_p*/true,/*labels_read_p*/true)) != NULL) {
 	fprintf(stderr,"Reading splicing file %s...",iitfile);
+	splicing_iitfile = Splicetrie_cache_iitfile(iitfile);
 	FREE(iitfile);
       }
     }
@@ -2366,6 +2516,7 @@ main (int argc, char *argv[]) {
       if ((splicing_iit = IIT_read(iitfile,/*name*/NULL,/*readonlyp*/true,/*divread*/READ_ALL,
 				      /*divstring*/NULL,/*add_iit_p*/true,/*labels_read_p*/true)) != NULL) {
 	fprintf(stderr,"Reading splicing file %s...",iitfile);
+	splicing_iitfile = Splicetrie_cache_iitfile(iitfile);
 	FREE(iitfile);
 	FREE(mapdir);
       } else {
@@ -2377,8 +2528,29 @@ main (int argc, char *argv[]) {
     }
 
     splicing_divint_crosstable = Univ_IIT_divint_crosstable(chromosome_iit,splicing_iit);
-    if ((donor_typeint = IIT_typeint(splicing_iit,"donor")) >= 0 && 
-	(acceptor_typeint = IIT_typeint(splicing_iit,"acceptor")) >= 0) {
+    if ((donor_typeint = IIT_typeint(splicing_iit,"donor")) >= 0) {
+      acceptor_typeint = IIT_typeint(splicing_iit,"acceptor");
+    }
+
+    if (user_splicetrie_cachefile != NULL) {
+      splicetrie_cachefile = (char *) CALLOC(strlen(user_splicetrie_cachefile)+1,sizeof(char));
+      strcpy(splicetrie_cachefile,user_splicetrie_cachefile);
+    } else {
+      splicetrie_cachefile = Splicetrie_cache_filename(splicing_iitfile);
+    }
+    chromosome_iitfile = (char *) CALLOC(strlen(genomesubdir)+strlen("/")+
+					 strlen(fileroot)+strlen(".chromosome.iit")+1,sizeof(char));
+    sprintf(chromosome_iitfile,"%s/%s.chromosome.iit",genomesubdir,fileroot);
+
+    if (build_splicetrie_cache_p == false &&
+	(splicetrie_cache = Splicetrie_cache_read(&distances_observed_p,&splicesites,&splicecomp,&splicetypes,&splicedists,
+						  &splicefrags_ref,&splicefrags_alt,&nsplicesites,
+						  &trieoffsets_obs,&triecontents_obs,&trieoffsets_max,&triecontents_max,
+						  splicetrie_cachefile,splicing_iitfile,chromosome_iitfile,
+						  genome,/*altp*/genomealt != NULL,shortsplicedist)) != NULL) {
+      fprintf(stderr,"mapped %d splicesites from splicetrie cache %s...",nsplicesites,splicetrie_cachefile);
+
+    } else if (donor_typeint >= 0 && acceptor_typeint >= 0) {
       fprintf(stderr,"found donor and acceptor tags, so treating as splicesites file\n");
       splicesites = Splicetrie_retrieve_via_splicesites(&distances_observed_p,&splicecomp,&splicetypes,&splicedists,
 							&splicestrings,&splicefrags_ref,&splicefrags_alt,
@@ -2401,7 +2573,7 @@ main (int argc, char *argv[]) {
 	if (multiple_sequences_p == true && splicetrie_precompute_p == true) {
 #endif
 	  Splicetrie_build_via_splicesites(&triecontents_obs,&trieoffsets_obs,&triecontents_max,&trieoffsets_max,
-					   nsplicepartners_skip,nsplicepartners_obs,nsplicepartners_max,splicetypes,
+					   &ntriecontents_obs,&ntriecontents_max,nsplicepartners_skip,nsplicepartners_obs,nsplicepartners_max,splicetypes,
 					   splicestrings,nsplicesites);
 	  FREE(nsplicepartners_max);
 	  FREE(nsplicepartners_obs);
@@ -2430,7 +2602,7 @@ main (int argc, char *argv[]) {
 #if 0
 	if (multiple_sequences_p == true && splicetrie_precompute_p == true) {
 #endif
-	  Splicetrie_build_via_introns(&triecontents_obs,&trieoffsets_obs,splicesites,splicetypes,
+	  Splicetrie_build_via_introns(&triecontents_obs,&trieoffsets_obs,&ntriecontents_obs,splicesites,splicetypes,
 				       splicestrings,nsplicesites,chromosome_iit,splicing_iit,splicing_divint_crosstable);
 	  triecontents_max = (Triecontent_T *) NULL;
 	  trieoffsets_max =  (Trieoffset_T *) NULL;
@@ -2442,12 +2614,29 @@ main (int argc, char *argv[]) {
 
     }
 
+    if (build_splicetrie_cache_p == true) {
+      fprintf(stderr,"writing splicetrie cache %s...",splicetrie_cachefile);
+      Splicetrie_cache_write(splicetrie_cachefile,splicing_iitfile,chromosome_iitfile,
+			     genome,/*altp*/genomealt != NULL,shortsplicedist,distances_observed_p,
+			     splicesites,splicecomp,splicetypes,splicedists,splicefrags_ref,splicefrags_alt,
+			     nsplicesites,trieoffsets_obs,triecontents_obs,ntriecontents_obs,
+			     trieoffsets_max,triecontents_max,ntriecontents_max);
+      fprintf(stderr,"done\n");
+      exit(0);
+    }
+    FREE(chromosome_iitfile);
+    FREE(splicetrie_cachefile);
+    FREE(splicing_iitfile);
+
     /* For benchmarking purposes.  Can spend time/memory to load
        splicesites, but then not use them. */
     if (unloadp == true) {
       fprintf(stderr,"unloading...");
 
-      if (nsplicesites > 0) {
+      if (splicetrie_cache != NULL) {
+	Splicetrie_cache_free(&splicetrie_cache);
+	nsplicesites = 0;
+      } else if (nsplicesites > 0) {
 	if (splicetrie_precompute_p == true) {
 	  FREE(triecontents_max);
 	  FREE(trieoffsets_max);
@@ -2570,7 +2759,8 @@ main (int argc, char *argv[]) {
 		   /*snpp*/snps_iit ? true : false,amb_closest_p,amb_clip_p,min_shortend);
   spansize = Spanningelt_setup(index1part,index1interval);
   Stage1hr_setup(index1part,index1interval,spansize,chromosome_iit,nchromosomes,
-		 genomealt,mode,maxpaths_search,terminal_threshold,
+		 genome,genomealt,mode,query_unk_mismatch_p,genome_unk_mismatch_p,
+		 maxpaths_search,terminal_threshold,
 		 splicesites,splicetypes,splicedists,nsplicesites,
 		 novelsplicingp,knownsplicingp,distances_observed_p,
 		 shortsplicedist_known,shortsplicedist_novelend,min_intronlength,
@@ -2636,14 +2826,30 @@ main (int argc, char *argv[]) {
   }
 #endif
 
+  if (output_bam_p == true) {
+    if (fails_as_input_p == true) {
+      fprintf(stderr,"BAM output doesn't support the --fails-as-input option.  Turning it off.\n");
+      fails_as_input_p = false;
+    }
+    if (appendp == true) {
+      fprintf(stderr,"Cannot append to BAM files, so ignoring --append-output\n");
+      appendp = false;
+    }
+    if (timingp == true) {
+      fprintf(stderr,"BAM output doesn't support the --time option.  Turning it off.\n");
+      timingp = false;
+    }
+    Bgzf_setup(bam_nthreads);	/* Ignored without pthreads */
+  }
+
   outbuffer = Outbuffer_new(output_buffer_size,nread,sevenway_root,appendp,
 #ifdef USE_OLD_MAXENT
 			    genome,
 #endif
 			    chromosome_iit,timingp,
-			    output_sam_p,sam_headers_p,sam_read_group_id,sam_read_group_name,
+			    output_sam_p,output_bam_p,sam_headers_p,sam_read_group_id,sam_read_group_name,
 			    sam_read_group_library,sam_read_group_platform,
-			    nworkers,orderedp,
+			    nworkers,orderedp,print_in_workers_p,
 			    gobywriter,nofailsp,failsonlyp,fails_as_input_p,
 			    fastq_format_p,clip_overlap_p,merge_samechr_p,
 			    maxpaths_report,quiet_if_excessive_p,quality_shift,
@@ -2683,6 +2889,11 @@ main (int argc, char *argv[]) {
     Except_init_pthread();
     pthread_key_create(&global_request_key,NULL);
 
+    /* Parse input ahead of the workers on its own thread */
+    Inbuffer_set_reader(inbuffer);
+    pthread_create(&input_thread_id,&thread_attr_join,Inbuffer_thread_reader,
+		   (void *) inbuffer);
+
     if (orderedp == true) {
       pthread_create(&output_thread_id,&thread_attr_join,Outbuffer_thread_ordered,
 		     (void *) outbuffer);
@@ -2703,6 +2914,7 @@ main (int argc, char *argv[]) {
     for (worker_id = 0; worker_id < nworkers; worker_id++) {
       pthread_join(worker_thread_ids[worker_id],NULL);
     }
+    pthread_join(input_thread_id,NULL);
 
     pthread_key_delete(global_request_key);
     /* Do not delete global_except_key, because worker threads might still need it */
@@ -2722,6 +2934,10 @@ main (int argc, char *argv[]) {
   Outbuffer_free(&outbuffer);
   Inbuffer_free(&inbuffer);	/* Also closes inputs, except for Goby */
 
+  if (output_bam_p == true) {
+    Bgzf_cleanup();
+  }
+
   if (output_goby_p == true) {
     Goby_writer_finish(gobywriter,gobyreader);
     Goby_writer_free(&gobywriter);
@@ -2750,13 +2966,17 @@ main (int argc, char *argv[]) {
   }
   if (genomealt != NULL) {
     Genome_free(&genomealt);
-    FREE(splicefrags_alt);	/* If genomealt == NULL, then splicefrags_alt == splicefrags_ref */
+    if (splicetrie_cache == NULL) {
+      FREE(splicefrags_alt);	/* If genomealt == NULL, then splicefrags_alt == splicefrags_ref */
+    }
   }
   if (genome != NULL) {
     Genome_free(&genome);
   }
 
-  if (nsplicesites > 0) {
+  if (splicetrie_cache != NULL) {
+    Splicetrie_cache_free(&splicetrie_cache); /* Arrays are mapped from the cache */
+  } else if (nsplicesites > 0) {
     if (splicetrie_precompute_p == true) {
       FREE(triecontents_max);
       FREE(trieoffsets_max);
@@ -2867,6 +3087,9 @@ Usage: gsnap [OPTIONS...] <FASTA file>, or\n\
 #ifdef HAVE_ZLIB
   fprintf(stdout,"\
   --gunzip                       Uncompress gzipped input files\n\
+  --gunzip-threads=INT           Threads for uncompressing gzipped input (default 2).  Files in BGZF\n\
+                                   format (from bgzip) are uncompressed in parallel; other gzip files\n\
+                                   use one thread.  If 0, the input thread uncompresses\n\
 ");
 #endif
 #ifdef HAVE_BZLIB
@@ -2917,6 +3140,23 @@ is still designed to be fast.\n\
                                    Values: 0 (no, default), or 1 (yes).\n\
                                    Expansion gives faster alignment, but requires more memory\n\
 ");
+#ifdef HAVE_SHM_OPEN
+  fprintf(stdout,"\
+  --shared-memory=STRING         Keep genome, offsets, and positions in POSIX shared memory segments\n\
+                                   that other gsnap processes on this host can attach, overriding --batch.\n\
+                                   Values: use (attach segments, creating any that are missing),\n\
+                                   load (create segments and exit without reading input),\n\
+                                   or remove (remove segments and exit).  Segments persist until removed;\n\
+                                   give load and remove the same index options as the jobs that use them.\n\
+");
+#endif
+  fprintf(stdout,"\
+  --prefetch-batch=INT           Number of reads each thread takes from the input buffer at a time\n\
+                                   (default 1).  If more than 1, index lookups for the next few reads\n\
+                                   are prefetched while the current one is aligned, which helps when\n\
+                                   memory latency dominates, as with short reads on large genomes.\n\
+                                   Keep nthreads times this value below --output-buffer-size\n\
+");
 
   fprintf(stdout,"\
   -m, --max-mismatches=FLOAT     Maximum number of mismatches allowed (if not specified, then\n\
@@ -3088,6 +3328,12 @@ is still designed to be fast.\n\
                                          splice site, but extend instead into the intron.  This flag makes\n\
                                          sense only if you provide the --use-splicing flag, and you are trying\n\
                                          to eliminate all soft clipping with --trim-mismatch-score=0\n\
+  --splicetrie-cache=STRING            Splicetrie cache for the --use-splicing file (default is the\n\
+                                         splicing file, with .splicetrie in place of .iit).  If the cache\n\
+                                         exists and matches the splicing file, genome, and -w and -v flags,\n\
+                                         its splicesites and tries are memory-mapped instead of being built\n\
+  --build-splicetrie-cache             Build the splicesites and tries for the --use-splicing file, write\n\
+                                         them to the splicetrie cache, and exit\n\
   -w, --localsplicedist=INT            Definition of local novel splicing event (default 200000)\n\
   --novelend-splicedist=INT            Distance to look for novel splices at the ends of reads (default 50000)\n\
   -e, --local-splice-penalty=INT       Penalty for a local splice (default 0).  Counts against mismatches allowed\n\
@@ -3168,12 +3414,12 @@ is still designed to be fast.\n\
 #ifdef HAVE_GOBY
   fprintf(stdout,"\
   -A, --format=STRING            Another format type, other than default.\n\
-                                   Currently implemented: sam, goby\n\
+                                   Currently implemented: sam, bam, goby\n\
 ");
 #else
   fprintf(stdout,"\
   -A, --format=STRING            Another format type, other than default.\n\
-                                   Currently implemented: sam\n\
+                                   Currently implemented: sam, bam\n\
                                    Also allowed, but not installed at compile-time: goby\n\
                                    (To install, need to re-compile with appropriate options)\n\
 ");
@@ -3188,7 +3434,15 @@ is still designed to be fast.\n\
                                    existing files.  Otherwise, the default is to create new files.\n\
   --output-buffer-size=INT       Buffer size, in queries, for output thread (default 1000).  When the number\n\
                                    of results to be printed exceeds this size, the worker threads are halted\n\
-                                   until the backlog is cleared\n\
+                                   until the backlog is cleared.  With --ordered, this is the size of the\n\
+                                   reordering window, and a worker waits while its query is this many\n\
+                                   queries ahead of the last one printed\n\
+  --print-in-workers             Have worker threads format their results, so the output thread only\n\
+                                   writes finished text.  Helps when output formatting is the bottleneck.\n\
+                                   Not compatible with --split-output, goby output, or --time, and ignored\n\
+                                   on systems without open_memstream\n\
+  --bam-threads=INT              Threads for compressing BAM output with -A bam (default 2).  If 0,\n\
+                                   the output thread compresses.  Works with --split-output\n\
 ");
   fprintf(stdout,"\n");
 
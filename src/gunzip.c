@@ -0,0 +1,619 @@
+static char rcsid[] = "$Id: gunzip.c $";
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gunzip.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "mem.h"
+
+#ifdef HAVE_PTHREAD
+#ifdef HAVE_SYS_TYPES_H
+#include <sys/types.h>		/* Needed to define pthread_t on Solaris */
+#endif
+#include <pthread.h>
+#endif
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+
+#ifdef DEBUG
+#define debug(x) x
+#else
+#define debug(x)
+#endif
+
+
+#define BLOCKSIZE 1048576	/* Bytes inflated at a time from ordinary gzip files */
+#define READSIZE 1048576	/* Compressed bytes read at a time */
+
+#define BGZF_HEADERLENGTH 18
+#define BGZF_FOOTERLENGTH 8
+#define BGZF_BLOCKS_PER_JOB 64	/* Up to 4 MB of output */
+
+typedef enum {COPY, GZIP, BGZF} Gunzip_mode_T;
+
+
+/* Holds compressed input (for BGZF) and inflated output for one job.
+   Jobs are numbered in file order, and job i goes to block i modulo
+   nblocks. */
+typedef struct Block_T *Block_T;
+struct Block_T {
+  unsigned char *input;
+  int inputlength;
+  int inputalloc;
+
+  char *output;
+  int outputlength;
+  int outputalloc;
+
+  bool readyp;
+};
+
+
+#define T Gunzip_T
+struct T {
+  char *filename;
+  FILE *fp;
+  Gunzip_mode_T mode;
+
+  unsigned char peek[BGZF_HEADERLENGTH]; /* Bytes read to determine the mode */
+  int npeek;
+  int peeki;
+
+#ifdef HAVE_ZLIB
+  z_stream strm;		/* Inflates ordinary gzip, across members */
+  z_stream bgzf_strm;		/* Inflates BGZF without threads */
+#endif
+  unsigned char *inbuffer;
+  bool streamendp;
+  bool inputdonep;
+
+  struct Block_T *blocks;
+  int nblocks;
+  unsigned int nextjob;
+  unsigned int nextread;
+
+  /* Reader */
+  Block_T current;
+  char *buffer;
+  int navail;
+  int bufferi;
+  bool eofp;
+
+#ifdef HAVE_PTHREAD
+  int nthreads;
+  int nrunning;
+  pthread_t *thread_ids;
+  pthread_mutex_t lock;
+  pthread_cond_t block_avail_p;
+  pthread_cond_t space_avail_p;
+  bool stopp;
+#endif
+};
+
+
+static int nthreads_bgzf = 0;
+
+/* Sets the number of threads for inflating BGZF input.  Other gzip
+   input is inflated by one thread, if nthreads > 0. */
+void
+Gunzip_setup (int nthreads) {
+  nthreads_bgzf = nthreads;
+  return;
+}
+
+
+static size_t
+read_input (T this, unsigned char *buffer, size_t length) {
+  size_t n = 0;
+
+  while (this->peeki < this->npeek && n < length) {
+    buffer[n++] = this->peek[this->peeki++];
+  }
+  if (n < length) {
+    n += fread(&(buffer[n]),sizeof(unsigned char),length - n,this->fp);
+  }
+  return n;
+}
+
+
+/* Expects the extra field written by bgzip and samtools */
+static bool
+bgzf_header_p (unsigned char *header) {
+  return (header[0] == 0x1f && header[1] == 0x8b && header[2] == 0x08 && (header[3] & 0x04) &&
+	  header[10] == 6 && header[11] == 0 && header[12] == 'B' && header[13] == 'C' &&
+	  header[14] == 2 && header[15] == 0) ? true : false;
+}
+
+static unsigned int
+get_uint32 (unsigned char *p) {
+  return (unsigned int) p[0] | (unsigned int) p[1] << 8 | (unsigned int) p[2] << 16 | (unsigned int) p[3] << 24;
+}
+
+
+/************************************************************************
+ *   Jobs
+ ************************************************************************/
+
+/* Reads the compressed input for a BGZF job.  Returns false at end of
+   file.  Called with the lock held, so jobs are read in order. */
+static bool
+read_bgzf_job (T this, Block_T block) {
+  unsigned char header[BGZF_HEADERLENGTH], *p;
+  int nread = 0, blocksize;
+  size_t n;
+
+  block->inputlength = 0;
+  while (nread < BGZF_BLOCKS_PER_JOB && (n = read_input(this,header,BGZF_HEADERLENGTH)) > 0) {
+    if (n < BGZF_HEADERLENGTH || bgzf_header_p(header) == false) {
+      fprintf(stderr,"Gzipped input %s starts in BGZF format, but has a block that is not BGZF\n",this->filename);
+      exit(9);
+    }
+    blocksize = ((int) header[16] | (int) header[17] << 8) + 1;
+    if (blocksize < BGZF_HEADERLENGTH + BGZF_FOOTERLENGTH) {
+      fprintf(stderr,"Gzipped input %s has a BGZF block of impossible size %d\n",this->filename,blocksize);
+      exit(9);
+    }
+
+    if (block->inputlength + blocksize > block->inputalloc) {
+      block->inputalloc = BGZF_BLOCKS_PER_JOB * 65536;
+      p = (unsigned char *) MALLOC(block->inputalloc*sizeof(unsigned char));
+      if (block->input != NULL) {
+	memcpy(p,block->input,block->inputlength);
+	FREE(block->input);
+      }
+      block->input = p;
+    }
+
+    memcpy(&(block->input[block->inputlength]),header,BGZF_HEADERLENGTH);
+    if ((int) read_input(this,&(block->input[block->inputlength + BGZF_HEADERLENGTH]),
+			 blocksize - BGZF_HEADERLENGTH) != blocksize - BGZF_HEADERLENGTH) {
+      fprintf(stderr,"Gzipped input %s ends in the middle of a BGZF block\n",this->filename);
+      exit(9);
+    }
+    block->inputlength += blocksize;
+    nread++;
+  }
+
+  return (nread > 0) ? true : false;
+}
+
+
+static void
+ensure_output (Block_T block, int length) {
+  if (length > block->outputalloc) {
+    if (block->output != NULL) {
+      FREE(block->output);
+    }
+    block->outputalloc = length;
+    block->output = (char *) MALLOC(block->outputalloc*sizeof(char));
+  }
+  return;
+}
+
+
+#ifdef HAVE_ZLIB
+/* Each BGZF block is a complete gzip member, so blocks of a job are
+   independent of other jobs */
+static void
+inflate_bgzf_job (T this, Block_T block, z_stream *strm) {
+  unsigned char *p, *end;
+  unsigned int isize, total = 0;
+  int blocksize;
+
+  end = &(block->input[block->inputlength]);
+  for (p = block->input; p < end; p += blocksize) {
+    blocksize = ((int) p[16] | (int) p[17] << 8) + 1;
+    total += get_uint32(&(p[blocksize - 4]));
+  }
+  ensure_output(block,total);
+
+  block->outputlength = 0;
+  for (p = block->input; p < end; p += blocksize) {
+    blocksize = ((int) p[16] | (int) p[17] << 8) + 1;
+    if ((isize = get_uint32(&(p[blocksize - 4]))) > 0) {
+      inflateReset(strm);
+      strm->next_in = &(p[BGZF_HEADERLENGTH]);
+      strm->avail_in = blocksize - BGZF_HEADERLENGTH - BGZF_FOOTERLENGTH;
+      strm->next_out = (unsigned char *) &(block->output[block->outputlength]);
+      strm->avail_out = isize;
+      if (inflate(strm,Z_FINISH) != Z_STREAM_END || strm->total_out != isize) {
+	fprintf(stderr,"Unable to inflate BGZF block in gzipped input %s\n",this->filename);
+	exit(9);
+      } else if (crc32(crc32(0L,NULL,0),(unsigned char *) &(block->output[block->outputlength]),isize) !=
+		 get_uint32(&(p[blocksize - 8]))) {
+	fprintf(stderr,"CRC error in BGZF block of gzipped input %s\n",this->filename);
+	exit(9);
+      }
+      block->outputlength += isize;
+    }
+  }
+
+  return;
+}
+
+
+/* Inflates the next BLOCKSIZE bytes of an ordinary gzip file.
+   Concatenated members are inflated in turn, as gzread does. */
+static void
+inflate_gzip_job (T this, Block_T block) {
+  z_stream *strm = &this->strm;
+  int status;
+
+  ensure_output(block,BLOCKSIZE);
+  strm->next_out = (unsigned char *) block->output;
+  strm->avail_out = BLOCKSIZE;
+
+  while (strm->avail_out > 0 && this->inputdonep == false) {
+    if (strm->avail_in == 0) {
+      if ((strm->avail_in = read_input(this,this->inbuffer,READSIZE)) == 0) {
+	if (this->streamendp == false) {
+	  fprintf(stderr,"Warning: gzipped input %s ends unexpectedly\n",this->filename);
+	}
+	this->inputdonep = true;
+	break;
+      }
+      strm->next_in = this->inbuffer;
+    }
+
+    if (this->streamendp == true) {
+      if (strm->next_in[0] != 0x1f) {
+	/* Trailing bytes that are not another member */
+	this->inputdonep = true;
+	break;
+      }
+      inflateReset(strm);
+      this->streamendp = false;
+    }
+
+    if ((status = inflate(strm,Z_NO_FLUSH)) == Z_STREAM_END) {
+      this->streamendp = true;
+    } else if (status != Z_OK && status != Z_BUF_ERROR) {
+      fprintf(stderr,"Error %d inflating gzipped input %s\n",status,this->filename);
+      exit(9);
+    }
+  }
+
+  block->outputlength = BLOCKSIZE - strm->avail_out;
+  return;
+}
+#endif
+
+
+static void
+copy_job (T this, Block_T block) {
+  ensure_output(block,BLOCKSIZE);
+  if ((block->outputlength = read_input(this,(unsigned char *) block->output,BLOCKSIZE)) < BLOCKSIZE) {
+    this->inputdonep = true;
+  }
+  return;
+}
+
+
+/* Called with the lock held.  Returns false if there are no more jobs. */
+static bool
+read_job (T this, Block_T block) {
+  if (this->mode == BGZF) {
+    return read_bgzf_job(this,block);
+  } else {
+    /* Only one thread, which reads while inflating */
+    return (this->inputdonep == true) ? false : true;
+  }
+}
+
+static void
+do_job (T this, Block_T block, void *bgzf_strm) {
+#ifdef HAVE_ZLIB
+  if (this->mode == BGZF) {
+    inflate_bgzf_job(this,block,(z_stream *) bgzf_strm);
+  } else if (this->mode == GZIP) {
+    inflate_gzip_job(this,block);
+  } else {
+    copy_job(this,block);
+  }
+#else
+  copy_job(this,block);
+#endif
+  return;
+}
+
+
+#ifdef HAVE_PTHREAD
+static void *
+inflate_thread (void *data) {
+  T this = (T) data;
+  Block_T block;
+#ifdef HAVE_ZLIB
+  z_stream strm;
+
+  memset(&strm,0,sizeof(z_stream));
+  inflateInit2(&strm,/*raw*/-15);
+#endif
+
+  pthread_mutex_lock(&this->lock);
+  while (1) {
+    /* Wait for the reader to release the block for the next job */
+    while (this->stopp == false && this->nextjob - this->nextread >= (unsigned int) this->nblocks) {
+      pthread_cond_wait(&this->space_avail_p,&this->lock);
+    }
+    block = &(this->blocks[this->nextjob % this->nblocks]);
+    if (this->stopp == true || read_job(this,block) == false) {
+      break;
+    }
+    this->nextjob += 1;
+    pthread_mutex_unlock(&this->lock);
+
+#ifdef HAVE_ZLIB
+    do_job(this,block,(void *) &strm);
+#else
+    do_job(this,block,(void *) NULL);
+#endif
+    debug(fprintf(stderr,"Inflated %d bytes\n",block->outputlength));
+
+    pthread_mutex_lock(&this->lock);
+    block->readyp = true;
+    pthread_cond_broadcast(&this->block_avail_p);
+  }
+
+  this->nrunning -= 1;
+  pthread_cond_broadcast(&this->block_avail_p);
+  pthread_mutex_unlock(&this->lock);
+
+#ifdef HAVE_ZLIB
+  inflateEnd(&strm);
+#endif
+  return (void *) NULL;
+}
+#endif
+
+
+/************************************************************************
+ *   Reader
+ ************************************************************************/
+
+/* Moves to the next block of output.  Returns false at end of input. */
+static bool
+next_block (T this) {
+  Block_T block;
+
+#ifdef HAVE_PTHREAD
+  if (this->nthreads > 0) {
+    pthread_mutex_lock(&this->lock);
+    if (this->current != NULL) {
+      this->current->readyp = false;
+      this->current = (Block_T) NULL;
+      this->nextread += 1;
+      pthread_cond_broadcast(&this->space_avail_p);
+    }
+
+    block = &(this->blocks[this->nextread % this->nblocks]);
+    while (block->readyp == false && (this->nrunning > 0 || this->nextread != this->nextjob)) {
+      pthread_cond_wait(&this->block_avail_p,&this->lock);
+    }
+    if (block->readyp == true) {
+      this->current = block;
+    }
+    pthread_mutex_unlock(&this->lock);
+
+    if (this->current == NULL) {
+      return false;
+    } else {
+      this->buffer = this->current->output;
+      this->navail = this->current->outputlength;
+      this->bufferi = 0;
+      return true;
+    }
+  }
+#endif
+
+  block = &(this->blocks[0]);
+  if (read_job(this,block) == false) {
+    return false;
+  } else {
+#ifdef HAVE_ZLIB
+    do_job(this,block,(void *) &this->bgzf_strm);
+#else
+    do_job(this,block,(void *) NULL);
+#endif
+    this->buffer = block->output;
+    this->navail = block->outputlength;
+    this->bufferi = 0;
+    return true;
+  }
+}
+
+
+/* Returns NULL if the file cannot be opened.  Input that is not
+   gzipped is passed through, as gzopen does. */
+T
+Gunzip_new (char *filename) {
+  T new;
+  FILE *fp;
+  int nthreads, i;
+
+  if ((fp = fopen(filename,"rb")) == NULL) {
+    return (T) NULL;
+  }
+
+  new = (T) MALLOC(sizeof(*new));
+  new->filename = (char *) CALLOC(strlen(filename)+1,sizeof(char));
+  strcpy(new->filename,filename);
+  new->fp = fp;
+
+  new->npeek = (int) fread(new->peek,sizeof(unsigned char),BGZF_HEADERLENGTH,fp);
+  new->peeki = 0;
+#ifdef HAVE_ZLIB
+  if (new->npeek == BGZF_HEADERLENGTH && bgzf_header_p(new->peek) == true) {
+    new->mode = BGZF;
+  } else if (new->npeek >= 2 && new->peek[0] == 0x1f && new->peek[1] == 0x8b) {
+    new->mode = GZIP;
+  } else {
+    new->mode = COPY;
+  }
+
+  memset(&new->strm,0,sizeof(z_stream));
+  memset(&new->bgzf_strm,0,sizeof(z_stream));
+  inflateInit2(&new->strm,/*gzip only*/15+16);
+  inflateInit2(&new->bgzf_strm,/*raw*/-15);
+#else
+  new->mode = COPY;
+#endif
+  debug(fprintf(stderr,"Gunzip mode for %s is %d\n",filename,new->mode));
+
+  new->inbuffer = (new->mode == GZIP) ? (unsigned char *) MALLOC(READSIZE*sizeof(unsigned char)) : NULL;
+  new->streamendp = false;
+  new->inputdonep = false;
+
+  if (new->mode == BGZF) {
+    nthreads = nthreads_bgzf;
+  } else {
+    nthreads = (nthreads_bgzf > 0) ? 1 : 0;
+  }
+#ifndef HAVE_PTHREAD
+  nthreads = 0;
+#endif
+
+  new->nblocks = (nthreads > 0) ? 2*nthreads + 2 : 1;
+  new->blocks = (struct Block_T *) CALLOC(new->nblocks,sizeof(struct Block_T));
+  new->nextjob = 0;
+  new->nextread = 0;
+
+  new->current = (Block_T) NULL;
+  new->buffer = (char *) NULL;
+  new->navail = 0;
+  new->bufferi = 0;
+  new->eofp = false;
+
+#ifdef HAVE_PTHREAD
+  new->nthreads = nthreads;
+  new->nrunning = nthreads;
+  new->stopp = false;
+  pthread_mutex_init(&new->lock,NULL);
+  pthread_cond_init(&new->block_avail_p,NULL);
+  pthread_cond_init(&new->space_avail_p,NULL);
+  if (nthreads > 0) {
+    new->thread_ids = (pthread_t *) CALLOC(nthreads,sizeof(pthread_t));
+    for (i = 0; i < nthreads; i++) {
+      pthread_create(&(new->thread_ids[i]),NULL,inflate_thread,(void *) new);
+    }
+  } else {
+    new->thread_ids = (pthread_t *) NULL;
+  }
+#endif
+
+  return new;
+}
+
+
+void
+Gunzip_free (T *old) {
+  int i;
+
+  if (*old) {
+#ifdef HAVE_PTHREAD
+    if ((*old)->nthreads > 0) {
+      pthread_mutex_lock(&(*old)->lock);
+      (*old)->stopp = true;
+      pthread_cond_broadcast(&(*old)->space_avail_p);
+      pthread_mutex_unlock(&(*old)->lock);
+      for (i = 0; i < (*old)->nthreads; i++) {
+	pthread_join((*old)->thread_ids[i],NULL);
+      }
+      FREE((*old)->thread_ids);
+    }
+    pthread_cond_destroy(&(*old)->space_avail_p);
+    pthread_cond_destroy(&(*old)->block_avail_p);
+    pthread_mutex_destroy(&(*old)->lock);
+#endif
+
+#ifdef HAVE_ZLIB
+    inflateEnd(&(*old)->bgzf_strm);
+    inflateEnd(&(*old)->strm);
+#endif
+
+    for (i = 0; i < (*old)->nblocks; i++) {
+      if ((*old)->blocks[i].input != NULL) {
+	FREE((*old)->blocks[i].input);
+      }
+      if ((*old)->blocks[i].output != NULL) {
+	FREE((*old)->blocks[i].output);
+      }
+    }
+    FREE((*old)->blocks);
+    if ((*old)->inbuffer != NULL) {
+      FREE((*old)->inbuffer);
+    }
+
+    fclose((*old)->fp);
+    FREE((*old)->filename);
+    FREE(*old);
+  }
+
+  return;
+}
+
+
+int
+Gunzip_getc (T this) {
+  while (this->navail == 0) {
+    if (this->eofp == true || next_block(this) == false) {
+      this->eofp = true;
+      return EOF;
+    }
+  }
+
+  this->navail -= 1;
+  return (int) (unsigned char) this->buffer[this->bufferi++];
+}
+
+
+/* True when no characters remain.  Unlike gzeof, does not need a read
+   to fail first. */
+bool
+Gunzip_eof (T this) {
+  while (this->navail == 0) {
+    if (this->eofp == true || next_block(this) == false) {
+      this->eofp = true;
+      return true;
+    }
+  }
+  return false;
+}
+
+
+/* Same as gzgets: reads up to maxlength - 1 characters, through the
+   first newline */
+char *
+Gunzip_gets (T this, char *buffer, int maxlength) {
+  int n = 0, length;
+  char *start, *p = NULL;
+
+  if (Gunzip_eof(this) == true) {
+    return (char *) NULL;
+  }
+
+  while (p == NULL && n < maxlength - 1 && Gunzip_eof(this) == false) {
+    start = &(this->buffer[this->bufferi]);
+    if ((length = this->navail) > maxlength - 1 - n) {
+      length = maxlength - 1 - n;
+    }
+    if ((p = memchr(start,'\n',length)) != NULL) {
+      length = (p - start) + 1;
+    }
+    memcpy(&(buffer[n]),start,length);
+    n += length;
+    this->bufferi += length;
+    this->navail -= length;
+  }
+
+  buffer[n] = '\0';
+  return buffer;
+}
+
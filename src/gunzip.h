@@ -0,0 +1,33 @@
+/* $Id: gunzip.h $ */
+#ifndef GUNZIP_INCLUDED
+#define GUNZIP_INCLUDED
+#include "bool.h"
+
+/* Reads gzipped input through large in-memory blocks, which are
+   inflated ahead of the reader on separate threads.  BGZF input, as
+   written by bgzip, is inflated in parallel, since each of its blocks
+   is a separate gzip member with a known size. */
+
+#define T Gunzip_T
+typedef struct T *T;
+
+extern void
+Gunzip_setup (int nthreads);
+
+extern T
+Gunzip_new (char *filename);
+
+extern void
+Gunzip_free (T *old);
+
+extern int
+Gunzip_getc (T this);
+
+extern bool
+Gunzip_eof (T this);
+
+extern char *
+Gunzip_gets (T this, char *buffer, int maxlength);
+
+#undef T
+#endif
@@ -28,6 +28,11 @@ static char rcsid[] = "$Id: inbuffer.c 90425 2013-03-27 16:27:35Z twu $";
 #endif
 
 
+/* Number of batches of nspaces requests each that the reader thread
+   may parse ahead of the workers */
+#define INBUFFER_NBATCHES 4
+
+
 #define T Inbuffer_T
 
 struct T {
@@ -40,8 +45,8 @@ struct T {
 #endif
 
 #ifdef HAVE_ZLIB
-  gzFile gzipped;
-  gzFile gzipped2;
+  Gunzip_T gzipped;
+  Gunzip_T gzipped2;
 #else
   void *gzipped;
   void *gzipped2;
@@ -86,6 +91,22 @@ struct T {
   int nleft;
   int inputid;
   int requestid;
+
+  /* Ring of batches for the parse-ahead reader thread.  buffer points
+     to batches[consumei] while workers are taking requests from it. */
+  bool readerp;
+  int nbatches;
+  Request_T **batches;
+  unsigned int *batch_nread;
+  int consumei;
+  int producei;
+  int nfilled;
+  bool eofp;
+
+#ifdef HAVE_PTHREAD
+  pthread_cond_t batch_filled_p;
+  pthread_cond_t batch_emptied_p;
+#endif
 };
 
 
@@ -115,6 +136,11 @@ Inbuffer_cmdline (char *contents, int length) {
 
   new->buffer[0] = Request_new(new->requestid++,Sequence_genomic_new(contents,length,/*copyp*/true));
 
+  new->readerp = false;
+  new->nbatches = 0;
+  new->batches = (Request_T **) NULL;
+  new->batch_nread = (unsigned int *) NULL;
+
 #ifdef HAVE_PTHREAD
   pthread_mutex_init(&new->lock,NULL);
 #endif
@@ -130,7 +156,7 @@ Inbuffer_new (int nextchar, FILE *input,
 #ifdef GSNAP
 	      FILE *input2,
 #ifdef HAVE_ZLIB
-	      gzFile gzipped, gzFile gzipped2,
+	      Gunzip_T gzipped, Gunzip_T gzipped2,
 #endif
 #ifdef HAVE_BZLIB
 	      Bzip2_T bzipped, Bzip2_T bzipped2,
@@ -151,6 +177,7 @@ Inbuffer_new (int nextchar, FILE *input,
 	      bool filter_if_both_p) {
 
   T new = (T) MALLOC(sizeof(*new));
+  int i;
 
   new->filter_if_both_p = filter_if_both_p;
   new->input = input;
@@ -203,9 +230,23 @@ Inbuffer_new (int nextchar, FILE *input,
 
 #ifdef HAVE_PTHREAD
   pthread_mutex_init(&new->lock,NULL);
+  pthread_cond_init(&new->batch_filled_p,NULL);
+  pthread_cond_init(&new->batch_emptied_p,NULL);
 #endif
 
-  new->buffer = (Request_T *) CALLOC(nspaces,sizeof(Request_T));
+  new->readerp = false;
+  new->nbatches = INBUFFER_NBATCHES;
+  new->batches = (Request_T **) CALLOC(new->nbatches,sizeof(Request_T *));
+  for (i = 0; i < new->nbatches; i++) {
+    new->batches[i] = (Request_T *) CALLOC(nspaces,sizeof(Request_T));
+  }
+  new->batch_nread = (unsigned int *) CALLOC(new->nbatches,sizeof(unsigned int));
+  new->consumei = 0;
+  new->producei = 0;
+  new->nfilled = 0;
+  new->eofp = false;
+
+  new->buffer = new->batches[0];
   new->ptr = 0;
   new->nleft = 0;
   new->inputid = 0;
@@ -223,10 +264,25 @@ Inbuffer_set_outbuffer (T this, Outbuffer_T outbuffer) {
 
 void
 Inbuffer_free (T *old) {
+  int i;
+
   if (*old) {
     /* No need to close input, since done by Shortread and Sequence read procedures */
 
-    FREE((*old)->buffer);
+    if ((*old)->batches == NULL) {
+      FREE((*old)->buffer);
+    } else {
+      for (i = 0; i < (*old)->nbatches; i++) {
+	FREE((*old)->batches[i]);
+      }
+      FREE((*old)->batches);
+      FREE((*old)->batch_nread);
+
+#ifdef HAVE_PTHREAD
+      pthread_cond_destroy(&(*old)->batch_emptied_p);
+      pthread_cond_destroy(&(*old)->batch_filled_p);
+#endif
+    }
     
 #ifdef HAVE_PTHREAD
     pthread_mutex_destroy(&(*old)->lock);
@@ -240,9 +296,11 @@ Inbuffer_free (T *old) {
 
 #ifdef GSNAP
 
-/* Returns number of requests read */
+/* Returns number of requests read into batch.  Called either by the
+   thread holding this->lock, or by the reader thread, which is then
+   the only one touching the input state. */
 static unsigned int
-fill_buffer (T this) {
+fill_batch (T this, Request_T *batch) {
   unsigned int nread = 0;
   unsigned int nchars = 0U;
   Shortread_T queryseq1, queryseq2;
@@ -279,7 +337,7 @@ fill_buffer (T this) {
 	  }
 
 	} else {
-	  this->buffer[nread++] = Request_new(this->requestid++,queryseq1,queryseq2);
+	  batch[nread++] = Request_new(this->requestid++,queryseq1,queryseq2);
 	  nchars += Shortread_fulllength(queryseq1);
 	  if (queryseq2 != NULL) {
 	    nchars += Shortread_fulllength(queryseq2);
@@ -320,7 +378,7 @@ fill_buffer (T this) {
 	  }
 
 	} else {
-	  this->buffer[nread++] = Request_new(this->requestid++,queryseq1,queryseq2);
+	  batch[nread++] = Request_new(this->requestid++,queryseq1,queryseq2);
 	  nchars += Shortread_fulllength(queryseq1);
 	  if (queryseq2 != NULL) {
 	    nchars += Shortread_fulllength(queryseq2);
@@ -360,7 +418,7 @@ fill_buffer (T this) {
 	  }
 
 	} else {
-	  this->buffer[nread++] = Request_new(this->requestid++,queryseq1,queryseq2);
+	  batch[nread++] = Request_new(this->requestid++,queryseq1,queryseq2);
 	  nchars += Shortread_fulllength(queryseq1);
 	  if (queryseq2 != NULL) {
 	    nchars += Shortread_fulllength(queryseq2);
@@ -400,7 +458,7 @@ fill_buffer (T this) {
 	}
 
       } else {
-	this->buffer[nread++] = Request_new(this->requestid++,queryseq1,queryseq2);
+	batch[nread++] = Request_new(this->requestid++,queryseq1,queryseq2);
 	nchars += Shortread_fulllength(queryseq1);
 	if (queryseq2 != NULL) {
 	  nchars += Shortread_fulllength(queryseq2);
@@ -442,7 +500,7 @@ fill_buffer (T this) {
 	  }
 
 	} else {
-	  this->buffer[nread++] = Request_new(this->requestid++,queryseq1,queryseq2);
+	  batch[nread++] = Request_new(this->requestid++,queryseq1,queryseq2);
 	  nchars += Shortread_fulllength(queryseq1);
 	  if (queryseq2 != NULL) {
 	    nchars += Shortread_fulllength(queryseq2);
@@ -483,7 +541,7 @@ fill_buffer (T this) {
 	  }
 
 	} else {
-	  this->buffer[nread++] = Request_new(this->requestid++,queryseq1,queryseq2);
+	  batch[nread++] = Request_new(this->requestid++,queryseq1,queryseq2);
 	  nchars += Shortread_fulllength(queryseq1);
 	  if (queryseq2 != NULL) {
 	    nchars += Shortread_fulllength(queryseq2);
@@ -524,7 +582,7 @@ fill_buffer (T this) {
 
 	} else {
 	  debug(printf("inbuffer creating request %d\n",this->requestid));
-	  this->buffer[nread++] = Request_new(this->requestid++,queryseq1,queryseq2);
+	  batch[nread++] = Request_new(this->requestid++,queryseq1,queryseq2);
 	  nchars += Shortread_fulllength(queryseq1);
 	  if (queryseq2 != NULL) {
 	    nchars += Shortread_fulllength(queryseq2);
@@ -535,17 +593,16 @@ fill_buffer (T this) {
     }
   }
 
-  this->nleft = nread;
-  this->ptr = 0;
-
   return nread;
 }
 
 #else
 	 
-/* Returns number of requests read */
+/* Returns number of requests read into batch.  Called either by the
+   thread holding this->lock, or by the reader thread, which is then
+   the only one touching the input state. */
 static unsigned int
-fill_buffer (T this) {
+fill_batch (T this, Request_T *batch) {
   unsigned int nread = 0;
   unsigned int nchars = 0U;
   Sequence_T queryseq;
@@ -560,20 +617,29 @@ fill_buffer (T this) {
       Sequence_free(&queryseq);
     } else {
       debug(printf("inbuffer creating request %d\n",this->requestid));
-      this->buffer[nread++] = Request_new(this->requestid++,queryseq);
+      batch[nread++] = Request_new(this->requestid++,queryseq);
       nchars += Sequence_fulllength(queryseq);
     }
     this->inputid++;
   }
 
+  return nread;
+}
+
+#endif
+
+
+static unsigned int
+fill_buffer (T this) {
+  unsigned int nread;
+
+  nread = fill_batch(this,this->buffer);
   this->nleft = nread;
   this->ptr = 0;
 
   return nread;
 }
 
-#endif
-
 
 /* No need to lock, since only main thread calls */
 /* Returns nread to give to Outbuffer_new */
@@ -585,10 +651,104 @@ Inbuffer_fill_init (T this) {
   nread = fill_buffer(this);
   debug(printf("inbuffer read %d sequences\n",nread));
 
+  if (this->batches != NULL && nread > 0) {
+    /* Initial batch occupies the first slot of the ring */
+    this->batch_nread[0] = nread;
+    this->consumei = 0;
+    this->producei = 1 % this->nbatches;
+    this->nfilled = 1;
+  }
+
   return nread;
 }
   
 
+#ifdef HAVE_PTHREAD
+/* Called by main thread before starting workers, if it will run
+   Inbuffer_thread_reader */
+void
+Inbuffer_set_reader (T this) {
+  if (this->batches != NULL && this->nbatches > 1) {
+    this->readerp = true;
+  }
+  return;
+}
+
+
+/* Parses batches ahead of the workers, so parsing and decompression
+   no longer happen under this->lock */
+void *
+Inbuffer_thread_reader (void *data) {
+  T this = (T) data;
+  unsigned int nread;
+  int producei;
+
+#ifdef MEMUSAGE
+  Mem_usage_set_threadname("inbuffer");
+#endif
+
+  do {
+    pthread_mutex_lock(&this->lock);
+    while (this->nfilled == this->nbatches) {
+      pthread_cond_wait(&this->batch_emptied_p,&this->lock);
+    }
+    producei = this->producei;
+    pthread_mutex_unlock(&this->lock);
+
+    /* Slot producei is not visible to workers until nfilled is incremented */
+    debug(printf("inbuffer reader filling batch %d\n",producei));
+    nread = fill_batch(this,this->batches[producei]);
+    Outbuffer_add_nread(this->outbuffer,nread);
+    debug(printf("inbuffer reader read %d sequences\n",nread));
+
+    pthread_mutex_lock(&this->lock);
+    if (nread == 0) {
+      this->eofp = true;
+      pthread_cond_broadcast(&this->batch_filled_p);
+    } else {
+      this->batch_nread[producei] = nread;
+      this->producei = (producei + 1) % this->nbatches;
+      this->nfilled += 1;
+      pthread_cond_signal(&this->batch_filled_p);
+    }
+    pthread_mutex_unlock(&this->lock);
+
+  } while (nread > 0);
+
+  return (void *) NULL;
+}
+
+
+/* Called with this->lock held.  Takes the next request from the ring,
+   waiting for the reader thread if necessary. */
+static Request_T
+get_request_from_reader (T this) {
+  Request_T request;
+
+  while (this->nleft == 0) {
+    if (this->nfilled > 0) {
+      this->buffer = this->batches[this->consumei];
+      this->nleft = this->batch_nread[this->consumei];
+      this->ptr = 0;
+    } else if (this->eofp == true) {
+      return (Request_T) NULL;
+    } else {
+      pthread_cond_wait(&this->batch_filled_p,&this->lock);
+    }
+  }
+
+  request = this->buffer[this->ptr++];
+  if (--this->nleft == 0) {
+    /* Requests have all been handed out, so slot can be refilled */
+    this->consumei = (this->consumei + 1) % this->nbatches;
+    this->nfilled -= 1;
+    pthread_cond_signal(&this->batch_emptied_p);
+  }
+
+  return request;
+}
+#endif
+
 
 Request_T
 #ifdef GSNAP
@@ -602,6 +762,12 @@ Inbuffer_get_request (Sequence_T *usersegment, T this, bool user_pairalign_p)
 
 #ifdef HAVE_PTHREAD
   pthread_mutex_lock(&this->lock);
+
+  if (this->readerp == true) {
+    request = get_request_from_reader(this);
+    pthread_mutex_unlock(&this->lock);
+    return request;
+  }
 #endif
   
   if (this->nleft > 0) {
@@ -642,7 +808,53 @@ Inbuffer_get_request (Sequence_T *usersegment, T this, bool user_pairalign_p)
 
 
 
-/* Same as Inbuffer_get_request, but leaves sequence in buffer */
+#ifdef GSNAP
+/* Gets up to nrequests requests under a single lock, so a worker can
+   prefetch across them.  Returns the number obtained, which is less
+   than nrequests only at the end of input. */
+int
+Inbuffer_get_requests (Request_T *requests, T this, int nrequests) {
+  int i = 0;
+  unsigned int nread;
+
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock(&this->lock);
+
+  if (this->readerp == true) {
+    while (i < nrequests && (requests[i] = get_request_from_reader(this)) != NULL) {
+      i++;
+    }
+    pthread_mutex_unlock(&this->lock);
+    return i;
+  }
+#endif
+
+  while (i < nrequests) {
+    if (this->nleft == 0) {
+      debug(printf("inbuffer filling\n"));
+      nread = fill_buffer(this);
+      Outbuffer_add_nread(this->outbuffer,nread);
+      debug(printf("inbuffer read %d sequences\n",nread));
+      if (nread == 0) {
+	/* Still empty */
+	break;
+      }
+    }
+    requests[i++] = this->buffer[this->ptr++];
+    this->nleft -= 1;
+  }
+
+#ifdef HAVE_PTHREAD
+  pthread_mutex_unlock(&this->lock);
+#endif
+
+  return i;
+}
+#endif
+
+
+/* Same as Inbuffer_get_request, but leaves sequence in buffer.  Called
+   only by main thread before any reader thread is started. */
 Request_T
 Inbuffer_first_request (T this) {
   Request_T request;
@@ -8,7 +8,7 @@
 #include "request.h"
 
 #ifdef HAVE_ZLIB
-#include <zlib.h>
+#include "gunzip.h"
 #endif
 
 #ifdef HAVE_BZLIB
@@ -29,7 +29,7 @@ Inbuffer_new (int nextchar, FILE *input,
 #ifdef GSNAP
 	      FILE *input2,
 #ifdef HAVE_ZLIB
-	      gzFile gzipped, gzFile gzipped2,
+	      Gunzip_T gzipped, Gunzip_T gzipped2,
 #endif
 #ifdef HAVE_BZLIB
 	      Bzip2_T bzipped, Bzip2_T bzipped2,
@@ -58,6 +58,14 @@ Inbuffer_free (T *old);
 extern unsigned int
 Inbuffer_fill_init (T this);
 
+#ifdef HAVE_PTHREAD
+extern void
+Inbuffer_set_reader (T this);
+
+extern void *
+Inbuffer_thread_reader (void *data);
+#endif
+
 extern Request_T
 #ifdef GSNAP
 Inbuffer_get_request (T this);
@@ -65,6 +73,11 @@ Inbuffer_get_request (T this);
 Inbuffer_get_request (Sequence_T *usersegment, T this, bool user_pairalign_p);
 #endif
 
+#ifdef GSNAP
+extern int
+Inbuffer_get_requests (Request_T *requests, T this, int nrequests);
+#endif
+
 
 extern Request_T
 Inbuffer_first_request (T this);
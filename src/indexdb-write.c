@@ -29,6 +29,9 @@ static char rcsid[] = "$Id: indexdb-write.c 99752 2013-06-27 21:10:19Z twu $";
 #ifdef HAVE_SYS_TYPES_H
 #include <sys/types.h>		/* For off_t */
 #endif
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 #if HAVE_DIRENT_H
 # include <dirent.h>
 # define NAMLEN(dirent) strlen((dirent)->d_name)
@@ -55,6 +58,8 @@ static char rcsid[] = "$Id: indexdb-write.c 99752 2013-06-27 21:10:19Z twu $";
 #include "genome_hr.h"		/* For read_gammas procedures */
 #include "iit-read-univ.h"
 #include "indexdb.h"
+#include "eliasfano.h"
+#include "positionsdelta.h"
 
 
 
@@ -131,6 +136,69 @@ write_gamma (FILE *offsetscomp_fp, Offsetscomp_T *offsets_buffer, int offsets_bu
 }
 
 
+/* Writes the same offsets as Elias-Fano blocks, next to the gamma
+   files, which are still needed by cmetindex, atoiindex, and
+   snpindex, and for expanding offsets */
+static void
+write_offsetsef (char *gammaptrsfile, char *offsetscompfile, Positionsptr_T *offsets,
+		 Oligospace_T oligospace, int blocksize) {
+  char *efptrsfile, *offsetseffile;
+  FILE *efptrs_fp, *offsetsef_fp;
+  Gammaptr_T *efptrs;
+  int efptri;
+  Oligospace_T oligoi;
+
+  Offsetscomp_T *words;
+  int nwords;
+  Gammaptr_T nwritten;
+
+  if ((efptrsfile = Access_filename_substitute(gammaptrsfile,"gammaptrs",EFPTRS_FILESUFFIX)) == NULL) {
+    return;
+  } else if ((offsetseffile = Access_filename_substitute(offsetscompfile,"offsetscomp",OFFSETSEF_FILESUFFIX)) == NULL) {
+    FREE(efptrsfile);
+    return;
+  }
+
+  if ((offsetsef_fp = FOPEN_WRITE_BINARY(offsetseffile)) == NULL) {
+    fprintf(stderr,"Can't write to file %s\n",offsetseffile);
+    exit(9);
+  }
+  efptrs = (Gammaptr_T *) CALLOC(oligospace/blocksize+1,sizeof(Gammaptr_T));
+  efptri = 0;
+  words = (Offsetscomp_T *) CALLOC(ELIASFANO_MAX_BLOCK_WORDS(blocksize),sizeof(Offsetscomp_T));
+
+  nwritten = 0U;
+  for (oligoi = 0; oligoi < oligospace; oligoi += blocksize) {
+    efptrs[efptri++] = nwritten;
+    nwords = Eliasfano_encode_block(words,&(offsets[oligoi]),blocksize);
+    FWRITE_UINTS(words,nwords,offsetsef_fp);
+    nwritten += nwords;
+  }
+
+  /* Final entry for i == oligospace, as for gammas, plus a word of
+     padding, because decoding reads one word past a block */
+  efptrs[efptri++] = nwritten;
+  words[0] = offsets[oligospace];
+  words[1] = 0U;
+  FWRITE_UINTS(words,2,offsetsef_fp);
+  FREE(words);
+  fclose(offsetsef_fp);
+
+  if ((efptrs_fp = FOPEN_WRITE_BINARY(efptrsfile)) == NULL) {
+    fprintf(stderr,"Can't write to file %s\n",efptrsfile);
+    exit(9);
+  } else {
+    FWRITE_UINTS(efptrs,efptri,efptrs_fp);
+    fclose(efptrs_fp);
+  }
+  FREE(efptrs);
+
+  FREE(offsetseffile);
+  FREE(efptrsfile);
+  return;
+}
+
+
 void
 Indexdb_write_gammaptrs (char *gammaptrsfile, char *offsetsfile, Positionsptr_T *offsets,
 			 Oligospace_T oligospace, int blocksize) {
@@ -219,6 +287,7 @@ Indexdb_write_gammaptrs (char *gammaptrsfile, char *offsetsfile, Positionsptr_T
     fclose(offsetscomp_fp);
     nwritten += 1;
 
+    write_offsetsef(gammaptrsfile,offsetsfile,offsets,oligospace,blocksize);
   }
 
   return;
@@ -376,6 +445,509 @@ power (int base, int exponent) {
 }
 
 
+#ifndef PMAP
+/************************************************************************
+ *   Building from the compressed genome, mapped into memory.  The
+ *   genome is scanned in rounds.  In each round, every thread scans
+ *   its own piece of the genome and groups the oligos it finds by
+ *   oligo range.  Then every thread takes one range, and collects
+ *   that range from the pieces in genome order, so the positions of
+ *   each oligo are stored in genome order, as by the serial
+ *   procedures.
+ ************************************************************************/
+
+#ifdef WORDS_BIGENDIAN
+#define GENOMECOMP(x) Bigendian_convert_uint(x)
+#else
+#define GENOMECOMP(x) (x)
+#endif
+
+/* Most nucleotides scanned by each thread in a round */
+#define SCAN_PIECE_LENGTH 262144
+
+/* A segment is a stretch of the genome that the serial procedures
+   scan with a continuous oligo, from one reset at a chromosome bound
+   to the next */
+struct Segment_T {
+  Univcoord_T start;
+  Univcoord_T end;		/* Exclusive */
+};
+
+/* Follows the chromosome bounds as the serial procedures do.  After
+   the last chromosome, every position is reset, so no oligos are
+   found there. */
+static struct Segment_T *
+compute_segments (int *nsegments, Univ_IIT_T chromosome_iit, Univcoord_T genomelength) {
+  struct Segment_T *segments;
+  Univcoord_T position = 0, next_chrbound;
+  int nchrs, chrnum, circular_typeint;
+
+  circular_typeint = Univ_IIT_typeint(chromosome_iit,"circular");
+  chrnum = 1;
+  nchrs = Univ_IIT_total_nintervals(chromosome_iit);
+  next_chrbound = Univ_IIT_next_chrbound(chromosome_iit,chrnum,circular_typeint);
+
+  segments = (struct Segment_T *) CALLOC(nchrs,sizeof(struct Segment_T));
+  *nsegments = 0;
+  while (chrnum <= nchrs && position < genomelength) {
+    segments[*nsegments].start = position;
+    if (next_chrbound > position) {
+      position = next_chrbound;
+    }
+    if (position >= genomelength) {
+      segments[(*nsegments)++].end = genomelength;
+    } else {
+      segments[(*nsegments)++].end = position + 1;
+    }
+
+    chrnum++;
+    while (chrnum <= nchrs && (next_chrbound = Univ_IIT_next_chrbound(chromosome_iit,chrnum,circular_typeint)) < position) {
+      chrnum++;
+    }
+    position++;
+  }
+
+  return segments;
+}
+
+
+/* An oligo found in a piece, with the position of its last
+   nucleotide relative to the start of the piece */
+struct Found_T {
+  Storedoligomer_T oligo;
+  UINT4 offset;
+};
+
+typedef struct Scan_T *Scan_T;
+struct Scan_T {
+  Genomecomp_T *genomecomp;
+  struct Segment_T *segments;
+  int nsegments;
+  int index1part;
+  int index1interval;
+
+  Oligospace_T oligo_start;	/* Oligos handled by all threads */
+  Oligospace_T oligo_end;
+  Oligospace_T *range_ends;	/* Oligos collected by each thread */
+  int nthreads;
+  int rangei;			/* Range collected by this thread */
+  Scan_T scans;			/* All threads, for collecting */
+
+  Univcoord_T piece_start;	/* Piece scanned by this thread in this round */
+  Univcoord_T piece_end;
+  struct Found_T *found;	/* Oligos in the piece, in genome order */
+  struct Found_T *buckets;	/* The same oligos, grouped by range */
+  int *bucket_starts;		/* Start of each range in buckets, and the end */
+
+  Positionsptr_T *offsets;
+  UINT4 *positions4;		/* If both positions are NULL, counts oligos into offsets */
+  UINT8 *positions8;
+  Positionsptr_T base;		/* Offset of positions[0] among all positions */
+};
+
+static int
+oligo_rangei (Oligospace_T *range_ends, int nranges, Storedoligomer_T oligo) {
+  int lowi = 0, highi = nranges - 1, middlei;
+
+  while (lowi < highi) {
+    middlei = lowi + (highi - lowi)/2;
+    if (oligo < range_ends[middlei]) {
+      highi = middlei;
+    } else {
+      lowi = middlei + 1;
+    }
+  }
+  return lowi;
+}
+
+static void *
+scan_piece (void *data) {
+  Scan_T this = (Scan_T) data;
+  Genomecomp_T *ptr, flags;
+  UINT8 nts;			/* The 32 nucleotides of a block, low word first */
+  Univcoord_T position, end, piece_start = this->piece_start, piece_end = this->piece_end;
+  Storedoligomer_T oligo, masked, mask;
+  Oligospace_T oligo_start = this->oligo_start, oligo_end = this->oligo_end;
+  struct Segment_T *segments = this->segments;
+  struct Found_T *found = this->found;
+  int *bucket_starts = this->bucket_starts;
+  int index1part = this->index1part, index1interval = this->index1interval;
+  int nsegments = this->nsegments, nranges = this->nthreads, nfound = 0;
+  int in_counter, bit, k, lowi, highi, middlei, rangei, i;
+  int chrpos_mod, sampled_mod;
+
+  mask = ~(~0UL << 2*index1part);
+
+  /* (chrpos-index1part+1U) % index1interval == 0, as in the serial
+     procedures, is tested without division by tracking chrpos modulo
+     index1interval */
+  sampled_mod = (index1part - 1) % index1interval;
+
+  /* Find the last segment that starts at or before the piece */
+  lowi = 0;
+  highi = nsegments;
+  while (lowi < highi) {
+    middlei = lowi + (highi - lowi)/2;
+    if (segments[middlei].start <= piece_start) {
+      lowi = middlei + 1;
+    } else {
+      highi = middlei;
+    }
+  }
+
+  for (k = (lowi > 0) ? lowi - 1 : 0; k < nsegments && segments[k].start < piece_end; k++) {
+    if (segments[k].end <= piece_start) {
+      continue;
+    }
+
+    /* Start early enough to fill the first oligo that ends in the
+       piece, so each oligo is found in the piece where it ends */
+    if (segments[k].start + (index1part - 1) >= piece_start) {
+      position = segments[k].start;
+    } else {
+      position = piece_start - (index1part - 1);
+    }
+    end = (segments[k].end < piece_end) ? segments[k].end : piece_end;
+
+    oligo = 0U; in_counter = 0;
+    chrpos_mod = (position - segments[k].start) % index1interval;
+
+    ptr = &(this->genomecomp[3*(position/32)]);
+    nts = ((UINT8) GENOMECOMP(ptr[0]) << 32) | (UINT8) GENOMECOMP(ptr[1]);
+    flags = GENOMECOMP(ptr[2]);
+    bit = position % 32;
+
+    while (position < end) {
+      if (bit == 32) {
+	ptr += 3;
+	nts = ((UINT8) GENOMECOMP(ptr[0]) << 32) | (UINT8) GENOMECOMP(ptr[1]);
+	flags = GENOMECOMP(ptr[2]);
+	bit = 0;
+      }
+
+      if (flags & (1U << bit)) {
+	/* N or X */
+	oligo = 0U; in_counter = 0;
+      } else {
+	oligo = (oligo << 2) | (Storedoligomer_T) ((nts >> 2*bit) & 3U);
+	if (++in_counter == index1part) {
+	  if (chrpos_mod == sampled_mod) {
+	    masked = oligo & mask;
+	    if (masked >= oligo_start && masked < oligo_end) {
+	      found[nfound].oligo = masked;
+	      found[nfound++].offset = (UINT4) (position - piece_start);
+	    }
+	  }
+	  in_counter--;
+	}
+      }
+
+      if (++chrpos_mod == index1interval) {
+	chrpos_mod = 0;
+      }
+      position++;
+      bit++;
+    }
+  }
+
+  /* Group by range, keeping genome order within each range */
+  for (rangei = 0; rangei <= nranges; rangei++) {
+    bucket_starts[rangei] = 0;
+  }
+  for (i = 0; i < nfound; i++) {
+    bucket_starts[oligo_rangei(this->range_ends,nranges,found[i].oligo) + 1] += 1;
+  }
+  for (rangei = 1; rangei <= nranges; rangei++) {
+    bucket_starts[rangei] += bucket_starts[rangei-1];
+  }
+  for (i = 0; i < nfound; i++) {
+    rangei = oligo_rangei(this->range_ends,nranges,found[i].oligo);
+    this->buckets[bucket_starts[rangei]++] = found[i];
+  }
+  for (rangei = nranges; rangei > 0; rangei--) {
+    bucket_starts[rangei] = bucket_starts[rangei-1];
+  }
+  bucket_starts[0] = 0;
+
+  return (void *) NULL;
+}
+
+/* Collects one range from the pieces of all threads, in genome order */
+static void *
+collect_range (void *data) {
+  Scan_T this = (Scan_T) data, piece;
+  struct Found_T *buckets;
+  Storedoligomer_T oligo;
+  Univcoord_T start;
+  Positionsptr_T *offsets = this->offsets;
+  UINT4 *positions4 = this->positions4;
+  UINT8 *positions8 = this->positions8;
+  Positionsptr_T base = this->base;
+  int rangei = this->rangei, t, i, end;
+
+  for (t = 0; t < this->nthreads; t++) {
+    piece = &(this->scans[t]);
+    buckets = piece->buckets;
+    start = piece->piece_start - this->index1part + 1U;
+    end = piece->bucket_starts[rangei+1];
+    for (i = piece->bucket_starts[rangei]; i < end; i++) {
+      oligo = buckets[i].oligo;
+      if (positions8 != NULL) {
+	positions8[offsets[oligo]++ - base] = start + buckets[i].offset;
+      } else if (positions4 != NULL) {
+	positions4[offsets[oligo]++ - base] = (UINT4) (start + buckets[i].offset);
+      } else {
+	offsets[oligo+1] += 1;
+      }
+    }
+  }
+
+  return (void *) NULL;
+}
+
+static void
+run_scans (struct Scan_T *scans, int nthreads, void *(*fcn)(void *)) {
+  int t;
+#ifdef HAVE_PTHREAD
+  pthread_t *threads;
+
+  if (nthreads > 1) {
+    threads = (pthread_t *) CALLOC(nthreads,sizeof(pthread_t));
+    for (t = 0; t < nthreads; t++) {
+      pthread_create(&(threads[t]),NULL,fcn,(void *) &(scans[t]));
+    }
+    for (t = 0; t < nthreads; t++) {
+      pthread_join(threads[t],NULL);
+    }
+    FREE(threads);
+    return;
+  }
+#endif
+
+  for (t = 0; t < nthreads; t++) {
+    (*fcn)((void *) &(scans[t]));
+  }
+  return;
+}
+
+
+/* Handles the oligos from oligo_start to oligo_end.  If positions4
+   and positions8 are NULL, adds the count of each oligo to
+   offsets[oligo+1].  Otherwise, stores the positions of each oligo
+   starting at offsets[oligo] - base, advancing offsets[oligo] as
+   compute_positions_in_memory does. */
+static void
+scan_genomecomp_range (UINT4 *positions4, UINT8 *positions8, Positionsptr_T *offsets, Positionsptr_T base,
+		       Oligospace_T oligo_start, Oligospace_T oligo_end, Genomecomp_T *genomecomp,
+		       struct Segment_T *segments, int nsegments, int index1part, int index1interval,
+		       int nthreads) {
+  struct Scan_T *scans;
+  Oligospace_T *range_ends, range_start = oligo_start, lowi, highi, middlei;
+  Univcoord_T genomelength, round_start, piece_length;
+  Positionsptr_T target;
+  int t;
+
+  if (nsegments == 0) {
+    return;
+  } else {
+    genomelength = segments[nsegments-1].end;
+  }
+
+  /* A genome shorter than one round is divided evenly */
+  if ((piece_length = (genomelength + nthreads - 1) / nthreads) > SCAN_PIECE_LENGTH) {
+    piece_length = SCAN_PIECE_LENGTH;
+  }
+
+  /* Oligo ranges are balanced by the number of positions when they
+     are known, and are equal otherwise */
+  range_ends = (Oligospace_T *) CALLOC(nthreads,sizeof(Oligospace_T));
+  for (t = 0; t < nthreads; t++) {
+    if (t == nthreads - 1) {
+      range_ends[t] = oligo_end;
+    } else if (positions4 == NULL && positions8 == NULL) {
+      range_ends[t] = oligo_start + (oligo_end - oligo_start) / nthreads * (t + 1);
+    } else {
+      /* Find the first oligo whose positions start at or after the target */
+      target = offsets[oligo_start] +
+	(Positionsptr_T) ((double) (offsets[oligo_end] - offsets[oligo_start]) / nthreads * (t + 1));
+      lowi = range_start;
+      highi = oligo_end;
+      while (lowi < highi) {
+	middlei = lowi + (highi - lowi)/2;
+	if (offsets[middlei] < target) {
+	  lowi = middlei + 1;
+	} else {
+	  highi = middlei;
+	}
+      }
+      range_ends[t] = lowi;
+    }
+    range_start = range_ends[t];
+  }
+
+  scans = (struct Scan_T *) CALLOC(nthreads,sizeof(struct Scan_T));
+  for (t = 0; t < nthreads; t++) {
+    scans[t].genomecomp = genomecomp;
+    scans[t].segments = segments;
+    scans[t].nsegments = nsegments;
+    scans[t].index1part = index1part;
+    scans[t].index1interval = index1interval;
+
+    scans[t].oligo_start = oligo_start;
+    scans[t].oligo_end = oligo_end;
+    scans[t].range_ends = range_ends;
+    scans[t].nthreads = nthreads;
+    scans[t].rangei = t;
+    scans[t].scans = scans;
+
+    scans[t].found = (struct Found_T *) CALLOC(piece_length,sizeof(struct Found_T));
+    scans[t].buckets = (struct Found_T *) CALLOC(piece_length,sizeof(struct Found_T));
+    scans[t].bucket_starts = (int *) CALLOC(nthreads+1,sizeof(int));
+
+    scans[t].offsets = offsets;
+    scans[t].positions4 = positions4;
+    scans[t].positions8 = positions8;
+    scans[t].base = base;
+  }
+
+  for (round_start = 0; round_start < genomelength; round_start += (Univcoord_T) nthreads * piece_length) {
+    for (t = 0; t < nthreads; t++) {
+      if ((scans[t].piece_start = round_start + (Univcoord_T) t * piece_length) > genomelength) {
+	scans[t].piece_start = genomelength;
+      }
+      if ((scans[t].piece_end = scans[t].piece_start + piece_length) > genomelength) {
+	scans[t].piece_end = genomelength;
+      }
+    }
+    run_scans(scans,nthreads,scan_piece);
+    run_scans(scans,nthreads,collect_range);
+  }
+
+  for (t = 0; t < nthreads; t++) {
+    FREE(scans[t].bucket_starts);
+    FREE(scans[t].buckets);
+    FREE(scans[t].found);
+  }
+  FREE(scans);
+  FREE(range_ends);
+
+  return;
+}
+
+static Genomecomp_T *
+map_genomecomp (int *fd, size_t *len, struct Segment_T **segments, int *nsegments,
+		char *genomecompfile, Univ_IIT_T chromosome_iit) {
+  Genomecomp_T *genomecomp;
+
+  genomecomp = (Genomecomp_T *) Access_mmap(&(*fd),&(*len),genomecompfile,sizeof(Genomecomp_T),/*randomp*/false);
+  if (genomecomp == NULL) {
+    fprintf(stderr,"Error: could not mmap file %s\n",genomecompfile);
+    exit(9);
+  }
+  *segments = compute_segments(&(*nsegments),chromosome_iit,
+			       /*genomelength*/32 * (Univcoord_T) (*len/(3*sizeof(Genomecomp_T))));
+  return genomecomp;
+}
+
+/* Counts or stores the positions of all oligos, as scan_genomecomp_range does */
+static void
+scan_genomecomp_parallel (UINT4 *positions4, UINT8 *positions8, Positionsptr_T *offsets,
+			  char *genomecompfile, Univ_IIT_T chromosome_iit, int index1part,
+			  int index1interval, int nthreads) {
+  Genomecomp_T *genomecomp;
+  struct Segment_T *segments;
+  int nsegments, fd;
+  size_t len;
+
+  genomecomp = map_genomecomp(&fd,&len,&segments,&nsegments,genomecompfile,chromosome_iit);
+  scan_genomecomp_range(positions4,positions8,offsets,/*base*/0U,/*oligo_start*/0,
+			/*oligo_end*/power(4,index1part),genomecomp,segments,nsegments,
+			index1part,index1interval,nthreads);
+
+  FREE(segments);
+  munmap((void *) genomecomp,len);
+  close(fd);
+
+  return;
+}
+
+
+/* Builds the positions with a buffer of at most maxcount entries.
+   The oligospace is divided into ranges whose positions fit in the
+   buffer, and the genome is scanned once for each range, after which
+   the positions of the range are appended to the file.  Since the
+   positions file is ordered by oligo, it is written sequentially. */
+static void
+compute_positions_in_ranges (FILE *positions_fp, Positionsptr_T *offsets, Positionsptr_T maxcount,
+			     char *genomecompfile, Univ_IIT_T chromosome_iit, int index1part,
+			     int index1interval, bool coord_values_8p, int nthreads) {
+  Genomecomp_T *genomecomp;
+  struct Segment_T *segments;
+  UINT4 *positions4 = NULL;
+  UINT8 *positions8 = NULL;
+  Oligospace_T oligospace, oligo_start, oligo_end, lowi, highi, middlei, oligoi;
+  Positionsptr_T base, count;
+  int nsegments, fd, nranges = 0;
+  size_t len;
+
+  oligospace = power(4,index1part);
+
+  /* A single oligo cannot be split among ranges */
+  for (oligoi = 0; oligoi < oligospace; oligoi++) {
+    if (offsets[oligoi+1] - offsets[oligoi] > maxcount) {
+      maxcount = offsets[oligoi+1] - offsets[oligoi];
+    }
+  }
+  if (coord_values_8p == true) {
+    positions8 = (UINT8 *) CALLOC(maxcount,sizeof(UINT8));
+  } else {
+    positions4 = (UINT4 *) CALLOC(maxcount,sizeof(UINT4));
+  }
+
+  genomecomp = map_genomecomp(&fd,&len,&segments,&nsegments,genomecompfile,chromosome_iit);
+
+  for (oligo_start = 0; oligo_start < oligospace; oligo_start = oligo_end) {
+    /* Find the last oligo_end whose positions fit after oligo_start */
+    base = offsets[oligo_start];
+    lowi = oligo_start + 1;
+    highi = oligospace;
+    while (lowi < highi) {
+      middlei = lowi + (highi - lowi + 1)/2;
+      if (offsets[middlei] - base <= maxcount) {
+	lowi = middlei;
+      } else {
+	highi = middlei - 1;
+      }
+    }
+    oligo_end = lowi;
+    count = offsets[oligo_end] - base;
+
+    fprintf(stderr,"Storing %u positions for oligomers %llu to %llu (range %d)\n",
+	    count,(unsigned long long) oligo_start,(unsigned long long) oligo_end - 1,++nranges);
+    scan_genomecomp_range(positions4,positions8,offsets,base,oligo_start,oligo_end,
+			  genomecomp,segments,nsegments,index1part,index1interval,nthreads);
+    if (coord_values_8p == true) {
+      FWRITE_UINT8S(positions8,count,positions_fp);
+    } else {
+      FWRITE_UINTS(positions4,count,positions_fp);
+    }
+  }
+
+  FREE(segments);
+  munmap((void *) genomecomp,len);
+  close(fd);
+
+  if (coord_values_8p == true) {
+    FREE(positions8);
+  } else {
+    FREE(positions4);
+  }
+
+  return;
+}
+#endif
+
+
 void
 Indexdb_write_offsets (char *gammaptrsfile, char *offsetscompfile, FILE *sequence_fp, Univ_IIT_T chromosome_iit,
 		       int offsetscomp_basesize,
@@ -384,7 +956,8 @@ Indexdb_write_offsets (char *gammaptrsfile, char *offsetscompfile, FILE *sequenc
 #else
 		       int index1part,
 #endif
-		       int index1interval, bool genome_lc_p, char *fileroot, bool mask_lowercase_p) {
+		       int index1interval, bool genome_lc_p, char *fileroot, bool mask_lowercase_p,
+		       char *genomecompfile, int nthreads) {
   char *uppercaseCode;
 
   /* If offsets[oligospace] > 2^32, then will will want to allocate and write 8-mers for offsets file */
@@ -464,6 +1037,14 @@ Indexdb_write_offsets (char *gammaptrsfile, char *offsetscompfile, FILE *sequenc
   nchrs = Univ_IIT_total_nintervals(chromosome_iit);
   next_chrbound = Univ_IIT_next_chrbound(chromosome_iit,chrnum,circular_typeint);
 
+#ifndef PMAP
+  if (genomecompfile != NULL) {
+    fprintf(stderr,"Indexing offsets of oligomers in genome %s (%d bp every %d bp) from %s with %d threads\n",
+	    fileroot,index1part,index1interval,genomecompfile,nthreads);
+    scan_genomecomp_parallel(/*positions4*/NULL,/*positions8*/NULL,offsets,genomecompfile,chromosome_iit,
+			     index1part,index1interval,nthreads);
+  } else
+#endif
   while ((c = Compress_get_char(sequence_fp,position,genome_lc_p)) != EOF) {
 #ifdef PMAP
     if (++frame == 3) {
@@ -1194,6 +1775,157 @@ compute_positions_in_memory (UINT4 *positions4, UINT8 *positions8, Positionsptr_
 
 #define WRITE_CHUNK 1000000
 
+/* Writes the positions again in the compressed format of
+   positionsdelta.c.  Needs all positions in memory.  Storing the
+   positions has advanced offsets[oligo] to the end of oligo, which is
+   the start of oligo + 1.  Returns true if the file was written. */
+static bool
+write_positionsdelta (char *positionsfile, Positionsptr_T *offsets, Oligospace_T oligospace,
+		      UINT4 *positions4, UINT8 *positions8, Positionsptr_T totalcounts) {
+  char *deltafile, *blocksfile;
+  FILE *delta_fp, *blocks_fp;
+  UINT4 *words, header[POSITIONSDELTA_HEADER_WORDS];
+  UINT8 values[POSITIONSDELTA_BLOCKSIZE], startbits, prev, maxvalue;
+  Positionsptr_T ptr0, ptr, start;
+  Oligospace_T oligoi;
+  UINT4 nwritten;
+  int rawwidth, nwords, n, i;
+
+  if ((deltafile = Access_filename_substitute(positionsfile,"positions",POSITIONSDELTA_FILESUFFIX)) == NULL) {
+    return false;
+  }
+  blocksfile = Access_filename_substitute(positionsfile,"positions",POSITIONSBLOCKS_FILESUFFIX);
+
+  maxvalue = 0ULL;
+  for (ptr = 0; ptr < totalcounts; ptr++) {
+    if (positions8 != NULL && positions8[ptr] > maxvalue) {
+      maxvalue = positions8[ptr];
+    } else if (positions4 != NULL && positions4[ptr] > maxvalue) {
+      maxvalue = positions4[ptr];
+    }
+  }
+  for (rawwidth = 1; (maxvalue >> rawwidth) != 0; rawwidth++) ;
+
+  if ((delta_fp = FOPEN_WRITE_BINARY(deltafile)) == NULL) {
+    fprintf(stderr,"Can't write to file %s\n",deltafile);
+    exit(9);
+  } else if ((blocks_fp = FOPEN_WRITE_BINARY(blocksfile)) == NULL) {
+    fprintf(stderr,"Can't write to file %s\n",blocksfile);
+    exit(9);
+  }
+  fprintf(stderr,"Writing compressed genomic positions to file %s, with %d bits per oligomer start ...\n",
+	  deltafile,rawwidth);
+
+  words = (UINT4 *) CALLOC(POSITIONSDELTA_MAX_BLOCK_WORDS,sizeof(UINT4));
+  nwritten = 0U;
+  prev = 0ULL;
+  oligoi = 0;
+  start = 0U;
+  for (ptr0 = 0; ptr0 < totalcounts; ptr0 += POSITIONSDELTA_BLOCKSIZE) {
+    if ((n = totalcounts - ptr0) > POSITIONSDELTA_BLOCKSIZE) {
+      n = POSITIONSDELTA_BLOCKSIZE;
+    }
+    for (i = 0; i < n; i++) {
+      values[i] = (positions8 != NULL) ? positions8[ptr0+i] : (UINT8) positions4[ptr0+i];
+    }
+
+    startbits = 0ULL;
+    while (oligoi < oligospace && start < ptr0 + n) {
+      if (offsets[oligoi] > start) {
+	startbits |= (1ULL << (start - ptr0));
+      }
+      start = offsets[oligoi++];
+    }
+
+    header[0] = nwritten;
+    nwords = Positionsdelta_encode_block(words,header,values,n,startbits,prev,rawwidth);
+    FWRITE_UINTS(header,POSITIONSDELTA_HEADER_WORDS,blocks_fp);
+    FWRITE_UINTS(words,nwords,delta_fp);
+    nwritten += nwords;
+    prev = values[n-1];
+  }
+
+  /* Padding, because decoding reads one word past a block */
+  words[0] = words[1] = 0U;
+  FWRITE_UINTS(words,2,delta_fp);
+  FREE(words);
+
+  fclose(blocks_fp);
+  fclose(delta_fp);
+  fprintf(stderr,"Compressed positions take %lu bytes, versus %lu\n",
+	  (unsigned long) (nwritten + 2U)*sizeof(UINT4) +
+	  (unsigned long) ((totalcounts + POSITIONSDELTA_BLOCKSIZE - 1)/POSITIONSDELTA_BLOCKSIZE)*POSITIONSDELTA_HEADER_WORDS*sizeof(UINT4),
+	  (unsigned long) totalcounts*((positions8 != NULL) ? sizeof(UINT8) : sizeof(UINT4)));
+
+  FREE(blocksfile);
+  FREE(deltafile);
+  return true;
+}
+
+
+/* Writes the 8-byte positions again with 5 bytes each, which the
+   readers use if present.  Reads them back from the positions file,
+   so this works however that file was built.  Every position lies
+   below the genome length, so the caller checks that against
+   POSITIONS40_MASK beforehand. */
+static void
+write_positions40 (char *positionsfile, Positionsptr_T totalcounts) {
+  char *positions40file;
+  FILE *input_fp, *output_fp;
+  UINT8 *values;
+  unsigned char *bytes, *p;
+  Positionsptr_T count;
+  size_t nbytes;
+  int n, i, j;
+
+  if ((positions40file = Access_filename_substitute(positionsfile,"positions",POSITIONS40_FILESUFFIX)) == NULL) {
+    return;
+  } else if ((input_fp = FOPEN_READ_BINARY(positionsfile)) == NULL) {
+    fprintf(stderr,"Can't read file %s\n",positionsfile);
+    exit(9);
+  } else if ((output_fp = FOPEN_WRITE_BINARY(positions40file)) == NULL) {
+    fprintf(stderr,"Can't write to file %s\n",positions40file);
+    exit(9);
+  }
+  fprintf(stderr,"Writing 5-byte genomic positions to file %s ...\n",positions40file);
+
+  values = (UINT8 *) CALLOC(WRITE_CHUNK,sizeof(UINT8));
+  bytes = (unsigned char *) CALLOC(WRITE_CHUNK*POSITIONS40_NBYTES,sizeof(unsigned char));
+  for (count = 0; count < totalcounts; count += n) {
+    if ((n = totalcounts - count) > WRITE_CHUNK) {
+      n = WRITE_CHUNK;
+    }
+    if (FREAD_UINT8S(values,n,input_fp) != (size_t) n) {
+      fprintf(stderr,"Could not read all positions from %s\n",positionsfile);
+      exit(9);
+    }
+    p = bytes;
+    for (i = 0; i < n; i++) {
+      for (j = 0; j < POSITIONS40_NBYTES; j++) {
+	*p++ = (unsigned char) (values[i] >> (8*j));
+      }
+    }
+    fwrite(bytes,sizeof(unsigned char),n*POSITIONS40_NBYTES,output_fp);
+  }
+  fclose(input_fp);
+
+  /* Padding, because readers load 8 bytes at a time, and to a whole word */
+  nbytes = (size_t) totalcounts*POSITIONS40_NBYTES;
+  memset(bytes,0,8);
+  n = sizeof(UINT8) - POSITIONS40_NBYTES;
+  n += (sizeof(UINT4) - (nbytes + n) % sizeof(UINT4)) % sizeof(UINT4);
+  fwrite(bytes,sizeof(unsigned char),n,output_fp);
+  fclose(output_fp);
+  FREE(bytes);
+  FREE(values);
+
+  fprintf(stderr,"5-byte positions take %lu bytes, versus %lu\n",
+	  (unsigned long) (nbytes + n),(unsigned long) totalcounts*sizeof(UINT8));
+
+  FREE(positions40file);
+  return;
+}
+
 void
 Indexdb_write_positions (char *positionsfile, char *gammaptrsfile, char *offsetscompfile,
 			 FILE *sequence_fp, Univ_IIT_T chromosome_iit, int offsetscomp_basesize,
@@ -1203,7 +1935,8 @@ Indexdb_write_positions (char *positionsfile, char *gammaptrsfile, char *offsets
 			 int index1part,
 #endif
 			 int index1interval, bool genome_lc_p, bool writefilep,
-			 char *fileroot, bool mask_lowercase_p, bool coord_values_8p) {
+			 char *fileroot, bool mask_lowercase_p, bool coord_values_8p, bool deltap,
+			 char *genomecompfile, int nthreads, size_t build_memory) {
   FILE *positions_fp;		/* For building positions in memory */
   int positions_fd;		/* For building positions in file */
   Positionsptr_T *offsets = NULL, totalcounts, count;
@@ -1211,6 +1944,10 @@ Indexdb_write_positions (char *positionsfile, char *gammaptrsfile, char *offsets
   UINT8 *positions8;
   Oligospace_T oligospace;
   off_t filesize;
+  bool deltawrittenp = false;
+#ifndef PMAP
+  size_t positions_memory, offsets_memory;
+#endif
 
 #ifdef PMAP
   offsets = Indexdb_offsets_from_gammas(gammaptrsfile,offsetscompfile,offsetscomp_basesize,
@@ -1239,12 +1976,48 @@ Indexdb_write_positions (char *positionsfile, char *gammaptrsfile, char *offsets
 			      coord_values_8p);
 #endif
     close(positions_fd);
+    if (deltap == true) {
+      fprintf(stderr,"Compressed positions need positions built in memory, so not writing them\n");
+    }
+
+#ifndef PMAP
+  } else if (build_memory > 0 && genomecompfile != NULL &&
+	     (positions_memory = (size_t) totalcounts * (coord_values_8p == true ? sizeof(UINT8) : sizeof(UINT4))) +
+	     (offsets_memory = (size_t) (oligospace + 1) * sizeof(Positionsptr_T)) > build_memory) {
+    /* The offsets must stay in memory, and the rest of the limit goes to the positions */
+    if (offsets_memory + WRITE_CHUNK * sizeof(UINT8) > build_memory) {
+      count = WRITE_CHUNK;
+    } else {
+      count = (build_memory - offsets_memory) / (coord_values_8p == true ? sizeof(UINT8) : sizeof(UINT4));
+    }
+    fprintf(stderr,"Offsets and positions need %lu bytes, more than the memory limit of %lu bytes.  Building positions in ranges of at most %u positions.\n",
+	    (unsigned long) (offsets_memory + positions_memory),(unsigned long) build_memory,count);
+    if (deltap == true) {
+      fprintf(stderr,"Compressed positions need positions built in memory, so not writing them\n");
+    }
+    if ((positions_fp = FOPEN_WRITE_BINARY(positionsfile)) == NULL) {
+      fprintf(stderr,"Can't open file %s\n",positionsfile);
+      exit(9);
+    }
+    compute_positions_in_ranges(positions_fp,offsets,/*maxcount*/count,genomecompfile,chromosome_iit,
+				index1part,index1interval,coord_values_8p,nthreads);
+    fclose(positions_fp);
+
+    if ((filesize = Access_filesize(positionsfile)) != (off_t) positions_memory) {
+      fprintf(stderr,"Error after build in ranges: expected file size for %s is %lu, but observed only %lu.  Please notify twu@gene.com of this error.\n",
+	      positionsfile,(unsigned long) positions_memory,filesize);
+      abort();
+    }
+#endif
 
   } else if (coord_values_8p == true) {
     fprintf(stderr,"Trying to allocate %u*%d bytes of memory...",totalcounts,(int) sizeof(UINT8));
     positions8 = (UINT8 *) CALLOC_NO_EXCEPTION(totalcounts,sizeof(UINT8));
     if (positions8 == NULL) {
       fprintf(stderr,"failed.  Building positions in file.\n");
+      if (deltap == true) {
+	fprintf(stderr,"Compressed positions need positions built in memory, so not writing them\n");
+      }
       positions_fd = Access_fileio_rw(positionsfile);
 #ifdef PMAP
       compute_positions_in_file(positions_fd,offsets,sequence_fp,chromosome_iit,
@@ -1274,9 +2047,15 @@ Indexdb_write_positions (char *positionsfile, char *gammaptrsfile, char *offsets
 				  index1part_aa,watsonp,index1interval,genome_lc_p,fileroot,
 				  mask_lowercase_p,/*coord_values_8p*/true);
 #else
-      compute_positions_in_memory(/*positions4*/NULL,positions8,offsets,sequence_fp,chromosome_iit,
-				  index1part,index1interval,genome_lc_p,fileroot,
-				  mask_lowercase_p,/*coord_values_8p*/true);
+      if (genomecompfile != NULL) {
+	fprintf(stderr,"Storing positions from %s with %d threads\n",genomecompfile,nthreads);
+	scan_genomecomp_parallel(/*positions4*/NULL,positions8,offsets,genomecompfile,chromosome_iit,
+				 index1part,index1interval,nthreads);
+      } else {
+	compute_positions_in_memory(/*positions4*/NULL,positions8,offsets,sequence_fp,chromosome_iit,
+				    index1part,index1interval,genome_lc_p,fileroot,
+				    mask_lowercase_p,/*coord_values_8p*/true);
+      }
 #endif
       fprintf(stderr,"Writing %u genomic positions to file %s ...\n",
 	      totalcounts,positionsfile);
@@ -1306,6 +2085,9 @@ Indexdb_write_positions (char *positionsfile, char *gammaptrsfile, char *offsets
 	}
       }
 
+      if (deltap == true) {
+	deltawrittenp = write_positionsdelta(positionsfile,offsets,oligospace,/*positions4*/NULL,positions8,totalcounts);
+      }
       FREE(positions8);
     }
 
@@ -1314,6 +2096,9 @@ Indexdb_write_positions (char *positionsfile, char *gammaptrsfile, char *offsets
     positions4 = (UINT4 *) CALLOC_NO_EXCEPTION(totalcounts,sizeof(UINT4));
     if (positions4 == NULL) {
       fprintf(stderr,"failed.  Building positions in file.\n");
+      if (deltap == true) {
+	fprintf(stderr,"Compressed positions need positions built in memory, so not writing them\n");
+      }
       positions_fd = Access_fileio_rw(positionsfile);
 #ifdef PMAP
       compute_positions_in_file(positions_fd,offsets,sequence_fp,chromosome_iit,
@@ -1343,9 +2128,15 @@ Indexdb_write_positions (char *positionsfile, char *gammaptrsfile, char *offsets
 				  index1part_aa,watsonp,index1interval,genome_lc_p,fileroot,
 				  mask_lowercase_p,/*coord_values_8p*/false);
 #else
-      compute_positions_in_memory(positions4,/*positions8*/NULL,offsets,sequence_fp,chromosome_iit,
-				  index1part,index1interval,genome_lc_p,fileroot,
-				  mask_lowercase_p,/*coord_values_8p*/false);
+      if (genomecompfile != NULL) {
+	fprintf(stderr,"Storing positions from %s with %d threads\n",genomecompfile,nthreads);
+	scan_genomecomp_parallel(positions4,/*positions8*/NULL,offsets,genomecompfile,chromosome_iit,
+				 index1part,index1interval,nthreads);
+      } else {
+	compute_positions_in_memory(positions4,/*positions8*/NULL,offsets,sequence_fp,chromosome_iit,
+				    index1part,index1interval,genome_lc_p,fileroot,
+				    mask_lowercase_p,/*coord_values_8p*/false);
+      }
 #endif
       fprintf(stderr,"Writing %u genomic positions to file %s ...\n",
 	      totalcounts,positionsfile);
@@ -1375,10 +2166,22 @@ Indexdb_write_positions (char *positionsfile, char *gammaptrsfile, char *offsets
 	}
       }
 
+      if (deltap == true) {
+	deltawrittenp = write_positionsdelta(positionsfile,offsets,oligospace,positions4,/*positions8*/NULL,totalcounts);
+      }
       FREE(positions4);
     }
   }
 
+  if (coord_values_8p == true && deltawrittenp == false) {
+    /* Readers prefer compressed positions, so 5-byte positions would go unused with them */
+    if ((UINT8) Univ_IIT_genomelength(chromosome_iit,/*with_circular_alias_p*/true) > POSITIONS40_MASK) {
+      fprintf(stderr,"Genome is too long for 5-byte positions, so not writing them\n");
+    } else {
+      write_positions40(positionsfile,totalcounts);
+    }
+  }
+
   FREE(offsets);
 
   return;
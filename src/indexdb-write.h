@@ -26,6 +26,15 @@
 #define OFFSETS_FILESUFFIX "offsets"
 #define POSITIONS_FILESUFFIX "positions"
 
+/* If genomecompfile is not NULL, the offsets and the positions built
+   in memory are computed by nthreads threads from the compressed
+   genome mapped from that file, instead of from sequence_fp.  The
+   files written are the same.
+
+   If build_memory is not 0 and genomecompfile is given, positions
+   that would need more than build_memory bytes, counting the offsets,
+   are built in ranges of oligomers that fit, scanning the genome once
+   per range and appending each range to the positions file. */
 
 
 extern void
@@ -40,7 +49,8 @@ Indexdb_write_offsets (char *gammaptrsfile, char *offsetscompfile, FILE *sequenc
 #else
 		       int index1part,
 #endif
-		       int index1interval, bool genome_lc_p, char *fileroot, bool mask_lowercase_p);
+		       int index1interval, bool genome_lc_p, char *fileroot, bool mask_lowercase_p,
+		       char *genomecompfile, int nthreads);
 
 extern void
 Indexdb_write_positions (char *positionsfile, char *gammaptrsfile, char *offsetscompfile,
@@ -51,7 +61,8 @@ Indexdb_write_positions (char *positionsfile, char *gammaptrsfile, char *offsets
 			 int index1part,
 #endif
 			 int index1interval, bool genome_lc_p, bool writefilep,
-			 char *fileroot, bool mask_lowercase_p, bool coord_values_8p);
+			 char *fileroot, bool mask_lowercase_p, bool coord_values_8p, bool deltap,
+			 char *genomecompfile, int nthreads, size_t build_memory);
 
 #endif
 
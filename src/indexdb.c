@@ -12,6 +12,8 @@ static char rcsid[] = "$Id: indexdb.c 99753 2013-06-27 21:13:11Z twu $";
 #include "indexdb.h"
 #include "indexdbdef.h"
 #include "genome_hr.h"		/* For read_gammas procedures */
+#include "eliasfano.h"
+#include "positionsdelta.h"
 
 
 #ifdef WORDS_BIGENDIAN
@@ -25,6 +27,7 @@ static char rcsid[] = "$Id: indexdb.c 99753 2013-06-27 21:13:11Z twu $";
 #include <stdlib.h>
 #include <string.h>		/* For memset */
 #include <ctype.h>		/* For toupper */
+#include <errno.h>		/* For EINTR */
 #include <sys/mman.h>		/* For munmap */
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>		/* For lseek and close */
@@ -62,6 +65,11 @@ static char rcsid[] = "$Id: indexdb.c 99753 2013-06-27 21:13:11Z twu $";
 #include <pthread.h>		/* sys/types.h already included above */
 #endif
 
+#if defined(HAVE_SSE) && !defined(WORDS_BIGENDIAN)
+#define USE_PREFETCH 1
+#include <xmmintrin.h>		/* For _mm_prefetch */
+#endif
+
 #define MAXENTRIES 20
 
 /* Note: NONMODULAR is the old behavior.  Now we store only when
@@ -128,6 +136,26 @@ Indexdb_setup (Width_T index1part_in) {
 #define T Indexdb_T
 
 
+static void
+positions_cache_free (void *data);
+
+static void
+positions_packed_free (void *array, Access_T access, size_t len, int fd) {
+  if (access == ALLOCATED) {
+    FREE(array);
+#ifdef HAVE_MMAP
+  } else if (access == MMAPPED) {
+    munmap(array,len);
+    close(fd);
+#endif
+#ifdef HAVE_SHM_OPEN
+  } else if (access == SHARED) {
+    Access_shm_detach((void *) array,len,fd);
+#endif
+  }
+  return;
+}
+
 void
 Indexdb_free (T *old) {
   if (*old) {
@@ -137,12 +165,36 @@ Indexdb_free (T *old) {
     } else if ((*old)->positions_access == MMAPPED) {
       munmap((void *) (*old)->positions,(*old)->positions_len);
       close((*old)->positions_fd);
+#endif
+#ifdef HAVE_SHM_OPEN
+    } else if ((*old)->positions_access == SHARED) {
+      Access_shm_detach((void *) (*old)->positions,(*old)->positions_len,(*old)->positions_fd);
 #endif
     } else if ((*old)->positions_access == FILEIO) {
 #ifdef HAVE_PTHREAD
+      /* Caches of other threads are freed by the key destructor when they exit */
+      if (pthread_getspecific((*old)->positions_cache_key) != NULL) {
+	positions_cache_free(pthread_getspecific((*old)->positions_cache_key));
+	pthread_setspecific((*old)->positions_cache_key,NULL);
+      }
+      pthread_key_delete((*old)->positions_cache_key);
       pthread_mutex_destroy(&(*old)->positions_read_mutex);
+#else
+      if ((*old)->positions_cache != NULL) {
+	positions_cache_free((*old)->positions_cache);
+      }
 #endif
-      close((*old)->positions_fd);
+      if ((*old)->positionsdelta != NULL) {
+	positions_packed_free((void *) (*old)->positionsdelta,(*old)->positionsdelta_access,
+			      (*old)->positionsdelta_len,(*old)->positionsdelta_fd);
+	positions_packed_free((void *) (*old)->positionsblocks,(*old)->positionsblocks_access,
+			      (*old)->positionsblocks_len,(*old)->positionsblocks_fd);
+      } else if ((*old)->positions40 != NULL) {
+	positions_packed_free((void *) (*old)->positions40,(*old)->positions40_access,
+			      (*old)->positions40_len,(*old)->positions40_fd);
+      } else {
+	close((*old)->positions_fd);
+      }
     }
 
     if ((*old)->offsetscomp_access == ALLOCATED) {
@@ -151,6 +203,10 @@ Indexdb_free (T *old) {
     } else if ((*old)->offsetscomp_access == MMAPPED) {
       munmap((void *) (*old)->offsetscomp,(*old)->offsetscomp_len);
       close((*old)->offsetscomp_fd);
+#endif
+#ifdef HAVE_SHM_OPEN
+    } else if ((*old)->offsetscomp_access == SHARED) {
+      Access_shm_detach((void *) (*old)->offsetscomp,(*old)->offsetscomp_len,(*old)->offsetscomp_fd);
 #endif
     }
       
@@ -207,7 +263,7 @@ Indexdb_mean_size (T this, Mode_T mode, Width_T index1part) {
 #endif
 
 #ifdef WORDS_BIGENDIAN
-  if (this->offsetscomp_access == ALLOCATED) {
+  if (this->offsetscomp_access == ALLOCATED || this->offsetscomp_access == SHARED) {
     return (double) this->offsetscomp[this->gammaptrs[oligospace/this->offsetscomp_blocksize]]/(double) n;
   } else {
     return (double) Bigendian_convert_uint(this->offsetscomp[this->gammaptrs[oligospace/this->offsetscomp_blocksize]])/(double) n;
@@ -218,6 +274,42 @@ Indexdb_mean_size (T this, Mode_T mode, Width_T index1part) {
 }
 
 
+/* Returns the offset of oligo in the positions, and the next one in *end0 */
+Positionsptr_T
+Indexdb_offsetptr (Positionsptr_T *end0, T this, Storedoligomer_T oligo) {
+#ifdef WORDS_BIGENDIAN
+  if (this->offsetscomp_access == ALLOCATED || this->offsetscomp_access == SHARED) {
+    return Genome_offsetptr_from_gammas(&(*end0),this->gammaptrs,this->offsetscomp,this->offsetscomp_blocksize,oligo);
+  } else {
+    return Genome_offsetptr_from_gammas_bigendian(&(*end0),this->gammaptrs,this->offsetscomp,this->offsetscomp_blocksize,oligo);
+  }
+#else
+  if (this->eliasfanop == true) {
+    return Eliasfano_offsetptr(&(*end0),this->gammaptrs,this->offsetscomp,this->offsetscomp_blocksize,oligo);
+  } else {
+    return Genome_offsetptr_from_gammas(&(*end0),this->gammaptrs,this->offsetscomp,this->offsetscomp_blocksize,oligo);
+  }
+#endif
+}
+
+Positionsptr_T
+Indexdb_offsetptr_only (T this, Storedoligomer_T oligo) {
+#ifdef WORDS_BIGENDIAN
+  if (this->offsetscomp_access == ALLOCATED || this->offsetscomp_access == SHARED) {
+    return Genome_offsetptr_only_from_gammas(this->gammaptrs,this->offsetscomp,this->offsetscomp_blocksize,oligo);
+  } else {
+    return Genome_offsetptr_only_from_gammas_bigendian(this->gammaptrs,this->offsetscomp,this->offsetscomp_blocksize,oligo);
+  }
+#else
+  if (this->eliasfanop == true) {
+    return Eliasfano_offsetptr_only(this->gammaptrs,this->offsetscomp,this->offsetscomp_blocksize,oligo);
+  } else {
+    return Genome_offsetptr_only_from_gammas(this->gammaptrs,this->offsetscomp,this->offsetscomp_blocksize,oligo);
+  }
+#endif
+}
+
+
 
 bool
 Indexdb_get_filenames_pregamma (char **offsets_filename, char **positions_filename,
@@ -695,6 +787,89 @@ Indexdb_get_filenames (char **gammaptrs_filename, char **offsetscomp_filename, c
 
 
 
+#if defined(HAVE_SHM_OPEN) && !defined(WORDS_BIGENDIAN)
+static void
+remove_positions_variant (char *positions_filename, char *filesuffix) {
+  char *filename;
+
+  if ((filename = Access_filename_substitute(positions_filename,"positions",filesuffix)) != NULL) {
+    Access_shm_remove(filename,/*suffix*/NULL);
+    FREE(filename);
+  }
+  return;
+}
+#endif
+
+
+/* Packed positions (compressed or 5-byte) are decoded into the
+   positions cache, so they need random access to the whole array.
+   They follow positions_access, except that USE_FILEIO maps them as
+   for USE_MMAP_ONLY, since a run cannot be located in the file
+   without its block.  Their files are padded to whole words. */
+static char *
+positions_packed_verb (Access_mode_T positions_access) {
+  if (positions_access == USE_MMAP_PRELOAD) {
+    return "Pre-loading";
+  } else if (positions_access == USE_MMAP_ONLY || positions_access == USE_FILEIO) {
+    return "Mapping";
+  } else if (positions_access == USE_SHARED) {
+    return "Attaching shared memory for";
+  } else {
+    return "Allocating memory for";
+  }
+}
+
+static void *
+positions_packed_load (int *fd, size_t *len, Access_T *access, char *filename, Access_mode_T positions_access) {
+  void *array = NULL;
+  double seconds = 0.0;
+  char *comma;
+#ifdef HAVE_MMAP
+  int npages;
+#endif
+
+#ifdef HAVE_SHM_OPEN
+  if (positions_access == USE_SHARED) {
+    if ((array = Access_shm_load(&(*fd),&(*len),&seconds,filename,sizeof(UINT4))) != NULL) {
+      *access = SHARED;
+    } else {
+      fprintf(stderr,"not available (will allocate private copy instead)...");
+    }
+  }
+#endif
+
+#ifdef HAVE_MMAP
+  if (positions_access == USE_MMAP_PRELOAD || positions_access == USE_MMAP_ONLY || positions_access == USE_FILEIO) {
+    if (positions_access == USE_MMAP_PRELOAD) {
+      array = (void *) Access_mmap_and_preload(&(*fd),&(*len),&npages,&seconds,filename,sizeof(UINT4));
+    } else {
+      array = (void *) Access_mmap(&(*fd),&(*len),filename,sizeof(UINT4),/*randomp*/true);
+    }
+    if (array != NULL) {
+      *access = MMAPPED;
+    } else {
+      close(*fd);
+      fprintf(stderr,"insufficient memory for mmap (will allocate instead)...");
+    }
+  }
+#endif
+
+  if (array == NULL) {
+    if ((array = Access_allocated(&(*len),&seconds,filename,sizeof(UINT4))) == NULL) {
+      fprintf(stderr,"insufficient memory (need to use a lower batch mode (-B)\n");
+      exit(9);
+    }
+    *access = ALLOCATED;
+  }
+
+  comma = Genomicpos_commafmt(*len);
+  fprintf(stderr,"done (%s bytes, %.2f sec, %.2f GB/s)\n",comma,seconds,Access_gbps(*len,seconds));
+  FREE(comma);
+
+  return array;
+}
+
+
 T
 Indexdb_new_genome (Width_T *basesize, Width_T *index1part, Width_T *index1interval,
 		    char *genomesubdir, char *fileroot, char *idx_filesuffix, char *snps_root,
@@ -708,6 +883,13 @@ Indexdb_new_genome (Width_T *basesize, Width_T *index1part, Width_T *index1inter
     *gammaptrs_basename_ptr, *offsetscomp_basename_ptr, *positions_basename_ptr,
     *gammaptrs_index1info_ptr, *offsetscomp_index1info_ptr, *positions_index1info_ptr;
   char *offsets_filename, *offsets_basename_ptr, *offsets_index1info_ptr;
+#ifndef WORDS_BIGENDIAN
+  char *efptrs_filename, *offsetsef_filename;
+  char *positionsdelta_filename, *positionsblocks_filename;
+#endif
+#if defined(LARGE_GENOMES) && !defined(WORDS_BIGENDIAN)
+  char *positions40_filename;
+#endif
   Oligospace_T basespace, base;
 
   unsigned int poly_T;
@@ -719,6 +901,12 @@ Indexdb_new_genome (Width_T *basesize, Width_T *index1part, Width_T *index1inter
 #ifdef HAVE_MMAP
   int npages;
 #endif
+#ifdef HAVE_SHM_OPEN
+  char *shmname;
+  Offsetscomp_T *shared;
+#endif
+
+  new->eliasfanop = false;
 
   /* Read offsets file */
   if (Indexdb_get_filenames(&gammaptrs_filename,&offsetscomp_filename,&positions_filename,
@@ -743,11 +931,37 @@ Indexdb_new_genome (Width_T *basesize, Width_T *index1part, Width_T *index1inter
       new->offsetscomp_blocksize = 1;
       basespace = power(4,new->index1part);
 #endif
-      new->gammaptrs = (Gammaptr_T *) CALLOC(basespace+1,sizeof(Gammaptr_T));
-      for (base = 0; base <= basespace; base++) {
-	new->gammaptrs[base] = base;
+      if (offsetscomp_access == USE_SHARED_REMOVE) {
+	new->gammaptrs = (Gammaptr_T *) NULL;
+      } else {
+	new->gammaptrs = (Gammaptr_T *) CALLOC(basespace+1,sizeof(Gammaptr_T));
+	for (base = 0; base <= basespace; base++) {
+	  new->gammaptrs[base] = base;
+	}
       }
 
+#ifdef HAVE_SHM_OPEN
+      /* Expanded offsets have no file of their own, so their segment is named after the offsetscomp file */
+      if (offsetscomp_access == USE_SHARED) {
+	shmname = Access_shm_name(offsetscomp_filename,"expanded");
+	new->offsetscomp = (Offsetscomp_T *) Access_shm_attach(&new->offsetscomp_fd,&new->offsetscomp_len,shmname);
+      } else {
+	shmname = (char *) NULL;
+	new->offsetscomp = (Offsetscomp_T *) NULL;
+      }
+
+      if (offsetscomp_access == USE_SHARED_REMOVE) {
+	Access_shm_remove(offsetscomp_filename,"expanded");
+	new->offsetscomp_access = ALLOCATED;
+
+      } else if (new->offsetscomp != NULL) {
+	comma = Genomicpos_commafmt(new->offsetscomp_len);
+	fprintf(stderr,"Attached %s expanded offsets in shared memory (%s bytes)\n",idx_filesuffix,comma);
+	FREE(comma);
+	new->offsetscomp_access = SHARED;
+
+      } else {
+#endif
 #ifdef PMAP
       new->offsetscomp = Indexdb_offsets_from_gammas(gammaptrs_filename,offsetscomp_filename,
 						     new->offsetscomp_basesize,*alphabet_size,new->index1part);
@@ -756,6 +970,27 @@ Indexdb_new_genome (Width_T *basesize, Width_T *index1part, Width_T *index1inter
 						     new->offsetscomp_basesize,new->index1part);
 #endif
       new->offsetscomp_access = ALLOCATED;
+#ifdef HAVE_SHM_OPEN
+	if (shmname != NULL) {
+	  fprintf(stderr,"Storing %s expanded offsets in shared memory...",idx_filesuffix);
+	  if ((shared = (Offsetscomp_T *) Access_shm_store(&new->offsetscomp_fd,&new->offsetscomp_len,&seconds,shmname,
+							   (void *) new->offsetscomp,(basespace+1)*sizeof(Offsetscomp_T))) == NULL) {
+	    fprintf(stderr,"not possible (will use private copy instead)\n");
+	  } else {
+	    comma = Genomicpos_commafmt(new->offsetscomp_len);
+	    fprintf(stderr,"done (%s bytes, %.2f sec, %.2f GB/s)\n",comma,seconds,Access_gbps(new->offsetscomp_len,seconds));
+	    FREE(comma);
+	    FREE(new->offsetscomp);
+	    new->offsetscomp = shared;
+	    new->offsetscomp_access = SHARED;
+	  }
+	}
+      }
+
+      if (shmname != NULL) {
+	FREE(shmname);
+      }
+#endif
 
     } else {
       *basesize = new->offsetscomp_basesize;
@@ -766,17 +1001,48 @@ Indexdb_new_genome (Width_T *basesize, Width_T *index1part, Width_T *index1inter
       new->offsetscomp_blocksize = power(4,(*index1part) - new->offsetscomp_basesize);
 #endif
 
+#ifndef WORDS_BIGENDIAN
+      /* Use Elias-Fano offsets instead of gammas if gmapindex wrote them */
+      if (new->index1part > new->offsetscomp_basesize &&
+	  (efptrs_filename = Access_filename_substitute(gammaptrs_filename,"gammaptrs",EFPTRS_FILESUFFIX)) != NULL) {
+	offsetsef_filename = Access_filename_substitute(offsetscomp_filename,"offsetscomp",OFFSETSEF_FILESUFFIX);
+	if (offsetsef_filename != NULL && Access_file_exists_p(efptrs_filename) == true &&
+	    Access_file_exists_p(offsetsef_filename) == true) {
+	  fprintf(stderr,"Using Elias-Fano offsets in %s\n",offsetsef_filename);
+	  FREE(gammaptrs_filename);
+	  FREE(offsetscomp_filename);
+	  gammaptrs_filename = efptrs_filename;
+	  offsetscomp_filename = offsetsef_filename;
+	  new->eliasfanop = true;
+	} else {
+	  if (offsetsef_filename != NULL) {
+	    FREE(offsetsef_filename);
+	  }
+	  FREE(efptrs_filename);
+	}
+      }
+#endif
+
       if (new->index1part == new->offsetscomp_basesize) {
 #ifdef PMAP
 	basespace = power(*alphabet_size,new->offsetscomp_basesize);
 #else
 	basespace = power(4,new->offsetscomp_basesize);
 #endif
-	new->gammaptrs = (Gammaptr_T *) CALLOC(basespace+1,sizeof(Gammaptr_T));
-	for (base = 0; base <= basespace; base++) {
-	  new->gammaptrs[base] = base;
+	if (offsetscomp_access == USE_SHARED_REMOVE) {
+	  new->gammaptrs = (Gammaptr_T *) NULL;
+	} else {
+	  new->gammaptrs = (Gammaptr_T *) CALLOC(basespace+1,sizeof(Gammaptr_T));
+	  for (base = 0; base <= basespace; base++) {
+	    new->gammaptrs[base] = base;
+	  }
 	}
 
+#ifdef HAVE_SHM_OPEN
+      } else if (offsetscomp_access == USE_SHARED_REMOVE) {
+	new->gammaptrs = (Gammaptr_T *) NULL;
+#endif
+
       } else {
 	/* gammaptrs always ALLOCATED */
 	if (snps_root) {
@@ -789,7 +1055,7 @@ Indexdb_new_genome (Width_T *basesize, Width_T *index1part, Width_T *index1inter
 	new->gammaptrs = (Gammaptr_T *) Access_allocated(&new->gammaptrs_len,&seconds,
 						    gammaptrs_filename,sizeof(Gammaptr_T));
 	comma = Genomicpos_commafmt(new->gammaptrs_len);
-	fprintf(stderr,"done (%s bytes, %.2f sec)\n",comma,seconds);
+	fprintf(stderr,"done (%s bytes, %.2f sec, %.2f GB/s)\n",comma,seconds,Access_gbps(new->gammaptrs_len,seconds));
 	FREE(comma);
       }
 
@@ -809,7 +1075,7 @@ Indexdb_new_genome (Width_T *basesize, Width_T *index1part, Width_T *index1inter
 	  exit(9);
 	} else {
 	  comma = Genomicpos_commafmt(new->offsetscomp_len);
-	  fprintf(stderr,"done (%s bytes, %.2f sec)\n",comma,seconds);
+	  fprintf(stderr,"done (%s bytes, %.2f sec, %.2f GB/s)\n",comma,seconds,Access_gbps(new->offsetscomp_len,seconds));
 	  FREE(comma);
 	  new->offsetscomp_access = ALLOCATED;
 	}
@@ -834,7 +1100,7 @@ Indexdb_new_genome (Width_T *basesize, Width_T *index1part, Width_T *index1inter
 #endif
 	} else {
 	  comma = Genomicpos_commafmt(new->offsetscomp_len);
-	  fprintf(stderr,"done (%s bytes, %d pages, %.2f sec)\n",comma,npages,seconds);
+	  fprintf(stderr,"done (%s bytes, %d pages, %.2f sec, %.2f GB/s)\n",comma,npages,seconds,Access_gbps(new->offsetscomp_len,seconds));
 	  FREE(comma);
 	  new->offsetscomp_access = MMAPPED;
 	}
@@ -855,6 +1121,37 @@ Indexdb_new_genome (Width_T *basesize, Width_T *index1part, Width_T *index1inter
 	}
 #endif
 
+#ifdef HAVE_SHM_OPEN
+      } else if (offsetscomp_access == USE_SHARED) {
+	if (snps_root) {
+	  fprintf(stderr,"Attaching %s (%s) offsets in shared memory, kmer %d, interval %d...",
+	    idx_filesuffix,snps_root,new->index1part,new->index1interval);
+	} else {
+	  fprintf(stderr,"Attaching %s offsets in shared memory, kmer %d, interval %d...",
+	    idx_filesuffix,new->index1part,new->index1interval);
+	}
+	if ((new->offsetscomp = (Offsetscomp_T *) Access_shm_load(&new->offsetscomp_fd,&new->offsetscomp_len,&seconds,
+							      offsetscomp_filename,sizeof(Offsetscomp_T))) != NULL) {
+	  new->offsetscomp_access = SHARED;
+	} else {
+	  fprintf(stderr,"not available (will allocate private copy instead)...");
+	  if ((new->offsetscomp = (Offsetscomp_T *) Access_allocated(&new->offsetscomp_len,&seconds,
+								offsetscomp_filename,sizeof(Offsetscomp_T))) == NULL) {
+	    fprintf(stderr,"insufficient memory (need to use a lower batch mode (-B))\n");
+	    exit(9);
+	  }
+	  new->offsetscomp_access = ALLOCATED;
+	}
+	comma = Genomicpos_commafmt(new->offsetscomp_len);
+	fprintf(stderr,"done (%s bytes, %.2f sec, %.2f GB/s)\n",comma,seconds,Access_gbps(new->offsetscomp_len,seconds));
+	FREE(comma);
+
+      } else if (offsetscomp_access == USE_SHARED_REMOVE) {
+	Access_shm_remove(offsetscomp_filename,/*suffix*/NULL);
+	new->offsetscomp = (Offsetscomp_T *) NULL;
+	new->offsetscomp_access = ALLOCATED;
+#endif
+
       } else if (offsetscomp_access == USE_FILEIO) {
 	fprintf(stderr,"Offsetscomp file I/O access of %s not allowed\n",offsetscomp_filename);
 	exit(9);
@@ -889,9 +1186,13 @@ Indexdb_new_genome (Width_T *basesize, Width_T *index1part, Width_T *index1inter
 #else
     basespace = power(4,new->index1part);
 #endif
-    new->gammaptrs = (Gammaptr_T *) CALLOC(basespace+1,sizeof(Gammaptr_T));
-    for (base = 0; base <= basespace; base++) {
-      new->gammaptrs[base] = base;
+    if (offsetscomp_access == USE_SHARED_REMOVE) {
+      new->gammaptrs = (Gammaptr_T *) NULL;
+    } else {
+      new->gammaptrs = (Gammaptr_T *) CALLOC(basespace+1,sizeof(Gammaptr_T));
+      for (base = 0; base <= basespace; base++) {
+	new->gammaptrs[base] = base;
+      }
     }
 
 
@@ -910,7 +1211,7 @@ Indexdb_new_genome (Width_T *basesize, Width_T *index1part, Width_T *index1inter
 	exit(9);
       } else {
 	comma = Genomicpos_commafmt(new->offsetscomp_len);
-	fprintf(stderr,"done (%s bytes, %.2f sec)\n",comma,seconds);
+	fprintf(stderr,"done (%s bytes, %.2f sec, %.2f GB/s)\n",comma,seconds,Access_gbps(new->offsetscomp_len,seconds));
 	FREE(comma);
 	new->offsetscomp_access = ALLOCATED;
       }
@@ -935,7 +1236,7 @@ Indexdb_new_genome (Width_T *basesize, Width_T *index1part, Width_T *index1inter
 #endif
       } else {
 	comma = Genomicpos_commafmt(new->offsetscomp_len);
-	fprintf(stderr,"done (%s bytes, %d pages, %.2f sec)\n",comma,npages,seconds);
+	fprintf(stderr,"done (%s bytes, %d pages, %.2f sec, %.2f GB/s)\n",comma,npages,seconds,Access_gbps(new->offsetscomp_len,seconds));
 	FREE(comma);
 	new->offsetscomp_access = MMAPPED;
       }
@@ -956,6 +1257,37 @@ Indexdb_new_genome (Width_T *basesize, Width_T *index1part, Width_T *index1inter
       }
 #endif
 
+#ifdef HAVE_SHM_OPEN
+    } else if (offsetscomp_access == USE_SHARED) {
+      if (snps_root) {
+	fprintf(stderr,"Attaching %s (%s) offsets in shared memory, kmer %d, interval %d...",
+	    idx_filesuffix,snps_root,new->index1part,new->index1interval);
+      } else {
+	fprintf(stderr,"Attaching %s offsets in shared memory, kmer %d, interval %d...",
+	    idx_filesuffix,new->index1part,new->index1interval);
+      }
+      if ((new->offsetscomp = (Offsetscomp_T *) Access_shm_load(&new->offsetscomp_fd,&new->offsetscomp_len,&seconds,
+							      offsets_filename,sizeof(Offsetscomp_T))) != NULL) {
+	new->offsetscomp_access = SHARED;
+      } else {
+	fprintf(stderr,"not available (will allocate private copy instead)...");
+	if ((new->offsetscomp = (Offsetscomp_T *) Access_allocated(&new->offsetscomp_len,&seconds,
+								offsets_filename,sizeof(Offsetscomp_T))) == NULL) {
+	  fprintf(stderr,"insufficient memory (need to use a lower batch mode (-B))\n");
+	  exit(9);
+	}
+	new->offsetscomp_access = ALLOCATED;
+      }
+      comma = Genomicpos_commafmt(new->offsetscomp_len);
+      fprintf(stderr,"done (%s bytes, %.2f sec, %.2f GB/s)\n",comma,seconds,Access_gbps(new->offsetscomp_len,seconds));
+      FREE(comma);
+
+    } else if (offsetscomp_access == USE_SHARED_REMOVE) {
+      Access_shm_remove(offsets_filename,/*suffix*/NULL);
+      new->offsetscomp = (Offsetscomp_T *) NULL;
+      new->offsetscomp_access = ALLOCATED;
+#endif
+
     } else if (offsetscomp_access == USE_FILEIO) {
       fprintf(stderr,"Offsets file I/O access of %s not allowed\n",offsets_filename);
       exit(9);
@@ -973,18 +1305,32 @@ Indexdb_new_genome (Width_T *basesize, Width_T *index1part, Width_T *index1inter
   }
 
 
+#ifdef HAVE_SHM_OPEN
+  if (positions_access == USE_SHARED_REMOVE) {
+    /* The offsets were not read, so there is nothing to check.
+       Remove the segment of each positions format that a loader
+       could have attached. */
+    Access_shm_remove(positions_filename,/*suffix*/NULL);
+#ifndef WORDS_BIGENDIAN
+    remove_positions_variant(positions_filename,POSITIONSDELTA_FILESUFFIX);
+    remove_positions_variant(positions_filename,POSITIONSBLOCKS_FILESUFFIX);
+#endif
+#if defined(LARGE_GENOMES) && !defined(WORDS_BIGENDIAN)
+    remove_positions_variant(positions_filename,POSITIONS40_FILESUFFIX);
+#endif
+    new->positions = (Univcoord_T *) NULL;
+    new->positionsdelta = (UINT4 *) NULL;
+    new->positions40 = (unsigned char *) NULL;
+    new->positions_access = ALLOCATED;
+    FREE(positions_filename);
+    return new;
+  }
+#endif
+
   /* Sanity check on positions filesize */
 
   poly_T = ~(~0UL << 2*new->index1part);
-#ifdef WORDS_BIGENDIAN
-  if (offsetscomp_access == ALLOCATED) {
-    ptr0 = Genome_offsetptr_from_gammas(&end0,new->gammaptrs,new->offsetscomp,new->offsetscomp_blocksize,poly_T);
-  } else {
-    ptr0 = Genome_offsetptr_from_gammas_bigendian(&end0,new->gammaptrs,new->offsetscomp,new->offsetscomp_blocksize,poly_T);
-  }
-#else
-  ptr0 = Genome_offsetptr_from_gammas(&end0,new->gammaptrs,new->offsetscomp,new->offsetscomp_blocksize,poly_T);
-#endif
+  ptr0 = Indexdb_offsetptr(&end0,new,poly_T);
   if ((filesize = Access_filesize(positions_filename)) != end0 * (off_t) sizeof(Univcoord_T)) {
     fprintf(stderr,"Something is wrong with the genomic index: expected file size for %s is %lu, but observed %lu.\n",
 	    positions_filename,end0*sizeof(Univcoord_T),filesize);
@@ -994,7 +1340,61 @@ Indexdb_new_genome (Width_T *basesize, Width_T *index1part, Width_T *index1inter
 
   /* Positions */
 
-  if (positions_access == USE_ALLOCATE) {
+  new->positionsdelta = (UINT4 *) NULL;
+#ifndef WORDS_BIGENDIAN
+  /* Use compressed positions instead if gmapindex -z wrote them */
+  positionsdelta_filename = Access_filename_substitute(positions_filename,"positions",POSITIONSDELTA_FILESUFFIX);
+  positionsblocks_filename = Access_filename_substitute(positions_filename,"positions",POSITIONSBLOCKS_FILESUFFIX);
+  if (positionsdelta_filename != NULL && Access_file_exists_p(positionsdelta_filename) == true &&
+      positionsblocks_filename != NULL && Access_file_exists_p(positionsblocks_filename) == true) {
+    if (snps_root) {
+      fprintf(stderr,"%s %s (%s) compressed positions, kmer %d, interval %d...",
+	      positions_packed_verb(positions_access),idx_filesuffix,snps_root,new->index1part,new->index1interval);
+    } else {
+      fprintf(stderr,"%s %s compressed positions, kmer %d, interval %d...",
+	      positions_packed_verb(positions_access),idx_filesuffix,new->index1part,new->index1interval);
+    }
+    new->positionsdelta = (UINT4 *) positions_packed_load(&new->positionsdelta_fd,&new->positionsdelta_len,
+							   &new->positionsdelta_access,positionsdelta_filename,positions_access);
+    fprintf(stderr,"%s %s compressed position blocks...",positions_packed_verb(positions_access),idx_filesuffix);
+    new->positionsblocks = (UINT4 *) positions_packed_load(&new->positionsblocks_fd,&new->positionsblocks_len,
+							    &new->positionsblocks_access,positionsblocks_filename,positions_access);
+  }
+  if (positionsblocks_filename != NULL) {
+    FREE(positionsblocks_filename);
+  }
+  if (positionsdelta_filename != NULL) {
+    FREE(positionsdelta_filename);
+  }
+#endif
+
+  new->positions40 = (unsigned char *) NULL;
+#if defined(LARGE_GENOMES) && !defined(WORDS_BIGENDIAN)
+  /* Otherwise, use 5-byte positions if gmapindex wrote them */
+  if (new->positionsdelta == NULL &&
+      (positions40_filename = Access_filename_substitute(positions_filename,"positions",POSITIONS40_FILESUFFIX)) != NULL) {
+    if (Access_file_exists_p(positions40_filename) == true) {
+      if (snps_root) {
+	fprintf(stderr,"%s %s (%s) 5-byte positions, kmer %d, interval %d...",
+		positions_packed_verb(positions_access),idx_filesuffix,snps_root,new->index1part,new->index1interval);
+      } else {
+	fprintf(stderr,"%s %s 5-byte positions, kmer %d, interval %d...",
+		positions_packed_verb(positions_access),idx_filesuffix,new->index1part,new->index1interval);
+      }
+      new->positions40 = (unsigned char *) positions_packed_load(&new->positions40_fd,&new->positions40_len,
+								 &new->positions40_access,positions40_filename,positions_access);
+    }
+    FREE(positions40_filename);
+  }
+#endif
+
+  if (new->positionsdelta != NULL || new->positions40 != NULL) {
+    /* Lookups go through Indexdb_positions_fileio, which decodes the
+       packed arrays into the positions cache */
+    new->positions = (Univcoord_T *) NULL;
+    new->positions_access = FILEIO;
+
+  } else if (positions_access == USE_ALLOCATE) {
     if (snps_root) {
       fprintf(stderr,"Allocating memory for %s (%s) positions, kmer %d, interval %d...",
 	      idx_filesuffix,snps_root,new->index1part,new->index1interval);
@@ -1009,7 +1409,7 @@ Indexdb_new_genome (Width_T *basesize, Width_T *index1part, Width_T *index1inter
       exit(9);
     } else {
       comma = Genomicpos_commafmt(new->positions_len);
-      fprintf(stderr,"done (%s bytes, %.2f sec)\n",comma,seconds);
+      fprintf(stderr,"done (%s bytes, %.2f sec, %.2f GB/s)\n",comma,seconds,Access_gbps(new->positions_len,seconds));
       FREE(comma);
       new->positions_access = ALLOCATED;
     }
@@ -1031,7 +1431,7 @@ Indexdb_new_genome (Width_T *basesize, Width_T *index1part, Width_T *index1inter
       new->positions_access = FILEIO;
     } else {
       comma = Genomicpos_commafmt(new->positions_len);
-      fprintf(stderr,"done (%s bytes, %d pages, %.2f sec)\n",comma,npages,seconds);
+      fprintf(stderr,"done (%s bytes, %d pages, %.2f sec, %.2f GB/s)\n",comma,npages,seconds,Access_gbps(new->positions_len,seconds));
       FREE(comma);
       new->positions_access = MMAPPED;
     }
@@ -1049,18 +1449,48 @@ Indexdb_new_genome (Width_T *basesize, Width_T *index1part, Width_T *index1inter
     }
 #endif
 
+#ifdef HAVE_SHM_OPEN
+  } else if (positions_access == USE_SHARED) {
+    if (snps_root) {
+      fprintf(stderr,"Attaching %s (%s) positions in shared memory, kmer %d, interval %d...",
+	      idx_filesuffix,snps_root,new->index1part,new->index1interval);
+    } else {
+      fprintf(stderr,"Attaching %s positions in shared memory, kmer %d, interval %d...",
+	      idx_filesuffix,new->index1part,new->index1interval);
+    }
+    if ((new->positions = (Univcoord_T *) Access_shm_load(&new->positions_fd,&new->positions_len,&seconds,
+							  positions_filename,sizeof(Univcoord_T))) != NULL) {
+      new->positions_access = SHARED;
+    } else {
+      fprintf(stderr,"not available (will allocate private copy instead)...");
+      if ((new->positions = (Univcoord_T *) Access_allocated(&new->positions_len,&seconds,
+							     positions_filename,sizeof(Univcoord_T))) == NULL) {
+	fprintf(stderr,"insufficient memory (need to use a lower batch mode (-B)\n");
+	exit(9);
+      }
+      new->positions_access = ALLOCATED;
+    }
+    comma = Genomicpos_commafmt(new->positions_len);
+    fprintf(stderr,"done (%s bytes, %.2f sec, %.2f GB/s)\n",comma,seconds,Access_gbps(new->positions_len,seconds));
+    FREE(comma);
+#endif
+
   } else if (positions_access == USE_FILEIO) {
+    new->positions_fd = Access_fileio(positions_filename);
     new->positions_access = FILEIO;
   } else {
     fprintf(stderr,"Don't recognize positions_access %d\n",positions_access);
     abort();
   }
 
-#ifdef HAVE_PTHREAD
   if (new->positions_access == FILEIO) {
+#ifdef HAVE_PTHREAD
     pthread_mutex_init(&new->positions_read_mutex,NULL);
-  }
+    pthread_key_create(&new->positions_cache_key,positions_cache_free);
+#else
+    new->positions_cache = (void *) NULL;
 #endif
+  }
 
   FREE(positions_filename);
 
@@ -1116,79 +1546,156 @@ shortoligo_nt (Storedoligomer_T oligo, Width_T oligosize) {
  ************************************************************************/
 
 
+/* Per-thread cache of recently read position runs, for FILEIO.
+   Direct-mapped on ptr0.  Only short runs are kept, since long ones
+   are rarely reused within a thread and would evict many short ones. */
+#define POSITIONS_CACHE_NENTRIES 1024
+#define POSITIONS_CACHE_MAXRUN 32
+
+typedef struct Positions_cache_T *Positions_cache_T;
+struct Positions_cache_T {
+  Positionsptr_T ptr0[POSITIONS_CACHE_NENTRIES];
+  int n[POSITIONS_CACHE_NENTRIES]; /* 0 means empty */
+  Univcoord_T values[POSITIONS_CACHE_NENTRIES*POSITIONS_CACHE_MAXRUN];
+};
+
 static void
-positions_move_absolute (int positions_fd, off_t ptr) {
-  off_t offset = ptr*((off_t) sizeof(Univcoord_T));
+positions_cache_free (void *data) {
+  Positions_cache_T cache = (Positions_cache_T) data;
 
-  if (lseek(positions_fd,offset,SEEK_SET) < 0) {
-    fprintf(stderr,"Attempted to do lseek on offset %ld*%lu=%ld\n",
-	    ptr,sizeof(Univcoord_T),offset);
-    perror("Error in indexdb.c, positions_move_absolute");
-    exit(9);
-  }
+  FREE_KEEP(cache);
   return;
 }
 
-#if 0
-static Univcoord_T
-positions_read_forward (int positions_fd) {
-  Univcoord_T value;
-  char buffer[4];
-
-  read(positions_fd,buffer,4);
+static Positions_cache_T
+positions_cache_get (T this) {
+  Positions_cache_T cache;
 
-  value = (buffer[3] & 0xff);
-  value <<= 8;
-  value |= (buffer[2] & 0xff);
-  value <<= 8;
-  value |= (buffer[1] & 0xff);
-  value <<= 8;
-  value |= (buffer[0] & 0xff);
+#ifdef HAVE_PTHREAD
+  if ((cache = (Positions_cache_T) pthread_getspecific(this->positions_cache_key)) == NULL) {
+    cache = (Positions_cache_T) CALLOC_KEEP(1,sizeof(*cache));
+    pthread_setspecific(this->positions_cache_key,(void *) cache);
+  }
+#else
+  if ((cache = (Positions_cache_T) this->positions_cache) == NULL) {
+    cache = (Positions_cache_T) CALLOC_KEEP(1,sizeof(*cache));
+    this->positions_cache = (void *) cache;
+  }
+#endif
 
-  return value;
+  return cache;
 }
-#endif
 
+
+/* 5-byte positions are little-endian, and the file is padded, so
+   each can be loaded as 8 bytes and masked */
 static void
-positions_read_multiple (int positions_fd, Univcoord_T *values, int n) {
+positions40_unpack (Univcoord_T *values, unsigned char *bytes, Positionsptr_T ptr0, int n) {
+#if defined(LARGE_GENOMES) && !defined(WORDS_BIGENDIAN)
+  unsigned char *p = &(bytes[ptr0*(size_t) POSITIONS40_NBYTES]);
+  UINT8 value;
   int i;
-  Univcoord_T value;
-  unsigned char buffer[4];
 
-#ifdef WORDS_BIGENDIAN
-  /* Need to keep in bigendian format */
   for (i = 0; i < n; i++) {
-    read(positions_fd,buffer,4);
+    memcpy(&value,p,sizeof(UINT8));
+    values[i] = value & POSITIONS40_MASK;
+    p += POSITIONS40_NBYTES;
+  }
+#else
+  abort();
+#endif
+  return;
+}
 
-    value = (buffer[0] & 0xff);
-    value <<= 8;
-    value |= (buffer[1] & 0xff);
-    value <<= 8;
-    value |= (buffer[2] & 0xff);
-    value <<= 8;
-    value |= (buffer[3] & 0xff);
 
-    values[i] = value;
+/* Reads n positions starting at ptr0 into values.  Leaves them in
+   file byte order, just as they would appear in an mmapped positions
+   file. */
+static void
+positions_read_fileio (Univcoord_T *values, T this, Positionsptr_T ptr0, int n) {
+  off_t offset = ptr0*((off_t) sizeof(Univcoord_T));
+  size_t nbytes = n*sizeof(Univcoord_T);
+  char *p = (char *) values;
+  ssize_t nread;
+
+  if (this->positionsdelta != NULL) {
+    Positionsdelta_read(values,this->positionsblocks,this->positionsdelta,ptr0,n);
+    return;
+  } else if (this->positions40 != NULL) {
+    positions40_unpack(values,this->positions40,ptr0,n);
+    return;
   }
-#else
-  for (i = 0; i < n; i++) {
-    read(positions_fd,buffer,4);
 
-    value = (buffer[3] & 0xff);
-    value <<= 8;
-    value |= (buffer[2] & 0xff);
-    value <<= 8;
-    value |= (buffer[1] & 0xff);
-    value <<= 8;
-    value |= (buffer[0] & 0xff);
+#ifdef HAVE_PREAD
+  /* Positioned reads share no file offset, so threads need no lock */
+  while (nbytes > 0) {
+    if ((nread = pread(this->positions_fd,p,nbytes,offset)) < 0 && errno == EINTR) {
+      /* Try again */
+    } else if (nread <= 0) {
+      fprintf(stderr,"Attempted to do pread of %lu bytes on offset %ld\n",
+	      (long unsigned int) nbytes,(long int) offset);
+      perror("Error in indexdb.c, positions_read_fileio");
+      exit(9);
+    } else {
+      p += nread;
+      nbytes -= nread;
+      offset += nread;
+    }
+  }
 
-    values[i] = value;
+#else
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock(&this->positions_read_mutex);
+#endif
+  if (lseek(this->positions_fd,offset,SEEK_SET) < 0) {
+    fprintf(stderr,"Attempted to do lseek on offset %ld\n",(long int) offset);
+    perror("Error in indexdb.c, positions_read_fileio");
+    exit(9);
+  }
+  while (nbytes > 0) {
+    if ((nread = read(this->positions_fd,p,nbytes)) < 0 && errno == EINTR) {
+      /* Try again */
+    } else if (nread <= 0) {
+      perror("Error in indexdb.c, positions_read_fileio");
+      exit(9);
+    } else {
+      p += nread;
+      nbytes -= nread;
+    }
   }
+#ifdef HAVE_PTHREAD
+  pthread_mutex_unlock(&this->positions_read_mutex);
+#endif
 #endif
 
   return;
 }
 
+
+/* Used when positions_access == FILEIO */
+void
+Indexdb_positions_fileio (Univcoord_T *values, T this, Positionsptr_T ptr0, int n) {
+  Positions_cache_T cache;
+  int slot;
+
+  if (n > POSITIONS_CACHE_MAXRUN) {
+    positions_read_fileio(values,this,ptr0,n);
+
+  } else {
+    cache = positions_cache_get(this);
+    slot = ptr0 % POSITIONS_CACHE_NENTRIES;
+    if (cache->n[slot] != n || cache->ptr0[slot] != ptr0) {
+      positions_read_fileio(&(cache->values[slot*POSITIONS_CACHE_MAXRUN]),this,ptr0,n);
+      cache->ptr0[slot] = ptr0;
+      cache->n[slot] = n;
+    }
+    memcpy(values,&(cache->values[slot*POSITIONS_CACHE_MAXRUN]),n*sizeof(Univcoord_T));
+  }
+
+  return;
+}
+
+
 #if 0
 static Univcoord_T
 positions_read_backward (int positions_fd) {
@@ -1360,15 +1867,7 @@ Indexdb_read (int *nentries, T this, Storedoligomer_T aaindex) {
 
   debug0(printf("%u (%s)\n",aaindex,Alphabet_aaindex_aa(aaindex,this->alphabet)));
 
-#ifdef WORDS_BIGENDIAN
-  if (this->offsetscomp_access == ALLOCATED) {
-    ptr0 = Genome_offsetptr_from_gammas(&end0,this->gammaptrs,this->offsetscomp,this->offsetscomp_blocksize,aaindex);
-  } else {
-    ptr0 = Genome_offsetptr_from_gammas_bigendian(&end0,this->gammaptrs,this->offsetscomp,this->offsetscomp_blocksize,aaindex);
-  }
-#else
-  ptr0 = Genome_offsetptr_from_gammas(&end0,this->gammaptrs,this->offsetscomp,this->offsetscomp_blocksize,aaindex);
-#endif
+  ptr0 = Indexdb_offsetptr(&end0,this,aaindex);
 
   debug0(printf("offset pointers are %u and %u\n",ptr0,end0));
 
@@ -1397,16 +1896,9 @@ Indexdb_read (int *nentries, T this, Storedoligomer_T aaindex) {
   } else {
     positions = (Univcoord_T *) CALLOC(*nentries,sizeof(Univcoord_T));
     if (this->positions_access == FILEIO) {
-#ifdef HAVE_PTHREAD
-      pthread_mutex_lock(&this->positions_read_mutex);
-#endif
-      positions_move_absolute(this->positions_fd,ptr0);
-      positions_read_multiple(this->positions_fd,positions,*nentries);
-#ifdef HAVE_PTHREAD
-      pthread_mutex_unlock(&this->positions_read_mutex);
-#endif
+      Indexdb_positions_fileio(positions,this,ptr0,*nentries);
 
-    } else if (this->positions_access == ALLOCATED) {
+    } else if (this->positions_access == ALLOCATED || this->positions_access == SHARED) {
       memcpy(positions,&(this->positions[ptr0]),(*nentries)*sizeof(Univcoord_T));
 
     } else {
@@ -1480,15 +1972,7 @@ Indexdb_read (int *nentries, T this, Storedoligomer_T oligo) {
     return NULL;
   }
 
-#ifdef WORDS_BIGENDIAN
-  if (this->offsetscomp_access == ALLOCATED) {
-    ptr0 = Genome_offsetptr_from_gammas(&end0,this->gammaptrs,this->offsetscomp,this->offsetscomp_blocksize,part0);
-  } else {
-    ptr0 = Genome_offsetptr_from_gammas_bigendian(&end0,this->gammaptrs,this->offsetscomp,this->offsetscomp_blocksize,part0);
-  }
-#else
-  ptr0 = Genome_offsetptr_from_gammas(&end0,this->gammaptrs,this->offsetscomp,this->offsetscomp_blocksize,part0);
-#endif
+  ptr0 = Indexdb_offsetptr(&end0,this,part0);
 
 #ifdef ALLOW_DUPLICATES
   /* Skip backward over bad values, due to duplicates */
@@ -1517,15 +2001,8 @@ Indexdb_read (int *nentries, T this, Storedoligomer_T oligo) {
   
     positions = (Univcoord_T *) CALLOC(*nentries,sizeof(Univcoord_T));
     if (this->positions_access == FILEIO) {
-#ifdef HAVE_PTHREAD
-      pthread_mutex_lock(&this->positions_read_mutex);
-#endif
-      positions_move_absolute(this->positions_fd,ptr0);
-      positions_read_multiple(this->positions_fd,positions,*nentries);
-#ifdef HAVE_PTHREAD
-      pthread_mutex_unlock(&this->positions_read_mutex);
-#endif
-    } else if (this->positions_access == ALLOCATED) {
+      Indexdb_positions_fileio(positions,this,ptr0,*nentries);
+    } else if (this->positions_access == ALLOCATED || this->positions_access == SHARED) {
       memcpy(positions,&(this->positions[ptr0]),(*nentries)*sizeof(Univcoord_T));
 
     } else {
@@ -1588,15 +2065,7 @@ Indexdb_read_inplace (int *nentries, T this, Storedoligomer_T oligo) {
     return NULL;
   }
 
-#ifdef WORDS_BIGENDIAN
-  if (this->offsetscomp_access == ALLOCATED) {
-    ptr0 = Genome_offsetptr_from_gammas(&end0,this->gammaptrs,this->offsetscomp,this->offsetscomp_blocksize,oligo);
-  } else {
-    ptr0 = Genome_offsetptr_from_gammas_bigendian(&end0,this->gammaptrs,this->offsetscomp,this->offsetscomp_blocksize,oligo);
-  }
-#else
-  ptr0 = Genome_offsetptr_from_gammas(&end0,this->gammaptrs,this->offsetscomp,this->offsetscomp_blocksize,oligo);
-#endif
+  ptr0 = Indexdb_offsetptr(&end0,this,oligo);
 
   debug0(printf("Indexdb_read_inplace: offset pointers are %u and %u\n",ptr0,end0));
 
@@ -1606,14 +2075,7 @@ Indexdb_read_inplace (int *nentries, T this, Storedoligomer_T oligo) {
     return NULL;
   } else if (this->positions_access == FILEIO) {
     positions = (Univcoord_T *) CALLOC(*nentries,sizeof(Univcoord_T));
-#ifdef HAVE_PTHREAD
-    pthread_mutex_lock(&this->positions_read_mutex);
-#endif
-    positions_move_absolute(this->positions_fd,ptr0);
-    positions_read_multiple(this->positions_fd,positions,*nentries);
-#ifdef HAVE_PTHREAD
-    pthread_mutex_unlock(&this->positions_read_mutex);
-#endif
+    Indexdb_positions_fileio(positions,this,ptr0,*nentries);
     return positions;
   } else {
     debug0(
@@ -1627,6 +2089,51 @@ Indexdb_read_inplace (int *nentries, T this, Storedoligomer_T oligo) {
   }
 }
 
+
+/* The loads in Indexdb_read_inplace depend on one another: the gamma
+   pointer, then the gamma block it points to, then the positions.
+   These procedures prefetch one level each, assuming that the
+   previous level has already been prefetched, so callers can
+   pipeline them across reads. */
+void
+Indexdb_prefetch_gammaptr (T this, Storedoligomer_T oligo) {
+#ifdef USE_PREFETCH
+  _mm_prefetch((const char *) &(this->gammaptrs[oligo/this->offsetscomp_blocksize]),_MM_HINT_T0);
+#endif
+  return;
+}
+
+void
+Indexdb_prefetch_offsets (T this, Storedoligomer_T oligo) {
+#ifdef USE_PREFETCH
+  Positionsptr_T *ptr;
+
+  ptr = &(this->offsetscomp[this->gammaptrs[oligo/this->offsetscomp_blocksize]]);
+  _mm_prefetch((const char *) ptr,_MM_HINT_T0);
+  _mm_prefetch((const char *) (ptr + 16),_MM_HINT_T0); /* Gamma block may cross a cache line */
+#endif
+  return;
+}
+
+void
+Indexdb_prefetch_positions (T this, Storedoligomer_T oligo) {
+#ifdef USE_PREFETCH
+  Positionsptr_T ptr0, end0;
+  Storedoligomer_T part0;
+
+  part0 = oligo & poly_T;
+  if (part0 == poly_A || part0 == poly_T) {
+    /* Not looked up by Indexdb_read_inplace */
+  } else if (this->positions_access != FILEIO) {
+    ptr0 = Indexdb_offsetptr(&end0,this,oligo);
+    if (end0 > ptr0) {
+      _mm_prefetch((const char *) &(this->positions[ptr0]),_MM_HINT_T0);
+    }
+  }
+#endif
+  return;
+}
+
 #endif	/* ifdef PMAP */
 
 
@@ -1637,15 +2144,7 @@ Indexdb_read_with_diagterm (int *nentries, T this, Storedoligomer_T oligo, int d
   Positionsptr_T ptr0, end0, ptr;
   int i;
 
-#ifdef WORDS_BIGENDIAN
-  if (this->offsetscomp_access == ALLOCATED) {
-    ptr0 = Genome_offsetptr_from_gammas(&end0,this->gammaptrs,this->offsetscomp,this->offsetscomp_blocksize,oligo);
-  } else {
-    ptr0 = Genome_offsetptr_from_gammas_bigendian(&end0,this->gammaptrs,this->offsetscomp,this->offsetscomp_blocksize,oligo);
-  }
-#else
-  ptr0 = Genome_offsetptr_from_gammas(&end0,this->gammaptrs,this->offsetscomp,this->offsetscomp_blocksize,oligo);
-#endif
+  ptr0 = Indexdb_offsetptr(&end0,this,oligo);
 
   debug0(printf("read_zero_shift: oligo = %06X, offset pointers are %u and %u\n",oligo,ptr0,end0));
 
@@ -1654,17 +2153,18 @@ Indexdb_read_with_diagterm (int *nentries, T this, Storedoligomer_T oligo, int d
   } else {
     positions = (Univcoord_T *) CALLOC(*nentries,sizeof(Univcoord_T));
     if (this->positions_access == FILEIO) {
-#ifdef HAVE_PTHREAD
-      pthread_mutex_lock(&this->positions_read_mutex);
-#endif
-      positions_move_absolute(this->positions_fd,ptr0);
-      positions_read_multiple(this->positions_fd,positions,*nentries);
-
-#ifdef HAVE_PTHREAD
-      pthread_mutex_unlock(&this->positions_read_mutex);
+      Indexdb_positions_fileio(positions,this,ptr0,*nentries);
+#ifdef WORDS_BIGENDIAN
+      for (i = 0; i < *nentries; i++) {
+	positions[i] = Bigendian_convert_univcoord(positions[i]) + diagterm;
+      }
+#else
+      for (i = 0; i < *nentries; i++) {
+	positions[i] += diagterm;
+      }
 #endif
 
-    } else if (this->positions_access == ALLOCATED) {
+    } else if (this->positions_access == ALLOCATED || this->positions_access == SHARED) {
       for (ptr = ptr0, i = 0; ptr < end0; ptr++) {
 	positions[i++] = this->positions[ptr] + diagterm;
       }
@@ -1703,15 +2203,7 @@ Indexdb_read_with_diagterm_sizelimit (int *nentries, T this, Storedoligomer_T ol
   Positionsptr_T ptr0, end0, ptr;
   int i;
 
-#ifdef WORDS_BIGENDIAN
-  if (this->offsetscomp_access == ALLOCATED) {
-    ptr0 = Genome_offsetptr_from_gammas(&end0,this->gammaptrs,this->offsetscomp,this->offsetscomp_blocksize,oligo);
-  } else {
-    ptr0 = Genome_offsetptr_from_gammas_bigendian(&end0,this->gammaptrs,this->offsetscomp,this->offsetscomp_blocksize,oligo);
-  }
-#else
-  ptr0 = Genome_offsetptr_from_gammas(&end0,this->gammaptrs,this->offsetscomp,this->offsetscomp_blocksize,oligo);
-#endif
+  ptr0 = Indexdb_offsetptr(&end0,this,oligo);
 
   debug0(printf("read_zero_shift: oligo = %06X, offset pointers are %u and %u\n",oligo,ptr0,end0));
 
@@ -1725,17 +2217,18 @@ Indexdb_read_with_diagterm_sizelimit (int *nentries, T this, Storedoligomer_T ol
   } else {
     positions = (Univcoord_T *) CALLOC(*nentries,sizeof(Univcoord_T));
     if (this->positions_access == FILEIO) {
-#ifdef HAVE_PTHREAD
-      pthread_mutex_lock(&this->positions_read_mutex);
-#endif
-      positions_move_absolute(this->positions_fd,ptr0);
-      positions_read_multiple(this->positions_fd,positions,*nentries);
-
-#ifdef HAVE_PTHREAD
-      pthread_mutex_unlock(&this->positions_read_mutex);
+      Indexdb_positions_fileio(positions,this,ptr0,*nentries);
+#ifdef WORDS_BIGENDIAN
+      for (i = 0; i < *nentries; i++) {
+	positions[i] = Bigendian_convert_univcoord(positions[i]) + diagterm;
+      }
+#else
+      for (i = 0; i < *nentries; i++) {
+	positions[i] += diagterm;
+      }
 #endif
 
-    } else if (this->positions_access == ALLOCATED) {
+    } else if (this->positions_access == ALLOCATED || this->positions_access == SHARED) {
       for (ptr = ptr0, i = 0; ptr < end0; ptr++) {
 	positions[i++] = this->positions[ptr] + diagterm;
       }
@@ -1807,6 +2300,9 @@ Indexdb_new_segment (char *genomicseg,
 #endif
 
 
+  new->eliasfanop = false;
+  new->positionsdelta = (UINT4 *) NULL;
+  new->positions40 = (unsigned char *) NULL;
   new->gammaptrs = (Gammaptr_T *) CALLOC(oligospace+1,sizeof(Gammaptr_T));
   for (oligoi = 0; oligoi <= oligospace; oligoi++) {
     new->gammaptrs[oligoi] = oligoi;
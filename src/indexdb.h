@@ -34,6 +34,11 @@
 #define OFFSETS_FILESUFFIX "offsets"
 #define POSITIONS_FILESUFFIX "positions"
 
+/* For large genomes, positions packed in 5 bytes each */
+#define POSITIONS40_FILESUFFIX "positions40"
+#define POSITIONS40_NBYTES 5
+#define POSITIONS40_MASK 0xFFFFFFFFFFULL
+
 
 #define T Indexdb_T
 typedef struct T *T;
@@ -54,8 +59,14 @@ Indexdb_interval (T this);
 #endif
 extern bool
 Indexdb_positions_fileio_p (T this);
+extern void
+Indexdb_positions_fileio (Univcoord_T *values, T this, Positionsptr_T ptr0, int n);
 extern double
 Indexdb_mean_size (T this, Mode_T mode, Width_T index1part);
+extern Positionsptr_T
+Indexdb_offsetptr (Positionsptr_T *end0, T this, Storedoligomer_T oligo);
+extern Positionsptr_T
+Indexdb_offsetptr_only (T this, Storedoligomer_T oligo);
 
 extern bool
 Indexdb_get_filenames (char **gammaptrs_filename, char **offsetscomp_filename, char **positions_filename,
@@ -108,6 +119,12 @@ extern Univcoord_T *
 Indexdb_read (int *nentries, T this, Storedoligomer_T oligo);
 extern Univcoord_T *
 Indexdb_read_inplace (int *nentries, T this, Storedoligomer_T oligo);
+extern void
+Indexdb_prefetch_gammaptr (T this, Storedoligomer_T oligo);
+extern void
+Indexdb_prefetch_offsets (T this, Storedoligomer_T oligo);
+extern void
+Indexdb_prefetch_positions (T this, Storedoligomer_T oligo);
 #endif
 
 extern Univcoord_T *
@@ -32,6 +32,7 @@ static char rcsid[] = "$Id: indexdb_hr.c 99737 2013-06-27 19:33:03Z twu $";
 #include <string.h>		/* For memcpy */
 #include "mem.h"
 #include "listdef.h"
+#include "merge.h"
 
 
 /* ALLOW_DUPLICATES is possible only if we permit alternative strains */
@@ -187,6 +188,8 @@ check_heap_even (Batch_T *heap, int heapsize) {
 
 #define READ_THEN_WRITE 1
 
+#ifdef WORDS_BIGENDIAN
+/* Little-endian hosts use merge.c instead */
 static Univcoord_T *
 merge_batches_one_heap_16_existing (int *nmerged, struct Batch_T *batchpool, int nentries, int diagterm) {
   Univcoord_T *positions, *ptr, position, last_position, this_position;
@@ -547,65 +550,8 @@ merge_batches_one_heap_4_existing (int *nmerged, struct Batch_T *batchpool, int
 
   return positions;
 }
-
-
-/************************************************************************
- *  The following positions functions are take from indexdb.c
- ************************************************************************/
-
-static void
-positions_move_absolute (int positions_fd, Positionsptr_T ptr) {
-  off_t offset = ptr*((off_t) sizeof(Univcoord_T));
-
-  if (lseek(positions_fd,offset,SEEK_SET) < 0) {
-    fprintf(stderr,"Attempted to do lseek on offset %u*%lu=%lu\n",
-	    ptr,sizeof(Univcoord_T),(long unsigned int) offset);
-    perror("Error in indexdb.c, positions_move_absolute");
-    exit(9);
-  }
-  return;
-}
-
-static void
-positions_read_multiple (int positions_fd, Univcoord_T *values, int n) {
-  int i;
-  Univcoord_T value;
-  unsigned char buffer[4];
-
-#ifdef WORDS_BIGENDIAN
-  /* Need to keep in bigendian format */
-  for (i = 0; i < n; i++) {
-    read(positions_fd,buffer,4);
-
-    value = (buffer[0] & 0xff);
-    value <<= 8;
-    value |= (buffer[1] & 0xff);
-    value <<= 8;
-    value |= (buffer[2] & 0xff);
-    value <<= 8;
-    value |= (buffer[3] & 0xff);
-
-    values[i] = value;
-  }
-#else
-  for (i = 0; i < n; i++) {
-    read(positions_fd,buffer,4);
-
-    value = (buffer[3] & 0xff);
-    value <<= 8;
-    value |= (buffer[2] & 0xff);
-    value <<= 8;
-    value |= (buffer[1] & 0xff);
-    value <<= 8;
-    value |= (buffer[0] & 0xff);
-
-    values[i] = value;
-  }
 #endif
 
-  return;
-}
-
 
 static Univcoord_T *
 point_one_shift (int *nentries, T this, Storedoligomer_T subst) {
@@ -615,15 +561,7 @@ point_one_shift (int *nentries, T this, Storedoligomer_T subst) {
   int i;
 #endif
 
-#ifdef WORDS_BIGENDIAN
-  if (this->offsetscomp_access == ALLOCATED) {
-    ptr0 = Genome_offsetptr_from_gammas(&end0,this->gammaptrs,this->offsetscomp,this->offsetscomp_blocksize,subst);
-  } else {
-    ptr0 = Genome_offsetptr_from_gammas_bigendian(&end0,this->gammaptrs,this->offsetscomp,this->offsetscomp_blocksize,subst);
-  }
-#else
-  ptr0 = Genome_offsetptr_from_gammas(&end0,this->gammaptrs,this->offsetscomp,this->offsetscomp_blocksize,subst);
-#endif
+  ptr0 = Indexdb_offsetptr(&end0,this,subst);
 
   debug(printf("point_one_shift: %08X %u %u\n",subst,ptr0,end0));
 
@@ -632,15 +570,7 @@ point_one_shift (int *nentries, T this, Storedoligomer_T subst) {
   } else {
     if (this->positions_access == FILEIO) {
       positions = (Univcoord_T *) CALLOC(*nentries,sizeof(Univcoord_T));
-#ifdef HAVE_PTHREAD
-      pthread_mutex_lock(&this->positions_read_mutex);
-#endif
-      positions_move_absolute(this->positions_fd,ptr0);
-      positions_read_multiple(this->positions_fd,positions,*nentries);
-
-#ifdef HAVE_PTHREAD
-      pthread_mutex_unlock(&this->positions_read_mutex);
-#endif
+      Indexdb_positions_fileio(positions,this,ptr0,*nentries);
 
     } else {
       /* ALLOCATED or MMAPPED */
@@ -712,18 +642,8 @@ static int
 count_one_shift (T this, Storedoligomer_T subst, int nadjacent) {
   Positionsptr_T ptr0, end0;
 
-#ifdef WORDS_BIGENDIAN
-  if (this->offsetscomp_access == ALLOCATED) {
-    ptr0 = Genome_offsetptr_only_from_gammas(this->gammaptrs,this->offsetscomp,this->offsetscomp_blocksize,subst);
-    end0 = Genome_offsetptr_only_from_gammas(this->gammaptrs,this->offsetscomp,this->offsetscomp_blocksize,subst+nadjacent);
-  } else {
-    ptr0 = Genome_offsetptr_only_from_gammas_bigendian(this->gammaptrs,this->offsetscomp,this->offsetscomp_blocksize,subst);
-    end0 = Genome_offsetptr_only_from_gammas_bigendian(this->gammaptrs,this->offsetscomp,this->offsetscomp_blocksize,subst+nadjacent);
-  }
-#else
-  ptr0 = Genome_offsetptr_only_from_gammas(this->gammaptrs,this->offsetscomp,this->offsetscomp_blocksize,subst);
-  end0 = Genome_offsetptr_only_from_gammas(this->gammaptrs,this->offsetscomp,this->offsetscomp_blocksize,subst+nadjacent);
-#endif
+  ptr0 = Indexdb_offsetptr_only(this,subst);
+  end0 = Indexdb_offsetptr_only(this,subst+nadjacent);
 
   debug(printf("count_one_shift: oligo = %06X (%s), %u - %u = %u\n",
 	       subst,shortoligo_nt(subst,index1part),end0,ptr0,end0-ptr0));
@@ -1177,6 +1097,19 @@ Compoundpos_heap_init (Compoundpos_T compoundpos, int querylength, int diagterm)
 }
 
 
+/* Entries left in the batches in the heap, which excludes those
+   removed by Compoundpos_heap_init */
+int
+Compoundpos_nentries (Compoundpos_T compoundpos) {
+  int nentries = 0, i;
+
+  for (i = 1; i <= compoundpos->heapsize; i++) {
+    nentries += compoundpos->heap[i]->nentries;
+  }
+  return nentries;
+}
+
+
 /* Used by DEBUG3 and DEBUG6 */
 static void
 heap_even_dump (Batch_T *heap, int heapsize) {
@@ -1479,6 +1412,7 @@ Compoundpos_search (Univcoord_T *value, Compoundpos_T compoundpos, Univcoord_T l
 }
 
 
+#ifdef WORDS_BIGENDIAN
 Univcoord_T *
 Indexdb_merge_compoundpos (int *nmerged, Compoundpos_T compoundpos, int diagterm) {
   int i;
@@ -1507,6 +1441,45 @@ Indexdb_merge_compoundpos (int *nmerged, Compoundpos_T compoundpos, int diagterm
   }
 }
 
+#else
+/* Merges the positions with merge.c, and then adds diagterm and
+   removes duplicates in place */
+Univcoord_T *
+Indexdb_merge_compoundpos (int *nmerged, Compoundpos_T compoundpos, int diagterm) {
+  Univcoord_T *positions, *ptr, last_position, this_position;
+  int nentries, i;
+
+  positions = Merge_univcoord(&nentries,compoundpos->positions,compoundpos->npositions,compoundpos->n);
+  debug(printf("merge_compoundpos: %d positions from %d batches\n",nentries,compoundpos->n));
+
+  ptr = positions;
+  last_position = 0U;
+  for (i = 0; i < nentries; i++) {
+    if ((this_position = positions[i] + diagterm) != last_position) {
+      *ptr++ = this_position;
+    }
+    last_position = this_position;
+  }
+
+  *nmerged = (ptr - positions);
+  return positions;
+}
+
+/* Merges what is left of the batches in the heap, without advancing
+   them */
+Univcoord_T *
+Compoundpos_merge (int *nmerged, Compoundpos_T compoundpos) {
+  Univcoord_T *runs[16];
+  int runlengths[16], i;
+
+  for (i = 1; i <= compoundpos->heapsize; i++) {
+    runs[i-1] = compoundpos->heap[i]->positionptr;
+    runlengths[i-1] = compoundpos->heap[i]->nentries;
+  }
+  return Merge_univcoord(&(*nmerged),runs,runlengths,compoundpos->heapsize);
+}
+#endif
+
 
 
 /* Should be the same as count_one_shift(this,oligo,1) */
@@ -1514,15 +1487,7 @@ int
 Indexdb_count_no_subst (T this, Storedoligomer_T oligo) {
   Positionsptr_T ptr0, end0;
 
-#ifdef WORDS_BIGENDIAN
-  if (this->offsetscomp_access == ALLOCATED) {
-    ptr0 = Genome_offsetptr_from_gammas(&end0,this->gammaptrs,this->offsetscomp,this->offsetscomp_blocksize,oligo);
-  } else {
-    ptr0 = Genome_offsetptr_from_gammas_bigendian(&end0,this->gammaptrs,this->offsetscomp,this->offsetscomp_blocksize,oligo);
-  }
-#else
-  ptr0 = Genome_offsetptr_from_gammas(&end0,this->gammaptrs,this->offsetscomp,this->offsetscomp_blocksize,oligo);
-#endif
+  ptr0 = Indexdb_offsetptr(&end0,this,oligo);
 
   debug(printf("count_one_shift: oligo = %06X (%s), %u - %u = %u\n",
 	       oligo,shortoligo_nt(oligo,index1part),end0,ptr0,end0-ptr0));
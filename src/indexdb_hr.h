@@ -28,6 +28,8 @@ extern void
 Compoundpos_free (Compoundpos_T *old);
 extern void
 Compoundpos_heap_init (Compoundpos_T compoundpos, int querylength, int diagterm);
+extern int
+Compoundpos_nentries (Compoundpos_T compoundpos);
 extern bool
 Compoundpos_find (bool *emptyp, Compoundpos_T compoundpos, Univcoord_T local_goal);
 extern int
@@ -43,6 +45,10 @@ Indexdb_compoundpos_right_subst_1 (T this, Storedoligomer_T oligo);
 
 extern Univcoord_T *
 Indexdb_merge_compoundpos (int *nmerged, Compoundpos_T compoundpos, int diagterm);
+#ifndef WORDS_BIGENDIAN
+extern Univcoord_T *
+Compoundpos_merge (int *nmerged, Compoundpos_T compoundpos);
+#endif
 
 extern Univcoord_T *
 Indexdb_read_left_subst_2 (int *npositions, T this, Storedoligomer_T oligo);
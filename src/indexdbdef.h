@@ -2,6 +2,7 @@
 #ifndef INDEXDBDEF_INCLUDED
 #define INDEXDBDEF_INCLUDED
 
+#include "bool.h"
 #include "genomicpos.h"
 #include "access.h"
 #include "types.h"
@@ -24,6 +25,7 @@ struct T {
   Width_T index1interval;
   Width_T offsetscomp_basesize;		/* e.g., 12 */
   Blocksize_T offsetscomp_blocksize;	/* e.g., 64 = 4^(15-12) */
+  bool eliasfanop;			/* gammaptrs and offsetscomp hold Elias-Fano blocks */
 
   /* Access_T gammaptrs_access; -- Always ALLOCATED */ 
   int gammaptrs_fd;
@@ -40,8 +42,29 @@ struct T {
   size_t positions_len;
   Univcoord_T *positions;
 
+  /* If positionsdelta is non-NULL, positions are decoded from it, with
+     positions_access set to FILEIO, so callers copy them */
+  Access_T positionsdelta_access;
+  int positionsdelta_fd;
+  size_t positionsdelta_len;
+  UINT4 *positionsdelta;
+
+  Access_T positionsblocks_access;
+  int positionsblocks_fd;
+  size_t positionsblocks_len;
+  UINT4 *positionsblocks;
+
+  /* Likewise for 5-byte positions of large genomes */
+  Access_T positions40_access;
+  int positions40_fd;
+  size_t positions40_len;
+  unsigned char *positions40;
+
 #ifdef HAVE_PTHREAD
-  pthread_mutex_t positions_read_mutex;
+  pthread_mutex_t positions_read_mutex; /* Needed only without pread */
+  pthread_key_t positions_cache_key;	/* Per-thread cache for FILEIO */
+#else
+  void *positions_cache;
 #endif
 };
 
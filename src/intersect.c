@@ -0,0 +1,365 @@
+static char rcsid[] = "$Id: intersect.c $";
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "intersect.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include "mem.h"
+
+#if defined(HAVE_SSE2) && !defined(WORDS_BIGENDIAN) && !defined(LARGE_GENOMES)
+#define USE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#ifdef STANDALONE
+#include "indexdb.h"
+#include "stopwatch.h"
+#endif
+
+
+#ifdef DEBUG
+#define debug(x) x
+#else
+#define debug(x)
+#endif
+
+
+/* Returns an i with positions[i] == goal if there is one, and
+   otherwise the first i with positions[i] > goal, or npositions.
+   Gallops from the start of the list, so the cost depends on how far
+   the answer is from the start rather than on npositions. */
+static inline int
+gallop (Univcoord_T *positions, int npositions, Univcoord_T goal) {
+  int lowi, highi, middlei, n, half;
+
+  if (npositions == 0 || positions[0] >= goal) {
+    return 0;
+  }
+
+  lowi = 0;
+  highi = 1;
+  while (highi < npositions && positions[highi] < goal) {
+    lowi = highi;
+    highi <<= 1;		/* gallop by 2 */
+  }
+  if (highi > npositions) {
+    highi = npositions;
+  }
+
+  /* positions[lowi] < goal, and the answer is in lowi+1..highi.  Wide
+     ranges use a three-way test, which the compiler must branch on,
+     so the processor can fetch ahead.  Within a cache line, the steps
+     are written for a conditional move. */
+  while (highi - lowi > (int) (64/sizeof(Univcoord_T))) {
+    middlei = lowi + (highi - lowi)/2;
+    if (positions[middlei] < goal) {
+      lowi = middlei;
+    } else if (positions[middlei] > goal) {
+      highi = middlei;
+    } else {
+      return middlei;
+    }
+  }
+
+  n = highi - lowi;
+  while (n > 1) {
+    half = n >> 1;
+    lowi = (positions[lowi + half] < goal) ? lowi + half : lowi;
+    n -= half;
+  }
+
+  return lowi + 1;
+}
+
+
+/* Each of these looks up positions0 + delta in positions1, and stores
+   the matches, plus diagterm, in diagonals.  Matches come out in
+   ascending order, so comparing against the last one is enough to
+   remove duplicates. */
+
+static int
+intersect_gallop (Univcoord_T *diagonals, Univcoord_T *positions0, int npositions0,
+		  Univcoord_T *positions1, int npositions1, int delta, int diagterm) {
+  Univcoord_T goal, this_diagonal, last_diagonal = 0U;
+  int ndiagonals = 0, i, j = 0;
+
+  for (i = 0; i < npositions0; i++) {
+    goal = positions0[i] + delta;
+    j += gallop(&(positions1[j]),npositions1 - j,goal);
+    if (j >= npositions1) {
+      return ndiagonals;
+    } else if (positions1[j] == goal) {
+      if ((this_diagonal = goal + diagterm) != last_diagonal) {
+	diagonals[ndiagonals++] = this_diagonal;
+      }
+      last_diagonal = this_diagonal;
+    }
+  }
+
+  return ndiagonals;
+}
+
+
+static int
+intersect_linear (Univcoord_T *diagonals, Univcoord_T *positions0, int npositions0,
+		  Univcoord_T *positions1, int npositions1, int delta, int diagterm) {
+  Univcoord_T goal, value, this_diagonal, last_diagonal = 0U;
+  int ndiagonals = 0, i = 0, j = 0;
+#ifdef USE_SSE2
+  __m128i deltas, goals, values, matches;
+  int mask, k;
+
+  /* Compares four goals against four values in every rotation, and
+     then discards whichever block ends lower, or both */
+  deltas = _mm_set1_epi32(delta);
+  while (i + 4 <= npositions0 && j + 4 <= npositions1) {
+    goals = _mm_add_epi32(_mm_loadu_si128((__m128i *) &(positions0[i])),deltas);
+    values = _mm_loadu_si128((__m128i *) &(positions1[j]));
+    matches = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi32(goals,values),
+					_mm_cmpeq_epi32(goals,_mm_shuffle_epi32(values,_MM_SHUFFLE(0,3,2,1)))),
+			   _mm_or_si128(_mm_cmpeq_epi32(goals,_mm_shuffle_epi32(values,_MM_SHUFFLE(1,0,3,2))),
+					_mm_cmpeq_epi32(goals,_mm_shuffle_epi32(values,_MM_SHUFFLE(2,1,0,3)))));
+
+    if ((mask = _mm_movemask_ps(_mm_castsi128_ps(matches))) != 0) {
+      for (k = 0; k < 4; k++) {
+	if (mask & (1 << k)) {
+	  if ((this_diagonal = positions0[i+k] + delta + diagterm) != last_diagonal) {
+	    diagonals[ndiagonals++] = this_diagonal;
+	  }
+	  last_diagonal = this_diagonal;
+	}
+      }
+    }
+
+    goal = positions0[i+3] + delta;
+    value = positions1[j+3];
+    i += (goal <= value) ? 4 : 0;
+    j += (value <= goal) ? 4 : 0;
+  }
+#endif
+
+  while (i < npositions0 && j < npositions1) {
+    goal = positions0[i] + delta;
+    value = positions1[j];
+    if (goal < value) {
+      i++;
+    } else if (value < goal) {
+      j++;
+    } else {
+      if ((this_diagonal = goal + diagterm) != last_diagonal) {
+	diagonals[ndiagonals++] = this_diagonal;
+      }
+      last_diagonal = this_diagonal;
+      i++;
+    }
+  }
+
+  return ndiagonals;
+}
+
+
+Univcoord_T *
+Intersect_diagonals (int *ndiagonals, Univcoord_T *positionsa, int diagterma, int npositionsa,
+		     Univcoord_T *positionsb, int diagtermb, int npositionsb) {
+  Univcoord_T *diagonals, *positions0, *positions1;
+  int npositions0, npositions1, delta, diagterm;
+
+  if (npositionsa < npositionsb) {
+    positions0 = positionsa;
+    npositions0 = npositionsa;
+    positions1 = positionsb;
+    npositions1 = npositionsb;
+    diagterm = diagtermb;	/* goals are based on the larger list */
+    delta = diagterma - diagtermb; /* list0 + (diagterm0 - diagterm1) = list1 */
+  } else {
+    positions0 = positionsb;
+    npositions0 = npositionsb;
+    positions1 = positionsa;
+    npositions1 = npositionsa;
+    diagterm = diagterma;	/* goals are based on the larger list */
+    delta = diagtermb - diagterma; /* list0 + (diagterm0 - diagterm1) = list1 */
+  }
+
+  *ndiagonals = 0;
+  if (npositions0 == 0) {
+    return (Univcoord_T *) NULL;
+  } else {
+    /* Allocate maximum possible size */
+    diagonals = (Univcoord_T *) CALLOC(npositions0,sizeof(Univcoord_T));
+  }
+
+  /* Goals that would wrap around cannot match, and would break the
+     ordering that both methods rely on */
+  if (delta < 0) {
+    while (npositions0 > 0 && *positions0 < (Univcoord_T) -delta) {
+      ++positions0;
+      --npositions0;
+    }
+  } else {
+    while (npositions0 > 0 && positions0[npositions0-1] > ((Univcoord_T) -1) - (Univcoord_T) delta) {
+      --npositions0;
+    }
+  }
+
+  if (npositions1 >= INTERSECT_GALLOP_RATIO * npositions0) {
+    debug(printf("Intersect_diagonals: galloping %d positions into %d\n",npositions0,npositions1));
+    *ndiagonals = intersect_gallop(diagonals,positions0,npositions0,positions1,npositions1,delta,diagterm);
+  } else {
+    debug(printf("Intersect_diagonals: walking %d positions against %d\n",npositions0,npositions1));
+    *ndiagonals = intersect_linear(diagonals,positions0,npositions0,positions1,npositions1,delta,diagterm);
+  }
+
+  return diagonals;
+}
+
+
+
+#ifdef STANDALONE
+
+/* Times both methods on the positions of random pairs of oligomers
+   from an index, grouped by the ratio of their list sizes, to check
+   INTERSECT_GALLOP_RATIO:
+
+     intersect <genomesubdir> <fileroot> [npairs] [nreps]
+*/
+
+#define NBUCKETS 12
+
+int
+main (int argc, char *argv[]) {
+  Indexdb_T indexdb;
+  Width_T basesize, index1part, index1interval;
+  Stopwatch_T stopwatch;
+  Univcoord_T **positionsa, **positionsb, *diagonals;
+  int *npositionsa, *npositionsb, *bucket, nsmall, nlarge;
+  UINT8 oligospace;
+  Storedoligomer_T oligo;
+  int npairs = 100000, nreps = 10, npairs_bucket, b, i, rep;
+  long int gallop_total, linear_total;
+  double gallop_time, linear_time, sumsmall;
+
+  if (argc < 3) {
+    fprintf(stderr,"Usage: intersect <genomesubdir> <fileroot> [npairs] [nreps]\n");
+    exit(9);
+  }
+  if (argc > 3) {
+    npairs = atoi(argv[3]);
+  }
+  if (argc > 4) {
+    nreps = atoi(argv[4]);
+  }
+
+  if ((indexdb = Indexdb_new_genome(&basesize,&index1part,&index1interval,
+				    argv[1],argv[2],/*idx_filesuffix*/"ref",/*snps_root*/NULL,
+				    /*required_basesize*/0,/*required_index1part*/0,/*required_interval*/0,
+				    /*expand_offsets_p*/false,USE_ALLOCATE,USE_ALLOCATE)) == NULL) {
+    fprintf(stderr,"Cannot find index files for %s in %s\n",argv[2],argv[1]);
+    exit(9);
+  }
+  Indexdb_setup(index1part);
+  oligospace = (UINT8) 1 << (2*index1part);
+
+  positionsa = (Univcoord_T **) CALLOC(npairs,sizeof(Univcoord_T *));
+  positionsb = (Univcoord_T **) CALLOC(npairs,sizeof(Univcoord_T *));
+  npositionsa = (int *) CALLOC(npairs,sizeof(int));
+  npositionsb = (int *) CALLOC(npairs,sizeof(int));
+  bucket = (int *) CALLOC(npairs,sizeof(int));
+
+  for (i = 0; i < npairs; i++) {
+    do {
+      oligo = (Storedoligomer_T) ((((UINT8) rand() << 31) | (UINT8) rand()) % oligospace);
+      positionsa[i] = Indexdb_read(&(npositionsa[i]),indexdb,oligo);
+    } while (npositionsa[i] == 0);
+    do {
+      oligo = (Storedoligomer_T) ((((UINT8) rand() << 31) | (UINT8) rand()) % oligospace);
+      positionsb[i] = Indexdb_read(&(npositionsb[i]),indexdb,oligo);
+    } while (npositionsb[i] == 0);
+
+    if (npositionsa[i] < npositionsb[i]) {
+      nsmall = npositionsa[i];
+      nlarge = npositionsb[i];
+    } else {
+      nsmall = npositionsb[i];
+      nlarge = npositionsa[i];
+    }
+    for (b = 0; b + 1 < NBUCKETS && (nlarge >> (b+1)) >= nsmall; b++) ;
+    bucket[i] = b;
+  }
+
+  stopwatch = Stopwatch_new();
+  printf("ratio\tpairs\tmean small\tgallop (us)\tlinear (us)\n");
+  for (b = 0; b < NBUCKETS; b++) {
+    npairs_bucket = 0;
+    sumsmall = 0.0;
+    for (i = 0; i < npairs; i++) {
+      if (bucket[i] == b) {
+	npairs_bucket++;
+	sumsmall += (npositionsa[i] < npositionsb[i]) ? npositionsa[i] : npositionsb[i];
+      }
+    }
+    if (npairs_bucket == 0) {
+      continue;
+    }
+
+    gallop_total = linear_total = 0;
+    Stopwatch_start(stopwatch);
+    for (rep = 0; rep < nreps; rep++) {
+      for (i = 0; i < npairs; i++) {
+	if (bucket[i] == b) {
+	  if (npositionsa[i] < npositionsb[i]) {
+	    diagonals = (Univcoord_T *) MALLOC(npositionsa[i]*sizeof(Univcoord_T));
+	    gallop_total += intersect_gallop(diagonals,positionsa[i],npositionsa[i],positionsb[i],npositionsb[i],/*delta*/0,/*diagterm*/0);
+	  } else {
+	    diagonals = (Univcoord_T *) MALLOC(npositionsb[i]*sizeof(Univcoord_T));
+	    gallop_total += intersect_gallop(diagonals,positionsb[i],npositionsb[i],positionsa[i],npositionsa[i],/*delta*/0,/*diagterm*/0);
+	  }
+	  FREE(diagonals);
+	}
+      }
+    }
+    gallop_time = Stopwatch_stop(stopwatch);
+
+    Stopwatch_start(stopwatch);
+    for (rep = 0; rep < nreps; rep++) {
+      for (i = 0; i < npairs; i++) {
+	if (bucket[i] == b) {
+	  if (npositionsa[i] < npositionsb[i]) {
+	    diagonals = (Univcoord_T *) MALLOC(npositionsa[i]*sizeof(Univcoord_T));
+	    linear_total += intersect_linear(diagonals,positionsa[i],npositionsa[i],positionsb[i],npositionsb[i],/*delta*/0,/*diagterm*/0);
+	  } else {
+	    diagonals = (Univcoord_T *) MALLOC(npositionsb[i]*sizeof(Univcoord_T));
+	    linear_total += intersect_linear(diagonals,positionsb[i],npositionsb[i],positionsa[i],npositionsa[i],/*delta*/0,/*diagterm*/0);
+	  }
+	  FREE(diagonals);
+	}
+      }
+    }
+    linear_time = Stopwatch_stop(stopwatch);
+
+    if (gallop_total != linear_total) {
+      fprintf(stderr,"Methods disagree for ratio %d: %ld vs %ld diagonals\n",1 << b,gallop_total,linear_total);
+      exit(9);
+    }
+
+    printf("%s%d\t%d\t%.1f\t%.3f\t%.3f\n",(b + 1 == NBUCKETS) ? ">=" : "",1 << b,npairs_bucket,sumsmall/npairs_bucket,
+	   1.0e6*gallop_time/nreps/npairs_bucket,1.0e6*linear_time/nreps/npairs_bucket);
+  }
+  Stopwatch_free(&stopwatch);
+
+  for (i = 0; i < npairs; i++) {
+    FREE(positionsa[i]);
+    FREE(positionsb[i]);
+  }
+  FREE(bucket);
+  FREE(npositionsb);
+  FREE(npositionsa);
+  FREE(positionsb);
+  FREE(positionsa);
+  Indexdb_free(&indexdb);
+
+  return 0;
+}
+#endif
+
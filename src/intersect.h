@@ -0,0 +1,25 @@
+/* $Id: intersect.h $ */
+#ifndef INTERSECT_INCLUDED
+#define INTERSECT_INCLUDED
+#include "types.h"
+
+/* When the larger list has at least this many times the entries of
+   the smaller one, each entry of the smaller list is found by a
+   galloping search in the larger.  Otherwise, the two lists are
+   walked together, four entries at a time where SSE2 is available. */
+#if defined(HAVE_SSE2) && !defined(WORDS_BIGENDIAN) && !defined(LARGE_GENOMES)
+#define INTERSECT_GALLOP_RATIO 32
+#else
+#define INTERSECT_GALLOP_RATIO 4
+#endif
+
+/* Returns the diagonals d, in ascending order and without
+   duplicates, for which d - diagterma is in positionsa and d -
+   diagtermb is in positionsb.  Both lists must be sorted and in host
+   byte order.  Returns NULL if either list is empty. */
+extern Univcoord_T *
+Intersect_diagonals (int *ndiagonals, Univcoord_T *positionsa, int diagterma, int npositionsa,
+		     Univcoord_T *positionsb, int diagtermb, int npositionsb);
+
+#endif
+
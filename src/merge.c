@@ -0,0 +1,313 @@
+static char rcsid[] = "$Id: merge.c $";
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "merge.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>		/* For memcpy */
+#include "mem.h"
+
+#ifdef HAVE_SSE4_1
+#define USE_SSE4_1 1
+#include <smmintrin.h>
+#endif
+
+
+#ifdef DEBUG
+#define debug(x) x
+#else
+#define debug(x)
+#endif
+
+
+/************************************************************************
+ *   Two runs
+ ************************************************************************/
+
+static void
+merge_two_uint4_scalar (UINT4 *dest, UINT4 *a, UINT4 *a_end, UINT4 *b, UINT4 *b_end) {
+  int takea;
+
+  while (a < a_end && b < b_end) {
+    takea = (*a <= *b);
+    *dest++ = takea ? *a : *b;
+    a += takea;
+    b += 1 - takea;
+  }
+  memcpy(dest,a,(a_end - a)*sizeof(UINT4));
+  memcpy(&(dest[a_end - a]),b,(b_end - b)*sizeof(UINT4));
+  return;
+}
+
+
+#ifdef USE_SSE4_1
+/* Given two sorted vectors, puts the lowest four values in order into
+   *lo and the highest four into *hi */
+static inline void
+bitonic_merge_4x4 (__m128i *lo, __m128i *hi) {
+  __m128i a, b, mins, maxs;
+
+  /* Against the reverse of *hi, which gives two bitonic sequences */
+  b = _mm_shuffle_epi32(*hi,_MM_SHUFFLE(0,1,2,3));
+  mins = _mm_min_epu32(*lo,b);
+  maxs = _mm_max_epu32(*lo,b);
+
+  /* Half-cleaners at distance 2 */
+  a = _mm_unpacklo_epi64(mins,maxs);
+  b = _mm_unpackhi_epi64(mins,maxs);
+  mins = _mm_min_epu32(a,b);
+  maxs = _mm_max_epu32(a,b);
+
+  /* Half-cleaners at distance 1 */
+  a = _mm_shuffle_epi32(mins,_MM_SHUFFLE(3,1,2,0));
+  b = _mm_shuffle_epi32(maxs,_MM_SHUFFLE(3,1,2,0));
+  mins = _mm_min_epu32(_mm_unpacklo_epi64(a,b),_mm_unpackhi_epi64(a,b));
+  maxs = _mm_max_epu32(_mm_unpacklo_epi64(a,b),_mm_unpackhi_epi64(a,b));
+
+  a = _mm_unpacklo_epi32(mins,maxs);
+  b = _mm_unpackhi_epi32(mins,maxs);
+  *lo = _mm_unpacklo_epi64(a,b);
+  *hi = _mm_unpackhi_epi64(a,b);
+  return;
+}
+#endif
+
+
+static void
+merge_two_uint4 (UINT4 *dest, UINT4 *a, int na, UINT4 *b, int nb) {
+  UINT4 *a_end = &(a[na]), *b_end = &(b[nb]);
+#ifdef USE_SSE4_1
+  UINT4 carry[4], buffer[8];
+  __m128i lo, hi;
+
+  if (na >= 4 && nb >= 4) {
+    lo = _mm_loadu_si128((__m128i *) a);
+    hi = _mm_loadu_si128((__m128i *) b);
+    a += 4;
+    b += 4;
+
+    while (1) {
+      bitonic_merge_4x4(&lo,&hi);
+      _mm_storeu_si128((__m128i *) dest,lo);
+      dest += 4;
+
+      /* The next block comes from the run with the smaller head, and
+	 everything still to come is at least the values just stored */
+      if (a < a_end && (b == b_end || *a <= *b)) {
+	if (a_end - a < 4) {
+	  break;
+	}
+	lo = _mm_loadu_si128((__m128i *) a);
+	a += 4;
+      } else if (b < b_end) {
+	if (b_end - b < 4) {
+	  break;
+	}
+	lo = _mm_loadu_si128((__m128i *) b);
+	b += 4;
+      } else {
+	break;
+      }
+    }
+
+    /* One run has fewer than 4 left.  Merge it with the carried
+       values, and then that with the other run. */
+    _mm_storeu_si128((__m128i *) carry,hi);
+    if (a_end - a < 4) {
+      merge_two_uint4_scalar(buffer,carry,&(carry[4]),a,a_end);
+      merge_two_uint4_scalar(dest,buffer,&(buffer[4 + (a_end - a)]),b,b_end);
+    } else {
+      merge_two_uint4_scalar(buffer,carry,&(carry[4]),b,b_end);
+      merge_two_uint4_scalar(dest,buffer,&(buffer[4 + (b_end - b)]),a,a_end);
+    }
+    return;
+  }
+#endif
+
+  merge_two_uint4_scalar(dest,a,a_end,b,b_end);
+  return;
+}
+
+
+static void
+merge_two_uint8 (UINT8 *dest, UINT8 *a, int na, UINT8 *b, int nb) {
+  UINT8 *a_end = &(a[na]), *b_end = &(b[nb]);
+  int takea;
+
+  while (a < a_end && b < b_end) {
+    takea = (*a <= *b);
+    *dest++ = takea ? *a : *b;
+    a += takea;
+    b += 1 - takea;
+  }
+  memcpy(dest,a,(a_end - a)*sizeof(UINT8));
+  memcpy(&(dest[a_end - a]),b,(b_end - b)*sizeof(UINT8));
+  return;
+}
+
+
+/************************************************************************
+ *   Merge passes
+ ************************************************************************/
+
+/* Merges adjacent pairs of runs, halving the number of runs each
+   pass.  Passes alternate between dest and one buffer, starting so
+   that the last pass writes into dest.  The first pass reads the
+   runs where they are, so they need not be contiguous. */
+
+static void
+merge_passes_uint4 (UINT4 *dest, UINT4 **runs, int *runlengths, int nruns, int nmerged) {
+  UINT4 *buffer, *src, *dst;
+  int *lengths, npasses, pass, nout, srci, dsti, i;
+
+  if (nruns == 1) {
+    memcpy(dest,runs[0],runlengths[0]*sizeof(UINT4));
+    return;
+  }
+
+  for (npasses = 0; (1 << npasses) < nruns; npasses++) ;
+  buffer = (UINT4 *) MALLOC(nmerged*sizeof(UINT4));
+  lengths = (int *) MALLOC(nruns*sizeof(int));
+
+  /* First pass, from the runs */
+  dst = (npasses % 2 == 1) ? dest : buffer;
+  dsti = 0;
+  for (i = 0, nout = 0; i + 1 < nruns; i += 2, nout++) {
+    merge_two_uint4(&(dst[dsti]),runs[i],runlengths[i],runs[i+1],runlengths[i+1]);
+    lengths[nout] = runlengths[i] + runlengths[i+1];
+    dsti += lengths[nout];
+  }
+  if (i < nruns) {
+    memcpy(&(dst[dsti]),runs[i],runlengths[i]*sizeof(UINT4));
+    lengths[nout++] = runlengths[i];
+  }
+
+  /* Later passes, between dest and buffer */
+  for (pass = 1; pass < npasses; pass++) {
+    src = dst;
+    dst = (src == dest) ? buffer : dest;
+    nruns = nout;
+    srci = dsti = 0;
+    for (i = 0, nout = 0; i + 1 < nruns; i += 2, nout++) {
+      merge_two_uint4(&(dst[dsti]),&(src[srci]),lengths[i],&(src[srci + lengths[i]]),lengths[i+1]);
+      lengths[nout] = lengths[i] + lengths[i+1];
+      srci += lengths[nout];
+      dsti += lengths[nout];
+    }
+    if (i < nruns) {
+      memcpy(&(dst[dsti]),&(src[srci]),lengths[i]*sizeof(UINT4));
+      lengths[nout++] = lengths[i];
+    }
+  }
+
+  FREE(lengths);
+  FREE(buffer);
+  return;
+}
+
+static void
+merge_passes_uint8 (UINT8 *dest, UINT8 **runs, int *runlengths, int nruns, int nmerged) {
+  UINT8 *buffer, *src, *dst;
+  int *lengths, npasses, pass, nout, srci, dsti, i;
+
+  if (nruns == 1) {
+    memcpy(dest,runs[0],runlengths[0]*sizeof(UINT8));
+    return;
+  }
+
+  for (npasses = 0; (1 << npasses) < nruns; npasses++) ;
+  buffer = (UINT8 *) MALLOC(nmerged*sizeof(UINT8));
+  lengths = (int *) MALLOC(nruns*sizeof(int));
+
+  /* First pass, from the runs */
+  dst = (npasses % 2 == 1) ? dest : buffer;
+  dsti = 0;
+  for (i = 0, nout = 0; i + 1 < nruns; i += 2, nout++) {
+    merge_two_uint8(&(dst[dsti]),runs[i],runlengths[i],runs[i+1],runlengths[i+1]);
+    lengths[nout] = runlengths[i] + runlengths[i+1];
+    dsti += lengths[nout];
+  }
+  if (i < nruns) {
+    memcpy(&(dst[dsti]),runs[i],runlengths[i]*sizeof(UINT8));
+    lengths[nout++] = runlengths[i];
+  }
+
+  /* Later passes, between dest and buffer */
+  for (pass = 1; pass < npasses; pass++) {
+    src = dst;
+    dst = (src == dest) ? buffer : dest;
+    nruns = nout;
+    srci = dsti = 0;
+    for (i = 0, nout = 0; i + 1 < nruns; i += 2, nout++) {
+      merge_two_uint8(&(dst[dsti]),&(src[srci]),lengths[i],&(src[srci + lengths[i]]),lengths[i+1]);
+      lengths[nout] = lengths[i] + lengths[i+1];
+      srci += lengths[nout];
+      dsti += lengths[nout];
+    }
+    if (i < nruns) {
+      memcpy(&(dst[dsti]),&(src[srci]),lengths[i]*sizeof(UINT8));
+      lengths[nout++] = lengths[i];
+    }
+  }
+
+  FREE(lengths);
+  FREE(buffer);
+  return;
+}
+
+
+/************************************************************************
+ *   Interface
+ ************************************************************************/
+
+UINT4 *
+Merge_uint4 (int *nmerged, UINT4 **runs, int *runlengths, int nruns) {
+  UINT4 *merged;
+  int i;
+
+  *nmerged = 0;
+  for (i = 0; i < nruns; i++) {
+    *nmerged += runlengths[i];
+  }
+  if (*nmerged == 0) {
+    return (UINT4 *) NULL;
+  }
+
+  merged = (UINT4 *) MALLOC((*nmerged)*sizeof(UINT4));
+  merge_passes_uint4(merged,runs,runlengths,nruns,*nmerged);
+  debug(printf("Merged %d runs into %d entries\n",nruns,*nmerged));
+
+  return merged;
+}
+
+UINT8 *
+Merge_uint8 (int *nmerged, UINT8 **runs, int *runlengths, int nruns) {
+  UINT8 *merged;
+  int i;
+
+  *nmerged = 0;
+  for (i = 0; i < nruns; i++) {
+    *nmerged += runlengths[i];
+  }
+  if (*nmerged == 0) {
+    return (UINT8 *) NULL;
+  }
+
+  merged = (UINT8 *) MALLOC((*nmerged)*sizeof(UINT8));
+  merge_passes_uint8(merged,runs,runlengths,nruns,*nmerged);
+  debug(printf("Merged %d runs into %d entries\n",nruns,*nmerged));
+
+  return merged;
+}
+
+Univcoord_T *
+Merge_univcoord (int *nmerged, Univcoord_T **runs, int *runlengths, int nruns) {
+  if (sizeof(Univcoord_T) == sizeof(UINT4)) {
+    return (Univcoord_T *) Merge_uint4(&(*nmerged),(UINT4 **) runs,runlengths,nruns);
+  } else {
+    return (Univcoord_T *) Merge_uint8(&(*nmerged),(UINT8 **) runs,runlengths,nruns);
+  }
+}
+
@@ -0,0 +1,20 @@
+/* $Id: merge.h $ */
+#ifndef MERGE_INCLUDED
+#define MERGE_INCLUDED
+#include "types.h"
+
+/* Merges nruns sorted runs into a newly allocated sorted array of
+   all their entries, keeping duplicates.  The runs need not be
+   contiguous.  Runs are merged in pairs, in log2(nruns) sequential
+   passes, using a bitonic merge network for 4-byte values where
+   SSE4.1 is available.  Returns NULL if the runs are all empty. */
+
+extern UINT4 *
+Merge_uint4 (int *nmerged, UINT4 **runs, int *runlengths, int nruns);
+extern UINT8 *
+Merge_uint8 (int *nmerged, UINT8 **runs, int *runlengths, int nruns);
+extern Univcoord_T *
+Merge_univcoord (int *nmerged, Univcoord_T **runs, int *runlengths, int nruns);
+
+#endif
+
@@ -16,9 +16,14 @@ static char rcsid[] = "$Id: oligoindex_hr.c 101727 2013-07-16 23:42:52Z twu $";
 #include "mem.h"
 #include "orderstat.h"
 #include "cmet.h"
+#include "cpuinfo.h"
 #ifdef HAVE_SSE2
 #include <emmintrin.h>
 #endif
+#if defined(HAVE_SSE2) && (defined(__AVX2__) || defined(USE_TARGET_ATTRIBUTES))
+#define USE_AVX2 1
+#include <immintrin.h>
+#endif
 
 
 #define T Oligoindex_T
@@ -8253,14 +8258,28 @@ static const Genomecomp_T reverse_nt[] =
 
 static Genomecomp_T *ref_blocks;
 static Mode_T mode;
+static Simd_level_T simd_level;
 
 void
 Oligoindex_hr_setup (Genomecomp_T *ref_blocks_in, Mode_T mode_in) {
   ref_blocks = ref_blocks_in;
   mode = mode_in;
+  simd_level = Oligoindex_hr_simd_level();
   return;
 }
 
+/* Kernel used by allocate_positions on this processor */
+Simd_level_T
+Oligoindex_hr_simd_level () {
+#if defined(USE_AVX2)
+  return (Cpuinfo_simd_level() >= SIMD_AVX2) ? SIMD_AVX2 : SIMD_SSE2;
+#elif defined(HAVE_SSE2)
+  return SIMD_SSE2;
+#else
+  return SIMD_NONE;
+#endif
+}
+
 
 
 static void
@@ -14138,33 +14157,17 @@ print_vector (__m128i x, char *label) {
 #define TWO_INTS 8
 #define SIMD_NINTS 4
 
+/* Clears the counts of oligomers not in the query, and returns the
+   total of the rest.  nskip gets one entry per block of SIMD_NCHARS
+   with a non-zero count, holding the number of oligomers with zero
+   counts that follow the block. */
 static int
-allocate_positions (Chrpos_T **pointers, Chrpos_T **positions,
-		    Count_T *inquery, Count_T *counts, int oligospace
-#ifndef PMAP
-		    , Shortoligomer_T mask
-#endif
-		    ) {
-  /* int totalcounts_old; */
+tally_counts_sse2 (int *nskip, Count_T *inquery, Count_T *counts, int oligospace) {
   int totalcounts = 0;
-  Chrpos_T *p;
-  int i;
+  int *nskip_ptr = nskip;
   __m128i *inquery_ptr, *counts_ptr, *end_ptr, zero, vec;
   __m128i terms_ptr[1];
   Count_T *terms;
-  /* __m128i result_allocated[1]; */
-  /* int *result; */
-  int *nskip, *nskip_ptr;
-
-
-#ifndef PMAP
-  counts[POLY_A & mask] = 0;
-  counts[POLY_C & mask] = 0;
-  counts[POLY_G & mask] = 0;
-  counts[POLY_T & mask] = 0;
-#endif
-
-  nskip_ptr = nskip = (int *) CALLOC(oligospace/SIMD_NCHARS + 1,sizeof(int));
 
   inquery_ptr = (__m128i *) inquery;
   counts_ptr = (__m128i *) counts;
@@ -14186,6 +14189,98 @@ allocate_positions (Chrpos_T **pointers, Chrpos_T **positions,
     }
   }
 
+  return totalcounts;
+}
+
+#ifdef USE_AVX2
+/* Same as tally_counts_sse2, 2 blocks at a time */
+static TARGET_AVX2 int
+tally_counts_avx2 (int *nskip, Count_T *inquery, Count_T *counts, int oligospace) {
+  int totalcounts = 0;
+  int *nskip_ptr = nskip;
+  unsigned int zeroes;
+  int i;
+  __m256i zero, vec, sums;
+  __m128i zero_128, vec_128, sums_128;
+
+  zero = _mm256_setzero_si256();
+  for (i = 0; i + 2*SIMD_NCHARS <= oligospace; i += 2*SIMD_NCHARS) {
+    vec = _mm256_and_si256(_mm256_loadu_si256((__m256i *) &(counts[i])),
+			   _mm256_loadu_si256((__m256i *) &(inquery[i])));
+    _mm256_storeu_si256((__m256i *) &(counts[i]),vec);
+    zeroes = (unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi8(vec,zero));
+    if (zeroes == 0xFFFFFFFF) {
+      /* All counts are zero in both blocks */
+      (*nskip_ptr) += 2*SIMD_NCHARS;
+    } else {
+      if ((zeroes & 0xFFFF) == 0xFFFF) {
+	(*nskip_ptr) += SIMD_NCHARS;
+      } else {
+	nskip_ptr++;
+      }
+      if ((zeroes >> 16) == 0xFFFF) {
+	(*nskip_ptr) += SIMD_NCHARS;
+      } else {
+	nskip_ptr++;
+      }
+
+      /* Sums of absolute differences from zero, in 4 quadwords */
+      sums = _mm256_sad_epu8(vec,zero);
+      sums_128 = _mm_add_epi32(_mm256_castsi256_si128(sums),_mm256_extracti128_si256(sums,1));
+      totalcounts += _mm_cvtsi128_si32(sums_128) + _mm_cvtsi128_si32(_mm_srli_si128(sums_128,8));
+    }
+  }
+
+  if (i + SIMD_NCHARS <= oligospace) {
+    zero_128 = _mm_setzero_si128();
+    vec_128 = _mm_and_si128(_mm_load_si128((__m128i *) &(counts[i])),_mm_load_si128((__m128i *) &(inquery[i])));
+    _mm_store_si128((__m128i *) &(counts[i]),vec_128);
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(vec_128,zero_128)) == 0xFFFF) {
+      (*nskip_ptr) += SIMD_NCHARS;
+    } else {
+      sums_128 = _mm_sad_epu8(vec_128,zero_128);
+      totalcounts += _mm_cvtsi128_si32(sums_128) + _mm_cvtsi128_si32(_mm_srli_si128(sums_128,8));
+      nskip_ptr++;
+    }
+  }
+
+  return totalcounts;
+}
+#endif
+
+static int
+allocate_positions (Chrpos_T **pointers, Chrpos_T **positions,
+		    Count_T *inquery, Count_T *counts, int oligospace
+#ifndef PMAP
+		    , Shortoligomer_T mask
+#endif
+		    ) {
+  /* int totalcounts_old; */
+  int totalcounts;
+  Chrpos_T *p;
+  int i;
+  int *nskip, *nskip_ptr;
+
+
+#ifndef PMAP
+  counts[POLY_A & mask] = 0;
+  counts[POLY_C & mask] = 0;
+  counts[POLY_G & mask] = 0;
+  counts[POLY_T & mask] = 0;
+#endif
+
+  nskip = (int *) CALLOC(oligospace/SIMD_NCHARS + 1,sizeof(int));
+
+#ifdef USE_AVX2
+  if (simd_level >= SIMD_AVX2) {
+    totalcounts = tally_counts_avx2(nskip,inquery,counts,oligospace);
+  } else {
+    totalcounts = tally_counts_sse2(nskip,inquery,counts,oligospace);
+  }
+#else
+  totalcounts = tally_counts_sse2(nskip,inquery,counts,oligospace);
+#endif
+
 #if 0
   /* For debugging */
   totalcounts_old = 0;
@@ -5,12 +5,16 @@
 #include "mode.h"
 #include "genomicpos.h"
 #include "oligoindex.h"
+#include "cpuinfo.h"
 
 #define T Oligoindex_T
 
 extern void
 Oligoindex_hr_setup (Genomecomp_T *ref_blocks_in, Mode_T mode_in);
 
+extern Simd_level_T
+Oligoindex_hr_simd_level ();
+
 extern void
 Oligoindex_hr_tally (T this, Univcoord_T mappingstart, Univcoord_T mappingend, bool plusp,
 		     char *queryuc_ptr, int querylength, Chrpos_T chrpos, int genestrand);
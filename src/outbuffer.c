@@ -24,6 +24,12 @@ static char rcsid[] = "$Id: outbuffer.c 105187 2013-08-19 18:38:05Z twu $";
 #include "shortread.h"
 #include "samprint.h"
 #include "stage3hr.h"
+#include "bamwrite.h"
+#endif
+
+#if defined(GSNAP) && defined(HAVE_ZLIB) && defined(HAVE_OPEN_MEMSTREAM)
+#define USE_BAM 1
+#define MAXBAMFILES 19		/* One for each split output file */
 #endif
 
 
@@ -40,11 +46,15 @@ static char rcsid[] = "$Id: outbuffer.c 105187 2013-08-19 18:38:05Z twu $";
 #endif
 
 
+/* An entry holds either a result and request to be printed by the
+   output thread, or text already rendered by a worker thread */
 typedef struct RRlist_T *RRlist_T;
 struct RRlist_T {
   int id;
   Result_T result;
   Request_T request;
+  char *text;
+  size_t textlength;
   RRlist_T next;
 };
 
@@ -65,79 +75,49 @@ RRlist_dump (RRlist_T head, RRlist_T tail) {
 #endif
 
 
-/* Returns new tail */
 static RRlist_T
-RRlist_push (RRlist_T *head, RRlist_T tail, Request_T request, Result_T result) {
+RRlist_new (int id, Request_T request, Result_T result, char *text, size_t textlength) {
   RRlist_T new;
 
   new = (RRlist_T) MALLOC_OUT(sizeof(*new)); /* Called by worker thread */
+  new->id = id;
   new->request = request;
   new->result = result;
+  new->text = text;
+  new->textlength = textlength;
   new->next = (RRlist_T) NULL;
-  
-  if (*head == NULL) {		/* Equivalent to tail == NULL, but using *head avoids having to set tail in RRlist_pop */
-    *head = new;
-  } else {
-    tail->next = new;
-  }
 
   return new;
 }
 
 
-/* Returns new head */
+/* Returns new tail */
 static RRlist_T
-RRlist_pop (RRlist_T head, Request_T *request, Result_T *result) {
-  RRlist_T newhead;
-
-  *request = head->request;
-  *result = head->result;
-
-  newhead = head->next;
+RRlist_push (RRlist_T *head, RRlist_T tail, RRlist_T new) {
 
-  FREE_OUT(head);		/* Called by outbuffer thread */
-  return newhead;
-}
-
-
-static RRlist_T
-RRlist_insert (RRlist_T list, int id, Request_T request, Result_T result) {
-  RRlist_T *p;
-  RRlist_T new;
-  
-  p = &list;
-  while (*p != NULL && id > (*p)->id) {
-    p = &(*p)->next;
+  if (*head == NULL) {		/* Equivalent to tail == NULL, but using *head avoids having to set tail in RRlist_pop */
+    *head = new;
+  } else {
+    tail->next = new;
   }
 
-  new = (RRlist_T) MALLOC_OUT(sizeof(*new));
-  new->id = id;
-  new->request = request;
-  new->result = result;
-  
-  new->next = *p;
-  *p = new;
-  return list;
+  return new;
 }
 
-/* Returns new head */
+
+/* Returns new head.  Caller is responsible for freeing *entry. */
 static RRlist_T
-RRlist_pop_id (RRlist_T head, int *id, Request_T *request, Result_T *result) {
+RRlist_pop (RRlist_T head, RRlist_T *entry) {
   RRlist_T newhead;
 
-  *id = head->id;
-  *request = head->request;
-  *result = head->result;
-
+  *entry = head;
   newhead = head->next;
+  head->next = (RRlist_T) NULL;
 
-  FREE_OUT(head);		/* Called by outbuffer thread */
   return newhead;
 }
 
 
-
-
 #define T Outbuffer_T
 struct T {
 
@@ -163,7 +143,8 @@ struct T {
   char **argv;
   int optind;
 #elif defined PMAP
-
+  int nworkers;
+  bool orderedp;
 #else
   bool sam_headers_p;
   bool sam_paired_p;
@@ -203,7 +184,9 @@ struct T {
 
   bool timingp;
   bool output_sam_p;
+  bool output_bam_p;
   Gobywriter_T gobywriter;
+  bool print_in_workers_p;
 
   bool fastq_format_p;
   bool clip_overlap_p;
@@ -213,6 +196,12 @@ struct T {
   bool invert_second_p;
   Chrpos_T pairmax;
 
+#ifdef USE_BAM
+  /* With BAM output, each fp above is the text stream of one of these */
+  Bamwrite_T bamfiles[MAXBAMFILES];
+  int nbamfiles;
+#endif
+
 #else
 
   FILE *fp_nomapping;
@@ -279,9 +268,17 @@ struct T {
 
   RRlist_T head;
   RRlist_T tail;
+
+  /* For ordered output.  Results are placed directly by id modulo
+     window_size, and workers wait while their id is more than
+     window_size ahead of noutput. */
+  RRlist_T *window;
+  unsigned int window_size;
+  unsigned int noutput;
   
 #ifdef HAVE_PTHREAD
   pthread_cond_t result_avail_p;
+  pthread_cond_t window_space_p;
 #endif
 };
 
@@ -292,6 +289,49 @@ struct T {
 
 #ifdef GSNAP
 
+/* With BAM output, returns the stream that collects SAM text for the
+   file, which is converted after each result */
+static FILE *
+output_fopen (T this, char *filename, char *write_mode) {
+  FILE *fp;
+
+  if ((fp = fopen(filename,write_mode)) == NULL) {
+    return (FILE *) NULL;
+#ifdef USE_BAM
+  } else if (this->output_bam_p == true) {
+    this->bamfiles[this->nbamfiles] = Bamwrite_new(fp,this->chromosome_iit);
+    return Bamwrite_textfp(this->bamfiles[this->nbamfiles++]);
+#endif
+  } else {
+    return fp;
+  }
+}
+
+#ifdef USE_BAM
+static void
+bamfiles_flush (T this) {
+  int i;
+
+  for (i = 0; i < this->nbamfiles; i++) {
+    Bamwrite_flush(this->bamfiles[i]);
+  }
+  return;
+}
+
+/* Also closes the files */
+static void
+bamfiles_close (T this) {
+  int i;
+
+  for (i = 0; i < this->nbamfiles; i++) {
+    Bamwrite_close(&(this->bamfiles[i]));
+  }
+  this->nbamfiles = 0;
+  return;
+}
+#endif
+
+
 static void
 sevenway_open_single (T this) {
   char *filename;
@@ -306,7 +346,7 @@ sevenway_open_single (T this) {
   if (this->fails_as_input_p == true) {
     filename = (char *) CALLOC(strlen(this->sevenway_root)+strlen(".nomapping.fq")+1,sizeof(char));
     sprintf(filename,"%s.nomapping.fq",this->sevenway_root);
-    if ((this->fp_nomapping_1 = fopen(filename,write_mode)) == NULL) {
+    if ((this->fp_nomapping_1 = output_fopen(this,filename,write_mode)) == NULL) {
       fprintf(stderr,"Cannot open file %s for writing\n",filename);
       exit(9);
     }
@@ -315,7 +355,7 @@ sevenway_open_single (T this) {
   } else {
     filename = (char *) CALLOC(strlen(this->sevenway_root)+strlen(".nomapping")+1,sizeof(char));
     sprintf(filename,"%s.nomapping",this->sevenway_root);
-    if ((this->fp_nomapping_1 = fopen(filename,write_mode)) == NULL) {
+    if ((this->fp_nomapping_1 = output_fopen(this,filename,write_mode)) == NULL) {
       fprintf(stderr,"Cannot open file %s for writing\n",filename);
       exit(9);
     }
@@ -331,7 +371,7 @@ sevenway_open_single (T this) {
 
   filename = (char *) CALLOC(strlen(this->sevenway_root)+strlen(".unpaired_uniq")+1,sizeof(char));
   sprintf(filename,"%s.unpaired_uniq",this->sevenway_root);
-  if ((this->fp_unpaired_uniq = fopen(filename,write_mode)) == NULL) {
+  if ((this->fp_unpaired_uniq = output_fopen(this,filename,write_mode)) == NULL) {
     fprintf(stderr,"Cannot open file %s for writing\n",filename);
     exit(9);
   }
@@ -339,7 +379,7 @@ sevenway_open_single (T this) {
 
   filename = (char *) CALLOC(strlen(this->sevenway_root)+strlen(".unpaired_circular")+1,sizeof(char));
   sprintf(filename,"%s.unpaired_circular",this->sevenway_root);
-  if ((this->fp_unpaired_circular = fopen(filename,write_mode)) == NULL) {
+  if ((this->fp_unpaired_circular = output_fopen(this,filename,write_mode)) == NULL) {
     fprintf(stderr,"Cannot open file %s for writing\n",filename);
     exit(9);
   }
@@ -347,7 +387,7 @@ sevenway_open_single (T this) {
 
   filename = (char *) CALLOC(strlen(this->sevenway_root)+strlen(".unpaired_transloc")+1,sizeof(char));
   sprintf(filename,"%s.unpaired_transloc",this->sevenway_root);
-  if ((this->fp_unpaired_transloc = fopen(filename,write_mode)) == NULL) {
+  if ((this->fp_unpaired_transloc = output_fopen(this,filename,write_mode)) == NULL) {
     fprintf(stderr,"Cannot open file %s for writing\n",filename);
     exit(9);
   }
@@ -355,7 +395,7 @@ sevenway_open_single (T this) {
 
   filename = (char *) CALLOC(strlen(this->sevenway_root)+strlen(".unpaired_mult")+1,sizeof(char));
   sprintf(filename,"%s.unpaired_mult",this->sevenway_root);
-  if ((this->fp_unpaired_mult = fopen(filename,write_mode)) == NULL) {
+  if ((this->fp_unpaired_mult = output_fopen(this,filename,write_mode)) == NULL) {
     fprintf(stderr,"Cannot open file %s for writing\n",filename);
     exit(9);
   }
@@ -399,7 +439,7 @@ sevenway_open_paired (T this) {
     if (this->fp_nomapping_1 == NULL) {
       filename = (char *) CALLOC(strlen(this->sevenway_root)+strlen(".nomapping.1.fq")+1,sizeof(char));
       sprintf(filename,"%s.nomapping.1.fq",this->sevenway_root);
-      if ((this->fp_nomapping_1 = fopen(filename,write_mode)) == NULL) {
+      if ((this->fp_nomapping_1 = output_fopen(this,filename,write_mode)) == NULL) {
 	fprintf(stderr,"Cannot open file %s for writing\n",filename);
 	exit(9);
       }
@@ -408,7 +448,7 @@ sevenway_open_paired (T this) {
 
     filename = (char *) CALLOC(strlen(this->sevenway_root)+strlen(".nomapping.2.fq")+1,sizeof(char));
     sprintf(filename,"%s.nomapping.2.fq",this->sevenway_root);
-    if ((this->fp_nomapping_2 = fopen(filename,write_mode)) == NULL) {
+    if ((this->fp_nomapping_2 = output_fopen(this,filename,write_mode)) == NULL) {
       fprintf(stderr,"Cannot open file %s for writing\n",filename);
       exit(9);
     }
@@ -418,7 +458,7 @@ sevenway_open_paired (T this) {
     if (this->fp_nomapping_1 == NULL) {
       filename = (char *) CALLOC(strlen(this->sevenway_root)+strlen(".nomapping")+1,sizeof(char));
       sprintf(filename,"%s.nomapping",this->sevenway_root);
-      if ((this->fp_nomapping_1 = fopen(filename,write_mode)) == NULL) {
+      if ((this->fp_nomapping_1 = output_fopen(this,filename,write_mode)) == NULL) {
 	fprintf(stderr,"Cannot open file %s for writing\n",filename);
 	exit(9);
       }
@@ -435,7 +475,7 @@ sevenway_open_paired (T this) {
 
   filename = (char *) CALLOC(strlen(this->sevenway_root)+strlen(".halfmapping_uniq")+1,sizeof(char));
   sprintf(filename,"%s.halfmapping_uniq",this->sevenway_root);
-  if ((this->fp_halfmapping_uniq = fopen(filename,write_mode)) == NULL) {
+  if ((this->fp_halfmapping_uniq = output_fopen(this,filename,write_mode)) == NULL) {
     fprintf(stderr,"Cannot open file %s for writing\n",filename);
     exit(9);
   }
@@ -443,7 +483,7 @@ sevenway_open_paired (T this) {
 
   filename = (char *) CALLOC(strlen(this->sevenway_root)+strlen(".halfmapping_circular")+1,sizeof(char));
   sprintf(filename,"%s.halfmapping_circular",this->sevenway_root);
-  if ((this->fp_halfmapping_circular = fopen(filename,write_mode)) == NULL) {
+  if ((this->fp_halfmapping_circular = output_fopen(this,filename,write_mode)) == NULL) {
     fprintf(stderr,"Cannot open file %s for writing\n",filename);
     exit(9);
   }
@@ -451,7 +491,7 @@ sevenway_open_paired (T this) {
 
   filename = (char *) CALLOC(strlen(this->sevenway_root)+strlen(".halfmapping_transloc")+1,sizeof(char));
   sprintf(filename,"%s.halfmapping_transloc",this->sevenway_root);
-  if ((this->fp_halfmapping_transloc = fopen(filename,write_mode)) == NULL) {
+  if ((this->fp_halfmapping_transloc = output_fopen(this,filename,write_mode)) == NULL) {
     fprintf(stderr,"Cannot open file %s for writing\n",filename);
     exit(9);
   }
@@ -459,7 +499,7 @@ sevenway_open_paired (T this) {
 
   filename = (char *) CALLOC(strlen(this->sevenway_root)+strlen(".halfmapping_mult")+1,sizeof(char));
   sprintf(filename,"%s.halfmapping_mult",this->sevenway_root);
-  if ((this->fp_halfmapping_mult = fopen(filename,write_mode)) == NULL) {
+  if ((this->fp_halfmapping_mult = output_fopen(this,filename,write_mode)) == NULL) {
     fprintf(stderr,"Cannot open file %s for writing\n",filename);
     exit(9);
   }
@@ -467,7 +507,7 @@ sevenway_open_paired (T this) {
 
   filename = (char *) CALLOC(strlen(this->sevenway_root)+strlen(".paired_uniq_circular")+1,sizeof(char));
   sprintf(filename,"%s.paired_uniq_circular",this->sevenway_root);
-  if ((this->fp_paired_uniq_circular = fopen(filename,write_mode)) == NULL) {
+  if ((this->fp_paired_uniq_circular = output_fopen(this,filename,write_mode)) == NULL) {
     fprintf(stderr,"Cannot open file %s for writing\n",filename);
     exit(9);
   }
@@ -475,7 +515,7 @@ sevenway_open_paired (T this) {
 
   filename = (char *) CALLOC(strlen(this->sevenway_root)+strlen(".paired_uniq_inv")+1,sizeof(char));
   sprintf(filename,"%s.paired_uniq_inv",this->sevenway_root);
-  if ((this->fp_paired_uniq_inv = fopen(filename,write_mode)) == NULL) {
+  if ((this->fp_paired_uniq_inv = output_fopen(this,filename,write_mode)) == NULL) {
     fprintf(stderr,"Cannot open file %s for writing\n",filename);
     exit(9);
   }
@@ -483,7 +523,7 @@ sevenway_open_paired (T this) {
 
   filename = (char *) CALLOC(strlen(this->sevenway_root)+strlen(".paired_uniq_scr")+1,sizeof(char));
   sprintf(filename,"%s.paired_uniq_scr",this->sevenway_root);
-  if ((this->fp_paired_uniq_scr = fopen(filename,write_mode)) == NULL) {
+  if ((this->fp_paired_uniq_scr = output_fopen(this,filename,write_mode)) == NULL) {
     fprintf(stderr,"Cannot open file %s for writing\n",filename);
     exit(9);
   }
@@ -491,7 +531,7 @@ sevenway_open_paired (T this) {
 
   filename = (char *) CALLOC(strlen(this->sevenway_root)+strlen(".paired_uniq_long")+1,sizeof(char));
   sprintf(filename,"%s.paired_uniq_long",this->sevenway_root);
-  if ((this->fp_paired_uniq_long = fopen(filename,write_mode)) == NULL) {
+  if ((this->fp_paired_uniq_long = output_fopen(this,filename,write_mode)) == NULL) {
     fprintf(stderr,"Cannot open file %s for writing\n",filename);
     exit(9);
   }
@@ -499,7 +539,7 @@ sevenway_open_paired (T this) {
 
   filename = (char *) CALLOC(strlen(this->sevenway_root)+strlen(".paired_mult")+1,sizeof(char));
   sprintf(filename,"%s.paired_mult",this->sevenway_root);
-  if ((this->fp_paired_mult = fopen(filename,write_mode)) == NULL) {
+  if ((this->fp_paired_mult = output_fopen(this,filename,write_mode)) == NULL) {
     fprintf(stderr,"Cannot open file %s for writing\n",filename);
     exit(9);
   }
@@ -507,7 +547,7 @@ sevenway_open_paired (T this) {
 
   filename = (char *) CALLOC(strlen(this->sevenway_root)+strlen(".concordant_uniq")+1,sizeof(char));
   sprintf(filename,"%s.concordant_uniq",this->sevenway_root);
-  if ((this->fp_concordant_uniq = fopen(filename,write_mode)) == NULL) {
+  if ((this->fp_concordant_uniq = output_fopen(this,filename,write_mode)) == NULL) {
     fprintf(stderr,"Cannot open file %s for writing\n",filename);
     exit(9);
   }
@@ -515,7 +555,7 @@ sevenway_open_paired (T this) {
 
   filename = (char *) CALLOC(strlen(this->sevenway_root)+strlen(".concordant_circular")+1,sizeof(char));
   sprintf(filename,"%s.concordant_circular",this->sevenway_root);
-  if ((this->fp_concordant_circular = fopen(filename,write_mode)) == NULL) {
+  if ((this->fp_concordant_circular = output_fopen(this,filename,write_mode)) == NULL) {
     fprintf(stderr,"Cannot open file %s for writing\n",filename);
     exit(9);
   }
@@ -523,7 +563,7 @@ sevenway_open_paired (T this) {
 
   filename = (char *) CALLOC(strlen(this->sevenway_root)+strlen(".concordant_transloc")+1,sizeof(char));
   sprintf(filename,"%s.concordant_transloc",this->sevenway_root);
-  if ((this->fp_concordant_transloc = fopen(filename,write_mode)) == NULL) {
+  if ((this->fp_concordant_transloc = output_fopen(this,filename,write_mode)) == NULL) {
     fprintf(stderr,"Cannot open file %s for writing\n",filename);
     exit(9);
   }
@@ -531,7 +571,7 @@ sevenway_open_paired (T this) {
 
   filename = (char *) CALLOC(strlen(this->sevenway_root)+strlen(".concordant_mult")+1,sizeof(char));
   sprintf(filename,"%s.concordant_mult",this->sevenway_root);
-  if ((this->fp_concordant_mult = fopen(filename,write_mode)) == NULL) {
+  if ((this->fp_concordant_mult = output_fopen(this,filename,write_mode)) == NULL) {
     fprintf(stderr,"Cannot open file %s for writing\n",filename);
     exit(9);
   }
@@ -597,6 +637,13 @@ sevenway_open_paired (T this) {
 
 static void
 sevenway_close (T this) {
+#ifdef USE_BAM
+  if (this->output_bam_p == true) {
+    bamfiles_close(this);
+    return;
+  }
+#endif
+
   fclose(this->fp_unpaired_uniq);
   fclose(this->fp_unpaired_circular);
   fclose(this->fp_unpaired_transloc);
@@ -802,16 +849,16 @@ sevenway_close (T this) {
 
 T
 Outbuffer_new (unsigned int output_buffer_size, unsigned int nread, char *sevenway_root, bool appendp, Univ_IIT_T chromosome_iit,
-	       bool timingp, bool output_sam_p, bool sam_headers_p, char *sam_read_group_id, char *sam_read_group_name,
+	       bool timingp, bool output_sam_p, bool output_bam_p, bool sam_headers_p, char *sam_read_group_id, char *sam_read_group_name,
 	       char *sam_read_group_library, char *sam_read_group_platform,
-	       int nworkers, bool orderedp,
+	       int nworkers, bool orderedp, bool print_in_workers_p,
 	       Gobywriter_T gobywriter, bool nofailsp, bool failsonlyp, bool fails_as_input_p,
 	       bool fastq_format_p, bool clip_overlap_p, bool merge_samechr_p,
 	       int maxpaths_report, bool quiet_if_excessive_p, int quality_shift,
 	       bool invert_first_p, bool invert_second_p, Chrpos_T pairmax,
 	       int argc, char **argv, int optind) {
   T new = (T) MALLOC(sizeof(*new));
-  FILE *fp_capture = NULL, *fp_ignore = NULL;
+  FILE *fp_capture = NULL, *fp_ignore = NULL, *fp;
 
   new->chromosome_iit = chromosome_iit;
 
@@ -840,6 +887,12 @@ Outbuffer_new (unsigned int output_buffer_size, unsigned int nread, char *sevenw
 
   new->timingp = timingp;
   new->output_sam_p = output_sam_p;
+#ifdef USE_BAM
+  new->output_bam_p = output_bam_p;
+  new->nbamfiles = 0;
+#else
+  new->output_bam_p = false;
+#endif
   new->sam_headers_p = sam_headers_p;
   new->sam_read_group_id = sam_read_group_id;
   new->sam_read_group_name = sam_read_group_name;
@@ -853,6 +906,21 @@ Outbuffer_new (unsigned int output_buffer_size, unsigned int nread, char *sevenw
 
   new->gobywriter = gobywriter;
 
+  /* Workers render into memory streams that stand in for every output
+     file, so this is possible only when everything goes to stdout */
+  new->print_in_workers_p = false;
+  if (print_in_workers_p == true) {
+#ifndef HAVE_OPEN_MEMSTREAM
+    fprintf(stderr,"Note: this system lacks open_memstream, so ignoring --print-in-workers\n");
+#else
+    if (timingp == true || gobywriter != NULL || sevenway_root != NULL) {
+      fprintf(stderr,"Note: --print-in-workers is not compatible with timing, Goby, or --split-output.  Turning it off.\n");
+    } else {
+      new->print_in_workers_p = true;
+    }
+#endif
+  }
+
   new->nofailsp = nofailsp;
   new->failsonlyp = failsonlyp;
   new->fails_as_input_p = fails_as_input_p;
@@ -880,8 +948,18 @@ Outbuffer_new (unsigned int output_buffer_size, unsigned int nread, char *sevenw
   new->head = (RRlist_T) NULL;
   new->tail = (RRlist_T) NULL;
 
+  if (orderedp == true) {
+    new->window_size = (output_buffer_size > 0) ? output_buffer_size : 1;
+    new->window = (RRlist_T *) CALLOC(new->window_size,sizeof(RRlist_T));
+  } else {
+    new->window_size = 0;
+    new->window = (RRlist_T *) NULL;
+  }
+  new->noutput = 0;
+
 #ifdef HAVE_PTHREAD
   pthread_cond_init(&new->result_avail_p,NULL);
+  pthread_cond_init(&new->window_space_p,NULL);
 #endif
 
   /* Initialize output streams */
@@ -911,38 +989,56 @@ Outbuffer_new (unsigned int output_buffer_size, unsigned int nread, char *sevenw
     sevenway_open_single(new);
 
   } else {
-    new->fp_nomapping_1 = stdout;
-    new->fp_nomapping_2 = stdout;
-    new->fp_halfmapping_uniq = stdout;
-    new->fp_halfmapping_circular = stdout;
-    new->fp_halfmapping_transloc = stdout;
-    new->fp_halfmapping_mult = stdout;
-    new->fp_unpaired_uniq = stdout;
-    new->fp_unpaired_circular = stdout;
-    new->fp_unpaired_transloc = stdout;
-    new->fp_unpaired_mult = stdout;
-    new->fp_paired_uniq_circular = stdout;
-    new->fp_paired_uniq_inv = stdout;
-    new->fp_paired_uniq_scr = stdout;
-    new->fp_paired_uniq_long = stdout;
-    new->fp_paired_mult = stdout;
-    new->fp_concordant_uniq = stdout;
-    new->fp_concordant_circular = stdout;
-    new->fp_concordant_transloc = stdout;
-    new->fp_concordant_mult = stdout;
+#ifdef USE_BAM
+    if (new->output_bam_p == true) {
+      new->bamfiles[new->nbamfiles] = Bamwrite_new(stdout,chromosome_iit);
+      fp = Bamwrite_textfp(new->bamfiles[new->nbamfiles++]);
+    } else {
+      fp = stdout;
+    }
+#else
+    fp = stdout;
+#endif
+
+    new->fp_nomapping_1 = fp;
+    new->fp_nomapping_2 = fp;
+    new->fp_halfmapping_uniq = fp;
+    new->fp_halfmapping_circular = fp;
+    new->fp_halfmapping_transloc = fp;
+    new->fp_halfmapping_mult = fp;
+    new->fp_unpaired_uniq = fp;
+    new->fp_unpaired_circular = fp;
+    new->fp_unpaired_transloc = fp;
+    new->fp_unpaired_mult = fp;
+    new->fp_paired_uniq_circular = fp;
+    new->fp_paired_uniq_inv = fp;
+    new->fp_paired_uniq_scr = fp;
+    new->fp_paired_uniq_long = fp;
+    new->fp_paired_mult = fp;
+    new->fp_concordant_uniq = fp;
+    new->fp_concordant_circular = fp;
+    new->fp_concordant_transloc = fp;
+    new->fp_concordant_mult = fp;
 
     if (output_sam_p == true && sam_headers_p == true) {
       if (fails_as_input_p == true) {
 	/* Don't print chromosomes */
       } else {
-	SAM_header_print_HD(stdout,nworkers,orderedp);
-	SAM_header_print_PG(stdout,argc,argv,optind);
-	Univ_IIT_dump_sam(stdout,chromosome_iit,sam_read_group_id,sam_read_group_name,
+	SAM_header_print_HD(fp,nworkers,orderedp);
+	SAM_header_print_PG(fp,argc,argv,optind);
+	Univ_IIT_dump_sam(fp,chromosome_iit,sam_read_group_id,sam_read_group_name,
 			  sam_read_group_library,sam_read_group_platform);
       }
     }
   }
 
+#ifdef USE_BAM
+  if (new->output_bam_p == true) {
+    /* Header lines are held until the first alignment */
+    bamfiles_flush(new);
+  }
+#endif
+
   return new;
 }
 
@@ -954,11 +1050,11 @@ Outbuffer_new (unsigned int output_buffer_size, unsigned int nread, char *sevenw
 	       char *dbversion, Genome_T genome, Univ_IIT_T chromosome_iit,
 	       Chrsubset_T chrsubset, Univ_IIT_T contig_iit, IIT_T altstrain_iit, IIT_T map_iit,
 	       int *map_divint_crosstable, Printtype_T printtype, bool checksump, int chimera_margin,
+	       int nworkers, bool orderedp,
 #ifndef PMAP
 	       bool sam_headers_p, int quality_shift, bool sam_paired_p,
 	       char *sam_read_group_id, char *sam_read_group_name,
 	       char *sam_read_group_library, char *sam_read_group_platform,
-	       int nworkers, bool orderedp,
 #endif
 	       bool nofailsp, bool failsonlyp, bool fails_as_input_p, int maxpaths_report, bool quiet_if_excessive_p,
 	       bool map_exons_p, bool map_bothstrands_p, bool print_comment_p, int nflanking,
@@ -997,6 +1093,9 @@ Outbuffer_new (unsigned int output_buffer_size, unsigned int nread, char *sevenw
   new->fp_transloc = NULL;
   new->fp_mult = NULL;
   
+  new->nworkers = nworkers;
+  new->orderedp = orderedp;
+
 #ifndef PMAP
   new->sam_headers_p = sam_headers_p;
   new->quality_shift = quality_shift;
@@ -1005,8 +1104,6 @@ Outbuffer_new (unsigned int output_buffer_size, unsigned int nread, char *sevenw
   new->sam_read_group_name = sam_read_group_name;
   new->sam_read_group_library = sam_read_group_library;
   new->sam_read_group_platform = sam_read_group_platform;
-  new->nworkers = nworkers;
-  new->orderedp = orderedp;
   new->argc = argc;
   new->argv = argv;
   new->optind = optind;
@@ -1053,8 +1150,18 @@ Outbuffer_new (unsigned int output_buffer_size, unsigned int nread, char *sevenw
   new->head = (RRlist_T) NULL;
   new->tail = (RRlist_T) NULL;
 
+  if (orderedp == true) {
+    new->window_size = (output_buffer_size > 0) ? output_buffer_size : 1;
+    new->window = (RRlist_T *) CALLOC(new->window_size,sizeof(RRlist_T));
+  } else {
+    new->window_size = 0;
+    new->window = (RRlist_T *) NULL;
+  }
+  new->noutput = 0;
+
 #ifdef HAVE_PTHREAD
   pthread_cond_init(&new->result_avail_p,NULL);
+  pthread_cond_init(&new->window_space_p,NULL);
 #endif
 
   /* Initialize output streams */
@@ -1097,8 +1204,18 @@ Outbuffer_free (T *old) {
     if ((*old)->sevenway_root != NULL) {
       sevenway_close(*old);
     }
+#ifdef USE_BAM
+    if ((*old)->output_bam_p == true) {
+      bamfiles_close(*old);	/* For stdout, if not split */
+    }
+#endif
+
+    if ((*old)->window != NULL) {
+      FREE((*old)->window);
+    }
 
 #ifdef HAVE_PTHREAD
+    pthread_cond_destroy(&(*old)->window_space_p);
     pthread_cond_destroy(&(*old)->result_avail_p);
     pthread_mutex_destroy(&(*old)->lock);
 #endif
@@ -1146,19 +1263,59 @@ Outbuffer_add_nread (T this, unsigned int nread) {
 }
 
 
+#if defined(GSNAP) && defined(HAVE_OPEN_MEMSTREAM)
+static RRlist_T
+render_entry (T this, Result_T result, Request_T request);
+#endif
+
+/* Called by worker threads */
 void
 Outbuffer_put_result (T this, Result_T result, Request_T request) {
+  RRlist_T entry;
+
+#if defined(GSNAP) && defined(HAVE_OPEN_MEMSTREAM)
+  if (this->print_in_workers_p == true) {
+    /* Formatting happens here, outside of the lock */
+    entry = render_entry(this,result,request);
+  } else {
+    entry = RRlist_new(Result_id(result),request,result,/*text*/NULL,/*textlength*/0);
+  }
+#else
+  entry = RRlist_new(Result_id(result),request,result,/*text*/NULL,/*textlength*/0);
+#endif
 
 #ifdef HAVE_PTHREAD
   pthread_mutex_lock(&this->lock);
 #endif
 
-  this->tail = RRlist_push(&this->head,this->tail,request,result);
-  debug1(RRlist_dump(this->head,this->tail));
-  this->nprocessed += 1;
+  if (this->window != NULL) {
+#ifdef HAVE_PTHREAD
+    /* Backpressure.  The lowest outstanding id always fits, so the
+       output thread can make progress. */
+    while ((unsigned int) entry->id - this->noutput >= this->window_size) {
+      pthread_cond_wait(&this->window_space_p,&this->lock);
+    }
+#endif
+    this->window[entry->id % this->window_size] = entry;
+    this->nprocessed += 1;
+
+#ifdef HAVE_PTHREAD
+    if ((unsigned int) entry->id == this->noutput) {
+      pthread_cond_signal(&this->result_avail_p);
+    }
+#endif
+
+  } else {
+    this->tail = RRlist_push(&this->head,this->tail,entry);
+    debug1(RRlist_dump(this->head,this->tail));
+    this->nprocessed += 1;
+
+#ifdef HAVE_PTHREAD
+    pthread_cond_signal(&this->result_avail_p);
+#endif
+  }
 
 #ifdef HAVE_PTHREAD
-  pthread_cond_signal(&this->result_avail_p);
   pthread_mutex_unlock(&this->lock);
 #endif
 
@@ -1595,6 +1752,52 @@ Outbuffer_print_result (T this, Result_T result, Request_T request
   return;
 }
 
+
+#ifdef HAVE_OPEN_MEMSTREAM
+/* Called by worker threads when print_in_workers_p is true.  Formats
+   the result into a memory buffer, using a private copy of the
+   outbuffer whose output files all point to that buffer, and frees
+   the result and request. */
+static RRlist_T
+render_entry (T this, Result_T result, Request_T request) {
+  struct T view;
+  FILE *fp;
+  char *text = NULL;
+  size_t textlength = 0;
+  int id;
+
+  view = *this;
+  if ((fp = open_memstream(&text,&textlength)) == NULL) {
+    fprintf(stderr,"Unable to open memory stream for output\n");
+    exit(9);
+  }
+
+  view.fp_nomapping_1 = view.fp_nomapping_2 = fp;
+  view.fp_halfmapping_uniq = view.fp_halfmapping_circular = fp;
+  view.fp_halfmapping_transloc = view.fp_halfmapping_mult = fp;
+  view.fp_unpaired_uniq = view.fp_unpaired_circular = fp;
+  view.fp_unpaired_transloc = view.fp_unpaired_mult = fp;
+  view.fp_paired_uniq_circular = view.fp_paired_uniq_inv = fp;
+  view.fp_paired_uniq_scr = view.fp_paired_uniq_long = fp;
+  view.fp_paired_mult = fp;
+  view.fp_concordant_uniq = view.fp_concordant_circular = fp;
+  view.fp_concordant_transloc = view.fp_concordant_mult = fp;
+
+  if (this->output_sam_p == true) {
+    print_result_sam(&view,result,request);
+  } else {
+    print_result_gsnap(&view,result,request);
+  }
+  fclose(fp);
+
+  id = Result_id(result);
+  Result_free(&result);
+  Request_free(&request);
+
+  return RRlist_new(id,/*request*/NULL,/*result*/NULL,text,textlength);
+}
+#endif
+
 #else
 
 /************************************************************************
@@ -2075,13 +2278,58 @@ Outbuffer_print_result (T this, Result_T result, Request_T request, Sequence_T h
 #endif
 
 
+/* Prints an entry and frees it, along with its result and request.
+   Called by the output thread. */
+static void
+print_entry (T this, RRlist_T entry, unsigned int noutput) {
+
+  if (entry->text != NULL) {
+    /* Already rendered by a worker thread */
+#ifdef USE_BAM
+    if (this->output_bam_p == true) {
+      Bamwrite_sam_text(this->bamfiles[0],entry->text,entry->textlength);
+    } else {
+      fwrite(entry->text,sizeof(char),entry->textlength,stdout);
+    }
+#else
+    fwrite(entry->text,sizeof(char),entry->textlength,stdout);
+#endif
+    free(entry->text);		/* Allocated by open_memstream */
+
+  } else if (entry->result != NULL) {
+#ifdef MEMUSAGE
+    Outbuffer_print_result(this,entry->result,entry->request,
+#ifndef GSNAP
+			   Request_queryseq(entry->request),
+#endif
+			   noutput+1);
+#else
+    Outbuffer_print_result(this,entry->result,entry->request
+#ifndef GSNAP
+			   ,Request_queryseq(entry->request)
+#endif
+			   );
+#endif
+    Result_free(&entry->result);
+    Request_free(&entry->request);
+#ifdef USE_BAM
+    if (this->output_bam_p == true) {
+      bamfiles_flush(this);
+    }
+#endif
+  }
+
+  FREE_OUT(entry);		/* Called by outbuffer thread */
+  return;
+}
+
+
 void *
 Outbuffer_thread_anyorder (void *data) {
   T this = (T) data;
   unsigned int output_buffer_size = this->output_buffer_size;
   unsigned int noutput = 0;
-  Result_T result;
-  Request_T request;
+  RRlist_T entry;
   
 #ifdef MEMUSAGE
   Mem_usage_set_threadname("outbuffer");
@@ -2105,28 +2353,14 @@ Outbuffer_thread_anyorder (void *data) {
 #endif
 
     } else {
-      this->head = RRlist_pop(this->head,&request,&result);
+      this->head = RRlist_pop(this->head,&entry);
       debug1(RRlist_dump(this->head,this->tail));
 
 #ifdef HAVE_PTHREAD
       /* Let worker threads put results while we print */
       pthread_mutex_unlock(&this->lock);
 #endif
-#ifdef MEMUSAGE
-      Outbuffer_print_result(this,result,request,
-#ifndef GSNAP
-			     Request_queryseq(request),
-#endif
-			     noutput+1);
-#else
-      Outbuffer_print_result(this,result,request
-#ifndef GSNAP
-			     ,Request_queryseq(request)
-#endif
-			     );
-#endif
-      Result_free(&result);
-      Request_free(&request);
+      print_entry(this,entry,noutput);
       noutput++;
 
       if (this->head && this->nprocessed - noutput > output_buffer_size) {
@@ -2135,24 +2369,9 @@ Outbuffer_thread_anyorder (void *data) {
 	pthread_mutex_lock(&this->lock);
 #endif
 	while (this->head && this->nprocessed - noutput > output_buffer_size) {
-	  this->head = RRlist_pop(this->head,&request,&result);
+	  this->head = RRlist_pop(this->head,&entry);
 	  debug1(RRlist_dump(this->head,this->tail));
-
-#ifdef MEMUSAGE
-	  Outbuffer_print_result(this,result,request,
-#ifndef GSNAP
-				 Request_queryseq(request),
-#endif
-				 noutput+1);
-#else
-	  Outbuffer_print_result(this,result,request
-#ifndef GSNAP
-				 ,Request_queryseq(request)
-#endif
-				 );
-#endif
-	  Result_free(&result);
-	  Request_free(&request);
+	  print_entry(this,entry,noutput);
 	  noutput++;
 	}
 
@@ -2174,149 +2393,51 @@ Outbuffer_thread_anyorder (void *data) {
 void *
 Outbuffer_thread_ordered (void *data) {
   T this = (T) data;
-  unsigned int output_buffer_size = this->output_buffer_size;
-  unsigned int noutput = 0, nqueued = 0;
-  Result_T result;
-  Request_T request;
-  RRlist_T queue = NULL;
-  int id;
+  RRlist_T *window = this->window;
+  unsigned int window_size = this->window_size;
+  unsigned int noutput = 0, nready, i;
+  RRlist_T *ready;
 
 #ifdef MEMUSAGE
   Mem_usage_set_threadname("outbuffer");
 #endif
 
+  ready = (RRlist_T *) CALLOC(window_size,sizeof(RRlist_T));
+
   while (noutput < this->ntotal) {
 #ifdef HAVE_PTHREAD
     pthread_mutex_lock(&this->lock);
-    while (this->head == NULL && noutput < this->ntotal) {
+    while (window[noutput % window_size] == NULL && noutput < this->ntotal) {
       pthread_cond_wait(&this->result_avail_p,&this->lock);
     }
     debug(fprintf(stderr,"__outbuffer_thread_ordered woke up\n"));
 #endif
 
-    if (this->head == NULL) {
-#ifdef HAVE_PTHREAD
-      /* False wake up */
-      pthread_mutex_unlock(&this->lock);
-#endif
-
-    } else {
-      this->head = RRlist_pop(this->head,&request,&result);
-
-#ifdef HAVE_PTHREAD
-      /* Allow workers access to the queue */
-      pthread_mutex_unlock(&this->lock);
-#endif
-      if ((id = Result_id(result)) != (int) noutput) {
-	/* Store in queue */
-	queue = RRlist_insert(queue,id,request,result);
-	nqueued++;
-      } else {
-#ifdef MEMUSAGE
-	Outbuffer_print_result(this,result,request,
-#ifndef GSNAP
-			       Request_queryseq(request),
-#endif
-			       noutput+1);
-#else
-	Outbuffer_print_result(this,result,request
-#ifndef GSNAP
-			       ,Request_queryseq(request)
-#endif
-			       );
-#endif
-	Result_free(&result);
-	Request_free(&request);
-	noutput++;
-	
-	/* Print out rest of stored queue */
-	while (queue != NULL && queue->id == (int) noutput) {
-	  queue = RRlist_pop_id(queue,&id,&request,&result);
-	  nqueued--;
-#ifdef MEMUSAGE
-	  Outbuffer_print_result(this,result,request,
-#ifndef GSNAP
-				 Request_queryseq(request),
-#endif
-				 noutput+1);
-#else
-	  Outbuffer_print_result(this,result,request
-#ifndef GSNAP
-				 ,Request_queryseq(request)
-#endif
-				 );
-#endif
-	  Result_free(&result);
-	  Request_free(&request);
-	  noutput++;
-	}
-      }
-
-      if (this->head && this->nprocessed - nqueued - noutput > output_buffer_size) {
-	/* Clear out backlog */
-#ifdef HAVE_PTHREAD
-	pthread_mutex_lock(&this->lock);
-#endif
-
-	while (this->head && this->nprocessed - nqueued - noutput > output_buffer_size) {
-	  this->head = RRlist_pop(this->head,&request,&result);
-	  if ((id = Result_id(result)) != (int) noutput) {
-	    /* Store in queue */
-	    queue = RRlist_insert(queue,id,request,result);
-	    nqueued++;
-	  } else {
-#ifdef MEMUSAGE
-	    Outbuffer_print_result(this,result,request,
-#ifndef GSNAP
-				   Request_queryseq(request),
-#endif				   
-				   noutput+1);
-#else
-	    Outbuffer_print_result(this,result,request
-#ifndef GSNAP
-				   ,Request_queryseq(request)
-#endif
-				   );
-#endif
-	    Result_free(&result);
-	    Request_free(&request);
-	    noutput++;
-	
-	    /* Print out rest of stored queue */
-	    while (queue != NULL && queue->id == (int) noutput) {
-	      queue = RRlist_pop_id(queue,&id,&request,&result);
-	      nqueued--;
-#ifdef MEMUSAGE
-	      Outbuffer_print_result(this,result,request,
-#ifndef GSNAP
-				     Request_queryseq(request),
-#endif
-				     noutput+1);
-#else
-	      Outbuffer_print_result(this,result,request
-#ifndef GSNAP
-				     ,Request_queryseq(request)
-#endif
-				     );
-#endif
-	      Result_free(&result);
-	      Request_free(&request);
-	      noutput++;
-	    }
-	  }
-	}
+    /* Take every consecutive result that is ready.  Slot (noutput +
+       nready) % window_size can hold only id noutput + nready. */
+    nready = 0;
+    while (nready < window_size && window[(noutput + nready) % window_size] != NULL) {
+      ready[nready] = window[(noutput + nready) % window_size];
+      window[(noutput + nready) % window_size] = (RRlist_T) NULL;
+      nready++;
+    }
+    this->noutput = noutput + nready;
 
 #ifdef HAVE_PTHREAD
-	pthread_mutex_unlock(&this->lock);
+    if (nready > 0) {
+      pthread_cond_broadcast(&this->window_space_p);
+    }
+    /* Allow workers access to the window while we print */
+    pthread_mutex_unlock(&this->lock);
 #endif
-      }
 
+    for (i = 0; i < nready; i++) {
+      print_entry(this,ready[i],noutput);
+      noutput++;
     }
   }
 
-  assert(queue == NULL);
+  FREE(ready);
 
   return (void *) NULL;
 }
-
-
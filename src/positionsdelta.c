@@ -0,0 +1,271 @@
+static char rcsid[] = "$Id: positionsdelta.c $";
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "positionsdelta.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>		/* For memset */
+
+#if defined(HAVE_SSE2) && !defined(WORDS_BIGENDIAN) && !defined(LARGE_GENOMES)
+#define USE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+
+#ifdef DEBUG
+#define debug(x) x
+#else
+#define debug(x)
+#endif
+
+
+#define HEADER_WORDPTR 0
+#define HEADER_STARTS_LOW 1
+#define HEADER_STARTS_HIGH 2
+#define HEADER_WIDTHS 3
+
+
+#ifdef HAVE_BUILTIN_POPCOUNT
+#define count_bits(x) __builtin_popcount(x)
+#else
+static inline int
+count_bits (UINT4 x) {
+  x = x - ((x >> 1) & 0x55555555);
+  x = (x & 0x33333333) + ((x >> 2) & 0x33333333);
+  x = (x + (x >> 4)) & 0x0F0F0F0F;
+  return (int) ((x * 0x01010101) >> 24);
+}
+#endif
+
+#ifdef HAVE_BUILTIN_CLZ
+#define count_leading_zeroes(x) __builtin_clz(x)
+#else
+static inline int
+count_leading_zeroes (UINT4 x) {
+  int n = 0;
+
+  while ((x & 0x80000000U) == 0U) {
+    x <<= 1;
+    n++;
+  }
+  return n;
+}
+#endif
+
+
+/* Bits 0 through i - 1, for i from 0 through 32 */
+static inline UINT4
+low_mask (int i) {
+  return (i == 0) ? 0U : (~0U >> (32 - i));
+}
+
+
+/* Reads nbits (at most 64) starting at bitpos.  May read one word
+   past the block, so the writer pads the end of the file. */
+static inline UINT8
+get_bits (UINT4 *words, UINT8 bitpos, int nbits) {
+  UINT8 window, value;
+
+  if (nbits == 0) {
+    return 0ULL;
+  } else {
+    window = ((UINT8) words[bitpos >> 5] | ((UINT8) words[(bitpos >> 5) + 1] << 32)) >> (bitpos & 31);
+    if (nbits <= 32) {
+      return window & (~0ULL >> (64 - nbits));
+    } else {
+      value = window & 0xFFFFFFFFULL;
+      bitpos += 32;
+      window = ((UINT8) words[bitpos >> 5] | ((UINT8) words[(bitpos >> 5) + 1] << 32)) >> (bitpos & 31);
+      return value | ((window & (~0ULL >> (96 - nbits))) << 32);
+    }
+  }
+}
+
+static inline void
+put_bits (UINT4 *words, UINT4 bitpos, UINT8 value, int nbits) {
+  while (nbits > 0) {
+    words[bitpos >> 5] |= (UINT4) (value << (bitpos & 31));
+    value >>= (32 - (bitpos & 31));
+    nbits -= (32 - (bitpos & 31));
+    bitpos += (32 - (bitpos & 31));
+  }
+  return;
+}
+
+
+int
+Positionsdelta_encode_block (UINT4 *words, UINT4 *header, UINT8 *values, int n,
+			     UINT8 startbits, UINT8 prev, int rawwidth) {
+  UINT8 delta;
+  UINT4 bitpos;
+  int deltawidth = 0, i;
+
+  memset(words,0,POSITIONSDELTA_MAX_BLOCK_WORDS*sizeof(UINT4));
+
+  for (i = 0; i < n; i++) {
+    if ((startbits & (1ULL << i)) == 0) {
+      delta = values[i] - ((i == 0) ? prev : values[i-1]);
+      while (deltawidth < 64 && (delta >> deltawidth) != 0) {
+	deltawidth++;
+      }
+    }
+  }
+
+  bitpos = 0;
+  for (i = 0; i < n; i++) {
+    if ((startbits & (1ULL << i)) != 0) {
+      put_bits(words,bitpos,values[i],rawwidth);
+      bitpos += rawwidth;
+    } else {
+      put_bits(words,bitpos,values[i] - ((i == 0) ? prev : values[i-1]),deltawidth);
+      bitpos += deltawidth;
+    }
+  }
+
+  header[HEADER_STARTS_LOW] = (UINT4) (startbits & 0xFFFFFFFFULL);
+  header[HEADER_STARTS_HIGH] = (UINT4) (startbits >> 32);
+  header[HEADER_WIDTHS] = (UINT4) deltawidth | ((UINT4) rawwidth << 8);
+  debug(printf("Encoded %d positions with delta width %d in %u bits\n",n,deltawidth,bitpos));
+
+  return (int) ((bitpos + 31)/32);
+}
+
+
+/* Number of oligomer starts before entry i of the block */
+static inline int
+count_starts (UINT4 *header, int i) {
+  if (i <= 32) {
+    return count_bits(header[HEADER_STARTS_LOW] & low_mask(i));
+  } else {
+    return count_bits(header[HEADER_STARTS_LOW]) + count_bits(header[HEADER_STARTS_HIGH] & low_mask(i - 32));
+  }
+}
+
+/* Last oligomer start at or before entry i of the block, or -1 */
+static inline int
+last_start (UINT4 *header, int i) {
+  UINT4 bits;
+
+  if (i >= 32) {
+    if ((bits = header[HEADER_STARTS_HIGH] & low_mask(i - 32 + 1)) != 0U) {
+      return 32 + 31 - count_leading_zeroes(bits);
+    }
+    i = 31;
+  }
+  if ((bits = header[HEADER_STARTS_LOW] & low_mask(i + 1)) != 0U) {
+    return 31 - count_leading_zeroes(bits);
+  } else {
+    return -1;
+  }
+}
+
+/* Bit position of entry i within the values of the block */
+static inline UINT8
+entry_bitpos (UINT4 *header, int i) {
+  int nstarts = count_starts(header,i);
+  int deltawidth = header[HEADER_WIDTHS] & 0xFF, rawwidth = header[HEADER_WIDTHS] >> 8;
+
+  return (UINT8) nstarts*rawwidth + (UINT8) (i - nstarts)*deltawidth;
+}
+
+
+/* Stores value plus the running sums of deltas[0..n-1] into out, and
+   returns the last one */
+static Univcoord_T
+prefix_sum (Univcoord_T *out, Univcoord_T *deltas, int n, Univcoord_T value) {
+  int i = 0;
+#ifdef USE_SSE2
+  __m128i x, carry;
+
+  carry = _mm_set1_epi32((int) value);
+  for ( ; i + 4 <= n; i += 4) {
+    x = _mm_loadu_si128((__m128i *) &(deltas[i]));
+    x = _mm_add_epi32(x,_mm_slli_si128(x,4));
+    x = _mm_add_epi32(x,_mm_slli_si128(x,8));
+    x = _mm_add_epi32(x,carry);
+    _mm_storeu_si128((__m128i *) &(out[i]),x);
+    carry = _mm_shuffle_epi32(x,0xFF);
+  }
+  if (i > 0) {
+    value = out[i-1];
+  }
+#endif
+
+  for ( ; i < n; i++) {
+    value += deltas[i];
+    out[i] = value;
+  }
+
+  return value;
+}
+
+
+void
+Positionsdelta_read (Univcoord_T *values, UINT4 *blocks, UINT4 *delta, Positionsptr_T ptr0, int n) {
+  Univcoord_T deltas[POSITIONSDELTA_BLOCKSIZE], value;
+  Positionsptr_T ptr, end;
+  UINT4 *header, *words;
+  UINT8 bitpos;
+  int deltawidth, i, j, k, blocki;
+
+  if (n == 0) {
+    return;
+  }
+
+  /* Callers normally start at an oligomer, but find its start in case not */
+  blocki = ptr0/POSITIONSDELTA_BLOCKSIZE;
+  header = &(blocks[blocki*POSITIONSDELTA_HEADER_WORDS]);
+  i = last_start(header,ptr0 % POSITIONSDELTA_BLOCKSIZE);
+  while (i < 0) {
+    if (blocki == 0) {
+      /* Position 0 always starts an oligomer in a correct file */
+      fprintf(stderr,"Compressed positions have no oligomer start at or before %u.  Please rebuild them with gmapindex -z.\n",
+	      ptr0);
+      exit(9);
+    }
+    blocki--;
+    header = &(blocks[blocki*POSITIONSDELTA_HEADER_WORDS]);
+    i = last_start(header,POSITIONSDELTA_BLOCKSIZE - 1);
+  }
+  words = &(delta[header[HEADER_WORDPTR]]);
+  value = (Univcoord_T) get_bits(words,entry_bitpos(header,i),header[HEADER_WIDTHS] >> 8);
+  ptr = (Positionsptr_T) blocki*POSITIONSDELTA_BLOCKSIZE + i;
+  if (ptr == ptr0) {
+    values[0] = value;
+  }
+  debug(printf("Positionsdelta_read of %d at %u: oligomer starts at %u with %u\n",n,ptr0,ptr,(UINT4) value));
+
+  /* Everything after the start of the oligomer is a delta */
+  end = ptr0 + n;
+  ptr++;
+  while (ptr < end) {
+    blocki = ptr/POSITIONSDELTA_BLOCKSIZE;
+    header = &(blocks[blocki*POSITIONSDELTA_HEADER_WORDS]);
+    words = &(delta[header[HEADER_WORDPTR]]);
+    deltawidth = header[HEADER_WIDTHS] & 0xFF;
+
+    i = ptr % POSITIONSDELTA_BLOCKSIZE;
+    if ((k = POSITIONSDELTA_BLOCKSIZE - i) > (int) (end - ptr)) {
+      k = end - ptr;
+    }
+    bitpos = entry_bitpos(header,i);
+    for (j = 0; j < k; j++) {
+      deltas[j] = (Univcoord_T) get_bits(words,bitpos,deltawidth);
+      bitpos += deltawidth;
+    }
+
+    j = 0;
+    while (j < k && ptr + j < ptr0) {
+      value += deltas[j++];
+    }
+    if (j < k) {
+      value = prefix_sum(&(values[ptr + j - ptr0]),&(deltas[j]),k - j,value);
+    }
+    ptr += k;
+  }
+
+  return;
+}
+
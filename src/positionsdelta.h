@@ -0,0 +1,37 @@
+/* $Id: positionsdelta.h $ */
+#ifndef POSITIONSDELTA_INCLUDED
+#define POSITIONSDELTA_INCLUDED
+#include "types.h"
+
+/* Alternative to the positions file, with the positions cut into
+   blocks of POSITIONSDELTA_BLOCKSIZE.  The first position of each
+   oligomer is stored in full, with rawwidth bits, and the others as
+   differences from the previous one, with a width chosen per block.
+   Each block has a header of POSITIONSDELTA_HEADER_WORDS words in the
+   blocks file: the word in the delta file where its values start, a
+   bitmap of the positions that start an oligomer, and the two widths. */
+
+#define POSITIONSDELTA_FILESUFFIX "positionsdelta"
+#define POSITIONSBLOCKS_FILESUFFIX "positionsblocks"
+
+#define POSITIONSDELTA_BLOCKSIZE 64
+#define POSITIONSDELTA_HEADER_WORDS 4
+
+/* Enough words for any block */
+#define POSITIONSDELTA_MAX_BLOCK_WORDS (POSITIONSDELTA_BLOCKSIZE*64/32 + 1)
+
+/* Encodes values[0..n-1], n <= POSITIONSDELTA_BLOCKSIZE, into words,
+   and fills in all of header except the word pointer.  Bit i of
+   startbits is set if values[i] is the first position of an oligomer,
+   and prev is the value before values[0].  Returns the number of
+   words used. */
+extern int
+Positionsdelta_encode_block (UINT4 *words, UINT4 *header, UINT8 *values, int n,
+			     UINT8 startbits, UINT8 prev, int rawwidth);
+
+/* Decodes n positions starting at ptr0 into values */
+extern void
+Positionsdelta_read (Univcoord_T *values, UINT4 *blocks, UINT4 *delta, Positionsptr_T ptr0, int n);
+
+#endif
+
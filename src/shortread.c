@@ -18,8 +18,7 @@ static char rcsid[] = "$Id: shortread.c 98808 2013-06-18 22:16:54Z twu $";
 #include <ctype.h>		/* For iscntrl and isspace */
 
 #ifdef HAVE_ZLIB
-#include <zlib.h>
-#define GZBUFFER_SIZE 131072
+#include "gunzip.h"
 #endif
 
 #define PAIRED_ADAPTER_NMISMATCHES_ALLOWED 1
@@ -234,13 +233,13 @@ Shortread_input_init (FILE *fp) {
 #ifdef HAVE_ZLIB
 /* Returns '>' if FASTA file, first sequence char if not */
 int
-Shortread_input_init_gzip (gzFile fp) {
+Shortread_input_init_gzip (Gunzip_T fp) {
   int c;
   bool okayp = false;
 
   Header[0] = '\0';
 
-  while (okayp == false && (c = gzgetc(fp)) != EOF) {
+  while (okayp == false && (c = Gunzip_getc(fp)) != EOF) {
     debug(printf("Read character %c\n",c));
     if (iscntrl(c)) {
 #ifdef DASH
@@ -375,15 +374,15 @@ input_header (bool *filterp, char **restofheader, FILE *fp) {
 
 #ifdef HAVE_ZLIB
 static char *
-input_header_gzip (bool *filterp, char **restofheader, gzFile fp) {
+input_header_gzip (bool *filterp, char **restofheader, Gunzip_T fp) {
   char *acc = NULL, *p, *q;
   size_t length;
 
   *filterp = false;
 
-  if (gzeof(fp)) {
+  if (Gunzip_eof(fp)) {
     return NULL;
-  } else if (gzgets(fp,&(Header[0]),HEADERLEN) == NULL) {
+  } else if (Gunzip_gets(fp,&(Header[0]),HEADERLEN) == NULL) {
     /* File must terminate after > */
     return NULL;
   }
@@ -397,7 +396,7 @@ input_header_gzip (bool *filterp, char **restofheader, gzFile fp) {
     *p = '\0';
   } else {
     /* Eliminate rest of header from input */
-    while (gzgets(fp,&(Discard[0]),DISCARDLEN) != NULL &&
+    while (Gunzip_gets(fp,&(Discard[0]),DISCARDLEN) != NULL &&
 	   rindex(&(Discard[0]),'\n') == NULL) ;
   }
 
@@ -650,16 +649,16 @@ input_header_fastq (bool *filterp, char **restofheader, FILE *fp) {
 
 #ifdef HAVE_ZLIB
 static char *
-input_header_fastq_gzip (bool *filterp, char **restofheader, gzFile fp) {
+input_header_fastq_gzip (bool *filterp, char **restofheader, Gunzip_T fp) {
   char *acc, *p, *q, *start;
   size_t length;
   int fieldi = 0;
 
   *filterp = false;
 
-  if (gzeof(fp)) {
+  if (Gunzip_eof(fp)) {
     return NULL;
-  } else if (gzgets(fp,&(Header[0]),HEADERLEN) == NULL) {
+  } else if (Gunzip_gets(fp,&(Header[0]),HEADERLEN) == NULL) {
     /* File must terminate after > */
     return NULL;
   }
@@ -673,7 +672,7 @@ input_header_fastq_gzip (bool *filterp, char **restofheader, gzFile fp) {
     *p = '\0';
   } else {
     /* Eliminate rest of header from input */
-    while (gzgets(fp,&(Discard[0]),DISCARDLEN) != NULL &&
+    while (Gunzip_gets(fp,&(Discard[0]),DISCARDLEN) != NULL &&
 	   rindex(&(Discard[0]),'\n') == NULL) ;
   }
 
@@ -833,18 +832,18 @@ skip_header (FILE *fp) {
 
 #ifdef HAVE_ZLIB
 static bool
-skip_header_gzip (gzFile fp) {
+skip_header_gzip (Gunzip_T fp) {
 
-  if (gzeof(fp)) {
+  if (Gunzip_eof(fp)) {
     return false;
-  } else if (gzgets(fp,&(Header[0]),HEADERLEN) == NULL) {
+  } else if (Gunzip_gets(fp,&(Header[0]),HEADERLEN) == NULL) {
     /* File must terminate after > */
     return false;
   }
 
   if (rindex(&(Header[0]),'\n') == NULL) {
     /* Eliminate rest of header from input */
-    while (gzgets(fp,&(Discard[0]),DISCARDLEN) != NULL &&
+    while (Gunzip_gets(fp,&(Discard[0]),DISCARDLEN) != NULL &&
 	   rindex(&(Discard[0]),'\n') == NULL) ;
   }
 
@@ -993,7 +992,7 @@ input_oneline (int *nextchar, char *Start, FILE *fp, char *acc, bool possible_fa
 
 #ifdef HAVE_ZLIB
 static int
-input_oneline_gzip (int *nextchar, char *Start, gzFile fp, char *acc, bool possible_fasta_header_p) {
+input_oneline_gzip (int *nextchar, char *Start, Gunzip_T fp, char *acc, bool possible_fasta_header_p) {
   int remainder;
   char *ptr, *p = NULL;
 
@@ -1006,7 +1005,7 @@ input_oneline_gzip (int *nextchar, char *Start, gzFile fp, char *acc, bool possi
     return 0;
   } else {
     *ptr++ = (char) *nextchar;
-    if ((p = gzgets(fp,ptr,remainder+1)) == NULL) {
+    if ((p = Gunzip_gets(fp,ptr,remainder+1)) == NULL) {
       /* NULL if file ends with a blank line */
       printf("Blank line. read %s.\n",ptr);
     } else {
@@ -1034,7 +1033,7 @@ input_oneline_gzip (int *nextchar, char *Start, gzFile fp, char *acc, bool possi
 	}
 	*p = '\0';
 	debug(printf("Now string is %s.\n",ptr));
-      } else if (gzeof(fp)) {
+      } else if (Gunzip_eof(fp)) {
 	/* No line feed, but end of file.  Handle below. */
 	debug(printf("End of file seen\n"));
       } else {
@@ -1047,10 +1046,10 @@ input_oneline_gzip (int *nextchar, char *Start, gzFile fp, char *acc, bool possi
     ptr += strlen(ptr);
 
     /* Peek at character after eoln */
-    if (gzeof(fp)) {
+    if (Gunzip_eof(fp)) {
       *nextchar = EOF;
     } else {
-      while ((*nextchar = gzgetc(fp)) != EOF && (*nextchar == '\r' || *nextchar == '\n' || isspace(*nextchar))) {
+      while ((*nextchar = Gunzip_getc(fp)) != EOF && (*nextchar == '\r' || *nextchar == '\n' || isspace(*nextchar))) {
       }
     }
 
@@ -2186,7 +2185,7 @@ Shortread_read_fasta_shortreads (int *nextchar, T *queryseq2, FILE **input1, FIL
 
 #ifdef HAVE_ZLIB
 T
-Shortread_read_fasta_shortreads_gzip (int *nextchar, T *queryseq2, gzFile *input1, gzFile*input2,
+Shortread_read_fasta_shortreads_gzip (int *nextchar, T *queryseq2, Gunzip_T *input1, Gunzip_T *input2,
 				      char ***files, int *nfiles,
 				      int barcode_length, bool invert_first_p, bool invert_second_p) {
   T queryseq1;
@@ -2196,13 +2195,13 @@ Shortread_read_fasta_shortreads_gzip (int *nextchar, T *queryseq2, gzFile *input
   bool filterp;
 
   while (1) {
-    if (*input1 == NULL || gzeof(*input1)) {
+    if (*input1 == NULL || Gunzip_eof(*input1)) {
       if (*input1 != NULL) {
-	gzclose(*input1);
+	Gunzip_free(&(*input1));
 	*input1 = NULL;
       }
       if (*input2 != NULL) {
-	gzclose(*input2);
+	Gunzip_free(&(*input2));
 	*input2 = NULL;
       }
 
@@ -2211,7 +2210,7 @@ Shortread_read_fasta_shortreads_gzip (int *nextchar, T *queryseq2, gzFile *input
 	return (T) NULL;
 
       } else if (*nfiles == 1 || force_single_end_p == true) {
-	if ((*input1 = gzopen((*files)[0],"rb")) == NULL) {
+	if ((*input1 = Gunzip_new((*files)[0])) == NULL) {
 	  fprintf(stderr,"Can't open file %s => skipping it.\n",(*files)[0]);
 	  (*files) += 1;
 	  (*nfiles) -= 1;
@@ -2225,7 +2224,7 @@ Shortread_read_fasta_shortreads_gzip (int *nextchar, T *queryseq2, gzFile *input
 	}
 
       } else {
-	while (*nfiles > 0 && (*input1 = gzopen((*files)[0],"rb")) == NULL) {
+	while (*nfiles > 0 && (*input1 = Gunzip_new((*files)[0])) == NULL) {
 	  fprintf(stderr,"Can't open file %s => skipping it.\n",(*files)[0]);
 	  (*files)++;
 	  (*nfiles)--;
@@ -2234,9 +2233,6 @@ Shortread_read_fasta_shortreads_gzip (int *nextchar, T *queryseq2, gzFile *input
 	  *nextchar = EOF;
 	  return (T) NULL;
 	} else {
-#ifdef HAVE_ZLIB_GZBUFFER
-	  gzbuffer(*input1,GZBUFFER_SIZE);
-#endif
 	  (*files)++;
 	  (*nfiles)--;
 	  *nextchar = '\0';
@@ -2256,9 +2252,9 @@ Shortread_read_fasta_shortreads_gzip (int *nextchar, T *queryseq2, gzFile *input
       /* fprintf(stderr,"No header\n"); */
       /* File ends after >.  Don't process, but loop again */
       *nextchar = EOF;
-    } else if ((*nextchar = gzgetc(*input1)) == '\r' || *nextchar == '\n') {
+    } else if ((*nextchar = Gunzip_getc(*input1)) == '\r' || *nextchar == '\n') {
       /* Process blank lines and loop again */
-      while (*nextchar != EOF && ((*nextchar = gzgetc(*input1)) != '>')) {
+      while (*nextchar != EOF && ((*nextchar = Gunzip_getc(*input1)) != '>')) {
       }
     } else if ((fulllength1 = input_oneline_gzip(&(*nextchar),&(Read1[0]),*input1,acc,
 						 /*possible_fasta_header_p*/true)) == 0) {
@@ -2280,10 +2276,7 @@ Shortread_read_fasta_shortreads_gzip (int *nextchar, T *queryseq2, gzFile *input
 
       } else {
 	if (*input2 == NULL && *nfiles > 0 && force_single_end_p == false &&
-	    (*input2 = gzopen((*files)[0],"rb")) != NULL) {
-#ifdef HAVE_ZLIB_GZBUFFER
-	  gzbuffer(*input2,GZBUFFER_SIZE);
-#endif
+	    (*input2 = Gunzip_new((*files)[0])) != NULL) {
 	  (*files) += 1;
 	  (*nfiles) -= 1;
 	  nextchar2 = '\0';
@@ -2296,9 +2289,9 @@ Shortread_read_fasta_shortreads_gzip (int *nextchar, T *queryseq2, gzFile *input
 	    /* File ends after >.  Don't process, but loop again */
 	    (*queryseq2) = (T) NULL;
 	    nextchar2 = EOF;
-	  } else if ((nextchar2 = gzgetc(*input2)) == '\r' || nextchar2 == '\n') {
+	  } else if ((nextchar2 = Gunzip_getc(*input2)) == '\r' || nextchar2 == '\n') {
 	    /* Process blank lines and loop again */
-	    while (nextchar2 != EOF && ((nextchar2 = gzgetc(*input2)) != '>')) {
+	    while (nextchar2 != EOF && ((nextchar2 = Gunzip_getc(*input2)) != '>')) {
 	    }
 	    (*queryseq2) = (T) NULL;
 	  } else if ((fulllength2 = input_oneline_gzip(&nextchar2,&(Read2[0]),*input2,acc2,
@@ -2635,7 +2628,7 @@ Shortread_read_fastq_shortreads (int *nextchar, T *queryseq2, FILE **input1, FIL
 
 #ifdef HAVE_ZLIB
 T
-Shortread_read_fastq_shortreads_gzip (int *nextchar, T *queryseq2, gzFile *input1, gzFile *input2,
+Shortread_read_fastq_shortreads_gzip (int *nextchar, T *queryseq2, Gunzip_T *input1, Gunzip_T *input2,
 				      char ***files, int *nfiles,
 				      int barcode_length, bool invert_first_p, bool invert_second_p) {
   T queryseq1;
@@ -2645,13 +2638,13 @@ Shortread_read_fastq_shortreads_gzip (int *nextchar, T *queryseq2, gzFile *input
   bool filterp;
 
   while (1) {
-    if (*input1 == NULL || gzeof(*input1)) {
+    if (*input1 == NULL || Gunzip_eof(*input1)) {
       if (*input1 != NULL) {
-	gzclose(*input1);
+	Gunzip_free(&(*input1));
 	*input1 = NULL;
       }
       if (*input2 != NULL) {
-	gzclose(*input2);
+	Gunzip_free(&(*input2));
 	*input2 = NULL;
       }
 
@@ -2660,13 +2653,9 @@ Shortread_read_fastq_shortreads_gzip (int *nextchar, T *queryseq2, gzFile *input
 	return (T) NULL;
 
       } else if (*nfiles == 1 || force_single_end_p == true) {
-	if ((*input1 = gzopen((*files)[0],"rb")) == NULL) {
+	if ((*input1 = Gunzip_new((*files)[0])) == NULL) {
 	  fprintf(stderr,"Cannot open gzipped file %s\n",(*files)[0]);
 	  exit(9);
-	} else {
-#ifdef HAVE_ZLIB_GZBUFFER
-	  gzbuffer(*input1,GZBUFFER_SIZE);
-#endif
 	}
 	*input2 = NULL;
 	(*files) += 1;
@@ -2674,22 +2663,14 @@ Shortread_read_fastq_shortreads_gzip (int *nextchar, T *queryseq2, gzFile *input
 	*nextchar = '\0';
 	
       } else {
-	if ((*input1 = gzopen((*files)[0],"rb")) == NULL) {
+	if ((*input1 = Gunzip_new((*files)[0])) == NULL) {
 	  fprintf(stderr,"Cannot open gzipped file %s\n",(*files)[0]);
 	  exit(9);
-	} else {
-#ifdef HAVE_ZLIB_GZBUFFER
-	  gzbuffer(*input1,GZBUFFER_SIZE);
-#endif
 	}
 
-	if ((*input2 = gzopen((*files)[1],"rb")) == NULL) {
+	if ((*input2 = Gunzip_new((*files)[1])) == NULL) {
 	  fprintf(stderr,"Cannot open gzipped file %s\n",(*files)[1]);
 	  exit(9);
-	} else {
-#ifdef HAVE_ZLIB_GZBUFFER
-	  gzbuffer(*input2,GZBUFFER_SIZE);
-#endif
 	}
 
 	(*files) += 2;
@@ -2704,7 +2685,7 @@ Shortread_read_fastq_shortreads_gzip (int *nextchar, T *queryseq2, gzFile *input
       /* File ends after >.  Don't process. */
       *nextchar = EOF;
     } else {
-      *nextchar = gzgetc(*input1);
+      *nextchar = Gunzip_getc(*input1);
       if ((fulllength = input_oneline_gzip(&(*nextchar),&(Read1[0]),*input1,acc,
 					   /*possible_fasta_header_p*/true)) == 0) {
 	/* fprintf(stderr,"length is zero\n"); */
@@ -2718,7 +2699,7 @@ Shortread_read_fastq_shortreads_gzip (int *nextchar, T *queryseq2, gzFile *input
 				  invert_first_p,/*copy_acc_p*/false);
       } else {
 	skip_header_gzip(*input1);
-	*nextchar = gzgetc(*input1);
+	*nextchar = Gunzip_getc(*input1);
 	quality_length = input_oneline_gzip(&(*nextchar),&(Quality[0]),*input1,acc,
 					    /*possible_fasta_header_p*/false);
 	if (quality_length != fulllength) {
@@ -2756,7 +2737,7 @@ Shortread_read_fastq_shortreads_gzip (int *nextchar, T *queryseq2, gzFile *input
 	    acc = (char *) NULL;
 	  }
 	}
-	nextchar2 = gzgetc(*input2);
+	nextchar2 = Gunzip_getc(*input2);
 	if ((fulllength = input_oneline_gzip(&nextchar2,&(Read2[0]),*input2,acc,
 					     /*possible_fasta_header_p*/true)) == 0) {
 	  /* fprintf(stderr,"length is zero\n"); */
@@ -2770,7 +2751,7 @@ Shortread_read_fastq_shortreads_gzip (int *nextchar, T *queryseq2, gzFile *input
 				       invert_second_p,/*copy_acc_p*/false);
 	} else {
 	  skip_header_gzip(*input2);
-	  nextchar2 = gzgetc(*input2);
+	  nextchar2 = Gunzip_getc(*input2);
 	  quality_length = input_oneline_gzip(&nextchar2,&(Quality[0]),*input2,acc,
 					      /*possible_fasta_header_p*/false);
 	  if (quality_length != fulllength) {
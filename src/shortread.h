@@ -5,7 +5,7 @@
 #include "bool.h"
 
 #ifdef HAVE_ZLIB
-#include <zlib.h>
+#include "gunzip.h"
 #endif
 
 #ifdef HAVE_BZLIB
@@ -35,7 +35,7 @@ Shortread_input_init (FILE *fp);
 
 #ifdef HAVE_ZLIB
 extern int
-Shortread_input_init_gzip (gzFile fp);
+Shortread_input_init_gzip (Gunzip_T fp);
 #endif
 
 #ifdef HAVE_BZLIB
@@ -95,11 +95,11 @@ Shortread_read_fastq_shortreads (int *nextchar, T *queryseq2, FILE **input1, FIL
 
 #ifdef HAVE_ZLIB
 extern T
-Shortread_read_fasta_shortreads_gzip (int *nextchar, T *queryseq2, gzFile *input1, gzFile *input2,
+Shortread_read_fasta_shortreads_gzip (int *nextchar, T *queryseq2, Gunzip_T *input1, Gunzip_T *input2,
 				      char ***files, int *nfiles,
 				      int barcode_length, bool invert_first_p, bool invert_second_p);
 extern T
-Shortread_read_fastq_shortreads_gzip (int *nextchar, T *queryseq2, gzFile *input1, gzFile *input2,
+Shortread_read_fastq_shortreads_gzip (int *nextchar, T *queryseq2, Gunzip_T *input1, Gunzip_T *input2,
 				      char ***files, int *nfiles,
 				      int barcode_length, bool invert_first_p, bool invert_second_p);
 #endif
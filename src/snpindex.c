@@ -22,6 +22,9 @@ static char rcsid[] = "$Id: snpindex.c 99737 2013-06-27 19:33:03Z twu $";
 #include <ctype.h>		/* For toupper */
 #include <sys/mman.h>		/* For munmap */
 #include <math.h>		/* For qsort */
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>		/* For lseek and close */
 #endif
@@ -58,6 +61,7 @@ static char rcsid[] = "$Id: snpindex.c 99737 2013-06-27 19:33:03Z twu $";
 #include "genomicpos.h"
 #include "iitdef.h"
 #include "uintlist.h"
+#include "stopwatch.h"
 #include "chrnum.h"
 #include "genome.h"
 #include "datadir.h"
@@ -106,6 +110,20 @@ static int circular_typeint = -1;
 static char *snps_root = NULL;
 static bool show_warnings_p = true;
 static int max_warnings = -1;
+static int nthreads = 1;
+
+/* Shared by the threads that process divisions.  snp_lock protects
+   these, the warning count, and snp_blocks, whose blocks can straddle
+   two chromosomes. */
+static int next_divno;
+static int ndivs_done;
+static UINT8 nsnps_done;
+static int nwarnings = 0;
+static bool warning_line_p = false; /* Last warning still needs a newline */
+static Stopwatch_T stopwatch;
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t snp_lock;
+#endif
 
 
 static struct option long_options[] = {
@@ -118,6 +136,9 @@ static struct option long_options[] = {
   {"destdir", required_argument, 0, 'V'},	/* user_destdir */
   {"snpsdb", required_argument, 0, 'v'}, /* snps_root */
 
+  /* Compute options */
+  {"nthreads", required_argument, 0, 't'}, /* nthreads */
+
   /* Output options */
   {"max-warnings", required_argument, 0, 'w'}, /* max_warnings */
 
@@ -274,9 +295,82 @@ Labeled_interval_cmp (const void *a, const void *b) {
 
 
 
+/* Oligomers and their positions found by one thread, in the order
+   found.  Each thread keeps its own list, so divisions can be
+   processed without sharing counts or positions between threads. */
+typedef struct Snplist_T *Snplist_T;
+struct Snplist_T {
+  Storedoligomer_T *oligos;
+  UINT4 *positions4;
+  UINT8 *positions8;
+  Positionsptr_T n;
+  size_t nalloc;
+};
+
+#define SNPLIST_INITIAL 65536
+
+static void
+Snplist_push (Snplist_T this, Storedoligomer_T oligo, Univcoord_T position, bool coord_values_8p) {
+  Storedoligomer_T *oligos;
+  UINT4 *positions4;
+  UINT8 *positions8;
+
+  if (this->n == this->nalloc) {
+    this->nalloc = (this->nalloc == 0) ? SNPLIST_INITIAL : 2*this->nalloc;
+    oligos = (Storedoligomer_T *) MALLOC(this->nalloc*sizeof(Storedoligomer_T));
+    if (this->n > 0) {
+      memcpy(oligos,this->oligos,this->n*sizeof(Storedoligomer_T));
+      FREE(this->oligos);
+    }
+    this->oligos = oligos;
+
+    if (coord_values_8p == true) {
+      positions8 = (UINT8 *) MALLOC(this->nalloc*sizeof(UINT8));
+      if (this->n > 0) {
+	memcpy(positions8,this->positions8,this->n*sizeof(UINT8));
+	FREE(this->positions8);
+      }
+      this->positions8 = positions8;
+    } else {
+      positions4 = (UINT4 *) MALLOC(this->nalloc*sizeof(UINT4));
+      if (this->n > 0) {
+	memcpy(positions4,this->positions4,this->n*sizeof(UINT4));
+	FREE(this->positions4);
+      }
+      this->positions4 = positions4;
+    }
+  }
+
+  this->oligos[this->n] = oligo;
+  if (coord_values_8p == true) {
+    this->positions8[this->n] = position;
+  } else {
+    this->positions4[this->n] = (UINT4) position;
+  }
+  this->n += 1;
+
+  return;
+}
+
+static void
+Snplist_free_contents (Snplist_T this) {
+  if (this->oligos != NULL) {
+    FREE(this->oligos);
+  }
+  if (this->positions4 != NULL) {
+    FREE(this->positions4);
+  }
+  if (this->positions8 != NULL) {
+    FREE(this->positions8);
+  }
+  this->n = 0;
+  this->nalloc = 0;
+  return;
+}
+
+
 static int
-process_snp_block (int *nwarnings, Positionsptr_T *offsets, UINT4 *positions4, UINT8 *positions8,
-		   Labeled_interval_T *intervals, int nintervals,
+process_snp_block (Snplist_T snplist, Labeled_interval_T *intervals, int nintervals,
 		   Univcoord_T chroffset, Genome_T genome,
 		   Genomecomp_T *snp_blocks, int divno, char *divstring, int intervali,
 		   IIT_T snps_iit, Univ_IIT_T chromosome_iit, int index1part,
@@ -357,6 +451,9 @@ process_snp_block (int *nwarnings, Positionsptr_T *offsets, UINT4 *positions4, U
       if (refnt == snptype[0]) {
 	if (altstring[stringi] != '\0' && altstring[stringi] != snptype[1]) {
 	  nerrors++;
+#ifdef HAVE_PTHREAD
+	  pthread_mutex_lock(&snp_lock);
+#endif
 	  if (show_warnings_p == true) {
 	    label = IIT_label(snps_iit,intervals[i]->origindex,&allocp);
 	    fprintf(stderr,"\nFor %s at %s:%u, saw two different alternate alleles %c and %c, so using N as alternate allele.",
@@ -364,11 +461,16 @@ process_snp_block (int *nwarnings, Positionsptr_T *offsets, UINT4 *positions4, U
 	    if (allocp == true) {
 	      FREE(label);
 	    }
-	    if (++(*nwarnings) == max_warnings) {
+	    warning_line_p = true;
+	    if (++nwarnings == max_warnings) {
 	      fprintf(stderr,"\nMaximum of %d warnings reached.  No more warnings will be shown\n",max_warnings);
 	      show_warnings_p = false;
+	      warning_line_p = false;
 	    }
 	  }
+#ifdef HAVE_PTHREAD
+	  pthread_mutex_unlock(&snp_lock);
+#endif
 	  altnt = 'N';
 	} else {
 	  altnt = check_acgt(snptype[1],snps_iit,divno,divstring,intervals[i]->origindex,intervals[i]->interval);
@@ -376,6 +478,9 @@ process_snp_block (int *nwarnings, Positionsptr_T *offsets, UINT4 *positions4, U
       } else if (refnt == snptype[1]) {
 	if (altstring[stringi] != '\0' && altstring[stringi] != snptype[0]) {
 	  nerrors++;
+#ifdef HAVE_PTHREAD
+	  pthread_mutex_lock(&snp_lock);
+#endif
 	  if (show_warnings_p == true) {
 	    label = IIT_label(snps_iit,intervals[i]->origindex,&allocp);
 	    fprintf(stderr,"\nFor %s at %s:%u, saw two different alternate alleles %c and %c, so using N as alternate allele.",
@@ -383,17 +488,25 @@ process_snp_block (int *nwarnings, Positionsptr_T *offsets, UINT4 *positions4, U
 	    if (allocp == true) {
 	      FREE(label);
 	    }
-	    if (++(*nwarnings) == max_warnings) {
+	    warning_line_p = true;
+	    if (++nwarnings == max_warnings) {
 	      fprintf(stderr,"\nMaximum of %d warnings reached.  No more warnings will be shown\n",max_warnings);
 	      show_warnings_p = false;
+	      warning_line_p = false;
 	    }
 	  }
+#ifdef HAVE_PTHREAD
+	  pthread_mutex_unlock(&snp_lock);
+#endif
 	  altnt = 'N';
 	} else {
 	  altnt = check_acgt(snptype[0],snps_iit,divno,divstring,intervals[i]->origindex,intervals[i]->interval);
 	}
       } else {
 	nerrors++;
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&snp_lock);
+#endif
 	if (show_warnings_p == true) {
 	  label = IIT_label(snps_iit,intervals[i]->origindex,&allocp);
 	  fprintf(stderr,"\nFor %s at %s:%u, snptype %s not consistent with reference allele %c, so ignoring.",
@@ -401,11 +514,16 @@ process_snp_block (int *nwarnings, Positionsptr_T *offsets, UINT4 *positions4, U
 	  if (allocp == true) {
 	    FREE(label);
 	  }
-	  if (++(*nwarnings) == max_warnings) {
+	  warning_line_p = true;
+	  if (++nwarnings == max_warnings) {
 	    fprintf(stderr,"\nMaximum of %d warnings reached.  No more warnings will be shown\n",max_warnings);
 	    show_warnings_p = false;
+	    warning_line_p = false;
 	  }
 	}
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&snp_lock);
+#endif
 	altnt = '\0';		/* Ignoring */
       }
 
@@ -422,6 +540,10 @@ process_snp_block (int *nwarnings, Positionsptr_T *offsets, UINT4 *positions4, U
 	  ptr = snpposition/32U*3;
 	  shift = snpposition % 32U;
 
+#ifdef HAVE_PTHREAD
+	  pthread_mutex_lock(&snp_lock);
+#endif
+
 #ifdef WORDS_BIGENDIAN
 	  flags = Bigendian_convert_uint(snp_blocks[ptr+2]);
 	  flags |= (1 << shift);
@@ -482,6 +604,9 @@ process_snp_block (int *nwarnings, Positionsptr_T *offsets, UINT4 *positions4, U
 	    }
 #endif
 	  }
+#ifdef HAVE_PTHREAD
+	  pthread_mutex_unlock(&snp_lock);
+#endif
 	}
       }
     }
@@ -559,36 +684,12 @@ process_snp_block (int *nwarnings, Positionsptr_T *offsets, UINT4 *positions4, U
 #endif	
 
 	/* Ignore the first element in oligomers, which is all reference */
-	if (positions4 == NULL && positions8 == NULL) {
-	  /* writing offsets */
-	  for (p = Uintlist_next(oligomers); p != NULL; p = Uintlist_next(p)) {
-	    oligo = Uintlist_head(p);
-	    offsets[oligo + 1U] += 1;
-	    debug1(nt = shortoligo_nt(oligo,index1part);
-		   printf("Storing %s at %lu (%s:%u)\n",nt,position,divstring,chrpos+1U);
-		   FREE(nt));
-	  }
-
-	} else {
-	  /* writing positions */
-	  if (coord_values_8p == true) {
-	    for (p = Uintlist_next(oligomers); p != NULL; p = Uintlist_next(p)) {
-	      oligo = Uintlist_head(p);
-	      positions8[offsets[oligo]++] = position;
-	      debug1(nt = shortoligo_nt(oligo,index1part);
-		     printf("Storing %s at %lu (%s:%u)\n",nt,position,divstring,chrpos+1U);
-		     FREE(nt));
-	    }
-	    
-	  } else {
-	    for (p = Uintlist_next(oligomers); p != NULL; p = Uintlist_next(p)) {
-	      oligo = Uintlist_head(p);
-	      positions4[offsets[oligo]++] = (UINT4) position;
-	      debug1(nt = shortoligo_nt(oligo,index1part);
-		     printf("Storing %s at %lu (%s:%u)\n",nt,position,divstring,chrpos+1U);
-		     FREE(nt));
-	    }
-	  }
+	for (p = Uintlist_next(oligomers); p != NULL; p = Uintlist_next(p)) {
+	  oligo = Uintlist_head(p);
+	  Snplist_push(snplist,oligo,position,coord_values_8p);
+	  debug1(nt = shortoligo_nt(oligo,index1part);
+		 printf("Storing %s at %lu (%s:%u)\n",nt,position,divstring,chrpos+1U);
+		 FREE(nt));
 	}
 	Uintlist_free(&oligomers);
       }
@@ -603,87 +704,210 @@ process_snp_block (int *nwarnings, Positionsptr_T *offsets, UINT4 *positions4, U
 }
 
 
-static Positionsptr_T *
-compute_offsets (IIT_T snps_iit, Univ_IIT_T chromosome_iit, Genome_T genome, Genomecomp_T *snp_blocks,
-		 Oligospace_T oligospace, int index1part) {
-  Positionsptr_T *offsets;
-
+/* Processes the snps of one division, adding the oligomers that they
+   create to snplist and revising snp_blocks */
+static void
+process_division (Snplist_T snplist, int divno, IIT_T snps_iit, Univ_IIT_T chromosome_iit,
+		  Genome_T genome, Genomecomp_T *snp_blocks, int index1part, bool coord_values_8p) {
   Labeled_interval_T *intervals;
   int origindex;
   Interval_T interval, copy;
-  int nintervals, nintervals_alias, nerrors, divno, i, j;
-  Oligospace_T oligoi;
+  int nintervals, nintervals_alias, nerrors = 0, i, j;
   char *divstring;
   Chrnum_T chrnum;
   Univcoord_T chroffset;
   Chrpos_T chrlength;
-  int nwarnings = 0;
+  bool circularp = false;
+  double seconds;
 
-  offsets = (Positionsptr_T *) CALLOC(oligospace+1,sizeof(Positionsptr_T));
+  divstring = IIT_divstring(snps_iit,divno);
+  nintervals = IIT_nintervals(snps_iit,divno);
+  if ((chrnum = Univ_IIT_find_one(chromosome_iit,divstring)) > 0) {
+    chroffset = Univ_IIT_interval_low(chromosome_iit,chrnum);
+    chrlength = Univ_IIT_interval_length(chromosome_iit,chrnum);
 
-  for (divno = 1; divno < snps_iit->ndivs; divno++) {
-    divstring = IIT_divstring(snps_iit,divno);
-    fprintf(stderr,"Processing offsets for chromosome %s...",divstring);
-    if ((chrnum = Univ_IIT_find_one(chromosome_iit,divstring)) <= 0) {
-      fprintf(stderr,"not found in chromosome iit\n");
-    } else {
-      nerrors = 0;
-      fprintf(stderr,"has %d snps...",IIT_nintervals(snps_iit,divno));
-      chroffset = Univ_IIT_interval_low(chromosome_iit,chrnum);
-      chrlength = Univ_IIT_interval_length(chromosome_iit,chrnum);
-      nintervals = IIT_nintervals(snps_iit,divno);
-
-      if (Univ_IIT_interval_type(chromosome_iit,chrnum) == circular_typeint) {
-	fprintf(stderr,"and is circular...");
-	nintervals_alias = 2*nintervals;
-	intervals = (Labeled_interval_T *) CALLOC(nintervals_alias,sizeof(Labeled_interval_T));
-	for (i = 0; i < nintervals; i++) {
-	  origindex = IIT_index(snps_iit,divno,i);
-	  intervals[i] = Labeled_interval_new(origindex,/*interval*/&(snps_iit->intervals[divno][i]));
-	}
-	for (j = 0; i < nintervals_alias; i++, j++) {
-	  origindex = IIT_index(snps_iit,divno,j);
-	  interval = intervals[j]->interval;
-	  copy = Interval_new(/*low*/Interval_low(interval) + chrlength,
-			      /*high*/Interval_high(interval) + chrlength,
-			      Interval_type(interval));
-	  intervals[i] = Labeled_interval_new(origindex,/*interval*/copy);
-	}
+    if (Univ_IIT_interval_type(chromosome_iit,chrnum) == circular_typeint) {
+      circularp = true;
+      nintervals_alias = 2*nintervals;
+      intervals = (Labeled_interval_T *) CALLOC(nintervals_alias,sizeof(Labeled_interval_T));
+      for (i = 0; i < nintervals; i++) {
+	origindex = IIT_index(snps_iit,divno,i);
+	intervals[i] = Labeled_interval_new(origindex,/*interval*/&(snps_iit->intervals[divno][i]));
+      }
+      for (j = 0; i < nintervals_alias; i++, j++) {
+	origindex = IIT_index(snps_iit,divno,j);
+	interval = intervals[j]->interval;
+	copy = Interval_new(/*low*/Interval_low(interval) + chrlength,
+			    /*high*/Interval_high(interval) + chrlength,
+			    Interval_type(interval));
+	intervals[i] = Labeled_interval_new(origindex,/*interval*/copy);
+      }
 
-      } else {
-	nintervals_alias = nintervals;
-	intervals = (Labeled_interval_T *) CALLOC(nintervals,sizeof(Labeled_interval_T));
-	for (i = 0; i < nintervals; i++) {
-	  origindex = IIT_index(snps_iit,divno,i);
-	  intervals[i] = Labeled_interval_new(origindex,/*interval*/&(snps_iit->intervals[divno][i]));
-	}
+    } else {
+      nintervals_alias = nintervals;
+      intervals = (Labeled_interval_T *) CALLOC(nintervals,sizeof(Labeled_interval_T));
+      for (i = 0; i < nintervals; i++) {
+	origindex = IIT_index(snps_iit,divno,i);
+	intervals[i] = Labeled_interval_new(origindex,/*interval*/&(snps_iit->intervals[divno][i]));
       }
+    }
 
-      qsort(intervals,nintervals,sizeof(Labeled_interval_T),Labeled_interval_cmp);
+    qsort(intervals,nintervals,sizeof(Labeled_interval_T),Labeled_interval_cmp);
 
-      i = 0;
-      while (i < nintervals_alias) {
-	j = i + 1;
-	while (j < nintervals_alias && Interval_low(intervals[j]->interval) < Interval_low(intervals[j-1]->interval) + index1part) {
-	  j++;
-	}
-	nerrors += process_snp_block(&nwarnings,offsets,/*positions4*/NULL,/*positions8*/NULL,
-				     &(intervals[i]),/*nintervals*/j-i,
-				     chroffset,genome,snp_blocks,
-				     divno,divstring,/*intervali*/i,snps_iit,chromosome_iit,index1part,
-				     /*coord_values_8p (irrelevant)*/false);
-	i = j;
+    i = 0;
+    while (i < nintervals_alias) {
+      j = i + 1;
+      while (j < nintervals_alias && Interval_low(intervals[j]->interval) < Interval_low(intervals[j-1]->interval) + index1part) {
+	j++;
       }
+      nerrors += process_snp_block(snplist,&(intervals[i]),/*nintervals*/j-i,
+				   chroffset,genome,snp_blocks,
+				   divno,divstring,/*intervali*/i,snps_iit,chromosome_iit,index1part,
+				   coord_values_8p);
+      i = j;
+    }
 
-      for (i = nintervals; i < nintervals_alias; i++) {
-	Labeled_interval_free(&(intervals[i]),/*free_interval_p*/true);
-      }
-      for (i = 0; i < nintervals; i++) {
-	Labeled_interval_free(&(intervals[i]),/*free_interval_p*/false);
-      }
+    for (i = nintervals; i < nintervals_alias; i++) {
+      Labeled_interval_free(&(intervals[i]),/*free_interval_p*/true);
+    }
+    for (i = 0; i < nintervals; i++) {
+      Labeled_interval_free(&(intervals[i]),/*free_interval_p*/false);
+    }
+
+    FREE(intervals);
+  }
+
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock(&snp_lock);
+#endif
+  ndivs_done += 1;
+  if (warning_line_p == true) {
+    fprintf(stderr,"\n");
+    warning_line_p = false;
+  }
+  if (chrnum <= 0) {
+    fprintf(stderr,"Chromosome %s not found in chromosome iit",divstring);
+  } else {
+    nsnps_done += nintervals;
+    fprintf(stderr,"Processed chromosome %s, which has %d snps%s (%d snps inconsistent with reference genome)",
+	    divstring,nintervals,circularp == true ? " and is circular" : "",nerrors);
+  }
+  if ((seconds = Stopwatch_stop(stopwatch)) > 0.0) {
+    fprintf(stderr,".  %d of %d chromosomes done, %.0f snps/sec\n",
+	    ndivs_done,snps_iit->ndivs - 1,(double) nsnps_done/seconds);
+  } else {
+    fprintf(stderr,".  %d of %d chromosomes done\n",ndivs_done,snps_iit->ndivs - 1);
+  }
+#ifdef HAVE_PTHREAD
+  pthread_mutex_unlock(&snp_lock);
+#endif
+
+  return;
+}
+
+
+struct Divscan_T {
+  Snplist_T snplist;
+  IIT_T snps_iit;
+  Univ_IIT_T chromosome_iit;
+  Genome_T genome;
+  Genomecomp_T *snp_blocks;
+  int index1part;
+  bool coord_values_8p;
+};
+
+/* Takes divisions in turn until none are left */
+static void *
+scan_divisions (void *data) {
+  struct Divscan_T *divscan = (struct Divscan_T *) data;
+  int divno;
+
+  while (1) {
+#ifdef HAVE_PTHREAD
+    pthread_mutex_lock(&snp_lock);
+#endif
+    divno = next_divno++;
+#ifdef HAVE_PTHREAD
+    pthread_mutex_unlock(&snp_lock);
+#endif
+
+    if (divno >= divscan->snps_iit->ndivs) {
+      return (void *) NULL;
+    } else {
+      process_division(divscan->snplist,divno,divscan->snps_iit,divscan->chromosome_iit,
+		       divscan->genome,divscan->snp_blocks,divscan->index1part,
+		       divscan->coord_values_8p);
+    }
+  }
+}
+
+
+/* Processes the divisions of snps_iit on nthreads threads, revising
+   snp_blocks, and returns one list of oligomers and positions per
+   thread */
+static struct Snplist_T *
+find_snp_oligomers (IIT_T snps_iit, Univ_IIT_T chromosome_iit, Genome_T genome, Genomecomp_T *snp_blocks,
+		    int index1part, bool coord_values_8p, int nthreads) {
+  struct Snplist_T *snplists;
+  struct Divscan_T *divscans;
+  int t;
+#ifdef HAVE_PTHREAD
+  pthread_t *threads;
+#endif
+
+  snplists = (struct Snplist_T *) CALLOC(nthreads,sizeof(struct Snplist_T));
+  divscans = (struct Divscan_T *) CALLOC(nthreads,sizeof(struct Divscan_T));
+  for (t = 0; t < nthreads; t++) {
+    divscans[t].snplist = &(snplists[t]);
+    divscans[t].snps_iit = snps_iit;
+    divscans[t].chromosome_iit = chromosome_iit;
+    divscans[t].genome = genome;
+    divscans[t].snp_blocks = snp_blocks;
+    divscans[t].index1part = index1part;
+    divscans[t].coord_values_8p = coord_values_8p;
+  }
+
+  next_divno = 1;
+  ndivs_done = 0;
+  nsnps_done = 0;
+  Stopwatch_start(stopwatch);
+
+#ifdef HAVE_PTHREAD
+  pthread_mutex_init(&snp_lock,NULL);
+  threads = (pthread_t *) CALLOC(nthreads,sizeof(pthread_t));
+  for (t = 0; t < nthreads; t++) {
+    pthread_create(&(threads[t]),NULL,scan_divisions,(void *) &(divscans[t]));
+  }
+  for (t = 0; t < nthreads; t++) {
+    pthread_join(threads[t],NULL);
+  }
+  FREE(threads);
+  pthread_mutex_destroy(&snp_lock);
+#else
+  for (t = 0; t < nthreads; t++) {
+    scan_divisions((void *) &(divscans[t]));
+  }
+#endif
+
+  FREE(divscans);
+  return snplists;
+}
 
-      FREE(intervals);
-      fprintf(stderr,"done (%d snps inconsistent with reference genome)\n",nerrors);
+
+static Positionsptr_T *
+compute_offsets (struct Snplist_T *snplists, int nlists, Oligospace_T oligospace) {
+  Positionsptr_T *offsets;
+  Storedoligomer_T *oligos;
+  Oligospace_T oligoi;
+  Positionsptr_T i;
+  int t;
+
+  offsets = (Positionsptr_T *) CALLOC(oligospace+1,sizeof(Positionsptr_T));
+
+  for (t = 0; t < nlists; t++) {
+    oligos = snplists[t].oligos;
+    for (i = 0; i < snplists[t].n; i++) {
+      offsets[oligos[i] + 1U] += 1;
     }
   }
 
@@ -700,23 +924,19 @@ compute_offsets (IIT_T snps_iit, Univ_IIT_T chromosome_iit, Genome_T genome, Gen
 }
 
 
+/* Gathers the positions in snplists by oligomer, freeing each list as
+   it goes.  The positions of each oligomer are sorted later, when
+   they are merged with the reference positions. */
 static void *
-compute_positions (Positionsptr_T *offsets, IIT_T snps_iit, Univ_IIT_T chromosome_iit,
-		   Genome_T genome, Oligospace_T oligospace, bool coord_values_8p) {
+compute_positions (Positionsptr_T *offsets, struct Snplist_T *snplists, int nlists,
+		   IIT_T snps_iit, Univ_IIT_T chromosome_iit, Oligospace_T oligospace, bool coord_values_8p) {
   UINT4 *positions4 = NULL;
   UINT8 *positions8 = NULL;
 
-  Labeled_interval_T *intervals;
-  int origindex;
-  Interval_T interval, copy;
-  int nintervals, nintervals_alias, divno, i, j;
+  Storedoligomer_T *oligos;
   Oligospace_T oligoi;
-  char *divstring;
-  Chrnum_T chrnum;
-  Univcoord_T chroffset;
-  Chrpos_T chrlength;
-  Positionsptr_T *pointers, totalcounts, block_start, block_end, npositions;
-  int nwarnings = 0;
+  Positionsptr_T *pointers, totalcounts, i;
+  int t;
 
   totalcounts = offsets[oligospace];
   if (totalcounts == 0) {
@@ -751,102 +971,42 @@ compute_positions (Positionsptr_T *offsets, IIT_T snps_iit, Univ_IIT_T chromosom
 
   /* Copy offsets */
   pointers = (Positionsptr_T *) CALLOC(oligospace+1,sizeof(Positionsptr_T));
-  for (i = 0; i <= oligospace; i++) {
-    pointers[i] = offsets[i];
+  for (oligoi = 0; oligoi <= oligospace; oligoi++) {
+    pointers[oligoi] = offsets[oligoi];
   }
 
-  for (divno = 1; divno < snps_iit->ndivs; divno++) {
-    divstring = IIT_divstring(snps_iit,divno);
-    fprintf(stderr,"Processing positions for chromosome %s...",divstring);
-    if ((chrnum = Univ_IIT_find_one(chromosome_iit,divstring)) <= 0) {
-      fprintf(stderr,"not found in chromosome iit\n");
-    } else {
-      fprintf(stderr,"has %d snps...",IIT_nintervals(snps_iit,divno));
-      chroffset = Univ_IIT_interval_low(chromosome_iit,chrnum);
-      chrlength = Univ_IIT_interval_length(chromosome_iit,chrnum);
-      nintervals = IIT_nintervals(snps_iit,divno);
-
-      if (Univ_IIT_interval_type(chromosome_iit,chrnum) == circular_typeint) {
-	fprintf(stderr,"and is circular...");
-	nintervals_alias = 2*nintervals;
-	intervals = (Labeled_interval_T *) CALLOC(nintervals_alias,sizeof(Labeled_interval_T));
-	for (i = 0; i < nintervals; i++) {
-	  origindex = IIT_index(snps_iit,divno,i);
-	  intervals[i] = Labeled_interval_new(origindex,/*interval*/&(snps_iit->intervals[divno][i]));
-	}
-	for (j = 0; i < nintervals_alias; i++, j++) {
-	  origindex = IIT_index(snps_iit,divno,j);
-	  interval = intervals[j]->interval;
-	  copy = Interval_new(/*low*/Interval_low(interval) + chrlength,
-			      /*high*/Interval_high(interval) + chrlength,
-			      Interval_type(interval));
-	  intervals[i] = Labeled_interval_new(origindex,/*interval*/copy);
-	}
-
-      } else {
-	nintervals_alias = nintervals;
-	intervals = (Labeled_interval_T *) CALLOC(nintervals,sizeof(Labeled_interval_T));
-	for (i = 0; i < nintervals; i++) {
-	  origindex = IIT_index(snps_iit,divno,i);
-	  intervals[i] = Labeled_interval_new(origindex,/*interval*/&(snps_iit->intervals[divno][i]));
-	}
+  for (t = 0; t < nlists; t++) {
+    oligos = snplists[t].oligos;
+    if (coord_values_8p == true) {
+      for (i = 0; i < snplists[t].n; i++) {
+	positions8[pointers[oligos[i]]++] = snplists[t].positions8[i];
       }
-
-      qsort(intervals,nintervals,sizeof(Labeled_interval_T),Labeled_interval_cmp);
-
-      i = 0;
-      while (i < nintervals_alias) {
-	j = i + 1;
-	while (j < nintervals_alias && Interval_low(intervals[j]->interval) < Interval_low(intervals[j-1]->interval) + index1part) {
-	  j++;
-	}
-	process_snp_block(&nwarnings,/*offsets*/pointers,positions4,positions8,
-			  &(intervals[i]),/*nintervals*/j-i,
-			  chroffset,genome,/*snp_blocks*/NULL,
-			  divno,divstring,/*intervali*/i,snps_iit,chromosome_iit,index1part,
-			  coord_values_8p);
-	i = j;
-      }
-
-      for (i = nintervals; i < nintervals_alias; i++) {
-	Labeled_interval_free(&(intervals[i]),/*free_interval_p*/true);
-      }
-      for (i = 0; i < nintervals; i++) {
-	Labeled_interval_free(&(intervals[i]),/*free_interval_p*/false);
+    } else {
+      for (i = 0; i < snplists[t].n; i++) {
+	positions4[pointers[oligos[i]]++] = snplists[t].positions4[i];
       }
-
-      FREE(intervals);
-      fprintf(stderr,"done\n");
     }
+    Snplist_free_contents(&(snplists[t]));
   }
 
   FREE(pointers);
 
-  /* Sort positions in each block */
   if (coord_values_8p == true) {
-    for (oligoi = 0; oligoi < oligospace; oligoi++) {
-      block_start = offsets[oligoi];
-      block_end = offsets[oligoi+1];
-      if ((npositions = block_end - block_start) > 1) {
-	qsort(&(positions8[block_start]),npositions,sizeof(UINT8),UINT8_compare);
-      }
-    }
     return positions8;
   } else {
-    for (oligoi = 0; oligoi < oligospace; oligoi++) {
-      block_start = offsets[oligoi];
-      block_end = offsets[oligoi+1];
-      if ((npositions = block_end - block_start) > 1) {
-	qsort(&(positions4[block_start]),npositions,sizeof(UINT4),UINT4_compare);
-      }
-    }
     return positions4;
   }
 }
 
 
-static void
-merge_positions8 (FILE *positions_fp, UINT8 *start1, UINT8 *end1,
+#ifdef WORDS_BIGENDIAN
+#define REF_OFFSET(offsets,oligo) Bigendian_convert_uint(offsets[oligo])
+#else
+#define REF_OFFSET(offsets,oligo) offsets[oligo]
+#endif
+
+static UINT8 *
+merge_positions8 (UINT8 *dest, UINT8 *start1, UINT8 *end1,
 		  UINT8 *start2, UINT8 *end2, Storedoligomer_T oligo, int index1part) {
   UINT8 *ptr1 = start1, *ptr2 = start2;
   char *nt;
@@ -858,68 +1018,53 @@ merge_positions8 (FILE *positions_fp, UINT8 *start1, UINT8 *end1,
 #ifdef WORDS_BIGENDIAN
     position2 = Bigendian_convert_uint8(*ptr2);
     if (*ptr1 < position2) {
-      FWRITE_UINT8(*ptr1,positions_fp);
-      ptr1++;
+      *dest++ = *ptr1++;
     } else if (position2 < *ptr1) {
-      FWRITE_UINT8(position2,positions_fp);
+      *dest++ = position2;
       ptr2++;
     } else {
       nt = shortoligo_nt(oligo,index1part);
       fprintf(stderr,"Problem: saw duplicate positions %u in oligo %s\n",*ptr1,nt);
       FREE(nt);
       abort();
-      /*
-      FWRITE_UINT8(*ptr1,positions_fp);
-      ptr1++;
-      ptr2++;
-      */
     }
 
 #else
 
     if (*ptr1 < *ptr2) {
-      FWRITE_UINT8(*ptr1,positions_fp);
-      ptr1++;
+      *dest++ = *ptr1++;
     } else if (*ptr2 < *ptr1) {
-      FWRITE_UINT8(*ptr2,positions_fp);
-      ptr2++;
+      *dest++ = *ptr2++;
     } else {
       nt = shortoligo_nt(oligo,index1part);
       fprintf(stderr,"Problem: saw duplicate positions %lu in oligo %s\n",*ptr1,nt);
       FREE(nt);
       abort();
-      /*
-      FWRITE_UINT8(*ptr1,positions_fp);
-      ptr1++;
-      ptr2++;
-      */
     }
 #endif
   }
 
   while (ptr1 < end1) {
-    FWRITE_UINT8(*ptr1,positions_fp);
-    ptr1++;
+    *dest++ = *ptr1++;
   }
 
 #ifdef WORDS_BIGENDIAN
   while (ptr2 < end2) {
-    FWRITE_UINT8(Bigendian_convert_uint8(*ptr2),positions_fp);
+    *dest++ = Bigendian_convert_uint8(*ptr2);
     ptr2++;
   }
 #else
   while (ptr2 < end2) {
-    FWRITE_UINT8(*ptr2,positions_fp);
-    ptr2++;
+    *dest++ = *ptr2++;
   }
 #endif
 
-  return;
+  return dest;
 }
 
 
-static void
-merge_positions4 (FILE *positions_fp, UINT4 *start1, UINT4 *end1,
+static UINT4 *
+merge_positions4 (UINT4 *dest, UINT4 *start1, UINT4 *end1,
 		  UINT4 *start2, UINT4 *end2, Storedoligomer_T oligo, int index1part) {
   UINT4 *ptr1 = start1, *ptr2 = start2;
   char *nt;
@@ -931,62 +1076,225 @@ merge_positions4 (FILE *positions_fp, UINT4 *start1, UINT4 *end1,
 #ifdef WORDS_BIGENDIAN
     position2 = Bigendian_convert_uint(*ptr2);
     if (*ptr1 < position2) {
-      FWRITE_UINT(*ptr1,positions_fp);
-      ptr1++;
+      *dest++ = *ptr1++;
     } else if (position2 < *ptr1) {
-      FWRITE_UINT(position2,positions_fp);
+      *dest++ = position2;
       ptr2++;
     } else {
       nt = shortoligo_nt(oligo,index1part);
       fprintf(stderr,"Problem: saw duplicate positions %u in oligo %s\n",*ptr1,nt);
       FREE(nt);
       abort();
-      /*
-      FWRITE_UINT(*ptr1,positions_fp);
-      ptr1++;
-      ptr2++;
-      */
     }
 
 #else
 
     if (*ptr1 < *ptr2) {
-      FWRITE_UINT(*ptr1,positions_fp);
-      ptr1++;
+      *dest++ = *ptr1++;
     } else if (*ptr2 < *ptr1) {
-      FWRITE_UINT(*ptr2,positions_fp);
-      ptr2++;
+      *dest++ = *ptr2++;
     } else {
       nt = shortoligo_nt(oligo,index1part);
       fprintf(stderr,"Problem: saw duplicate positions %u in oligo %s\n",*ptr1,nt);
       FREE(nt);
       abort();
-      /*
-      FWRITE_UINT(*ptr1,positions_fp);
-      ptr1++;
-      ptr2++;
-      */
     }
 #endif
   }
 
   while (ptr1 < end1) {
-    FWRITE_UINT(*ptr1,positions_fp);
-    ptr1++;
+    *dest++ = *ptr1++;
   }
 
 #ifdef WORDS_BIGENDIAN
   while (ptr2 < end2) {
-    FWRITE_UINT(Bigendian_convert_uint(*ptr2),positions_fp);
+    *dest++ = Bigendian_convert_uint(*ptr2);
     ptr2++;
   }
 #else
   while (ptr2 < end2) {
-    FWRITE_UINT(*ptr2,positions_fp);
-    ptr2++;
+    *dest++ = *ptr2++;
   }
 #endif
 
+  return dest;
+}
+
+
+#define MERGE_CHUNK 4194304	/* Positions merged by one thread at a time */
+
+struct Merge_T {
+  Oligospace_T oligo_start;
+  Oligospace_T oligo_end;
+
+  Positionsptr_T *snp_offsets;
+  UINT4 *snp_positions4;
+  UINT8 *snp_positions8;
+  Positionsptr_T *ref_offsets;
+  UINT4 *ref_positions4;
+  UINT8 *ref_positions8;
+  int index1part;
+  bool coord_values_8p;
+
+  UINT4 *merged4;
+  UINT8 *merged8;
+  Positionsptr_T nmerged;
+};
+
+/* Sorts the snp positions of each oligomer in the range, and merges
+   them with the reference positions into a buffer of host-order
+   values */
+static void *
+merge_range (void *data) {
+  struct Merge_T *merge = (struct Merge_T *) data;
+  Positionsptr_T *snp_offsets = merge->snp_offsets, *ref_offsets = merge->ref_offsets;
+  Positionsptr_T block_start, block_end;
+  Oligospace_T oligoi;
+  UINT4 *dest4;
+  UINT8 *dest8;
+
+  merge->nmerged = (REF_OFFSET(ref_offsets,merge->oligo_end) - REF_OFFSET(ref_offsets,merge->oligo_start)) +
+    (snp_offsets[merge->oligo_end] - snp_offsets[merge->oligo_start]);
+  merge->merged4 = (UINT4 *) NULL;
+  merge->merged8 = (UINT8 *) NULL;
+  if (merge->nmerged == 0) {
+    return (void *) NULL;
+  }
+
+  if (merge->coord_values_8p == true) {
+    dest8 = merge->merged8 = (UINT8 *) MALLOC(merge->nmerged*sizeof(UINT8));
+    for (oligoi = merge->oligo_start; oligoi < merge->oligo_end; oligoi++) {
+      block_start = snp_offsets[oligoi];
+      block_end = snp_offsets[oligoi+1];
+      if (block_end - block_start > 1) {
+	qsort(&(merge->snp_positions8[block_start]),block_end - block_start,sizeof(UINT8),UINT8_compare);
+      }
+      dest8 = merge_positions8(dest8,&(merge->snp_positions8[block_start]),&(merge->snp_positions8[block_end]),
+			       &(merge->ref_positions8[REF_OFFSET(ref_offsets,oligoi)]),
+			       &(merge->ref_positions8[REF_OFFSET(ref_offsets,oligoi+1)]),
+			       oligoi,merge->index1part);
+    }
+
+  } else {
+    dest4 = merge->merged4 = (UINT4 *) MALLOC(merge->nmerged*sizeof(UINT4));
+    for (oligoi = merge->oligo_start; oligoi < merge->oligo_end; oligoi++) {
+      block_start = snp_offsets[oligoi];
+      block_end = snp_offsets[oligoi+1];
+      if (block_end - block_start > 1) {
+	qsort(&(merge->snp_positions4[block_start]),block_end - block_start,sizeof(UINT4),UINT4_compare);
+      }
+      dest4 = merge_positions4(dest4,&(merge->snp_positions4[block_start]),&(merge->snp_positions4[block_end]),
+			       &(merge->ref_positions4[REF_OFFSET(ref_offsets,oligoi)]),
+			       &(merge->ref_positions4[REF_OFFSET(ref_offsets,oligoi+1)]),
+			       oligoi,merge->index1part);
+    }
+  }
+
+  return (void *) NULL;
+}
+
+
+/* Merges the snp positions with the reference positions on nthreads
+   threads.  The oligomers are split into ranges of about MERGE_CHUNK
+   positions, and each round merges nthreads consecutive ranges and
+   then writes them in order. */
+static void
+write_merged_positions (FILE *positions_fp, Positionsptr_T *snp_offsets, UINT4 *snp_positions4, UINT8 *snp_positions8,
+			Positionsptr_T *ref_offsets, UINT4 *ref_positions4, UINT8 *ref_positions8,
+			Oligospace_T oligospace, int index1part, bool coord_values_8p, int nthreads) {
+  struct Merge_T *merges;
+  Oligospace_T oligoi = 0, lowi, highi, middlei;
+  Positionsptr_T base, totalcounts, nwritten = 0, next_report;
+  int nmerges, t;
+  double seconds;
+#ifdef HAVE_PTHREAD
+  pthread_t *threads;
+#endif
+
+  totalcounts = REF_OFFSET(ref_offsets,oligospace) + snp_offsets[oligospace];
+  next_report = totalcounts/10;
+
+  merges = (struct Merge_T *) CALLOC(nthreads,sizeof(struct Merge_T));
+  for (t = 0; t < nthreads; t++) {
+    merges[t].snp_offsets = snp_offsets;
+    merges[t].snp_positions4 = snp_positions4;
+    merges[t].snp_positions8 = snp_positions8;
+    merges[t].ref_offsets = ref_offsets;
+    merges[t].ref_positions4 = ref_positions4;
+    merges[t].ref_positions8 = ref_positions8;
+    merges[t].index1part = index1part;
+    merges[t].coord_values_8p = coord_values_8p;
+  }
+#ifdef HAVE_PTHREAD
+  threads = (pthread_t *) CALLOC(nthreads,sizeof(pthread_t));
+#endif
+
+  Stopwatch_start(stopwatch);
+  while (oligoi < oligospace) {
+    for (nmerges = 0; nmerges < nthreads && oligoi < oligospace; nmerges++) {
+      /* Find the last oligo that keeps the range within MERGE_CHUNK
+	 positions, taking at least one oligo */
+      base = REF_OFFSET(ref_offsets,oligoi) + snp_offsets[oligoi];
+      lowi = oligoi + 1;
+      highi = oligospace;
+      while (lowi < highi) {
+	middlei = lowi + (highi - lowi + 1)/2;
+	if (REF_OFFSET(ref_offsets,middlei) + snp_offsets[middlei] - base <= MERGE_CHUNK) {
+	  lowi = middlei;
+	} else {
+	  highi = middlei - 1;
+	}
+      }
+      merges[nmerges].oligo_start = oligoi;
+      merges[nmerges].oligo_end = oligoi = lowi;
+    }
+
+#ifdef HAVE_PTHREAD
+    for (t = 0; t < nmerges; t++) {
+      pthread_create(&(threads[t]),NULL,merge_range,(void *) &(merges[t]));
+    }
+    for (t = 0; t < nmerges; t++) {
+      pthread_join(threads[t],NULL);
+    }
+#else
+    for (t = 0; t < nmerges; t++) {
+      merge_range((void *) &(merges[t]));
+    }
+#endif
+
+    for (t = 0; t < nmerges; t++) {
+      if (merges[t].merged8 != NULL) {
+	FWRITE_UINT8S(merges[t].merged8,merges[t].nmerged,positions_fp);
+	FREE(merges[t].merged8);
+      } else if (merges[t].merged4 != NULL) {
+	FWRITE_UINTS(merges[t].merged4,merges[t].nmerged,positions_fp);
+	FREE(merges[t].merged4);
+      }
+      nwritten += merges[t].nmerged;
+    }
+
+    if (nwritten >= next_report && oligoi < oligospace) {
+      if ((seconds = Stopwatch_stop(stopwatch)) > 0.0) {
+	fprintf(stderr,"Merged %u of %u positions, %.0f positions/sec\n",
+		nwritten,totalcounts,(double) nwritten/seconds);
+      } else {
+	fprintf(stderr,"Merged %u of %u positions\n",nwritten,totalcounts);
+      }
+      next_report = nwritten + totalcounts/10;
+    }
+  }
+
+  if ((seconds = Stopwatch_stop(stopwatch)) > 0.0) {
+    fprintf(stderr,"Merged %u positions in %.1f seconds, %.0f positions/sec\n",
+	    nwritten,seconds,(double) nwritten/seconds);
+  } else {
+    fprintf(stderr,"Merged %u positions\n",nwritten);
+  }
+
+#ifdef HAVE_PTHREAD
+  FREE(threads);
+#endif
+  FREE(merges);
   return;
 }
 
@@ -1001,12 +1309,13 @@ main (int argc, char *argv[]) {
   Univ_IIT_T chromosome_iit;
   IIT_T snps_iit;
   Genome_T genome;
+  struct Snplist_T *snplists;
   Positionsptr_T *offsets, *snp_offsets, *ref_offsets;
 #ifdef EXTRA_ALLOCATION
   Positionsptr_T npositions;
 #endif
-  UINT8 *snp_positions8, *ref_positions8;
-  UINT4 *snp_positions4, *ref_positions4;
+  UINT8 *snp_positions8 = NULL, *ref_positions8 = NULL;
+  UINT4 *snp_positions4 = NULL, *ref_positions4 = NULL;
   Univcoord_T nblocks;
   Genomecomp_T *snp_blocks;
   Oligospace_T oligospace, oligoi;
@@ -1022,9 +1331,6 @@ main (int argc, char *argv[]) {
   FILE *genome_fp, *positions_fp, *ref_positions_fp;
   int ref_positions_fd;
   size_t ref_positions_len;
-#ifdef WORDS_BIGENDIAN
-  Positionsptr_T offset1, offset2;
-#endif
 
   int opt;
   extern int optind;
@@ -1032,7 +1338,7 @@ main (int argc, char *argv[]) {
   int long_option_index = 0;
   const char *long_name;
 
-  while ((opt = getopt_long(argc,argv,"D:d:b:k:q:V:v:w:",
+  while ((opt = getopt_long(argc,argv,"D:d:b:k:q:V:v:w:t:",
 			    long_options,&long_option_index)) != -1) {
     switch (opt) {
     case 0: 
@@ -1058,11 +1364,16 @@ main (int argc, char *argv[]) {
     case 'V': user_destdir = optarg; break;
     case 'v': snps_root = optarg; break;
     case 'w': max_warnings = atoi(optarg); break;
+    case 't': nthreads = atoi(optarg); break;
     }
   }
   argc -= (optind - 1);
   argv += (optind - 1);
 
+  if (nthreads < 1) {
+    nthreads = 1;
+  }
+
   if (dbroot == NULL) {
     fprintf(stderr,"Missing name of genome database.  Must specify with -d flag.\n");
     print_program_usage();
@@ -1163,9 +1474,11 @@ main (int argc, char *argv[]) {
 			sourcedir,fileroot,IDX_FILESUFFIX,/*snps_root*/NULL,
 			required_basesize,required_index1part,required_interval);
 
-  /* Compute offsets and write genome */
+  /* Find snp oligomers, compute offsets, and write genome */
   oligospace = power(4,index1part);
-  snp_offsets = compute_offsets(snps_iit,chromosome_iit,genome,snp_blocks,oligospace,index1part);
+  stopwatch = Stopwatch_new();
+  snplists = find_snp_oligomers(snps_iit,chromosome_iit,genome,snp_blocks,index1part,coord_values_8p,nthreads);
+  snp_offsets = compute_offsets(snplists,nthreads,oligospace);
   fprintf(stderr,"last offset = %u\n",snp_offsets[oligospace]);
   filename = (char *) CALLOC(strlen(destdir)+strlen("/")+strlen(fileroot)+
 			     strlen(".genomecomp.")+strlen(snps_root)+1,sizeof(char));
@@ -1183,12 +1496,14 @@ main (int argc, char *argv[]) {
 
 
   /* Compute positions */
-  show_warnings_p = false;	/* Already shown in compute_offsets */
   if (coord_values_8p == true) {
-    snp_positions8 = compute_positions(snp_offsets,snps_iit,chromosome_iit,genome,oligospace,/*coord_values_8p*/true);
+    snp_positions8 = compute_positions(snp_offsets,snplists,nthreads,snps_iit,chromosome_iit,oligospace,
+				       /*coord_values_8p*/true);
   } else {
-    snp_positions4 = compute_positions(snp_offsets,snps_iit,chromosome_iit,genome,oligospace,/*coord_values_8p*/false);
+    snp_positions4 = compute_positions(snp_offsets,snplists,nthreads,snps_iit,chromosome_iit,oligospace,
+				       /*coord_values_8p*/false);
   }
+  FREE(snplists);
 
 
   /* Read reference offsets and update */
@@ -1292,32 +1607,10 @@ main (int argc, char *argv[]) {
   ref_offsets = Indexdb_offsets_from_gammas(gammaptrs_filename,offsetscomp_filename,offsetscomp_basesize,index1part);
 #endif
 
-  if (coord_values_8p == true) {
-    for (oligoi = 0; oligoi < oligospace; oligoi++) {
-#ifdef WORDS_BIGENDIAN
-      offset1 = Bigendian_convert_uint(ref_offsets[oligoi]);
-      offset2 = Bigendian_convert_uint(ref_offsets[oligoi+1]);
-      merge_positions8(positions_fp,&(snp_positions8[snp_offsets[oligoi]]),&(snp_positions8[snp_offsets[oligoi+1]]),
-		       &(ref_positions8[offset1]),&(ref_positions8[offset2]),oligoi,index1part);
-#else
-      merge_positions8(positions_fp,&(snp_positions8[snp_offsets[oligoi]]),&(snp_positions8[snp_offsets[oligoi+1]]),
-		       &(ref_positions8[ref_offsets[oligoi]]),&(ref_positions8[ref_offsets[oligoi+1]]),oligoi,index1part);
-#endif
-    }
-  } else {
-    for (oligoi = 0; oligoi < oligospace; oligoi++) {
-#ifdef WORDS_BIGENDIAN
-      offset1 = Bigendian_convert_uint(ref_offsets[oligoi]);
-      offset2 = Bigendian_convert_uint(ref_offsets[oligoi+1]);
-      merge_positions4(positions_fp,&(snp_positions4[snp_offsets[oligoi]]),&(snp_positions4[snp_offsets[oligoi+1]]),
-		       &(ref_positions4[offset1]),&(ref_positions4[offset2]),oligoi,index1part);
-#else
-      merge_positions4(positions_fp,&(snp_positions4[snp_offsets[oligoi]]),&(snp_positions4[snp_offsets[oligoi+1]]),
-		       &(ref_positions4[ref_offsets[oligoi]]),&(ref_positions4[ref_offsets[oligoi+1]]),oligoi,index1part);
-#endif
-    }
-  }
-
+  write_merged_positions(positions_fp,snp_offsets,snp_positions4,snp_positions8,
+			 ref_offsets,ref_positions4,ref_positions8,oligospace,index1part,
+			 coord_values_8p,nthreads);
+  Stopwatch_free(&stopwatch);
 
   FREE(ref_offsets);
   fclose(positions_fp);
@@ -1440,6 +1733,8 @@ for <genome>.\n\
                                    inconsistencies relative to the reference genome.\n\
                                    A value of 0 turns off all warnings.  A negative value\n\
                                    prints all warnings.  (default -1, meaning no limit)\n\
+  -t, --nthreads=INT             Number of threads for processing chromosomes and for\n\
+                                   merging with the reference positions (default 1)\n\
 \n\
   --version                      Show version\n\
   --help                         Show this help message\n\
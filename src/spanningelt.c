@@ -8,11 +8,18 @@ static char rcsid[] = "$Id: spanningelt.c 99756 2013-06-27 21:20:19Z twu $";
 #include <math.h>		/* For qsort */
 #include "mem.h"
 #include "indexdbdef.h"
+#include "intersect.h"
 
 #ifdef WORDS_BIGENDIAN
 #include "bigendian.h"
 #endif
 
+/* With 8-byte positions, compute_intersection is faster than
+   Intersect_diagonals on long lists of very different sizes */
+#if !defined(WORDS_BIGENDIAN) && !defined(LARGE_GENOMES)
+#define USE_INTERSECT 1
+#endif
+
 #define T Spanningelt_T
 
 #ifdef DEBUG
@@ -500,7 +507,7 @@ binary_search (int lowi, int highi, Univcoord_T *positions, Univcoord_T goal) {
     return highi;
   }
 }
-#else
+#elif !defined(USE_INTERSECT)
 static int
 binary_search (int lowi, int highi, Univcoord_T *positions, Univcoord_T goal) {
   bool foundp = false;
@@ -533,7 +540,9 @@ binary_search (int lowi, int highi, Univcoord_T *positions, Univcoord_T goal) {
 #endif
 
 
-/* This procedure needs to eliminate duplicates, which can happen with a SNP-tolerant indexdb */
+/* This procedure needs to eliminate duplicates, which can happen with
+   a SNP-tolerant indexdb.  Used where Intersect_diagonals is not. */
+#ifndef USE_INTERSECT
 static Univcoord_T *
 compute_intersection (int *ndiagonals, Univcoord_T *positionsa, int diagterma, int npositionsa, 
 		      Univcoord_T *positionsb, int diagtermb, int npositionsb) {
@@ -641,6 +650,7 @@ compute_intersection (int *ndiagonals, Univcoord_T *positionsa, int diagterma, i
 
   return diagonals;
 }
+#endif
 
 
 /* This procedure needs to eliminate duplicates, which can happen with a SNP-tolerant indexdb */
@@ -650,12 +660,28 @@ compoundpos_intersect (int *ndiagonals, Univcoord_T *positions0, int diagterm0,
   Univcoord_T *diagonals, local_goal, last_local_goal;
   int delta;
   bool emptyp;
+#ifdef USE_INTERSECT
+  Univcoord_T *merged;
+  int nmerged;
+#endif
 
   delta = diagterm0 - diagterm1; /* list0 + (diagterm0 - diagterm1) = list1 */
 
   *ndiagonals = 0;
   if (npositions0 == 0) {
     return (Univcoord_T *) NULL;
+#ifdef USE_INTERSECT
+  } else if (Compoundpos_nentries(compoundpos) < INTERSECT_GALLOP_RATIO * npositions0) {
+    /* Comparable sizes, so cheaper to merge the batches once than to
+       search each of them for every goal */
+    merged = Compoundpos_merge(&nmerged,compoundpos);
+    diagonals = Intersect_diagonals(&(*ndiagonals),positions0,diagterm0,npositions0,
+				    merged,diagterm1,nmerged);
+    if (merged != NULL) {
+      FREE(merged);
+    }
+    return diagonals;
+#endif
   } else {
   /* Could add up compoundpos->npositions to see if we could allocate less memory */
     diagonals = (Univcoord_T *) CALLOC(npositions0,sizeof(Univcoord_T));
@@ -789,10 +815,17 @@ Spanningelt_diagonals (int *ndiagonals, T this, int *miss_querypos5, int *miss_q
     if (this->compoundpos == NULL) {
       debug(printf("Two positions.  Converting to diagonals\n"));
       /* Two positions */
+#ifndef USE_INTERSECT
       this->intersection_diagonals = 
 	compute_intersection(&this->intersection_ndiagonals,
 			     this->partner_positions,this->partner_diagterm,this->partner_npositions,
 			     this->positions,this->diagterm,this->npositions);
+#else
+      this->intersection_diagonals = 
+	Intersect_diagonals(&this->intersection_ndiagonals,
+			    this->partner_positions,this->partner_diagterm,this->partner_npositions,
+			    this->positions,this->diagterm,this->npositions);
+#endif
       *ndiagonals = this->candidates_score = this->pruning_score = this->intersection_ndiagonals;
 
       this->intersection_diagonals_reset = this->intersection_diagonals;
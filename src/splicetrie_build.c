@@ -1822,6 +1822,9 @@ Splicetrie_npartners (int **nsplicepartners_skip, int **nsplicepartners_obs, int
 void
 Splicetrie_build_via_splicesites (Triecontent_T **triecontents_obs, Trieoffset_T **trieoffsets_obs,
 				  Triecontent_T **triecontents_max, Trieoffset_T **trieoffsets_max,
+#ifdef GSNAP
+				  int *ntriecontents_obs, int *ntriecontents_max,
+#endif
 				  int *nsplicepartners_skip, int *nsplicepartners_obs, int *nsplicepartners_max,
 				  Splicetype_T *splicetypes, List_T *splicestrings, int nsplicesites) {
   Uintlist_T triecontents_obs_list = NULL, triecontents_max_list = NULL;
@@ -2103,6 +2106,7 @@ Splicetrie_build_via_splicesites (Triecontent_T **triecontents_obs, Trieoffset_T
     Uintlist_free(&triecontents_obs_list);
   } else {
     *triecontents_obs = (Triecontent_T *) NULL;
+    nprinted_obs = 0;
   }
 
   fprintf(stderr,"splicetrie_max has %d entries...",nprinted_max);
@@ -2110,6 +2114,11 @@ Splicetrie_build_via_splicesites (Triecontent_T **triecontents_obs, Trieoffset_T
   *triecontents_max = Uintlist_to_array(&nprinted_max,triecontents_max_list);
   Uintlist_free(&triecontents_max_list);
 
+#ifdef GSNAP
+  *ntriecontents_obs = nprinted_obs;
+  *ntriecontents_max = nprinted_max;
+#endif
+
   return;
 }
 
@@ -2480,6 +2489,9 @@ Splicetrie_build_one (Triecontent_T **triecontents_obs, Trieoffset_T **triestart
 
 void
 Splicetrie_build_via_introns (Triecontent_T **triecontents_obs, Trieoffset_T **trieoffsets_obs,
+#ifdef GSNAP
+			      int *ntriecontents_obs,
+#endif
 			      Univcoord_T *splicesites, Splicetype_T *splicetypes,
 			      List_T *splicestrings, int nsplicesites,
 			      Univ_IIT_T chromosome_iit, IIT_T splicing_iit, int *splicing_divint_crosstable) {
@@ -2694,6 +2706,10 @@ Splicetrie_build_via_introns (Triecontent_T **triecontents_obs, Trieoffset_T **t
   *triecontents_obs = Uintlist_to_array(&nprinted_obs,triecontents_obs_list);
   Uintlist_free(&triecontents_obs_list);
 
+#ifdef GSNAP
+  *ntriecontents_obs = nprinted_obs;
+#endif
+
   return;
 }
 
@@ -0,0 +1,379 @@
+static char rcsid[] = "$Id: splicetrie_cache.c $";
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "splicetrie_cache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>		/* For memcmp, memcpy */
+#include <errno.h>
+#ifdef HAVE_MMAP
+#include <sys/mman.h>		/* For munmap */
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>		/* For close */
+#endif
+
+#include "mem.h"
+#include "fopen.h"
+#include "access.h"
+#include "md5.h"
+
+
+#ifdef DEBUG
+#define debug(x) x
+#else
+#define debug(x)
+#endif
+
+
+#define CACHE_MAGIC "GSNAPSPT"
+#define CACHE_VERSION 1
+#define BYTEORDER_MARK 0x01020304U
+
+/* Files are digested in chunks, since MD5_compute takes an int
+   length.  The digest of a file is the MD5 of its chunk digests. */
+#define DIGEST_CHUNKSIZE 67108864 /* 2^26 */
+
+
+/* Written as is, in host byte order.  All fields are fixed-width, and
+   the size is a multiple of 8, so the arrays that follow stay
+   aligned. */
+struct Header_T {
+  char magic[8];
+  UINT4 version;
+  UINT4 byteorder;
+  UINT4 univcoord_size;
+  UINT4 splicetype_size;
+  UINT4 shortsplicedist;
+  UINT4 altp;
+  UINT4 distances_observed_p;
+  UINT4 nsplicesites;
+  UINT4 obsp;			/* Whether trieoffsets_obs is present */
+  UINT4 maxp;			/* Whether trieoffsets_max is present */
+  UINT4 ntriecontents_obs;
+  UINT4 ntriecontents_max;
+  UINT8 genomelength;
+  UINT8 nblocks;
+  unsigned char splicing_md5[16];
+  unsigned char chromosome_md5[16];
+};
+
+
+#define T Splicetrie_cache_T
+struct T {
+  Access_T access;
+  void *memory;
+  size_t len;
+  int fd;
+};
+
+
+void
+Splicetrie_cache_free (T *old) {
+  if (*old) {
+    if ((*old)->access == ALLOCATED) {
+      FREE((*old)->memory);
+#ifdef HAVE_MMAP
+    } else if ((*old)->access == MMAPPED) {
+      munmap((void *) (*old)->memory,(*old)->len);
+      close((*old)->fd);
+#endif
+    }
+    FREE(*old);
+  }
+  return;
+}
+
+
+/* Returns the file that IIT_read opens for filename, with add_iit_p
+   true */
+char *
+Splicetrie_cache_iitfile (char *filename) {
+  char *iitfile;
+
+  iitfile = (char *) CALLOC(strlen(filename)+strlen(".iit")+1,sizeof(char));
+  sprintf(iitfile,"%s.iit",filename);
+  if (Access_file_exists_p(iitfile) == false) {
+    strcpy(iitfile,filename);
+  }
+  return iitfile;
+}
+
+char *
+Splicetrie_cache_filename (char *splicing_iitfile) {
+  char *filename;
+  int length;
+
+  length = strlen(splicing_iitfile);
+  if (length > 4 && !strcmp(&(splicing_iitfile[length-4]),".iit")) {
+    length -= 4;
+  }
+  filename = (char *) CALLOC(length+strlen(".splicetrie")+1,sizeof(char));
+  strncpy(filename,splicing_iitfile,length);
+  strcpy(&(filename[length]),".splicetrie");
+  return filename;
+}
+
+
+static bool
+file_digest (unsigned char *digest, char *filename) {
+  FILE *fp;
+  unsigned char *buffer, *digests, *chunk_digest, *combined;
+  int nchunks = 0, maxchunks, nread;
+
+  if ((fp = FOPEN_READ_BINARY(filename)) == NULL) {
+    return false;
+  }
+
+  maxchunks = Access_filesize(filename)/DIGEST_CHUNKSIZE + 1;
+  buffer = (unsigned char *) MALLOC(DIGEST_CHUNKSIZE*sizeof(unsigned char));
+  digests = (unsigned char *) MALLOC(maxchunks*16*sizeof(unsigned char));
+  while (nchunks < maxchunks && (nread = fread(buffer,sizeof(unsigned char),DIGEST_CHUNKSIZE,fp)) > 0) {
+    chunk_digest = MD5_compute(buffer,nread);
+    memcpy(&(digests[16*nchunks++]),chunk_digest,16);
+    FREE(chunk_digest);
+  }
+  fclose(fp);
+
+  combined = MD5_compute(digests,16*nchunks);
+  memcpy(digest,combined,16);
+  FREE(combined);
+  FREE(digests);
+  FREE(buffer);
+
+  return true;
+}
+
+
+static void
+header_init (struct Header_T *header, char *splicing_iitfile, char *chromosome_iitfile,
+	     Genome_T genome, bool altp, Chrpos_T shortsplicedist) {
+
+  memset(header,0,sizeof(struct Header_T));
+  memcpy(header->magic,CACHE_MAGIC,8);
+  header->version = CACHE_VERSION;
+  header->byteorder = BYTEORDER_MARK;
+  header->univcoord_size = sizeof(Univcoord_T);
+  header->splicetype_size = sizeof(Splicetype_T);
+  header->shortsplicedist = (UINT4) shortsplicedist;
+  header->altp = (altp == true) ? 1 : 0;
+  header->genomelength = (UINT8) Genome_totallength(genome);
+  header->nblocks = (header->genomelength + 31)/32U; /* As in Splicetrie_retrieve_* */
+
+  if (file_digest(header->splicing_md5,splicing_iitfile) == false) {
+    fprintf(stderr,"Error: can't open splicing file %s\n",splicing_iitfile);
+    exit(9);
+  }
+  if (file_digest(header->chromosome_md5,chromosome_iitfile) == false) {
+    fprintf(stderr,"Error: can't open chromosome file %s\n",chromosome_iitfile);
+    exit(9);
+  }
+
+  return;
+}
+
+
+/* Sizes of the arrays following the header, in the order written */
+#define NARRAYS 10
+
+static void
+array_sizes (size_t *sizes, struct Header_T *header) {
+  size_t nsplicesites = (size_t) header->nsplicesites;
+
+  sizes[0] = (nsplicesites + 1) * sizeof(Univcoord_T); /* splicesites, with sentinel */
+  sizes[1] = header->nblocks * sizeof(Genomecomp_T);    /* splicecomp */
+  sizes[2] = nsplicesites * sizeof(Splicetype_T);       /* splicetypes */
+  sizes[3] = nsplicesites * sizeof(Chrpos_T);           /* splicedists */
+  sizes[4] = nsplicesites * sizeof(Genomecomp_T);       /* splicefrags_ref */
+  sizes[5] = (header->altp ? nsplicesites : 0) * sizeof(Genomecomp_T);
+  sizes[6] = (header->obsp ? nsplicesites : 0) * sizeof(Trieoffset_T);
+  sizes[7] = (size_t) header->ntriecontents_obs * sizeof(Triecontent_T);
+  sizes[8] = (header->maxp ? nsplicesites : 0) * sizeof(Trieoffset_T);
+  sizes[9] = (size_t) header->ntriecontents_max * sizeof(Triecontent_T);
+  return;
+}
+
+static size_t
+padded (size_t nbytes) {
+  return (nbytes + 7) & ~((size_t) 7);
+}
+
+
+void
+Splicetrie_cache_write (char *filename, char *splicing_iitfile, char *chromosome_iitfile,
+			Genome_T genome, bool altp, Chrpos_T shortsplicedist, bool distances_observed_p,
+			Univcoord_T *splicesites, Genomecomp_T *splicecomp, Splicetype_T *splicetypes,
+			Chrpos_T *splicedists, Genomecomp_T *splicefrags_ref, Genomecomp_T *splicefrags_alt,
+			int nsplicesites, Trieoffset_T *trieoffsets_obs, Triecontent_T *triecontents_obs,
+			int ntriecontents_obs, Trieoffset_T *trieoffsets_max, Triecontent_T *triecontents_max,
+			int ntriecontents_max) {
+  struct Header_T header;
+  size_t sizes[NARRAYS];
+  void *arrays[NARRAYS];
+  char *tempfile, zeroes[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+  FILE *fp;
+  int k;
+
+  header_init(&header,splicing_iitfile,chromosome_iitfile,genome,altp,shortsplicedist);
+  header.distances_observed_p = (distances_observed_p == true) ? 1 : 0;
+  header.nsplicesites = (UINT4) nsplicesites;
+  header.obsp = (trieoffsets_obs != NULL) ? 1 : 0;
+  header.maxp = (trieoffsets_max != NULL) ? 1 : 0;
+  header.ntriecontents_obs = (triecontents_obs != NULL) ? (UINT4) ntriecontents_obs : 0;
+  header.ntriecontents_max = (triecontents_max != NULL) ? (UINT4) ntriecontents_max : 0;
+
+  array_sizes(sizes,&header);
+  arrays[0] = (void *) splicesites;
+  arrays[1] = (void *) splicecomp;
+  arrays[2] = (void *) splicetypes;
+  arrays[3] = (void *) splicedists;
+  arrays[4] = (void *) splicefrags_ref;
+  arrays[5] = (void *) splicefrags_alt;
+  arrays[6] = (void *) trieoffsets_obs;
+  arrays[7] = (void *) triecontents_obs;
+  arrays[8] = (void *) trieoffsets_max;
+  arrays[9] = (void *) triecontents_max;
+
+  /* Write to a temporary file and rename, so that concurrent jobs
+     never map a partial cache */
+  tempfile = (char *) CALLOC(strlen(filename)+strlen(".tmp")+1,sizeof(char));
+  sprintf(tempfile,"%s.tmp",filename);
+  if ((fp = FOPEN_WRITE_BINARY(tempfile)) == NULL) {
+    fprintf(stderr,"Error: can't write to file %s\n",tempfile);
+    exit(9);
+  }
+
+  fwrite(&header,sizeof(struct Header_T),1,fp);
+  for (k = 0; k < NARRAYS; k++) {
+    if (sizes[k] > 0) {
+      fwrite(arrays[k],sizeof(char),sizes[k],fp);
+      fwrite(zeroes,sizeof(char),padded(sizes[k]) - sizes[k],fp);
+    }
+  }
+
+  if (fclose(fp) != 0) {
+    fprintf(stderr,"Error: could not finish writing file %s.  Error %d: %s\n",tempfile,errno,strerror(errno));
+    exit(9);
+  } else if (rename(tempfile,filename) != 0) {
+    fprintf(stderr,"Error: could not rename %s to %s.  Error %d: %s\n",tempfile,filename,errno,strerror(errno));
+    exit(9);
+  }
+  FREE(tempfile);
+
+  return;
+}
+
+
+/* Returns NULL if the cache does not exist or does not match the
+   given splicing file, genome, and parameters */
+T
+Splicetrie_cache_read (bool *distances_observed_p, Univcoord_T **splicesites, Genomecomp_T **splicecomp,
+		       Splicetype_T **splicetypes, Chrpos_T **splicedists,
+		       Genomecomp_T **splicefrags_ref, Genomecomp_T **splicefrags_alt, int *nsplicesites,
+		       Trieoffset_T **trieoffsets_obs, Triecontent_T **triecontents_obs,
+		       Trieoffset_T **trieoffsets_max, Triecontent_T **triecontents_max,
+		       char *filename, char *splicing_iitfile, char *chromosome_iitfile,
+		       Genome_T genome, bool altp, Chrpos_T shortsplicedist) {
+  T new;
+  struct Header_T header, expected;
+  size_t sizes[NARRAYS], total;
+  void *arrays[NARRAYS];
+  char *p;
+  FILE *fp;
+  int k;
+
+  if ((fp = FOPEN_READ_BINARY(filename)) == NULL) {
+    return (T) NULL;
+  } else if (fread(&header,sizeof(struct Header_T),1,fp) != 1) {
+    fprintf(stderr,"Splicetrie cache %s is truncated, so ignoring it...",filename);
+    fclose(fp);
+    return (T) NULL;
+  }
+
+  header_init(&expected,splicing_iitfile,chromosome_iitfile,genome,altp,shortsplicedist);
+  if (memcmp(header.magic,expected.magic,8) || header.version != expected.version ||
+      header.byteorder != expected.byteorder || header.univcoord_size != expected.univcoord_size ||
+      header.splicetype_size != expected.splicetype_size) {
+    fprintf(stderr,"Splicetrie cache %s was written by a different version or machine type, so ignoring it...",filename);
+    fclose(fp);
+    return (T) NULL;
+  } else if (memcmp(header.splicing_md5,expected.splicing_md5,16) ||
+	     memcmp(header.chromosome_md5,expected.chromosome_md5,16) ||
+	     header.genomelength != expected.genomelength || header.nblocks != expected.nblocks) {
+    fprintf(stderr,"Splicetrie cache %s was built from a different splicing file or genome, so ignoring it...",filename);
+    fclose(fp);
+    return (T) NULL;
+  } else if (header.shortsplicedist != expected.shortsplicedist || header.altp != expected.altp) {
+    fprintf(stderr,"Splicetrie cache %s was built with a different -w or -v flag, so ignoring it...",filename);
+    fclose(fp);
+    return (T) NULL;
+  }
+
+  array_sizes(sizes,&header);
+  total = sizeof(struct Header_T);
+  for (k = 0; k < NARRAYS; k++) {
+    total += padded(sizes[k]);
+  }
+  if ((size_t) Access_filesize(filename) != total) {
+    fprintf(stderr,"Splicetrie cache %s has the wrong size, so ignoring it...",filename);
+    fclose(fp);
+    return (T) NULL;
+  }
+
+  new = (T) MALLOC(sizeof(*new));
+#ifdef HAVE_MMAP
+  fclose(fp);
+  new->memory = (void *) Access_mmap(&new->fd,&new->len,filename,/*eltsize*/sizeof(char),/*randomp*/true);
+  new->access = MMAPPED;
+  if (new->memory == NULL) {
+    close(new->fd);
+    if ((fp = FOPEN_READ_BINARY(filename)) == NULL) {
+      FREE(new);
+      return (T) NULL;
+    }
+#endif
+    new->len = total;
+    new->memory = (void *) MALLOC(total);
+    new->access = ALLOCATED;
+    memcpy(new->memory,&header,sizeof(struct Header_T));
+    if (fread(&(((char *) new->memory)[sizeof(struct Header_T)]),sizeof(char),total - sizeof(struct Header_T),fp) !=
+	total - sizeof(struct Header_T)) {
+      fprintf(stderr,"Error: could not read file %s\n",filename);
+      exit(9);
+    }
+    fclose(fp);
+#ifdef HAVE_MMAP
+  }
+#endif
+
+  p = &(((char *) new->memory)[sizeof(struct Header_T)]);
+  for (k = 0; k < NARRAYS; k++) {
+    arrays[k] = (sizes[k] == 0) ? NULL : (void *) p;
+    p += padded(sizes[k]);
+  }
+
+  *distances_observed_p = (header.distances_observed_p == 1) ? true : false;
+  *nsplicesites = (int) header.nsplicesites;
+  *splicesites = (Univcoord_T *) arrays[0];
+  *splicecomp = (Genomecomp_T *) arrays[1];
+  *splicetypes = (Splicetype_T *) arrays[2];
+  *splicedists = (Chrpos_T *) arrays[3];
+  *splicefrags_ref = (Genomecomp_T *) arrays[4];
+  if (header.altp == 1) {
+    *splicefrags_alt = (Genomecomp_T *) arrays[5];
+  } else {
+    *splicefrags_alt = *splicefrags_ref;
+  }
+  *trieoffsets_obs = (Trieoffset_T *) arrays[6];
+  *triecontents_obs = (Triecontent_T *) arrays[7];
+  *trieoffsets_max = (Trieoffset_T *) arrays[8];
+  *triecontents_max = (Triecontent_T *) arrays[9];
+
+  debug(printf("Mapped splicetrie cache %s with %d splicesites\n",filename,*nsplicesites));
+
+  return new;
+}
+
@@ -0,0 +1,50 @@
+/* $Id: splicetrie_cache.h $ */
+#ifndef SPLICETRIE_CACHE_INCLUDED
+#define SPLICETRIE_CACHE_INCLUDED
+
+#include "bool.h"
+#include "types.h"
+#include "genomicpos.h"
+#include "genome.h"
+#include "splicetrie_build.h"	/* For Splicetype_T */
+
+/* A splicetrie cache holds the splicesites and tries that
+   Splicetrie_retrieve_* and Splicetrie_build_* compute from a splicing
+   IIT file, so that they can be mapped read-only instead of rebuilt
+   at each startup.  The file is in host byte order, and records MD5
+   digests of the splicing IIT and chromosome IIT files, together with
+   the genome length and the parameters that affect the build.  A cache
+   that does not match all of these is ignored. */
+
+#define T Splicetrie_cache_T
+typedef struct T *T;
+
+extern char *
+Splicetrie_cache_iitfile (char *filename);
+extern char *
+Splicetrie_cache_filename (char *splicing_iitfile);
+
+extern void
+Splicetrie_cache_write (char *filename, char *splicing_iitfile, char *chromosome_iitfile,
+			Genome_T genome, bool altp, Chrpos_T shortsplicedist, bool distances_observed_p,
+			Univcoord_T *splicesites, Genomecomp_T *splicecomp, Splicetype_T *splicetypes,
+			Chrpos_T *splicedists, Genomecomp_T *splicefrags_ref, Genomecomp_T *splicefrags_alt,
+			int nsplicesites, Trieoffset_T *trieoffsets_obs, Triecontent_T *triecontents_obs,
+			int ntriecontents_obs, Trieoffset_T *trieoffsets_max, Triecontent_T *triecontents_max,
+			int ntriecontents_max);
+
+extern T
+Splicetrie_cache_read (bool *distances_observed_p, Univcoord_T **splicesites, Genomecomp_T **splicecomp,
+		       Splicetype_T **splicetypes, Chrpos_T **splicedists,
+		       Genomecomp_T **splicefrags_ref, Genomecomp_T **splicefrags_alt, int *nsplicesites,
+		       Trieoffset_T **trieoffsets_obs, Triecontent_T **triecontents_obs,
+		       Trieoffset_T **trieoffsets_max, Triecontent_T **triecontents_max,
+		       char *filename, char *splicing_iitfile, char *chromosome_iitfile,
+		       Genome_T genome, bool altp, Chrpos_T shortsplicedist);
+
+extern void
+Splicetrie_cache_free (T *old);
+
+#undef T
+#endif
+
@@ -30,11 +30,13 @@ static char rcsid[] = "$Id: stage1hr.c 104801 2013-08-14 00:55:53Z twu $";
 #include "complement.h"
 #include "compress.h"
 #include "genome_hr.h"
+#include "blockdiff.h"
 #include "maxent.h"
 #include "maxent_hr.h"
 #include "iitdef.h"
 #include "interval.h"
 #include "spanningelt.h"
+#include "merge.h"
 #include "cmet.h"
 #include "atoi.h"
 
@@ -46,6 +48,14 @@ static char rcsid[] = "$Id: stage1hr.c 104801 2013-08-14 00:55:53Z twu $";
 #include "bigendian.h"
 #endif
 
+#ifdef HAVE_PTHREAD
+#include <pthread.h>		/* For per-thread sort buffers */
+#endif
+
+#ifdef HAVE_SSE
+#include <xmmintrin.h>		/* For _mm_prefetch */
+#endif
+
 
 #ifdef HAVE_64_BIT
 #ifdef LARGE_GENOMES
@@ -61,6 +71,15 @@ static char rcsid[] = "$Id: stage1hr.c 104801 2013-08-14 00:55:53Z twu $";
 /* #define USE_QSORT 1 */
 #define USE_HEAPSORT 1
 
+/* Merge position lists with merge.c, rather than with a heap */
+#define USE_MERGE 1
+
+/* Identify segments by radix sorting diagonal and querypos together
+   in one key, rather than with a heap */
+#ifdef HAVE_64_BIT
+#define USE_RADIX_SEGMENTS 1
+#endif
+
 
 /* #define EXTRACT_GENOMICSEG 1 */
 #ifdef EXTRACT_GENOMICSEG
@@ -82,6 +101,12 @@ static Mode_T mode;
 static bool snpp;
 static int maxpaths_search;
 
+/* Verification of candidates */
+static Genomecomp_T *ref_blocks;
+static Genomecomp_T *snp_blocks;
+static bool query_unk_mismatch_p;
+static bool genome_unk_mismatch_p;
+
 
 /* Penalties */
 static int terminal_threshold;
@@ -1363,7 +1388,7 @@ struct Batch_T {
 };
 
 
-#ifdef USE_HEAPSORT
+#if defined(USE_HEAPSORT) && !defined(USE_RADIX_SEGMENTS)
 static void
 Batch_init (Batch_T batch, int querypos, int diagterm, Univcoord_T *positions, int npositions, int querylength) {
 
@@ -1422,7 +1447,7 @@ Batch_init_simple (Batch_T batch, Univcoord_T *diagonals, int ndiagonals, int qu
 }
 
 
-#ifdef USE_HEAPSORT
+#if defined(USE_HEAPSORT) && !defined(USE_RADIX_SEGMENTS)
 static void
 min_heap_insert (Batch_T *heap, int *heapsize, Batch_T batch) {
   int i;
@@ -1457,6 +1482,7 @@ min_heap_insert (Batch_T *heap, int *heapsize, Batch_T batch) {
 #endif
 
 
+#ifndef USE_MERGE
 static void
 min_heap_insert_simple (Batch_T *heap, int *heapsize, Batch_T batch) {
   int i;
@@ -1472,6 +1498,172 @@ min_heap_insert_simple (Batch_T *heap, int *heapsize, Batch_T batch) {
 
   return;
 }
+#endif
+
+
+#ifdef USE_RADIX_SEGMENTS
+/* Sorts the diagonals from all querypos into a per-thread buffer,
+   with an LSD radix sort.  Each key holds the diagonal above
+   querypos_bits bits of querypos.  Keys are filled in querypos order
+   and only the diagonal bits are sorted, so since each pass is
+   stable, equal diagonals stay in querypos order, as from the heap.
+   Small inputs use smaller digits, so as not to spend their time on
+   clearing and summing counts. */
+
+#define RADIX_BITS 11
+#define RADIX_BITS_SMALL 8
+#define RADIX_SMALL_NKEYS 2048
+#define RADIX_MAXPASSES 8	/* 64 bits in RADIX_BITS_SMALL digits */
+
+typedef struct Diagonal_sort_T *Diagonal_sort_T;
+struct Diagonal_sort_T {
+  int nalloc;
+  UINT8 *keys;
+  UINT8 *temp;
+  UINT4 counts[RADIX_MAXPASSES][1 << RADIX_BITS];
+};
+
+#ifdef HAVE_PTHREAD
+static pthread_key_t diagonal_sort_key;
+#else
+static Diagonal_sort_T diagonal_sort = NULL;
+#endif
+
+static void
+diagonal_sort_free (void *data) {
+  Diagonal_sort_T this = (Diagonal_sort_T) data;
+
+  if (this->nalloc > 0) {
+    FREE_KEEP(this->temp);
+    FREE_KEEP(this->keys);
+  }
+  FREE_KEEP(this);
+  return;
+}
+
+/* Returns the buffer for this thread, with room for nkeys keys */
+static Diagonal_sort_T
+diagonal_sort_get (int nkeys) {
+  Diagonal_sort_T this;
+
+#ifdef HAVE_PTHREAD
+  if ((this = (Diagonal_sort_T) pthread_getspecific(diagonal_sort_key)) == NULL) {
+    this = (Diagonal_sort_T) CALLOC_KEEP(1,sizeof(*this));
+    pthread_setspecific(diagonal_sort_key,(void *) this);
+  }
+#else
+  if ((this = diagonal_sort) == NULL) {
+    this = diagonal_sort = (Diagonal_sort_T) CALLOC_KEEP(1,sizeof(*this));
+  }
+#endif
+
+  if (nkeys > this->nalloc) {
+    if (this->nalloc > 0) {
+      FREE_KEEP(this->temp);
+      FREE_KEEP(this->keys);
+    }
+    this->nalloc = (nkeys > 2*this->nalloc) ? nkeys : 2*this->nalloc;
+    this->keys = (UINT8 *) MALLOC_KEEP(this->nalloc*sizeof(UINT8));
+    this->temp = (UINT8 *) MALLOC_KEEP(this->nalloc*sizeof(UINT8));
+  }
+
+  return this;
+}
+
+/* Returns the sorted keys, which belong to the per-thread buffer and
+   should not be freed.  Leaves out diagonals straddling the beginning
+   of the genome, as Batch_init does. */
+static UINT8 *
+sort_diagonals (int *nkeys, int *querypos_bits, Univcoord_T **positions, int *npositions, bool *omitted,
+		int querylength, int query_lastpos, bool plusp) {
+  Diagonal_sort_T this;
+  UINT8 *keys, *src, *dst, *temp, key;
+  UINT4 *counts, count, sum;
+  Univcoord_T diagonal, diagonal_bits = 0U;
+  int total_npositions = 0, digit_bits, digit_mask, nbits, npasses, pass, shift;
+  int querypos, diagterm, i, k;
+
+  for (querypos = 0; querypos <= query_lastpos; querypos++) {
+    if (omitted[querypos] == false) {
+      total_npositions += npositions[querypos];
+    }
+  }
+  if (total_npositions == 0) {
+    *nkeys = 0;
+    return (UINT8 *) NULL;
+  }
+
+  *querypos_bits = 1;
+  while ((query_lastpos >> *querypos_bits) != 0) {
+    (*querypos_bits)++;
+  }
+
+  this = diagonal_sort_get(total_npositions);
+  keys = this->keys;
+  k = 0;
+  for (querypos = 0; querypos <= query_lastpos; querypos++) {
+    if (omitted[querypos] == false) {
+      diagterm = plusp ? querylength - querypos : querypos + index1part;
+      for (i = 0; i < npositions[querypos]; i++) {
+#ifdef WORDS_BIGENDIAN
+	diagonal = Bigendian_convert_univcoord(positions[querypos][i]) + diagterm;
+#else
+	diagonal = positions[querypos][i] + diagterm;
+#endif
+	if (diagonal >= (Univcoord_T) querylength) {
+	  keys[k++] = ((UINT8) diagonal << *querypos_bits) | querypos;
+	  diagonal_bits |= diagonal;
+	}
+      }
+    }
+  }
+  if ((*nkeys = k) == 0) {
+    return (UINT8 *) NULL;
+  }
+
+  digit_bits = (k < RADIX_SMALL_NKEYS) ? RADIX_BITS_SMALL : RADIX_BITS;
+  digit_mask = (1 << digit_bits) - 1;
+  for (nbits = 0; nbits < (int) (8*sizeof(Univcoord_T)) && (diagonal_bits >> nbits) != 0; nbits++) ;
+  npasses = (nbits + digit_bits - 1)/digit_bits;
+
+  /* Counts for all passes in one read */
+  memset(this->counts,0,npasses*sizeof(this->counts[0]));
+  for (i = 0; i < k; i++) {
+    key = keys[i] >> *querypos_bits;
+    for (pass = 0; pass < npasses; pass++) {
+      this->counts[pass][(key >> (pass*digit_bits)) & digit_mask]++;
+    }
+  }
+
+  src = keys;
+  dst = this->temp;
+  for (pass = 0; pass < npasses; pass++) {
+    counts = this->counts[pass];
+    shift = *querypos_bits + pass*digit_bits;
+    if (counts[(src[0] >> shift) & digit_mask] == (UINT4) k) {
+      /* All keys have this digit */
+      continue;
+    }
+
+    sum = 0;
+    for (i = 0; i <= digit_mask; i++) {
+      count = counts[i];
+      counts[i] = sum;
+      sum += count;
+    }
+    for (i = 0; i < k; i++) {
+      key = src[i];
+      dst[counts[(key >> shift) & digit_mask]++] = key;
+    }
+
+    temp = src;
+    src = dst;
+    dst = temp;
+  }
+
+  return src;
+}
+#endif
 
 
 
@@ -2725,24 +2917,39 @@ find_spanning_multimiss_matches (int *found_score, int *nhits, List_T hits, T th
   List_T spanningset, sorted;
   Spanningelt_T *array;
   int nunion = nmisses_allowed + nrequired, nelts;
-  int heapsize, count, mod, i;
+  int count, mod, i;
   int ndiagonals, nempty;
+#ifdef USE_MERGE
+  Univcoord_T **runs, *merged;
+  int *runlengths, nruns, nmerged, mergei;
+#else
+  int heapsize;
   int parenti, smallesti, righti;
+#endif
   int global_miss_querypos5, global_miss_querypos3;
   int elt_miss_querypos5, elt_miss_querypos3;
-  struct Batch_T *batchpool, sentinel_struct;
-  Batch_T *heap, batch, sentinel;
+  struct Batch_T *batchpool;
+  Batch_T batch;
+#ifndef USE_MERGE
+  struct Batch_T sentinel_struct;
+  Batch_T *heap, sentinel;
+#endif
   Univcoord_T chroffset, chrhigh;
   Chrpos_T chrlength;
   Chrnum_T chrnum;
 
   debug(printf("Starting find_spanning_multimiss_matches with %d misses allowed\n",nmisses_allowed));
 
+  batchpool = (struct Batch_T *) CALLOC(nunion,sizeof(struct Batch_T));
+#ifdef USE_MERGE
+  runs = (Univcoord_T **) CALLOC(nunion,sizeof(Univcoord_T *));
+  runlengths = (int *) CALLOC(nunion,sizeof(int));
+#else
   sentinel_struct.diagonal = (Univcoord_T) -1; /* infinity */
   sentinel = &sentinel_struct;
 
-  batchpool = (struct Batch_T *) CALLOC(nunion,sizeof(struct Batch_T));
   heap = (Batch_T *) CALLOC(2*(nunion+1)+1+1,sizeof(Batch_T)); /* being liberal with allocation */
+#endif
 
   /* Plus */
   for (mod = 0; mod < index1interval; mod++) {
@@ -2767,7 +2974,11 @@ find_spanning_multimiss_matches (int *found_score, int *nhits, List_T hits, T th
     debug(Spanningelt_print_set(sorted));
 
     /* Put first few pointers into heap */
+#ifdef USE_MERGE
+    nruns = 0;
+#else
     heapsize = 0;
+#endif
     spanningset = sorted;
     global_miss_querypos5 = querylength;
     global_miss_querypos3 = 0;
@@ -2782,20 +2993,58 @@ find_spanning_multimiss_matches (int *found_score, int *nhits, List_T hits, T th
       if (ndiagonals > 0) {
 	Batch_init_simple(batch,diagonals,ndiagonals,querylength,/*querypos*/i);
 	if (batch->npositions > 0) {
+#ifdef USE_MERGE
+	  runs[nruns] = batch->positions;
+	  runlengths[nruns++] = batch->npositions;
+#else
 	  debug(printf("inserting into heap"));
 	  min_heap_insert_simple(heap,&heapsize,batch);
+#endif
 	}
       }
       debug(printf("\n"));
     }
+#ifdef USE_MERGE
+    if (nruns == 0) {
+#else
     debug(printf("heapsize is %d\n",heapsize));
     if (heapsize == 0) {
+#endif
       List_free(&sorted);
     } else {
       spanningset = List_push(List_copy(spanningset),(void **) NULL); /* Add a dummy list elt to front */
       nempty = 0;
       List_free(&sorted);
 
+#ifdef USE_MERGE
+      merged = Merge_univcoord(&nmerged,runs,runlengths,nruns);
+      diagonal = merged[0];
+      count = 1;
+      debug7(printf("*** multimiss mod %d plus:\n",mod));
+      debug7(printf("initial diagonal is %lu\n",diagonal));
+
+      chrhigh = 0U;
+      for (mergei = 1; mergei < nmerged && *nhits <= maxpaths_search; mergei++) {
+	if (merged[mergei] == diagonal) {
+	  count++;
+	  debug7(printf("incrementing diagonal %lu to count %d\n",diagonal,count));
+	} else {
+	  /* End of diagonal */
+	  if (count >= nrequired) {
+	    hits = identify_multimiss_iter(&(*found_score),&chrnum,&chroffset,&chrhigh,&chrlength,&(*nhits),hits,diagonal,
+					   /*prev*/spanningset,&nempty,&global_miss_querypos5,&global_miss_querypos3,
+					   querylength,/*query_compress*/query_compress_fwd,
+					   /*plusp*/true,genestrand,nmisses_allowed,
+					   /*nmisses_seen*/nunion-count+nempty,global_miss_querypos5,global_miss_querypos3);
+	  }
+	  diagonal = merged[mergei];
+	  count = 1;
+	  debug7(printf("next diagonal is %lu\n",diagonal));
+	}
+      }
+      FREE(merged);
+
+#else
       /* Set up rest of heap */
       for (i = heapsize+1; i <= 2*heapsize+1; i++) {
 	heap[i] = sentinel;
@@ -2893,6 +3142,8 @@ find_spanning_multimiss_matches (int *found_score, int *nhits, List_T hits, T th
 	debug6(printf("Inserting at %d\n\n",parenti));
       }
 
+#endif
+
       /* Terminate loop */
       if (count >= nrequired && *nhits <= maxpaths_search) {
 	hits = identify_multimiss_iter(&(*found_score),&chrnum,&chroffset,&chrhigh,&chrlength,&(*nhits),hits,diagonal,
@@ -2928,7 +3179,11 @@ find_spanning_multimiss_matches (int *found_score, int *nhits, List_T hits, T th
     debug(Spanningelt_print_set(sorted));
 
     /* Put first few pointers into heap */
+#ifdef USE_MERGE
+    nruns = 0;
+#else
     heapsize = 0;
+#endif
     spanningset = sorted;
     global_miss_querypos5 = querylength;
     global_miss_querypos3 = 0;
@@ -2943,21 +3198,58 @@ find_spanning_multimiss_matches (int *found_score, int *nhits, List_T hits, T th
       if (ndiagonals > 0) {
 	Batch_init_simple(batch,diagonals,ndiagonals,querylength,/*querypos*/i);
 	if (batch->npositions > 0) {
+#ifdef USE_MERGE
+	  runs[nruns] = batch->positions;
+	  runlengths[nruns++] = batch->npositions;
+#else
 	  debug(printf("inserting into heap"));
 	  min_heap_insert_simple(heap,&heapsize,batch);
+#endif
 	}
       }
       debug(printf("\n"));
     }
+#ifdef USE_MERGE
+    if (nruns == 0) {
+#else
     debug(printf("heapsize is %d\n",heapsize));
-
     if (heapsize == 0) {
+#endif
       List_free(&sorted);
     } else {
       spanningset = List_push(List_copy(spanningset),(void **) NULL); /* Add a dummy list elt to front */
       nempty = 0;
       List_free(&sorted);
 
+#ifdef USE_MERGE
+      merged = Merge_univcoord(&nmerged,runs,runlengths,nruns);
+      diagonal = merged[0];
+      count = 1;
+      debug7(printf("*** multimiss mod %d minus:\n",mod));
+      debug7(printf("initial diagonal is %lu\n",diagonal));
+
+      chrhigh = 0U;
+      for (mergei = 1; mergei < nmerged && *nhits <= maxpaths_search; mergei++) {
+	if (merged[mergei] == diagonal) {
+	  count++;
+	  debug7(printf("incrementing diagonal %lu to count %d\n",diagonal,count));
+	} else {
+	  /* End of diagonal */
+	  if (count >= nrequired) {
+	    hits = identify_multimiss_iter(&(*found_score),&chrnum,&chroffset,&chrhigh,&chrlength,&(*nhits),hits,diagonal,
+					   /*prev*/spanningset,&nempty,&global_miss_querypos5,&global_miss_querypos3,
+					   querylength,/*query_compress*/query_compress_rev,
+					   /*plusp*/false,genestrand,nmisses_allowed,
+					   /*nmisses_seen*/nunion-count+nempty,global_miss_querypos5,global_miss_querypos3);
+	  }
+	  diagonal = merged[mergei];
+	  count = 1;
+	  debug7(printf("next diagonal is %lu\n",diagonal));
+	}
+      }
+      FREE(merged);
+
+#else
       /* Set up rest of heap */
       for (i = heapsize+1; i <= 2*heapsize+1; i++) {
 	heap[i] = sentinel;
@@ -3054,6 +3346,8 @@ find_spanning_multimiss_matches (int *found_score, int *nhits, List_T hits, T th
 	debug6(printf("Inserting at %d\n\n",parenti));
       }
 
+#endif
+
       /* Terminate loop */
       if (count >= nrequired && *nhits <= maxpaths_search) {
 	hits = identify_multimiss_iter(&(*found_score),&chrnum,&chroffset,&chrhigh,&chrlength,&(*nhits),hits,diagonal,
@@ -3066,7 +3360,12 @@ find_spanning_multimiss_matches (int *found_score, int *nhits, List_T hits, T th
     }
   }
 
+#ifdef USE_MERGE
+  FREE(runlengths);
+  FREE(runs);
+#else
   FREE(heap);
+#endif
   FREE(batchpool);
   return hits;
 }
@@ -3120,6 +3419,101 @@ trim_ends_unknowns_only (int *trim5, int *trim3, char *sequence1, char *sequence
 /************************************************************************/
 
 
+/* Candidates are collected and verified in batches of this many */
+#define VERIFY_BATCH 64
+
+/* Genome blocks are prefetched this many candidates ahead */
+#define VERIFY_PREFETCH_AHEAD 8
+
+#define VERIFY_NLANES 4
+
+static inline void
+prefetch_candidate (Univcoord_T left, int querylength) {
+#ifdef HAVE_SSE
+  Genomecomp_T *ptr, *end;
+
+  /* A 64-byte cache line holds 16 words */
+  end = &(ref_blocks[(left+querylength-1)/32U*3 + 2]);
+  for (ptr = &(ref_blocks[left/32U*3]); ptr < end; ptr += 16) {
+    _mm_prefetch((const char *) ptr,_MM_HINT_T0);
+  }
+  _mm_prefetch((const char *) end,_MM_HINT_T0);
+
+  if (snp_blocks != NULL) {
+    end = &(snp_blocks[(left+querylength-1)/32U*3 + 2]);
+    for (ptr = &(snp_blocks[left/32U*3]); ptr < end; ptr += 16) {
+      _mm_prefetch((const char *) ptr,_MM_HINT_T0);
+    }
+    _mm_prefetch((const char *) end,_MM_HINT_T0);
+  }
+#endif
+
+  return;
+}
+
+
+/* Counts mismatches against the whole query at each of the lefts.
+   Puts the indices of candidates with at most max_mismatches_allowed
+   into survivors, in order, and their counts into nmismatches.
+   Returns the number of survivors. */
+static int
+verify_candidates (int *survivors, int *nmismatches, Univcoord_T *lefts, int ncandidates,
+		   int querylength, Compress_T query_compress, int max_mismatches_allowed,
+		   bool plusp, int genestrand) {
+  Genomecomp_T *query_blocks[VERIFY_NLANES], *genome_blocks[VERIFY_NLANES], *alt_blocks[VERIFY_NLANES];
+  int startpos[VERIFY_NLANES], endpos[VERIFY_NLANES], counts[VERIFY_NLANES];
+  int nsurvivors = 0, nshift, i, k;
+
+  for (i = 0; i < ncandidates && i < VERIFY_PREFETCH_AHEAD; i++) {
+    prefetch_candidate(lefts[i],querylength);
+  }
+
+  i = 0;
+  if (mode == STANDARD) {
+    /* Other modes convert the genome by strand, so they go through Genome_count_mismatches_limit */
+    for ( ; i + VERIFY_NLANES <= ncandidates; i += VERIFY_NLANES) {
+      for (k = 0; k < VERIFY_NLANES; k++) {
+	if (i + k + VERIFY_PREFETCH_AHEAD < ncandidates) {
+	  prefetch_candidate(lefts[i+k+VERIFY_PREFETCH_AHEAD],querylength);
+	}
+	nshift = lefts[i+k] % 32;
+	query_blocks[k] = Compress_shift(query_compress,nshift);
+	genome_blocks[k] = &(ref_blocks[lefts[i+k]/32U*3]);
+	if (snp_blocks != NULL) {
+	  alt_blocks[k] = &(snp_blocks[lefts[i+k]/32U*3]);
+	}
+	startpos[k] = nshift;
+	endpos[k] = nshift + querylength;
+      }
+
+      Blockdiff_count_limit_4(counts,query_blocks,genome_blocks,snp_blocks == NULL ? NULL : alt_blocks,
+			      startpos,endpos,max_mismatches_allowed,
+			      query_unk_mismatch_p,genome_unk_mismatch_p);
+      for (k = 0; k < VERIFY_NLANES; k++) {
+	if (counts[k] <= max_mismatches_allowed) {
+	  survivors[nsurvivors] = i + k;
+	  nmismatches[nsurvivors++] = counts[k];
+	}
+      }
+    }
+  }
+
+  for ( ; i < ncandidates; i++) {
+    if (i + VERIFY_PREFETCH_AHEAD < ncandidates) {
+      prefetch_candidate(lefts[i+VERIFY_PREFETCH_AHEAD],querylength);
+    }
+    if ((counts[0] = Genome_count_mismatches_limit(query_compress,lefts[i],/*pos5*/0,/*pos3*/querylength,
+						   max_mismatches_allowed,plusp,genestrand)) <= max_mismatches_allowed) {
+      survivors[nsurvivors] = i;
+      nmismatches[nsurvivors++] = counts[0];
+    }
+  }
+
+  debug(printf("verify_candidates: %d of %d candidates survive\n",nsurvivors,ncandidates));
+  return nsurvivors;
+}
+
+
 /* Returns a master pointer (segments) to the block of segments */
 /* If end_indel_mismatches_allowed set to 0, won't save any segments for end indels. */
 static List_T
@@ -3127,26 +3521,35 @@ find_complete_mm (int *found_score, int *nhits, List_T hits, struct Segment_T *s
 		  int querylength, Compress_T query_compress,
 		  int max_mismatches_allowed, bool plusp, int genestrand) {
   Stage3end_T hit;
-  int nmismatches;
-  Univcoord_T left;
-  Segment_T segmenti;
-
-  for (segmenti = segments; segmenti < &(segments[nsegments]); segmenti++) {
-    if (segmenti->diagonal == (Univcoord_T) -1) {
-      /* Skip chr marker segment */
-    } else if (segmenti->floor <= max_mismatches_allowed) {
-      left = segmenti->diagonal - querylength;
-      nmismatches = Genome_count_mismatches_limit(query_compress,left,/*pos5*/0,/*pos3*/querylength,
-						  max_mismatches_allowed,plusp,genestrand);
-      if (nmismatches <= max_mismatches_allowed) {
-	if ((hit = Stage3end_new_substitution(&(*found_score),nmismatches,
-					      left,/*genomiclength*/querylength,
-					      query_compress,plusp,genestrand,segmenti->chrnum,
-					      segmenti->chroffset,segmenti->chrhigh,segmenti->chrlength)) != NULL) {
-	  segmenti->usedp = true;
-	  *nhits += 1;
-	  hits = List_push(hits,(void *) hit);
-	}
+  Univcoord_T lefts[VERIFY_BATCH];
+  Segment_T candidates[VERIFY_BATCH], segmenti;
+  int survivors[VERIFY_BATCH], nmismatches[VERIFY_BATCH];
+  int ncandidates, nsurvivors, i;
+
+  segmenti = segments;
+  while (segmenti < &(segments[nsegments])) {
+    ncandidates = 0;
+    while (segmenti < &(segments[nsegments]) && ncandidates < VERIFY_BATCH) {
+      if (segmenti->diagonal == (Univcoord_T) -1) {
+	/* Skip chr marker segment */
+      } else if (segmenti->floor <= max_mismatches_allowed) {
+	lefts[ncandidates] = segmenti->diagonal - querylength;
+	candidates[ncandidates++] = segmenti;
+      }
+      segmenti++;
+    }
+
+    nsurvivors = verify_candidates(survivors,nmismatches,lefts,ncandidates,querylength,query_compress,
+				   max_mismatches_allowed,plusp,genestrand);
+    for (i = 0; i < nsurvivors; i++) {
+      if ((hit = Stage3end_new_substitution(&(*found_score),nmismatches[i],
+					    lefts[survivors[i]],/*genomiclength*/querylength,
+					    query_compress,plusp,genestrand,candidates[survivors[i]]->chrnum,
+					    candidates[survivors[i]]->chroffset,candidates[survivors[i]]->chrhigh,
+					    candidates[survivors[i]]->chrlength)) != NULL) {
+	candidates[survivors[i]]->usedp = true;
+	*nhits += 1;
+	hits = List_push(hits,(void *) hit);
       }
     }
   }
@@ -3163,11 +3566,16 @@ identify_all_segments (int *nsegments, Univcoord_T **positions, int *npositions,
 		       bool *omitted, int querylength, int query_lastpos, Floors_T floors,
 		       bool plusp) {
   struct Segment_T *segments = NULL;
+#ifdef USE_RADIX_SEGMENTS
+  UINT8 *keys, querypos_mask;
+  int nkeys, keyi, querypos_bits;
+#else
   Batch_T batch, sentinel;
   struct Batch_T sentinel_struct, *batchpool;
   Batch_T *heap;
   int heapsize = 0;
   int parenti, smallesti, righti, i;
+#endif
   int querypos, first_querypos, last_querypos;
   int floor, floor_xfirst, floor_xlast;
   int floor_left, floor_right, floor_incr;
@@ -3180,7 +3588,7 @@ identify_all_segments (int *nsegments, Univcoord_T **positions, int *npositions,
   int halfquerylength, halfquery_lastpos;
 #endif
 
-#ifdef DIAGONAL_ADD_QUERYPOS
+#if defined(DIAGONAL_ADD_QUERYPOS) && !defined(USE_RADIX_SEGMENTS)
   UINT8 diagonal_add_querypos;
 #endif
   int total_npositions = 0;
@@ -3216,6 +3624,25 @@ identify_all_segments (int *nsegments, Univcoord_T **positions, int *npositions,
   halfquery_lastpos = halfquerylength - index1part;
 #endif
 
+#ifdef USE_RADIX_SEGMENTS
+  /* Don't add entries for compoundpos positions (skip querypos -2, -1, lastpos+1, lastpos+2) */
+  for (querypos = 0; querypos <= query_lastpos; querypos++) {
+    if (omitted[querypos] == false && npositions[querypos] > 0) {
+      total_npositions += npositions[querypos];
+    }
+  }
+  debug14(printf("Initial total_npositions = %d\n",total_npositions));
+
+  keys = sort_diagonals(&nkeys,&querypos_bits,positions,npositions,omitted,querylength,query_lastpos,plusp);
+  if (nkeys == 0) {
+    *nsegments = 0;
+    if (splicesites == NULL) {
+      FREE(splicesites_local);
+    }
+    return (struct Segment_T *) NULL;
+  }
+
+#else
   /* Create sentinel */
 #ifdef DIAGONAL_ADD_QUERYPOS
   sentinel_struct.diagonal_add_querypos = (Univcoord_T) -1; /* infinity */
@@ -3289,6 +3716,7 @@ identify_all_segments (int *nsegments, Univcoord_T **positions, int *npositions,
   for (i = heapsize+1; i <= 2*heapsize+1; i++) {
     heap[i] = sentinel;
   }
+#endif
 
   /* Putting chr marker "segments" after each chromosome */
   segments = (struct Segment_T *) CALLOC(total_npositions + nchromosomes,sizeof(struct Segment_T));
@@ -3324,9 +3752,15 @@ identify_all_segments (int *nsegments, Univcoord_T **positions, int *npositions,
 
 
   /* Initialize loop */
+#ifdef USE_RADIX_SEGMENTS
+  querypos_mask = ((UINT8) 1 << querypos_bits) - 1;
+  first_querypos = last_querypos = querypos = (int) (keys[0] & querypos_mask);
+  last_diagonal = diagonal = (Univcoord_T) (keys[0] >> querypos_bits);
+#else
   batch = heap[1];
   first_querypos = last_querypos = querypos = batch->querypos;
   last_diagonal = diagonal = batch->diagonal;
+#endif
 
   floor_incr = floors_from_neg3[first_querypos];
   floor = floor_incr;
@@ -3356,6 +3790,7 @@ identify_all_segments (int *nsegments, Univcoord_T **positions, int *npositions,
   debug1(printf("first_querypos = %d => initial values: floor %d, floor_xfirst %d, floor_xlast %d, floor_left %d, floor_right %d\n",
 	        first_querypos,floor,floor_xfirst,floor_xlast,floor_left,floor_right));
 
+#ifndef USE_RADIX_SEGMENTS
   if (--batch->npositions <= 0) {
     /* Use last entry in heap for insertion */
     batch = heap[heapsize];
@@ -3411,13 +3846,20 @@ identify_all_segments (int *nsegments, Univcoord_T **positions, int *npositions,
   }
 #endif
   heap[parenti] = batch;
+#endif
 
 
   /* Continue after initialization */
+#ifdef USE_RADIX_SEGMENTS
+  for (keyi = 1; keyi < nkeys; keyi++) {
+    querypos = (int) (keys[keyi] & querypos_mask);
+    diagonal = (Univcoord_T) (keys[keyi] >> querypos_bits);
+#else
   while (heapsize > 0) {
     batch = heap[1];
     querypos = batch->querypos;
     diagonal = batch->diagonal;
+#endif
     debug14(printf("diagonal = %u, querypos = %d\n",last_diagonal,last_querypos));
 
     if (diagonal == last_diagonal) {
@@ -3599,6 +4041,7 @@ identify_all_segments (int *nsegments, Univcoord_T **positions, int *npositions,
     last_querypos = querypos;
 
 
+#ifndef USE_RADIX_SEGMENTS
     if (--batch->npositions <= 0) {
       /* Use last entry in heap for insertion */
       batch = heap[heapsize];
@@ -3654,6 +4097,7 @@ identify_all_segments (int *nsegments, Univcoord_T **positions, int *npositions,
     }
 #endif
     heap[parenti] = batch;
+#endif
   }
   debug14(printf("diagonal = %u, querypos = %d\n",last_diagonal,last_querypos));
   debug14(printf("\n"));
@@ -3789,8 +4233,10 @@ identify_all_segments (int *nsegments, Univcoord_T **positions, int *npositions,
   printf("total_npositions = %d, nchromosomes = %d\n",total_npositions,nchromosomes);
 #endif
 
+#ifndef USE_RADIX_SEGMENTS
   FREE(heap);
   FREE(batchpool);
+#endif
 
   /* Note: segments is in descending diagonal order.  Will need to
      reverse before solving middle deletions */
@@ -4434,11 +4880,16 @@ identify_all_segments_for_terminals (int *nsegments, Univcoord_T **positions, in
 				     bool *omitted, int querylength, int query_lastpos,
 				     Floors_T floors, int max_mismatches_allowed, bool plusp) {
   struct Segment_T *segments = NULL;
+#ifdef USE_RADIX_SEGMENTS
+  UINT8 *keys, querypos_mask;
+  int nkeys, keyi, querypos_bits;
+#else
   Batch_T batch, sentinel;
   struct Batch_T sentinel_struct, *batchpool;
   Batch_T *heap;
   int heapsize = 0;
   int parenti, smallesti, righti, i;
+#endif
   int querypos, first_querypos, last_querypos;
   int floor_left, floor_right, floor_incr;
   int *floors_from_neg3, *floors_from_xfirst, *floors_to_xlast, *floors_to_pos3;
@@ -4449,7 +4900,7 @@ identify_all_segments_for_terminals (int *nsegments, Univcoord_T **positions, in
 #ifdef OLD_FLOOR_ENDS
   int halfquerylength, halfquery_lastpos;
 #endif
-#ifdef DIAGONAL_ADD_QUERYPOS
+#if defined(DIAGONAL_ADD_QUERYPOS) && !defined(USE_RADIX_SEGMENTS)
   UINT8 diagonal_add_querypos;
 #endif
   int total_npositions = 0;
@@ -4467,6 +4918,21 @@ identify_all_segments_for_terminals (int *nsegments, Univcoord_T **positions, in
   halfquery_lastpos = halfquerylength - index1part;
 #endif
 
+#ifdef USE_RADIX_SEGMENTS
+  /* Don't add entries for compoundpos positions (skip querypos -2, -1, lastpos+1, lastpos+2) */
+  for (querypos = 0; querypos <= query_lastpos; querypos++) {
+    if (omitted[querypos] == false && npositions[querypos] > 0) {
+      total_npositions += npositions[querypos];
+    }
+  }
+
+  keys = sort_diagonals(&nkeys,&querypos_bits,positions,npositions,omitted,querylength,query_lastpos,plusp);
+  if (nkeys == 0) {
+    *nsegments = 0;
+    return (struct Segment_T *) NULL;
+  }
+
+#else
   /* Create sentinel */
 #ifdef DIAGONAL_ADD_QUERYPOS
   sentinel_struct.diagonal_add_querypos = (UINT8) -1; /* infinity */
@@ -4536,6 +5002,7 @@ identify_all_segments_for_terminals (int *nsegments, Univcoord_T **positions, in
   for (i = heapsize+1; i <= 2*heapsize+1; i++) {
     heap[i] = sentinel;
   }
+#endif
 
   /* Putting chr marker "segments" after each chromosome */
   segments = (struct Segment_T *) CALLOC(total_npositions + nchromosomes,sizeof(struct Segment_T));
@@ -4571,9 +5038,15 @@ identify_all_segments_for_terminals (int *nsegments, Univcoord_T **positions, in
 
 
   /* Initialize loop */
+#ifdef USE_RADIX_SEGMENTS
+  querypos_mask = ((UINT8) 1 << querypos_bits) - 1;
+  first_querypos = last_querypos = querypos = (int) (keys[0] & querypos_mask);
+  last_diagonal = diagonal = (Univcoord_T) (keys[0] >> querypos_bits);
+#else
   batch = heap[1];
   first_querypos = last_querypos = querypos = batch->querypos;
   last_diagonal = diagonal = batch->diagonal;
+#endif
 
   floor_incr = floors_from_neg3[first_querypos];
 #if 0
@@ -4605,6 +5078,7 @@ identify_all_segments_for_terminals (int *nsegments, Univcoord_T **positions, in
   debug1(printf("first_querypos = %d => initial values: floor_left %d, floor_right %d\n",
 	        first_querypos,floor_left,floor_right));
 
+#ifndef USE_RADIX_SEGMENTS
   if (--batch->npositions <= 0) {
     /* Use last entry in heap for insertion */
     batch = heap[heapsize];
@@ -4660,13 +5134,20 @@ identify_all_segments_for_terminals (int *nsegments, Univcoord_T **positions, in
   }
 #endif
   heap[parenti] = batch;
+#endif
 
 
   /* Continue after initialization */
+#ifdef USE_RADIX_SEGMENTS
+  for (keyi = 1; keyi < nkeys; keyi++) {
+    querypos = (int) (keys[keyi] & querypos_mask);
+    diagonal = (Univcoord_T) (keys[keyi] >> querypos_bits);
+#else
   while (heapsize > 0) {
     batch = heap[1];
     querypos = batch->querypos;
     diagonal = batch->diagonal;
+#endif
 
     if (diagonal == last_diagonal) {
       /* Continuing exact match or substitution */
@@ -4827,6 +5308,7 @@ identify_all_segments_for_terminals (int *nsegments, Univcoord_T **positions, in
     last_querypos = querypos;
 
 
+#ifndef USE_RADIX_SEGMENTS
     if (--batch->npositions <= 0) {
       /* Use last entry in heap for insertion */
       batch = heap[heapsize];
@@ -4882,6 +5364,7 @@ identify_all_segments_for_terminals (int *nsegments, Univcoord_T **positions, in
     }
 #endif
     heap[parenti] = batch;
+#endif
   }
 
   /* Terminate loop. */
@@ -4985,8 +5468,10 @@ identify_all_segments_for_terminals (int *nsegments, Univcoord_T **positions, in
   }
 
 
+#ifndef USE_RADIX_SEGMENTS
   FREE(heap);
   FREE(batchpool);
+#endif
 
   /* Note: segments is in descending diagonal order.  Will need to
      reverse before solving middle deletions */
@@ -14289,6 +14774,50 @@ single_read_tolerant_nonstranded (int *npaths, int *first_absmq, int *second_abs
 }
 
 
+/* Prefetches one level of the index lookups for queryseq, so a
+   worker holding a batch of reads can overlap the cache misses of
+   upcoming reads with the alignment of the current one.  Only
+   standard mode is handled, since other modes reduce oligos by
+   strand. */
+void
+Stage1_prefetch_read (Shortread_T queryseq, Indexdb_T indexdb, Indexdb_T indexdb2, int level) {
+  Reader_T reader;
+  Oligostate_T last_state = INIT;
+  Storedoligomer_T forward = 0U, revcomp = 0U;
+  int querylength, querypos;
+
+  if (mode != STANDARD) {
+    return;
+  } else if ((querylength = Shortread_fulllength(queryseq)) < min_readlength || querylength > MAX_READLENGTH) {
+    return;
+  }
+
+  reader = Reader_new(Shortread_fullpointer_uc(queryseq),/*querystart*/0,/*queryend*/querylength);
+  while ((last_state = Oligo_next(last_state,&querypos,&forward,&revcomp,
+				  reader,/*cdnaend*/FIVE)) != DONE) {
+    if (last_state == VALID) {
+      switch (level) {
+      case STAGE1_PREFETCH_GAMMAPTR:
+	Indexdb_prefetch_gammaptr(indexdb,forward & oligobase_mask);
+	Indexdb_prefetch_gammaptr(indexdb2,(revcomp >> leftreadshift) & oligobase_mask);
+	break;
+      case STAGE1_PREFETCH_OFFSETS:
+	Indexdb_prefetch_offsets(indexdb,forward & oligobase_mask);
+	Indexdb_prefetch_offsets(indexdb2,(revcomp >> leftreadshift) & oligobase_mask);
+	break;
+      case STAGE1_PREFETCH_POSITIONS:
+	Indexdb_prefetch_positions(indexdb,forward & oligobase_mask);
+	Indexdb_prefetch_positions(indexdb2,(revcomp >> leftreadshift) & oligobase_mask);
+	break;
+      }
+    }
+  }
+  Reader_free(&reader);
+
+  return;
+}
+
+
 Stage3end_T *
 Stage1_single_read (int *npaths, int *first_absmq, int *second_absmq,
 		    Shortread_T queryseq, Indexdb_T indexdb, Indexdb_T indexdb2,
@@ -18271,6 +18800,21 @@ Stage1_paired_read (int *npaths, int *first_absmq, int *second_absmq, Pairtype_T
 
 void
 Stage1hr_cleanup () {
+#ifdef USE_RADIX_SEGMENTS
+#ifdef HAVE_PTHREAD
+  if (pthread_getspecific(diagonal_sort_key) != NULL) {
+    diagonal_sort_free(pthread_getspecific(diagonal_sort_key));
+    pthread_setspecific(diagonal_sort_key,NULL);
+  }
+  pthread_key_delete(diagonal_sort_key);
+#else
+  if (diagonal_sort != NULL) {
+    diagonal_sort_free((void *) diagonal_sort);
+    diagonal_sort = NULL;
+  }
+#endif
+#endif
+
   FREE(chroffsets);
   FREE(chrhighs);
   FREE(chrlengths);
@@ -18281,7 +18825,8 @@ Stage1hr_cleanup () {
 void
 Stage1hr_setup (int index1part_in, int index1interval_in, int spansize_in,
 		Univ_IIT_T chromosome_iit_in, int nchromosomes_in,
-		Genome_T genomealt, Mode_T mode_in, int maxpaths_search_in,
+		Genome_T genome, Genome_T genomealt, Mode_T mode_in,
+		bool query_unk_mismatch_p_in, bool genome_unk_mismatch_p_in, int maxpaths_search_in,
 		int terminal_threshold_in,
 
 		Univcoord_T *splicesites_in, Splicetype_T *splicetypes_in,
@@ -18312,6 +18857,10 @@ Stage1hr_setup (int index1part_in, int index1interval_in, int spansize_in,
   nchromosomes = nchromosomes_in;
   Univ_IIT_intervals_setup(&chroffsets,&chrhighs,&chrlengths,chromosome_iit,nchromosomes,circular_typeint);
 
+#if defined(USE_RADIX_SEGMENTS) && defined(HAVE_PTHREAD)
+  pthread_key_create(&diagonal_sort_key,diagonal_sort_free);
+#endif
+
   leftreadshift = 32 - index1part - index1part; /* For 12-mers, 8 */
   oligobase_mask = ~(~0UL << 2*index1part);  /* For 12-mers, was 0x00FFFFFF */
   one_miss_querylength = spansize + spansize - (index1interval - 1); /* For 12-mers, 22 */
@@ -18409,9 +18958,14 @@ Stage1hr_setup (int index1part_in, int index1interval_in, int spansize_in,
 
   if (genomealt != NULL) {
     snpp = true;
+    snp_blocks = Genome_blocks(genomealt);
   } else {
     snpp = false;
+    snp_blocks = (Genomecomp_T *) NULL;
   }
+  ref_blocks = Genome_blocks(genome);
+  query_unk_mismatch_p = query_unk_mismatch_p_in;
+  genome_unk_mismatch_p = genome_unk_mismatch_p_in;
 
   return;
 }
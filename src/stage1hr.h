@@ -47,6 +47,16 @@ extern void
 Stage1_free (T *old, int querylength);
 
 
+/* Levels of Stage1_prefetch_read, in the order they are issued for a read */
+#define STAGE1_PREFETCH_GAMMAPTR 0
+#define STAGE1_PREFETCH_OFFSETS 1
+#define STAGE1_PREFETCH_POSITIONS 2
+#define STAGE1_PREFETCH_NLEVELS 3
+
+extern void
+Stage1_prefetch_read (Shortread_T queryseq, Indexdb_T indexdb, Indexdb_T indexdb2, int level);
+
+
 extern Stage3end_T *
 Stage1_single_read (int *npaths, int *first_absmq, int *second_absmq,
 		    Shortread_T queryseq, Indexdb_T indexdb, Indexdb_T indexdb2,
@@ -85,7 +95,8 @@ Stage1hr_cleanup ();
 extern void
 Stage1hr_setup (int index1part_in, int index1interval_in, int spansize_in,
 		Univ_IIT_T chromosome_iit_in, int nchromosomes_in,
-		Genome_T genomealt, Mode_T mode_in, int maxpaths_search_in,
+		Genome_T genome, Genome_T genomealt, Mode_T mode_in,
+		bool query_unk_mismatch_p_in, bool genome_unk_mismatch_p_in, int maxpaths_search_in,
 		int terminal_threshold_in,
 
 		Univcoord_T *splicesites_in, Splicetype_T *splicetypes_in,
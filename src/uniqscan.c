@@ -1113,7 +1113,8 @@ main (int argc, char *argv[]) {
 		   /*snpp*/snps_iit ? true : false,amb_closest_p,/*amb_clip_p*/true,min_shortend);
   spansize = Spanningelt_setup(index1part,index1interval);
   Stage1hr_setup(index1part,index1interval,spansize,chromosome_iit,nchromosomes,
-		 genomealt,mode,/*maxpaths_search*/10,/*terminal_threshold*/5,
+		 genome,genomealt,mode,query_unk_mismatch_p,genome_unk_mismatch_p,
+		 /*maxpaths_search*/10,/*terminal_threshold*/5,
 		 splicesites,splicetypes,splicedists,nsplicesites,
 		 novelsplicingp,knownsplicingp,distances_observed_p,
 		 shortsplicedist_known,shortsplicedist_novelend,min_intronlength,